@@ -0,0 +1,191 @@
+// Trains zstd dictionaries for the DOM storage chunks of crengine cache files.
+//
+// Reads a set of .cr3 cache files (made with zstd and without dictionaries),
+// collects their text, element, render rect and style chunks, and trains one
+// dictionary per chunk type, to be loaded by the frontend with
+// setCacheFileCompressionDictionary('t', ...) & co.
+// Also reports the compressed size of the samples without and with the
+// trained dictionary, at the given compression level.
+//
+// usage: cachedict [-l level] [-s dictsize] outdir file.cr3 [file.cr3 ...]
+//   writes outdir/text.zdict, elem.zdict, rect.zdict and style.zdict
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <vector>
+#include <string>
+#include <zstd.h>
+#include <zdict.h>
+
+// Must match the cache file layout in src/lvtinydom.cpp
+#define CACHE_FILE_MAGIC_SIZE 40
+#define CACHE_FILE_ITEM_MAGIC 0xC007B00C
+#define CBT_INDEX 1
+#define CBT_TEXT_DATA 2
+
+struct CacheFileItem {
+    uint32_t _magic;
+    uint16_t _dataType;
+    uint16_t _dataIndex;
+    int32_t _blockIndex;
+    int32_t _blockFilePos;
+    int32_t _blockSize;
+    int32_t _dataSize;
+    uint64_t _dataHash;
+    uint64_t _packedHash;
+    uint32_t _uncompressedSize;
+    uint32_t _padding;
+};
+
+struct CacheFileHeader {
+    char _magic[CACHE_FILE_MAGIC_SIZE];
+    uint32_t _dirty;
+    uint32_t _dom_version;
+    uint32_t _fsize;
+    uint32_t _padding;
+    CacheFileItem _indexBlock;
+};
+
+// chunk types, in CBT_TEXT_DATA order, and matching setCacheFileCompressionDictionary() letters
+static const char * chunkNames[] = { "text", "elem", "rect", "style" };
+#define CHUNK_TYPES 4
+
+struct Samples {
+    std::vector<char> data;
+    std::vector<size_t> sizes;
+};
+
+static bool readAt(FILE * f, long pos, void * buf, size_t size) {
+    return fseek(f, pos, SEEK_SET) == 0 && fread(buf, 1, size, f) == size;
+}
+
+static bool collectSamples(const char * filename, Samples * samples) {
+    FILE * f = fopen(filename, "rb");
+    if (!f) {
+        fprintf(stderr, "%s: cannot open\n", filename);
+        return false;
+    }
+    CacheFileHeader hdr;
+    bool ok = readAt(f, 0, &hdr, sizeof(hdr)) && hdr._indexBlock._magic == CACHE_FILE_ITEM_MAGIC;
+    if (!ok || strncmp(hdr._magic, "CoolReader 3 Cache", 18) != 0) {
+        fprintf(stderr, "%s: not a cache file\n", filename);
+        fclose(f);
+        return false;
+    }
+    int count = hdr._indexBlock._dataSize / (int)sizeof(CacheFileItem);
+    std::vector<CacheFileItem> index(count > 0 ? count : 0);
+    if (count <= 0 || !readAt(f, hdr._indexBlock._blockFilePos, &index[0], count * sizeof(CacheFileItem))) {
+        fprintf(stderr, "%s: cannot read index\n", filename);
+        fclose(f);
+        return false;
+    }
+    int found = 0;
+    std::vector<char> packed;
+    for (int i = 0; i < count; i++) {
+        const CacheFileItem & item = index[i];
+        int type = (int)item._dataType - CBT_TEXT_DATA;
+        if (item._magic != CACHE_FILE_ITEM_MAGIC || type < 0 || type >= CHUNK_TYPES)
+            continue;
+        if (item._dataIndex == 0xFFFF || item._dataSize <= 0)
+            continue; // chunk index, not chunk data
+        packed.resize(item._dataSize);
+        if (!readAt(f, item._blockFilePos, &packed[0], item._dataSize))
+            continue;
+        Samples & s = samples[type];
+        size_t pos = s.data.size();
+        if (item._uncompressedSize == 0) {
+            // stored as is
+            s.data.insert(s.data.end(), packed.begin(), packed.end());
+            s.sizes.push_back(packed.size());
+        } else {
+            if (ZSTD_getDictID_fromFrame(&packed[0], packed.size()) != 0)
+                continue; // made with a dictionary: not representative
+            s.data.resize(pos + item._uncompressedSize);
+            size_t res = ZSTD_decompress(&s.data[pos], item._uncompressedSize, &packed[0], packed.size());
+            if (ZSTD_isError(res) || res != item._uncompressedSize) {
+                s.data.resize(pos);
+                continue;
+            }
+            s.sizes.push_back(res);
+        }
+        found++;
+    }
+    fclose(f);
+    printf("%s: %d chunks\n", filename, found);
+    return true;
+}
+
+// total compressed size of all samples, with optional dictionary
+static size_t compressedSize(const Samples & s, const void * dict, size_t dictSize, int level) {
+    ZSTD_CCtx * cctx = ZSTD_createCCtx();
+    ZSTD_CDict * cdict = dict ? ZSTD_createCDict(dict, dictSize, level) : NULL;
+    std::vector<char> out;
+    size_t total = 0;
+    size_t pos = 0;
+    for (size_t i = 0; i < s.sizes.size(); i++) {
+        out.resize(ZSTD_compressBound(s.sizes[i]));
+        size_t res = cdict ? ZSTD_compress_usingCDict(cctx, &out[0], out.size(), &s.data[pos], s.sizes[i], cdict)
+                           : ZSTD_compressCCtx(cctx, &out[0], out.size(), &s.data[pos], s.sizes[i], level);
+        total += ZSTD_isError(res) ? s.sizes[i] : res;
+        pos += s.sizes[i];
+    }
+    ZSTD_freeCDict(cdict);
+    ZSTD_freeCCtx(cctx);
+    return total;
+}
+
+int main(int argc, char ** argv) {
+    int level = ZSTD_CLEVEL_DEFAULT;
+    size_t dictCapacity = 16 * 1024;
+    int argi = 1;
+    for (; argi + 1 < argc && argv[argi][0] == '-'; argi += 2) {
+        if (!strcmp(argv[argi], "-l"))
+            level = atoi(argv[argi + 1]);
+        else if (!strcmp(argv[argi], "-s"))
+            dictCapacity = (size_t)atoi(argv[argi + 1]);
+        else
+            break;
+    }
+    if (argc - argi < 2) {
+        fprintf(stderr, "usage: cachedict [-l level] [-s dictsize] outdir file.cr3 [file.cr3 ...]\n");
+        return 1;
+    }
+    const char * outdir = argv[argi++];
+    Samples samples[CHUNK_TYPES];
+    for (; argi < argc; argi++)
+        collectSamples(argv[argi], samples);
+
+    int errors = 0;
+    std::vector<char> dict(dictCapacity);
+    for (int t = 0; t < CHUNK_TYPES; t++) {
+        const Samples & s = samples[t];
+        if (s.sizes.size() < 8) {
+            printf("%s: not enough samples (%d)\n", chunkNames[t], (int)s.sizes.size());
+            continue;
+        }
+        size_t dictSize = ZDICT_trainFromBuffer(&dict[0], dict.size(), &s.data[0], &s.sizes[0], (unsigned)s.sizes.size());
+        if (ZDICT_isError(dictSize)) {
+            printf("%s: training failed: %s\n", chunkNames[t], ZDICT_getErrorName(dictSize));
+            errors++;
+            continue;
+        }
+        std::string path = std::string(outdir) + "/" + chunkNames[t] + ".zdict";
+        FILE * f = fopen(path.c_str(), "wb");
+        if (!f || fwrite(&dict[0], 1, dictSize, f) != dictSize) {
+            fprintf(stderr, "%s: cannot write\n", path.c_str());
+            if (f)
+                fclose(f);
+            errors++;
+            continue;
+        }
+        fclose(f);
+        size_t plain = compressedSize(s, NULL, 0, level);
+        size_t withDict = compressedSize(s, &dict[0], dictSize, level);
+        printf("%s: %d samples, %d bytes -> %d bytes, %d with dictionary (id %u, %d bytes) -> %s\n",
+               chunkNames[t], (int)s.sizes.size(), (int)s.data.size(), (int)plain, (int)withDict,
+               ZDICT_getDictID(&dict[0], dictSize), (int)dictSize, path.c_str());
+    }
+    return errors ? 1 : 0;
+}
@@ -0,0 +1,171 @@
+// Check and microbenchmark for the gray quantization kernels used by
+// QuantizeToGray() (src/lvdither.h).
+//
+// "check" quantizes pseudo-random gray rows (all row lengths, start columns,
+// thresholds and output depths) with ordered dithering, packs them, and
+// compares the bytes with per-pixel quantization and bit by bit packing.
+// It also checks that error diffusion keeps black and white, and the mean
+// gray of flat areas.
+// Without argument, reports milliseconds per 1264x1680 page for each mode
+// and depth.
+// Run it from builds with and without SIMD kernels (see makefile).
+//
+// usage: dither_bench [iterations]
+//        dither_bench check
+
+#include "../../src/lvdither.h"
+#include "../simd_bench/simd_bench.h"
+
+// as dither_2bpp_8x8 in lvdrawbuf.cpp
+static const lUInt8 bayer8x8[64] = {
+    0, 32, 12, 44, 2, 34, 14, 46,
+    48, 16, 60, 28, 50, 18, 62, 30,
+    8, 40, 4, 36, 10, 42, 6, 38,
+    56, 24, 52, 20, 58, 26, 54, 22,
+    3, 35, 15, 47, 1, 33, 13, 45,
+    51, 19, 63, 31, 49, 17, 61, 29,
+    11, 43, 7, 39, 9, 41, 5, 37,
+    59, 27, 55, 23, 57, 25, 53, 21,
+};
+
+// Reference: per-pixel quantization and bit by bit packing
+static void refRow( lUInt8 * dst, const lUInt8 * gray, int count, int x0, const lUInt8 * thresholds, int bpp ) {
+    const int maxLevel = (1 << bpp) - 1;
+    const int ppb = 8 / bpp;
+    memset(dst, 0, (count + ppb - 1) / ppb);
+    for (int i = 0; i < count; i++) {
+        const int v = gray[i] + (gray[i] >> 7); // 0..256
+        const int level = (v * maxLevel + thresholds[(x0 + i) & 7]) / 256;
+        dst[i / ppb] |= level << ((ppb - 1 - i % ppb) * bpp);
+    }
+}
+
+static int checkOrdered() {
+    const int maxLen = 80;
+    int errors = 0;
+    int rows = 0;
+    lUInt8 gray[maxLen + 8];
+    lUInt8 levels[maxLen + 8];
+    lUInt8 packed[maxLen + 8], ref[maxLen + 8];
+    lUInt8 thresholds[8];
+    for (int pass = 0; pass < 100; pass++) {
+        for (int bpp = 1; bpp <= 4; bpp *= 2) {
+            for (int len = 0; len <= maxLen; len++) {
+                int x0 = rnd() % 8;
+                for (int i = 0; i < 8; i++)
+                    thresholds[i] = pass & 1 ? (lUInt8)(bayer8x8[(pass & 7) * 8 + i] * 4 + 2) : (lUInt8)rnd();
+                for (int i = 0; i < len; i++) {
+                    unsigned r = rnd() % 8;
+                    gray[i] = r == 0 ? 0 : r == 1 ? 0xFF : (lUInt8)rnd();
+                }
+                memset(levels, 0, sizeof(levels));
+                memset(packed, 0xAA, sizeof(packed));
+                ditherOrderedRow(levels, gray, len, x0, thresholds, (1 << bpp) - 1);
+                ditherPackRow(packed, levels, len, bpp);
+                refRow(ref, gray, len, x0, thresholds, bpp);
+                const int bytes = (len * bpp + 7) / 8;
+                if (memcmp(packed, ref, bytes) || packed[bytes] != 0xAA) {
+                    if (errors < 10)
+                        printf("mismatch: bpp %d len %d x0 %d\n", bpp, len, x0);
+                    errors++;
+                }
+                rows++;
+            }
+        }
+    }
+    printf("%s: ordered %d rows, %d mismatches\n", kernelName(), rows, errors);
+    return errors;
+}
+
+// error diffusion over a flat w x h area of gray v: returns mean output gray
+static double diffuseFlat( int v, int bpp, bool atkinson, int * extremes ) {
+    const int w = 64, h = 64;
+    const int maxLevel = (1 << bpp) - 1;
+    std::vector<lUInt8> gray(w, (lUInt8)v), levels(w);
+    std::vector<int> err((w + 4) * 3);
+    int * e0 = &err[0], * e1 = e0 + w + 4, * e2 = e1 + w + 4;
+    long sum = 0;
+    *extremes = 0;
+    for (int y = 0; y < h; y++) {
+        ditherDiffuseRow(&levels[0], &gray[0], w, maxLevel, e0, e1, e2, atkinson);
+        int * t = e0; e0 = e1; e1 = e2; e2 = t;
+        memset(e2, 0, (w + 4) * sizeof(int));
+        for (int x = 0; x < w; x++) {
+            sum += levels[x] * 255 / maxLevel;
+            if ((v == 0 && levels[x] != 0) || (v == 255 && levels[x] != maxLevel))
+                (*extremes)++;
+        }
+    }
+    return (double)sum / (w * h);
+}
+
+static int checkDiffusion() {
+    int errors = 0;
+    for (int mode = 0; mode < 2; mode++) {
+        for (int bpp = 1; bpp <= 4; bpp *= 2) {
+            for (int v = 0; v <= 255; v += 5) {
+                int extremes;
+                double mean = diffuseFlat(v, bpp, mode == 1, &extremes);
+                // Atkinson drops 1/4 of the error: mid grays drift toward the nearest level
+                double tolerance = mode == 1 ? 255.0 / ((1 << bpp) - 1) / 4 + 2 : 2;
+                if (extremes || mean < v - tolerance || mean > v + tolerance) {
+                    if (errors < 10)
+                        printf("%s: bpp %d gray %d: mean %.1f\n", mode ? "atkinson" : "floyd-steinberg", bpp, v, mean);
+                    errors++;
+                }
+            }
+        }
+    }
+    printf("%s: error diffusion %d failures\n", kernelName(), errors);
+    return errors;
+}
+
+static int check() {
+    int errors = checkOrdered() + checkDiffusion();
+    printf("%s: %s\n", kernelName(), errors ? "FAILED" : "OK");
+    return errors ? 1 : 0;
+}
+
+static void bench(int iterations) {
+    // an e-ink page: 1264x1680 8 bpp gray
+    const int w = 1264, h = 1680;
+    std::vector<lUInt8> page(w * h);
+    for (int i = 0; i < w * h; i++)
+        page[i] = (lUInt8)((i % w) * 255 / w ^ (rnd() & 7));
+    std::vector<lUInt8> out(w * h / 2);
+    std::vector<lUInt8> levels((w + 7) & ~7);
+    std::vector<int> err((w + 4) * 3);
+    static const char * modes[] = { "ordered", "floyd-steinberg", "atkinson" };
+    printf("%s:\n", kernelName());
+    for (int mode = 0; mode < 3; mode++) {
+        for (int bpp = 1; bpp <= 4; bpp *= 2) {
+            const int pitch = (w * bpp + 7) / 8;
+            double start = now();
+            for (int it = 0; it < iterations; it++) {
+                int * e0 = &err[0], * e1 = e0 + w + 4, * e2 = e1 + w + 4;
+                memset(&err[0], 0, err.size() * sizeof(int));
+                for (int y = 0; y < h; y++) {
+                    const lUInt8 * row = &page[y * w];
+                    if (mode == 0) {
+                        lUInt8 thresholds[8];
+                        for (int i = 0; i < 8; i++)
+                            thresholds[i] = (lUInt8)(bayer8x8[(y & 7) * 8 + i] * 4 + 2);
+                        ditherOrderedRow(&levels[0], row, w, 0, thresholds, (1 << bpp) - 1);
+                    } else {
+                        ditherDiffuseRow(&levels[0], row, w, (1 << bpp) - 1, e0, e1, e2, mode == 2);
+                        int * t = e0; e0 = e1; e1 = e2; e2 = t;
+                        memset(e2, 0, (w + 4) * sizeof(int));
+                    }
+                    ditherPackRow(&out[y * pitch], &levels[0], w, bpp);
+                }
+            }
+            double elapsed = now() - start;
+            sink = out[pitch * h / 2 + 3];
+            printf("  %-15s %d bpp  %7.3f ms/page\n", modes[mode], bpp, elapsed * 1e3 / iterations);
+        }
+    }
+}
+
+int main(int argc, char ** argv) {
+    return simdBenchMain(argc, argv, check, bench, 20);
+}
@@ -0,0 +1,387 @@
+// Check and benchmark for drawing pages in concurrent horizontal bands from a
+// LVRecordingDrawBuf recording (see DrawDocumentInBands() in src/lvrend.cpp).
+//
+// "check" draws random rectangles, patterns, lines, glyphs, and scaled,
+// scalable and smooth scaled images at all depths, once directly and once
+// recorded then replayed by bands on several threads, and compares both
+// buffers byte for byte.
+// Large images are drawn too, taking more memory than the recording keeps for
+// images: these are decoded by each band drawing them instead of once for all.
+// Without argument, times drawing a text page and image-heavy pages directly,
+// and by recording and replaying bands on 2 and 4 threads. The recording
+// (done serially, as it walks the DOM in crengine) and the replay (where
+// images are decoded and scaled) are reported separately: the page latency is
+// their sum. Text pages are drawn directly by DrawDocumentInBands(), they're
+// timed to show why.
+//
+// usage: drawbands_bench [iterations]
+//        drawbands_bench check [thread count]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "../../include/lvdrawbuf.h"
+
+// normally in src/lvmemman.cpp, src/lvstring.cpp and src/lvimg.cpp
+ref_count_rec_t ref_count_rec_t::null_ref(NULL);
+ref_count_rec_t ref_count_rec_t::protected_null_ref(NULL);
+void crFatalError( int code, const char * errorText ) {
+    fprintf( stderr, "fatal error %d: %s\n", code, errorText );
+    abort();
+}
+void CRLog::error( const char * msg, ... ) { fprintf( stderr, "error: %s\n", msg ); }
+LVImageDecoderCallback::~LVImageDecoderCallback() { }
+LVImageSource::~LVImageSource() { }
+CacheableObject::CacheableObject() : _callback(NULL), _cache(NULL) { _objectId = 0; }
+CR9PatchInfo * LVImageSource::DetectNinePatch() { return NULL; }
+LVImageSourceRef LVCreateImageSourceCopy( LVImageSourceRef srcImage );
+
+// Image decoded line by line as a photo would be (with a few transparent pixels),
+// supporting reduced size decoding as the JPEG decoder does
+class BenchImage : public LVImageSource {
+    int _dx;
+    int _dy;
+    bool _scalable;
+public:
+    BenchImage( int dx, int dy, bool scalable=false ) : _dx(dx), _dy(dy), _scalable(scalable) { }
+    virtual ldomNode * GetSourceNode() { return NULL; }
+    virtual LVStream * GetSourceStream() { return NULL; }
+    virtual ldomDocument * GetSourceDocument() { return NULL; }
+    virtual void Compact() { }
+    virtual int GetWidth() const { return _dx; }
+    virtual int GetHeight() const { return _dy; }
+    virtual bool IsScalable() const { return _scalable; }
+    virtual bool Decode( LVImageDecoderCallback * callback ) {
+        int dx = _dx;
+        int dy = _dy;
+        int tdx, tdy;
+        if ( _scalable )
+            callback->GetTargetSize( dx, dy );
+        else if ( callback->GetTargetSize( tdx, tdy ) && (_dx+1)/2 >= tdx && (_dy+1)/2 >= tdy
+                  && callback->OnReducedSize( (_dx+1)/2, (_dy+1)/2 ) ) {
+            dx = (_dx+1)/2;
+            dy = (_dy+1)/2;
+        }
+        callback->OnStartDecode( this );
+        std::vector<lUInt32> row( dx );
+        for ( int y=0; y<dy; y++ ) {
+            for ( int x=0; x<dx; x++ )
+                row[x] = ((x*7 + y*13) & 0xFF) | (((x*y) & 0xFF) << 8) | (((x+y) & 0xFF) << 16)
+                         | ((x+y) % 3 == 0 ? 0x80000000 : 0);
+            callback->OnLineDecoded( this, y, &row[0] );
+        }
+        callback->OnEndDecode( this, false );
+        return true;
+    }
+};
+
+// As made from a copy of the image file data in crengine
+LVImageSourceRef LVCreateImageSourceCopy( LVImageSourceRef srcImage ) {
+    BenchImage * img = dynamic_cast<BenchImage *>( srcImage.get() );
+    if ( !img )
+        return LVImageSourceRef();
+    return LVImageSourceRef( new BenchImage( img->GetWidth(), img->GetHeight(), img->IsScalable() ) );
+}
+
+struct Rnd {
+    unsigned state;
+    explicit Rnd( unsigned seed ) : state(seed) { }
+    unsigned next() {
+        state = state * 1103515245u + 12345u;
+        return state >> 8;
+    }
+};
+
+static LVBaseDrawBuf * newBuffer( int dx, int dy, int bpp, lUInt8 * data=NULL ) {
+    if ( bpp >= 16 )
+        return data ? new LVColorDrawBuf( dx, dy, data, bpp ) : new LVColorDrawBuf( dx, dy, bpp );
+    return data ? new LVGrayDrawBuf( dx, dy, bpp, data ) : new LVGrayDrawBuf( dx, dy, bpp );
+}
+
+// Tasks replaying a recording, as DrawDocumentInBands() queues them: images left
+// to replaying threads are decoded first, then bands, waiting for the images they draw
+struct ReplayTasks {
+    std::vector<int> decoded;
+    std::vector<lvRect> rects;
+    // (image sources are created on this thread, as in crengine)
+    std::vector< LVArray<LVImageSourceRef> > images;
+    std::vector< LVArray<int> > awaited;
+    ReplayTasks( const LVRecordingDrawBuf & recording, int threads ) {
+        const lvRect bounds = recording.getDirtyBounds();
+        int bands = threads * 2;
+        int bandHeight = (bounds.height() + bands - 1) / bands;
+        if ( bandHeight < 16 )
+            bandHeight = 16;
+        for ( int y = bounds.top; y < bounds.bottom; y += bandHeight ) {
+            rects.push_back( lvRect( bounds.left, y, bounds.right, y + bandHeight < bounds.bottom ? y + bandHeight : bounds.bottom ) );
+            images.push_back( LVArray<LVImageSourceRef>() );
+            recording.getBandImages( rects.back(), images.back() );
+            awaited.push_back( LVArray<int>() );
+            recording.getBandDeferredImages( rects.back(), awaited.back() );
+        }
+        for ( int i=0; i<recording.getImageCount(); i++ ) {
+            if ( recording.isDeferredImage( i ) )
+                decoded.push_back( i );
+        }
+    }
+    int count() const { return (int)(decoded.size() + rects.size()); }
+    void replay( const LVRecordingDrawBuf & recording, LVBaseDrawBuf & target, int i ) {
+        LVBaseDrawBuf * buf = newBuffer( target.GetWidth(), target.GetHeight(), target.GetBitsPerPixel(), target.GetScanLine( 0 ) );
+        recording.Replay( *buf, rects[i], images[i] );
+        delete buf;
+    }
+};
+
+// Replays recording into target by bands on threads, as DrawDocumentInBands() does
+static void replayBands( const LVRecordingDrawBuf & recording, LVBaseDrawBuf & target, int threads ) {
+    ReplayTasks tasks( recording, threads );
+    std::vector<char> done( recording.getImageCount(), 0 );
+    std::mutex mutex;
+    std::condition_variable cond;
+    std::atomic<int> next( 0 );
+    std::vector<std::thread> workers;
+    for ( int t=0; t<threads; t++ ) {
+        workers.push_back( std::thread( [&]() {
+            int i;
+            while ( (i = next++) < tasks.count() ) {
+                if ( i < (int)tasks.decoded.size() ) {
+                    recording.decodeImage( tasks.decoded[i] );
+                    std::lock_guard<std::mutex> lock( mutex );
+                    done[tasks.decoded[i]] = 1;
+                    cond.notify_all();
+                    continue;
+                }
+                i -= (int)tasks.decoded.size();
+                for ( int k=0; k<tasks.awaited[i].length(); k++ ) {
+                    std::unique_lock<std::mutex> lock( mutex );
+                    const int index = tasks.awaited[i][k];
+                    cond.wait( lock, [&]() { return done[index] != 0; } );
+                }
+                tasks.replay( recording, target, i );
+            }
+        } ) );
+    }
+    for ( int t=0; t<threads; t++ )
+        workers[t].join();
+}
+
+// Random drawing calls, clipped to random rectangles, some overflowing the buffer
+static void drawRandom( LVDrawBuf & buf, unsigned seed ) {
+    Rnd rnd( seed );
+    lUInt8 glyph[20*24];
+    for ( int i=0; i<(int)sizeof(glyph); i++ )
+        glyph[i] = (lUInt8)rnd.next();
+    lUInt8 pattern[4] = { 0xAA, 0x55, 0xF0, 0x0F };
+    for ( int i=0; i<400; i++ ) {
+        lvRect clip( rnd.next() % 50, rnd.next() % 80, 150 + rnd.next() % 150, 200 + rnd.next() % 200 );
+        buf.SetClipRect( &clip );
+        int x = (int)(rnd.next() % 320) - 20;
+        int y = (int)(rnd.next() % 420) - 20;
+        lUInt32 color = rnd.next() | (rnd.next() % 4 == 0 ? 0x80000000 : 0);
+        if ( rnd.next() % 5 != 0 )
+            color &= 0x00FFFFFF;
+        switch ( rnd.next() % 7 ) {
+        case 0:
+            buf.FillRect( x, y, x + rnd.next() % 60, y + rnd.next() % 60, color );
+            break;
+        case 1:
+            buf.FillRectPattern( x, y, x + rnd.next() % 60, y + rnd.next() % 60, color, rnd.next() & 0xFFFFFF, pattern );
+            break;
+        case 2:
+            buf.InvertRect( x, y, x + 8 + rnd.next() % 60, y + rnd.next() % 60 );
+            break;
+        case 3:
+            buf.DrawLine( x, y, x + rnd.next() % 60, y + 1 + rnd.next() % 3, color, 1 + rnd.next() % 3, rnd.next() % 3, rnd.next() % 2 );
+            break;
+        case 4:
+        case 5: {
+            buf.SetTextColor( color );
+            lUInt32 palette = rnd.next() & 0xFFFFFF;
+            buf.Draw( x, y, glyph, 20, 24, rnd.next() % 2 ? &palette : NULL );
+            break;
+        }
+        case 6: {
+            bool scalable = rnd.next() % 3 == 0;
+            bool large = rnd.next() % 16 == 0;
+            int dx = large ? 700 : 5 + rnd.next() % 200;
+            int dy = large ? 600 : 5 + rnd.next() % 200;
+            LVImageSourceRef img( new BenchImage( dx, dy, scalable ) );
+            buf.Draw( img, x, y, 5 + rnd.next() % 80, 5 + rnd.next() % 80, rnd.next() % 2 );
+            break;
+        }
+        }
+    }
+}
+
+static int check( int threads ) {
+    const int bpps[] = { 1, 2, 3, 4, 8, 16, 32 };
+    int failures = 0;
+    int tests = 0;
+    for ( int b=0; b<(int)(sizeof(bpps)/sizeof(bpps[0])); b++ ) {
+        for ( int options=0; options<4; options++ ) {
+            for ( unsigned seed=1; seed<6; seed++ ) {
+                int bpp = bpps[b];
+                LVBaseDrawBuf * direct = newBuffer( 300, 400, bpp );
+                LVBaseDrawBuf * bands = newBuffer( 300, 400, bpp );
+                LVBaseDrawBuf * bufs[2] = { direct, bands };
+                for ( int k=0; k<2; k++ ) {
+                    bufs[k]->Clear( 0xFFFFFF );
+                    bufs[k]->setSmoothScalingImages( options & 1 );
+                    bufs[k]->setHidePartialGlyphs( options & 2 );
+                    bufs[k]->setInvertImages( seed % 2 );
+                    bufs[k]->setDitherImages( seed % 3 == 0 );
+                }
+                drawRandom( *direct, seed );
+                LVRecordingDrawBuf recording( *bands );
+                drawRandom( recording, seed );
+                tests++;
+                if ( !recording.isReplayable() ) {
+                    printf( "%d bpp, options %d, seed %u: recording not replayable\n", bpp, options, seed );
+                    failures++;
+                }
+                else {
+                    replayBands( recording, *bands, threads );
+                    if ( memcmp( direct->GetScanLine( 0 ), bands->GetScanLine( 0 ), direct->GetRowSize() * 400 ) ) {
+                        printf( "%d bpp, options %d, seed %u: bands differ from direct drawing\n", bpp, options, seed );
+                        failures++;
+                    }
+                }
+                delete direct;
+                delete bands;
+            }
+        }
+    }
+    printf( "%d/%d tests passed (%d threads)\n", tests - failures, tests, threads );
+    return failures ? 1 : 0;
+}
+
+// Pages of a 1264x1680 screen: a full text page, and pages with images taking
+// most of their surface (photos 2 to 3 times larger than drawn, as in EPUBs)
+enum PageKind { PAGE_TEXT, PAGE_IMAGES, PAGE_IMAGES_SMOOTH };
+static const int PAGE_DX = 1264;
+static const int PAGE_DY = 1680;
+
+static void drawPage( LVDrawBuf & buf, PageKind kind ) {
+    Rnd rnd( 1 );
+    lUInt8 glyph[22*30];
+    for ( int i=0; i<(int)sizeof(glyph); i++ )
+        glyph[i] = (lUInt8)(rnd.next() % 3 ? 0 : rnd.next());
+    buf.SetTextColor( 0x000000 );
+    int text_top = 40;
+    if ( kind != PAGE_TEXT ) {
+        // 2 large images and 2 smaller side by side, then a few lines
+        LVImageSourceRef img1( new BenchImage( 2400, 1500 ) );
+        LVImageSourceRef img2( new BenchImage( 1800, 1200 ) );
+        LVImageSourceRef img3( new BenchImage( 1200, 900 ) );
+        buf.Draw( img1, 40, 40, 1184, 740, true );
+        buf.Draw( img2, 40, 800, 580, 386, true );
+        buf.Draw( img3, 644, 800, 580, 435, true );
+        buf.Draw( img1, 40, 1250, 1184, 330, true );
+        text_top = 1600;
+    }
+    for ( int y = text_top; y + 30 < PAGE_DY - 40; y += 38 ) {
+        for ( int x = 40; x + 22 < PAGE_DX - 40; x += 18 + rnd.next() % 6 )
+            buf.Draw( x, y, glyph, 22, 30, NULL );
+    }
+}
+
+static double now() {
+    struct timespec ts;
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+    return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
+// Runs the replay tasks serially, timing them, and returns the replay time they would
+// take on threads cores: tasks taken in order by the first free thread, bands waiting
+// for the images they draw. Used on machines with less cores than threads.
+static double replayBandsEstimated( const LVRecordingDrawBuf & recording, LVBaseDrawBuf & target, int threads ) {
+    ReplayTasks tasks( recording, threads );
+    std::vector<double> decodedAt( recording.getImageCount(), 0 );
+    std::vector<double> freeAt( threads, 0 );
+    double end = 0;
+    for ( int i=0; i<tasks.count(); i++ ) {
+        int t = (int)(std::min_element( freeAt.begin(), freeAt.end() ) - freeAt.begin());
+        double time = freeAt[t];
+        double t0 = now();
+        if ( i < (int)tasks.decoded.size() ) {
+            recording.decodeImage( tasks.decoded[i] );
+            time += now() - t0;
+            decodedAt[tasks.decoded[i]] = time;
+        }
+        else {
+            const int band = i - (int)tasks.decoded.size();
+            for ( int k=0; k<tasks.awaited[band].length(); k++ )
+                time = std::max( time, decodedAt[tasks.awaited[band][k]] );
+            t0 = now();
+            tasks.replay( recording, target, band );
+            time += now() - t0;
+        }
+        freeAt[t] = time;
+        end = std::max( end, time );
+    }
+    return end;
+}
+
+static void bench( int iterations ) {
+    const int cores = (int)std::thread::hardware_concurrency();
+    const char * names[] = { "text (drawn directly)", "images", "images, smooth scaling" };
+    const int bpps[] = { 8, 32 };
+    printf( "%dx%d page, ms per page (%d iterations, %d cores)\n", PAGE_DX, PAGE_DY, iterations, cores );
+    printf( "%-24s %4s %8s %8s %24s %24s\n", "page", "bpp", "direct", "record", "replay 2 thr", "replay 4 thr" );
+    for ( int k=0; k<3; k++ ) {
+        for ( int b=0; b<2; b++ ) {
+            PageKind kind = (PageKind)k;
+            LVBaseDrawBuf * buf = newBuffer( PAGE_DX, PAGE_DY, bpps[b] );
+            buf->setSmoothScalingImages( kind == PAGE_IMAGES_SMOOTH );
+            buf->setDitherImages( bpps[b] < 16 );
+            double t0 = now();
+            for ( int i=0; i<iterations; i++ )
+                drawPage( *buf, kind );
+            double direct = (now() - t0) / iterations;
+            double record = 0;
+            double replay[2] = { 0, 0 };
+            for ( int th=0; th<2; th++ ) {
+                for ( int i=0; i<iterations; i++ ) {
+                    double t1 = now();
+                    LVRecordingDrawBuf recording( *buf );
+                    drawPage( recording, kind );
+                    double t2 = now();
+                    const int threads = th ? 4 : 2;
+                    if ( cores >= threads ) {
+                        replayBands( recording, *buf, threads );
+                        replay[th] += now() - t2;
+                    }
+                    else {
+                        replay[th] += replayBandsEstimated( recording, *buf, threads );
+                    }
+                    record += t2 - t1;
+                }
+            }
+            record /= iterations * 2;
+            replay[0] /= iterations;
+            replay[1] /= iterations;
+            printf( "%-24s %4d %8.1f %8.1f %7.1f (%5.1f, %5.2fx) %7.1f (%5.1f, %5.2fx)\n", names[k], bpps[b], direct, record,
+                    replay[0], record + replay[0], direct / (record + replay[0]),
+                    replay[1], record + replay[1], direct / (record + replay[1]) );
+            delete buf;
+        }
+    }
+    printf( "replay columns: replay time (record + replay: the page latency, its speedup over direct drawing)\n" );
+    if ( cores < 4 )
+        printf( "warning: less than 4 cores: replay times with more threads than cores are estimated from\n"
+                "bands replayed serially, scheduled on as many threads as DrawDocumentInBands() would\n" );
+}
+
+int main( int argc, char ** argv ) {
+    if ( argc > 1 && !strcmp( argv[1], "check" ) )
+        return check( argc > 2 ? atoi( argv[2] ) : 4 );
+    bench( argc > 1 ? atoi( argv[1] ) : 10 );
+    return 0;
+}
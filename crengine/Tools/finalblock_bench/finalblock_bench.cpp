@@ -0,0 +1,185 @@
+// Check and benchmark for final blocks formatted ahead on worker threads during
+// a full rendering (see setFinalBlockFormattingThreads() in src/lvtinydom.cpp).
+//
+// Loads a book with the given fonts and renders it in pages, from a new document
+// each time (no cache file), serially then with final blocks formatted ahead.
+// "check" renders it serially, then with the check mode on the given number of
+// threads: each block formatted ahead is also formatted serially and their lines
+// compared line by line and word by word (LFormattedText::hasSameLines()). The
+// page splits of both renderings are compared too.
+// Without "check", reports full rendering times with 1 (serial), 2 and 4 threads.
+//
+// usage: finalblock_bench [iterations] book font.ttf...
+//        finalblock_bench check [thread count] book font.ttf...
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "../../include/crengine.h"
+#include "../../include/crconcurrent.h"
+
+// Recursive mutexes, as crengine locks nest (FONT_GUARD...)
+class StdMutex : public CRMutex {
+protected:
+    std::recursive_mutex _mutex;
+public:
+    virtual void acquire() { _mutex.lock(); }
+    virtual void release() { _mutex.unlock(); }
+};
+
+class StdMonitor : public CRMonitor {
+    std::recursive_mutex _mutex;
+    std::condition_variable_any _cond;
+public:
+    virtual void acquire() { _mutex.lock(); }
+    virtual void release() { _mutex.unlock(); }
+    virtual void wait() {
+        std::unique_lock<std::recursive_mutex> lock( _mutex, std::adopt_lock );
+        _cond.wait( lock );
+        lock.release();
+    }
+    virtual void notify() { _cond.notify_one(); }
+    virtual void notifyAll() { _cond.notify_all(); }
+};
+
+class StdThread : public CRThread {
+    CRRunnable * _task;
+    std::thread _thread;
+public:
+    StdThread( CRRunnable * task ) : _task(task) { }
+    virtual void start() { _thread = std::thread( [this]() { _task->run(); } ); }
+    virtual void join() { if ( _thread.joinable() ) _thread.join(); }
+    virtual ~StdThread() { join(); }
+};
+
+class StdConcurrencyProvider : public CRConcurrencyProvider {
+public:
+    virtual CRMutex * createMutex() { return new StdMutex(); }
+    virtual CRMonitor * createMonitor() { return new StdMonitor(); }
+    virtual CRThread * createThread( CRRunnable * threadTask ) { return new StdThread( threadTask ); }
+    virtual void executeGui( CRRunnable * task ) { task->run(); delete task; }
+    virtual void executeGui( CRRunnable * task, int delayMillis ) { CR_UNUSED(delayMillis); if ( task ) executeGui( task ); }
+    virtual void sleepMs( int durationMs ) { std::this_thread::sleep_for( std::chrono::milliseconds( durationMs ) ); }
+};
+
+struct PageSplit {
+    int start;
+    int height;
+    int flags;
+    int footnotes;
+    bool operator==( const PageSplit & other ) const {
+        return start == other.start && height == other.height && flags == other.flags && footnotes == other.footnotes;
+    }
+};
+
+static double now() {
+    struct timespec ts;
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+    return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
+// Renders book in 1264x1680 pages from a new document, returns the rendering time
+// in ms (loading excluded), and the page splits if pages is not NULL
+static double render( const char * book, std::vector<PageSplit> * pages ) {
+    LVDocView view;
+    view.Resize( 1264, 1680 );
+    if ( !view.LoadDocument( book ) ) {
+        fprintf( stderr, "can't load %s\n", book );
+        exit( 2 );
+    }
+    double t0 = now();
+    view.Render();
+    double t = now() - t0;
+    if ( pages ) {
+        LVRendPageList * list = view.getPageList();
+        pages->clear();
+        for ( int i=0; i<list->length(); i++ ) {
+            LVRendPageInfo * p = list->get( i );
+            PageSplit split = { p->start, p->height, p->flags, p->footnotes.length() };
+            pages->push_back( split );
+        }
+    }
+    return t;
+}
+
+static int check( int threads, const char * book ) {
+    std::vector<PageSplit> serial;
+    std::vector<PageSplit> ahead;
+    setFinalBlockFormattingThreads( 0 );
+    render( book, &serial );
+    setFinalBlockFormattingThreads( threads, true );
+    render( book, &ahead );
+    int checked, mismatches;
+    getFinalBlockFormattingCheckCounts( checked, mismatches );
+    setFinalBlockFormattingThreads( 0 );
+    int page_diffs = 0;
+    for ( size_t i=0; i<serial.size() || i<ahead.size(); i++ ) {
+        if ( i >= serial.size() || i >= ahead.size() || !(serial[i] == ahead[i]) ) {
+            if ( !page_diffs )
+                printf( "first page split difference at page %d\n", (int)i );
+            page_diffs++;
+        }
+    }
+    printf( "%d final blocks formatted ahead and checked, %d with different lines (%d threads)\n",
+            checked, mismatches, threads );
+    printf( "%d pages, %d page splits differ\n", (int)serial.size(), page_diffs );
+    if ( !checked )
+        printf( "warning: no final block was formatted ahead (no concurrency, or no plain text paragraphs)\n" );
+    return mismatches || page_diffs ? 1 : 0;
+}
+
+static void bench( int iterations, const char * book ) {
+    const int threads[] = { 0, 2, 4 };
+    // Warm up font caches (glyph widths, shaping) so the first run isn't penalized
+    render( book, NULL );
+    printf( "%s, full rendering, ms (%d iterations, %d cores)\n", book, iterations,
+            (int)std::thread::hardware_concurrency() );
+    printf( "%8s %10s %8s\n", "threads", "rendering", "speedup" );
+    double serial = 0;
+    for ( int k=0; k<3; k++ ) {
+        setFinalBlockFormattingThreads( threads[k] );
+        double t = 0;
+        for ( int i=0; i<iterations; i++ )
+            t += render( book, NULL );
+        t /= iterations;
+        if ( !k )
+            serial = t;
+        printf( "%8d %10.1f %7.2fx\n", threads[k] ? threads[k] : 1, t, serial / t );
+    }
+    setFinalBlockFormattingThreads( 0 );
+}
+
+int main( int argc, char ** argv ) {
+    int arg = 1;
+    bool checking = argc > arg && !strcmp( argv[arg], "check" );
+    if ( checking )
+        arg++;
+    int count = checking ? 4 : 3;
+    if ( argc > arg && atoi( argv[arg] ) > 0 )
+        count = atoi( argv[arg++] );
+    if ( argc < arg + 2 ) {
+        fprintf( stderr, "usage: finalblock_bench [iterations] book font.ttf...\n"
+                         "       finalblock_bench check [thread count] book font.ttf...\n" );
+        return 2;
+    }
+    const char * book = argv[arg++];
+    concurrencyProvider = new StdConcurrencyProvider();
+    CRSetupEngineConcurrency();
+    InitFontManager( lString8::empty_str );
+    for ( ; arg < argc; arg++ ) {
+        if ( !fontMan->RegisterFont( lString8( argv[arg] ) ) )
+            fprintf( stderr, "can't register font %s\n", argv[arg] );
+    }
+    int res = 0;
+    if ( checking )
+        res = check( count, book );
+    else
+        bench( count, book );
+    ShutdownFontManager();
+    return res;
+}
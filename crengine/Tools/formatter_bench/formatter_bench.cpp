@@ -0,0 +1,214 @@
+// Allocation counts and check for the LVFormatter per thread buffers
+// (src/lvformatterbufs.h).
+//
+// Runs the buffer requests LVFormatter makes while formatting a book: final
+// blocks of a few paragraphs of various lengths, some with inline-blocks or
+// floats whose content is formatted while their container is (nested
+// formatting). Without argument, reports allocator calls and time for the
+// per thread workspaces, and for the former scheme (one set of static
+// buffers, malloc'ed buffers when nested or longer than 8192 chars, freed
+// after each final block).
+// "check" runs the same requests on several threads, each formatting filling
+// its arrays with its own pattern, and checks the pattern is still there after
+// nested formatting and other threads' formatting.
+//
+// usage: formatter_bench [blocks]
+//        formatter_bench check [thread count]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <thread>
+#include <vector>
+#include "../../src/lvformatterbufs.h"
+
+// Item sizes of LVFormatter paragraph arrays: m_text, m_flags, m_charindex,
+// m_srcs, m_widths, m_bidi_ctypes, m_bidi_btypes, m_bidi_levels
+static const int item_sizes[] = { 4, 2, 2, (int)sizeof(void *), 4, 4, 4, 1 };
+static const int nb_arrays = sizeof(item_sizes) / sizeof(item_sizes[0]);
+
+struct Rnd {
+    unsigned state;
+    explicit Rnd( unsigned seed ) : state(seed) { }
+    unsigned next() {
+        state = state * 1103515245u + 12345u;
+        return state >> 8;
+    }
+};
+
+// Paragraph length, in chars: mostly short paragraphs, a few long ones
+static int paragraphLength( Rnd & rnd ) {
+    unsigned r = rnd.next() % 100;
+    if ( r < 80 )
+        return 50 + rnd.next() % 1500;
+    if ( r < 98 )
+        return 1500 + rnd.next() % 6500;
+    return 8000 + rnd.next() % 32000;
+}
+
+// Fills arrays as copyText()/measureText() would, returns a checksum
+static unsigned touch( void ** arrays, int length, unsigned pattern ) {
+    unsigned sum = 0;
+    for ( int a=0; a<nb_arrays; a++ ) {
+        lUInt8 * p = (lUInt8 *)arrays[a];
+        memset( p, (int)(pattern & 0xFF), (size_t)item_sizes[a] * length );
+        sum += p[(size_t)item_sizes[a] * (length - 1)];
+    }
+    return sum;
+}
+
+static bool verify( void ** arrays, int length, unsigned pattern ) {
+    for ( int a=0; a<nb_arrays; a++ ) {
+        const lUInt8 * p = (const lUInt8 *)arrays[a];
+        for ( size_t i=0; i<(size_t)item_sizes[a] * length; i++ )
+            if ( p[i] != (lUInt8)pattern )
+                return false;
+    }
+    return true;
+}
+
+// Former LVFormatter buffers
+class OldBuffers {
+    static bool _staticInUse;
+    static lUInt8 _static[nb_arrays][8192 * 8];
+    void * _arrays[nb_arrays];
+    int _size;
+    bool _static_bufs;
+public:
+    static long calls; // malloc/realloc/free calls
+    OldBuffers() : _size(0), _static_bufs(!_staticInUse) { memset(_arrays, 0, sizeof(_arrays)); }
+    void ** allocate( int length ) {
+        if ( !_static_bufs || length + 1 > 8192 ) {
+            if ( length + 1 > _size ) {
+                _size = length + 16;
+                for ( int a=0; a<nb_arrays; a++ ) {
+                    _arrays[a] = realloc( _static_bufs ? NULL : _arrays[a], (size_t)item_sizes[a] * _size );
+                    calls++;
+                }
+            }
+            _static_bufs = false;
+        }
+        else {
+            for ( int a=0; a<nb_arrays; a++ )
+                _arrays[a] = _static[a];
+            _static_bufs = true;
+            _staticInUse = true;
+        }
+        return _arrays;
+    }
+    void dealloc() {
+        if ( !_static_bufs ) {
+            for ( int a=0; a<nb_arrays; a++ ) {
+                free( _arrays[a] );
+                calls++;
+            }
+            _static_bufs = true;
+        }
+        else {
+            _staticInUse = false;
+        }
+    }
+};
+bool OldBuffers::_staticInUse = false;
+lUInt8 OldBuffers::_static[nb_arrays][8192 * 8];
+long OldBuffers::calls = 0;
+
+// LVFormatter buffers from this thread's workspaces
+class NewBuffers {
+    LVFormatterWorkspace * _ws;
+    void * _arrays[nb_arrays];
+public:
+    NewBuffers() : _ws(NULL) { }
+    void ** allocate( int length ) {
+        if ( !_ws )
+            _ws = LVFormatterWorkspaces::forCurrentThread().acquire();
+        _ws->paragraph.reserve( length + 1, item_sizes, nb_arrays, _arrays );
+        return _arrays;
+    }
+    void dealloc() {
+        if ( _ws ) {
+            LVFormatterWorkspaces::release( _ws );
+            _ws = NULL;
+        }
+    }
+};
+
+// Formats a final block: a few paragraphs, some with nested formatting
+template <class Buffers>
+static unsigned formatBlock( Rnd & rnd, int depth, unsigned pattern, bool * ok ) {
+    Buffers bufs;
+    unsigned sum = 0;
+    int paragraphs = 1 + rnd.next() % 3;
+    for ( int p=0; p<paragraphs; p++ ) {
+        int length = depth > 0 ? 20 + rnd.next() % 300 : paragraphLength( rnd );
+        void ** arrays = bufs.allocate( length );
+        unsigned own = pattern + depth * 7 + p;
+        sum += touch( arrays, length, own );
+        // inline-blocks and floats are formatted while measuring our text
+        if ( depth < 2 && rnd.next() % 10 == 0 )
+            sum += formatBlock<Buffers>( rnd, depth + 1, pattern + 101, ok );
+        if ( ok && !verify( arrays, length, own ) )
+            *ok = false;
+    }
+    bufs.dealloc();
+    return sum;
+}
+
+static double now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static volatile unsigned sink;
+
+static void bench( int blocks ) {
+    Rnd rnd1(12345);
+    double start = now();
+    unsigned sum = 0;
+    for ( int i=0; i<blocks; i++ )
+        sum += formatBlock<OldBuffers>( rnd1, 0, i, NULL );
+    double old_time = now() - start;
+    Rnd rnd2(12345);
+    start = now();
+    for ( int i=0; i<blocks; i++ )
+        sum += formatBlock<NewBuffers>( rnd2, 0, i, NULL );
+    double new_time = now() - start;
+    sink = sum;
+    printf("%d final blocks:\n", blocks);
+    printf("  static+malloc buffers  %8ld allocator calls  %8.3f ms\n", OldBuffers::calls, old_time * 1e3);
+    printf("  thread workspaces      %8d allocator calls  %8.3f ms\n",
+           LVFormatterWorkspaces::forCurrentThread().getAllocations(), new_time * 1e3);
+}
+
+static void checkThread( int index, int blocks, bool * ok ) {
+    Rnd rnd(1000 + index);
+    for ( int i=0; i<blocks; i++ )
+        formatBlock<NewBuffers>( rnd, 0, index * 31 + i, ok );
+}
+
+static int check( int threads ) {
+    std::vector<std::thread> workers;
+    bool * ok = new bool[threads];
+    for ( int t=0; t<threads; t++ ) {
+        ok[t] = true;
+        workers.push_back( std::thread(checkThread, t, 2000, &ok[t]) );
+    }
+    int errors = 0;
+    for ( int t=0; t<threads; t++ ) {
+        workers[t].join();
+        if ( !ok[t] )
+            errors++;
+    }
+    delete[] ok;
+    printf("%d threads: %d with overwritten buffers: %s\n", threads, errors, errors ? "FAILED" : "OK");
+    return errors ? 1 : 0;
+}
+
+int main( int argc, char ** argv ) {
+    if ( argc > 1 && !strcmp(argv[1], "check") )
+        return check( argc > 2 ? atoi(argv[2]) : 4 );
+    bench( argc > 1 ? atoi(argv[1]) : 20000 );
+    return 0;
+}
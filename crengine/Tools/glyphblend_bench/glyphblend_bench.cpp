@@ -0,0 +1,158 @@
+// Check and microbenchmark for the glyph blending kernels used by
+// LVColorDrawBuf::Draw() and LVGrayDrawBuf::Draw() (src/lvglyphblend.h).
+//
+// "check" blends pseudo-random glyph rows (background, fully opaque and
+// antialiased pixels, all row lengths and alignments, opaque and
+// translucent colors) into pseudo-random 32, 16 and 8 bpp rows, and
+// compares the result pixel by pixel with the former per-pixel loops.
+// Without argument, reports nanoseconds per glyph pixel for each depth.
+// Run it from builds with and without SIMD kernels (see makefile).
+//
+// usage: glyphblend_bench [iterations]
+//        glyphblend_bench check
+
+#include "../../src/lvglyphblend.h"
+#include "../simd_bench/simd_bench.h"
+
+// Reference: per-pixel loops, as formerly in lvdrawbuf.cpp
+static void refRow32( lUInt32 * dst, const lUInt8 * src, int count, lUInt32 color, lUInt8 bopacity ) {
+    for (int i = 0; i < count; i++) {
+        lUInt8 opacity = src[i];
+        if ( opacity == 0 ) {
+        }
+        else if (opacity == 0xFF && bopacity == 0xFF) {
+            dst[i] = color;
+        }
+        else {
+            opacity = (opacity*bopacity)>>8;
+            const lUInt8 alpha = opacity ^ 0xFF;
+            const lUInt32 n1 = (((dst[i] & 0xFF00FF) * alpha + (color & 0xFF00FF) * opacity) >> 8) & 0xFF00FF;
+            const lUInt32 n2 = (((dst[i] & 0x00FF00) * alpha + (color & 0x00FF00) * opacity) >> 8) & 0x00FF00;
+            dst[i] = n1 | n2;
+        }
+    }
+}
+
+static void refRow16( lUInt16 * dst, const lUInt8 * src, int count, lUInt16 color, lUInt8 bopacity ) {
+    for (int i = 0; i < count; i++) {
+        lUInt8 opacity = src[i];
+        if ( opacity == 0 ) {
+        }
+        else if (opacity == 0xFF && bopacity == 0xFF) {
+            dst[i] = color;
+        }
+        else {
+            opacity = (opacity*bopacity)>>8;
+            const lUInt8 alpha = opacity ^ 0xFF;
+            const lUInt32 r = (((dst[i] & 0xF800) * alpha + (color & 0xF800) * opacity) >> 8) & 0xF800;
+            const lUInt32 g = (((dst[i] & 0x07E0) * alpha + (color & 0x07E0) * opacity) >> 8) & 0x07E0;
+            const lUInt32 b = (((dst[i] & 0x001F) * alpha + (color & 0x001F) * opacity) >> 8) & 0x001F;
+            dst[i] = (lUInt16)(r | g | b);
+        }
+    }
+}
+
+static void refRow8( lUInt8 * dst, const lUInt8 * src, int count, lUInt8 color, lUInt8 bopacity ) {
+    for (int i = 0; i < count; i++) {
+        lUInt8 opacity = src[i];
+        if ( opacity == 0 ) {
+        }
+        else if (opacity == 0xFF && bopacity == 0xFF) {
+            dst[i] = color;
+        }
+        else {
+            opacity = (opacity*bopacity)>>8;
+            const lUInt8 alpha = opacity ^ 0xFF;
+            // ApplyAlphaGray8()
+            if ( alpha == 0 )
+                dst[i] = color;
+            else if ( alpha < 255 )
+                dst[i] = (dst[i] * alpha + color * opacity) >> 8;
+        }
+    }
+}
+
+// glyph-like coverage: mostly background, some fully opaque, some antialiased
+static void fillCoverage( lUInt8 * p, int n ) {
+    for (int i = 0; i < n; i++) {
+        unsigned r = rnd() % 8;
+        p[i] = r < 3 ? 0 : r < 5 ? 0xFF : (lUInt8)rnd();
+    }
+}
+
+static int check() {
+    const int maxLen = 80;
+    const lUInt8 opacities[] = { 0xFF, 0xFE, 0x80, 0x01, 0x00 };
+    int errors = 0;
+    int rows = 0;
+    lUInt8 src[maxLen + 16];
+    lUInt32 d32[maxLen + 4], r32[maxLen + 4];
+    lUInt16 d16[maxLen + 8], r16[maxLen + 8];
+    lUInt8 d8[maxLen + 16], r8[maxLen + 16];
+    for (int pass = 0; pass < 200; pass++) {
+        for (unsigned oi = 0; oi < sizeof(opacities); oi++) {
+            lUInt8 bop = opacities[oi];
+            lUInt32 color = rnd() & 0xFFFFFF;
+            for (int len = 0; len <= maxLen; len++) {
+                int off = rnd() % 4; // unaligned rows
+                fillCoverage(src + off, len);
+                for (int i = 0; i < len + 4; i++) {
+                    d32[i] = r32[i] = (rnd() << 8) ^ rnd();
+                    d16[i] = r16[i] = (lUInt16)rnd();
+                    d8[i] = r8[i] = (lUInt8)rnd();
+                }
+                glyphBlendRow32(d32 + off, src + off, len, color, bop);
+                refRow32(r32 + off, src + off, len, color, bop);
+                glyphBlendRow16(d16 + off, src + off, len, (lUInt16)color, bop);
+                refRow16(r16 + off, src + off, len, (lUInt16)color, bop);
+                glyphBlendRow8(d8 + off, src + off, len, (lUInt8)color, bop);
+                refRow8(r8 + off, src + off, len, (lUInt8)color, bop);
+                if (memcmp(d32, r32, (len + 4) * sizeof(lUInt32)) || memcmp(d16, r16, (len + 4) * sizeof(lUInt16))
+                        || memcmp(d8, r8, len + 4)) {
+                    if (errors < 10)
+                        printf("mismatch: len %d offset %d color %06x opacity %02x\n", len, off, color, bop);
+                    errors++;
+                }
+                rows++;
+            }
+        }
+    }
+    printf("%s: %d rows, %d mismatches: %s\n", kernelName(), rows, errors, errors ? "FAILED" : "OK");
+    return errors ? 1 : 0;
+}
+
+static void bench(int iterations) {
+    // a page worth of glyphs: 2000 glyphs of 12x16 coverage pixels
+    const int glyphs = 2000, gw = 12, gh = 16, lineWidth = 600;
+    std::vector<lUInt8> cov(glyphs * gw * gh);
+    fillCoverage(&cov[0], (int)cov.size());
+    std::vector<lUInt32> buf32(lineWidth * gh);
+    std::vector<lUInt16> buf16(lineWidth * gh);
+    std::vector<lUInt8> buf8(lineWidth * gh);
+    double pixels = (double)iterations * glyphs * gw * gh;
+    printf("%s:\n", kernelName());
+    for (int depth = 0; depth < 3; depth++) {
+        double start = now();
+        for (int it = 0; it < iterations; it++) {
+            for (int g = 0; g < glyphs; g++) {
+                const lUInt8 * bmp = &cov[g * gw * gh];
+                int x = (g * (gw + 1)) % (lineWidth - gw);
+                for (int y = 0; y < gh; y++) {
+                    if (depth == 0)
+                        glyphBlendRow32(&buf32[y * lineWidth + x], bmp + y * gw, gw, 0x203040, 0xFF);
+                    else if (depth == 1)
+                        glyphBlendRow16(&buf16[y * lineWidth + x], bmp + y * gw, gw, 0x2104, 0xFF);
+                    else
+                        glyphBlendRow8(&buf8[y * lineWidth + x], bmp + y * gw, gw, 0x30, 0xFF);
+                }
+            }
+        }
+        double elapsed = now() - start;
+        sink = buf32[gh / 2 * lineWidth + 5] + buf16[7] + buf8[9];
+        printf("  %2d bpp  %6.3f ns/pixel\n", depth == 0 ? 32 : depth == 1 ? 16 : 8, elapsed * 1e9 / pixels);
+    }
+}
+
+int main(int argc, char ** argv) {
+    return simdBenchMain(argc, argv, check, bench, 200);
+}
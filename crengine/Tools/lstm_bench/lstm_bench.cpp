@@ -0,0 +1,88 @@
+// Microbenchmark for the LSTM South-East-Asian word break engine
+// (src/linebreak/lstmbe.cpp).
+//
+// For each language model, breaks pseudo-random runs of characters taken
+// from the model dictionary, and reports words per second along with a
+// checksum of the break positions found. Builds with and without SIMD
+// kernels must report the same checksums (see makefile "check" target).
+//
+// usage: lstm_bench [iterations]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "../../src/linebreak/lstmbe.h"
+#include "../../src/linebreak/lstm_data.h"
+
+struct BenchModel {
+    const char * name;
+    const lstm_data * model;
+    char32_t first; // script block to take characters from
+    char32_t last;
+};
+
+static const BenchModel models[] = {
+    { "thai",    &lstm_model_thai,    0x0E00, 0x0E7F },
+    { "lao",     &lstm_model_lao,     0x0E80, 0x0EFF },
+    { "burmese", &lstm_model_burmese, 0x1000, 0x109F },
+    { "khmer",   &lstm_model_khmer,   0x1780, 0x17FF },
+};
+
+struct BenchResult {
+    int words;
+    unsigned checksum;
+};
+
+static void onBreak(void * context, int32_t pos) {
+    BenchResult * res = (BenchResult *)context;
+    res->words++;
+    res->checksum = (res->checksum ^ (unsigned)pos) * 16777619u;
+}
+
+static double now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int main(int argc, char ** argv) {
+    int iterations = argc > 1 ? atoi(argv[1]) : 200;
+    const int textLen = 4096;
+    char32_t * text = new char32_t[textLen];
+    char32_t * alphabet = new char32_t[0x100];
+    for (unsigned m = 0; m < sizeof(models) / sizeof(models[0]); m++) {
+        const BenchModel & bm = models[m];
+        int alphabetLen = 0;
+        for (char32_t ch = bm.first; ch <= bm.last; ch++) {
+            if (bm.model->mapping(ch) >= 0)
+                alphabet[alphabetLen++] = ch;
+        }
+        // deterministic text, so checksums can be compared between builds
+        unsigned seed = 12345;
+        for (int i = 0; i < textLen; i++) {
+            seed = seed * 1103515245u + 12345u;
+            text[i] = alphabet[(seed >> 16) % alphabetLen];
+        }
+        LSTMBreakEngine engine(*bm.model);
+        BenchResult res = { 0, 2166136261u };
+        double start = now();
+        for (int it = 0; it < iterations; it++) {
+            // break the text in runs of 16..271 chars, like SA runs in paragraphs
+            int pos = 0;
+            while (pos < textLen) {
+                int len = 16 + ((pos * 31 + it * 7) & 0xFF);
+                if (pos + len > textLen)
+                    len = textLen - pos;
+                res.words++; // first word of the run
+                engine.breakWord(text, pos, pos + len, onBreak, &res);
+                pos += len;
+            }
+        }
+        double elapsed = now() - start;
+        printf("%-8s %10.0f words/s %10.0f chars/s  checksum %08x\n", bm.name,
+               res.words / elapsed, (double)textLen * iterations / elapsed, res.checksum);
+    }
+    delete[] text;
+    delete[] alphabet;
+    return 0;
+}
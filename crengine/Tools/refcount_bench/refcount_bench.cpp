@@ -0,0 +1,136 @@
+// Microbenchmark for the LVRef/LVFastRef reference counters (include/lvref.h).
+//
+// Runs the reference patterns met when rendering a document on a single
+// thread (style and font refs copied from parent to child nodes, image refs
+// kept in vectors, null refs created and cleared), and reports nanoseconds
+// per reference copy+release. Build and run it with and without
+// USE_ATOMIC_REFCOUNT (see makefile "bench" target) to get the cost of
+// atomic counters on single-threaded rendering.
+// With "threads" as argument, checks that counters are not corrupted when
+// the same objects are shared by several threads (only reliable with
+// atomic counters).
+//
+// usage: refcount_bench [iterations]
+//        refcount_bench threads [thread count]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <thread>
+#include <vector>
+#include "../../include/lvref.h"
+
+// normally in src/lvmemman.cpp
+ref_count_rec_t ref_count_rec_t::null_ref(NULL);
+ref_count_rec_t ref_count_rec_t::protected_null_ref(NULL);
+
+// like css_style_rec_t, counted by LVFastRef
+struct BenchStyle : public LVRefCounter {
+    int fontSize;
+    static int deleted;
+    BenchStyle(int size) : fontSize(size) { }
+    ~BenchStyle() { deleted++; }
+};
+int BenchStyle::deleted = 0;
+
+// like LVImageSource, counted by LVRef
+struct BenchImage {
+    int width;
+    BenchImage(int w) : width(w) { }
+};
+
+static double now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// "volatile" sink so the compiler can't drop the reference traffic
+static volatile int sink;
+
+static void benchFastRef(int iterations) {
+    const int depth = 32; // node nesting levels
+    LVFastRef<BenchStyle> root(new BenchStyle(16));
+    std::vector< LVFastRef<BenchStyle> > stack(depth);
+    double start = now();
+    for (int it = 0; it < iterations; it++) {
+        // each node gets its parent style, which is then dropped for the next sibling
+        stack[0] = root;
+        for (int i = 1; i < depth; i++)
+            stack[i] = stack[i - 1];
+        sink = stack[depth - 1]->fontSize;
+        for (int i = depth - 1; i >= 0; i--)
+            stack[i].Clear();
+    }
+    double elapsed = now() - start;
+    printf("LVFastRef copy     %6.2f ns/ref\n", elapsed * 1e9 / ((double)iterations * depth));
+}
+
+static void benchRef(int iterations) {
+    const int count = 64; // images on a page
+    LVRef<BenchImage> img(new BenchImage(100));
+    LVRefVec<BenchImage> vec;
+    double start = now();
+    for (int it = 0; it < iterations; it++) {
+        for (int i = 0; i < count; i++)
+            vec.add(img);
+        sink = vec[count - 1]->width;
+        vec.clear();
+    }
+    double elapsed = now() - start;
+    printf("LVRef copy         %6.2f ns/ref\n", elapsed * 1e9 / ((double)iterations * count));
+}
+
+static void benchNullRef(int iterations) {
+    const int count = 64;
+    double start = now();
+    for (int it = 0; it < iterations; it++) {
+        for (int i = 0; i < count; i++) {
+            LVRef<BenchImage> ref; // shares the global null_ref counter
+            sink = ref.isNull();
+        }
+    }
+    double elapsed = now() - start;
+    printf("LVRef null         %6.2f ns/ref\n", elapsed * 1e9 / ((double)iterations * count));
+}
+
+static void shareRefs(LVFastRef<BenchStyle> * style, LVRef<BenchImage> * img, int iterations) {
+    for (int it = 0; it < iterations; it++) {
+        LVFastRef<BenchStyle> s1 = *style;
+        LVFastRef<BenchStyle> s2 = s1;
+        LVRef<BenchImage> i1 = *img;
+        LVRef<BenchImage> i2;
+        i2 = i1;
+        sink = s2->fontSize + i2->width;
+    }
+}
+
+static int checkThreads(int threadCount) {
+    const int iterations = 1000000;
+    LVFastRef<BenchStyle> style(new BenchStyle(16));
+    LVRef<BenchImage> img(new BenchImage(100));
+    std::vector<std::thread> threads;
+    for (int i = 0; i < threadCount; i++)
+        threads.push_back(std::thread(shareRefs, &style, &img, iterations));
+    for (int i = 0; i < threadCount; i++)
+        threads[i].join();
+    int styleRefs = style.getRefCount();
+    int imgRefs = img.getRefCount();
+    style.Clear();
+    bool ok = styleRefs == 1 && imgRefs == 1 && BenchStyle::deleted == 1;
+    printf("%d threads: style refs %d, image refs %d, styles deleted %d: %s\n", threadCount,
+           styleRefs, imgRefs, BenchStyle::deleted, ok ? "OK" : "FAILED");
+    return ok ? 0 : 1;
+}
+
+int main(int argc, char ** argv) {
+    if (argc > 1 && !strcmp(argv[1], "threads"))
+        return checkThreads(argc > 2 ? atoi(argv[2]) : 4);
+    int iterations = argc > 1 ? atoi(argv[1]) : 1000000;
+    printf("USE_ATOMIC_REFCOUNT=%d\n", USE_ATOMIC_REFCOUNT);
+    benchFastRef(iterations);
+    benchRef(iterations);
+    benchNullRef(iterations);
+    return 0;
+}
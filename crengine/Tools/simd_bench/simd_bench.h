@@ -0,0 +1,46 @@
+// Common driver of the draw buffer kernel checks and microbenchmarks
+// (Tools/*_bench), each built with and without
+// SIMD kernels by simd_bench.mk.
+// A bench defines check(), returning non zero on mismatch, and bench(iterations),
+// then calls simdBenchMain() from main().
+//
+// usage: <bench> [iterations]
+//        <bench> check
+
+#ifndef SIMD_BENCH_H_INCLUDED
+#define SIMD_BENCH_H_INCLUDED
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <vector>
+#include "../../src/lvsimd.h"
+
+static const char * kernelName() {
+    return DRAWBUF_SIMD_NAME;
+}
+
+static unsigned rnd_state = 12345;
+static unsigned rnd() {
+    rnd_state = rnd_state * 1103515245u + 12345u;
+    return rnd_state >> 8;
+}
+
+static double now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// "volatile" sink so the compiler can't drop the benchmarked work
+static volatile unsigned sink;
+
+static int simdBenchMain(int argc, char ** argv, int (*check)(), void (*bench)(int), int defaultIterations) {
+    if (argc > 1 && !strcmp(argv[1], "check"))
+        return check();
+    bench(argc > 1 ? atoi(argv[1]) : defaultIterations);
+    return 0;
+}
+
+#endif
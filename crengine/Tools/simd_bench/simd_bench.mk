@@ -0,0 +1,35 @@
+# Common rules of the draw buffer kernel checks and microbenchmarks, included
+# by their makefiles after setting:
+#   BENCH  - program name, built from $(BENCH).cpp
+#   KERNEL - kernel header under test
+# Targets:
+#   make            - build $(BENCH) (SIMD kernels for the host CPU) and $(BENCH)_scalar
+#   make check      - run checks of both builds
+#   make bench      - run benchmark for both builds
+
+CC = g++
+CFLAGS = -O2 -Wall
+ARCHFLAGS = -march=native
+SRCS = $(BENCH).cpp
+DEPS = $(SRCS) $(KERNEL) ../../src/lvsimd.h ../simd_bench/simd_bench.h
+
+all: $(BENCH) $(BENCH)_scalar
+
+$(BENCH): $(DEPS)
+	$(CC) $(CFLAGS) $(ARCHFLAGS) -o $@ $(SRCS)
+
+$(BENCH)_scalar: $(DEPS)
+	$(CC) $(CFLAGS) -DDRAWBUF_DISABLE_SIMD -o $@ $(SRCS)
+
+check: $(BENCH) $(BENCH)_scalar
+	./$(BENCH) check
+	./$(BENCH)_scalar check
+
+bench: $(BENCH) $(BENCH)_scalar
+	./$(BENCH)
+	./$(BENCH)_scalar
+
+clean:
+	rm -f $(BENCH) $(BENCH)_scalar
+
+.PHONY: all bench check clean
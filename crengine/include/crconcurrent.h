@@ -6,6 +6,7 @@
 
 #include "lvref.h"
 #include "lvqueue.h"
+#include "lvptrvec.h"
 
 class CRConcurrencyProvider {
 public:
@@ -36,5 +37,41 @@ public:
     virtual void run();
 };
 
+/// Fixed size pool of worker threads sharing a single task queue.
+/// When no concurrency provider is set (or threadCount is 0), tasks are executed
+/// synchronously inside execute(), so callers don't need a separate code path.
+class CRThreadPool : public CRExecutor {
+    class Worker : public CRRunnable {
+        CRThreadPool * _pool;
+    public:
+        Worker(CRThreadPool * pool) : _pool(pool) {}
+        virtual void run() { _pool->workerLoop(); }
+    };
+    volatile bool _stopped;
+    int _activeCount;
+    CRMonitorRef _monitor;
+    LVPtrVector<Worker> _workers;
+    LVPtrVector<CRThread> _threads;
+    LVQueue<CRRunnable *> _queue;
+    void workerLoop();
+public:
+    CRThreadPool(int threadCount);
+    virtual ~CRThreadPool();
+    /// number of worker threads (0 means tasks are run synchronously)
+    int getThreadCount() const { return _threads.length(); }
+    /// returns true if tasks are executed in the calling thread
+    bool isSynchronous() const { return _threads.length() == 0; }
+    /// queue task for execution; task will be deleted after run
+    virtual void execute(CRRunnable * task);
+    /// wait until task queue is empty and all workers are idle
+    void waitAll();
+    /// set flag and wake up threads blocked in waitFor()
+    void notifyDone(volatile bool & flag);
+    /// wait until flag is set by notifyDone()
+    void waitFor(volatile bool & flag);
+    /// drop pending tasks and stop all workers
+    void stop();
+};
+
 
 #endif // CRCONCURRENT_H
@@ -57,11 +57,16 @@ extern CRMutex * _fontManMutex;
 extern CRMutex * _fontGlyphCacheMutex;
 extern CRMutex * _fontLocalGlyphCacheMutex;
 extern CRMutex * _crengineMutex;
+/// set on threads formatting final blocks ahead (see setFinalBlockFormattingThreads()): they
+/// only measure text having all its glyphs in a single font, under this font's own mutex
+extern thread_local bool _fontMeasuringThread;
 
 // use REF_GUARD to acquire LVProtectedRef mutex
 #define REF_GUARD CRGuard _refGuard(_refMutex); CR_UNUSED(_refGuard);
 // use FONT_GUARD to acquire font operations mutex
 #define FONT_GUARD CRGuard _fontGuard(_fontMutex); CR_UNUSED(_fontGuard);
+// use FONT_MEASURE_GUARD to acquire font operations mutex, except on text measuring threads
+#define FONT_MEASURE_GUARD CRGuard _fontGuard(_fontMeasuringThread ? (CRMutex *)NULL : _fontMutex); CR_UNUSED(_fontGuard);
 // use FONT_MAN_GUARD to acquire font manager mutex
 #define FONT_MAN_GUARD CRGuard _fontManGuard(_fontManMutex); CR_UNUSED(_fontManGuard);
 // use FONT_GLYPH_CACHE_GUARD to acquire font global glyph cache operations mutex
@@ -42,7 +42,6 @@
 #define USE_GIF                              0
 #define USE_FREETYPE                         0
 #define USE_HARFBUZZ                         0
-#define USE_GLYPHCACHE_HASHTABLE             0
 #define GLYPH_CACHE_SIZE                     0x1000
 #define ZIP_STREAM_BUFFER_SIZE               0x1000
 #define FILE_STREAM_BUFFER_SIZE              0x1000
@@ -54,7 +53,6 @@
 #define USE_GIF                              1
 #define USE_FREETYPE                         1
 #define USE_HARFBUZZ                         1
-#define USE_GLYPHCACHE_HASHTABLE             0
 #define GLYPH_CACHE_SIZE                     0x20000
 #define ZIP_STREAM_BUFFER_SIZE               0x80000
 #define FILE_STREAM_BUFFER_SIZE              0x40000
@@ -78,7 +76,6 @@
 #define GRAY_INVERSE                         0
 #define USE_FREETYPE                         1
 #define USE_HARFBUZZ                         1
-#define USE_GLYPHCACHE_HASHTABLE             0
 
 #ifndef ANDROID
 #ifndef MAC
@@ -116,7 +113,6 @@
 #define USE_HARFBUZZ                         1
 #endif
 #define ALLOW_KERNING                        1
-#define USE_GLYPHCACHE_HASHTABLE             0
 #define GLYPH_CACHE_SIZE                     0x20000
 #define ZIP_STREAM_BUFFER_SIZE               0x80000
 #define FILE_STREAM_BUFFER_SIZE              0x40000
@@ -301,8 +297,10 @@
 #define MAX_IMAGE_SCALE_MUL 2
 #endif
 
-#ifndef USE_GLYPHCACHE_HASHTABLE
-#define USE_GLYPHCACHE_HASHTABLE 0
+/// set to 1 to use atomic reference counters in LVRef/LVFastRef, so references
+/// can be shared between threads (see Tools/refcount_bench for the overhead)
+#ifndef USE_ATOMIC_REFCOUNT
+#define USE_ATOMIC_REFCOUNT 0
 #endif
 
 #ifndef USE_LIMITED_FONT_SIZES_SET
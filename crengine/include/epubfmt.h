@@ -10,6 +10,8 @@ bool ImportEpubDocument( LVStreamRef stream, ldomDocument * doc, LVDocViewCallba
     const elem_def_t * node_scheme=NULL, const attr_def_t * attr_scheme=NULL, const ns_def_t * ns_scheme=NULL);
 lString32 EpubGetRootFilePath( LVContainerRef m_arc );
 LVStreamRef GetEpubCoverpage(LVContainerRef arc);
+/// set number of threads inflating spine items ahead of parsing (0 to disable, needs concurrency provider)
+void setEpubSpinePrefetchThreads(int threads);
 
 
 #endif // EPUBFMT_H
@@ -21,6 +21,7 @@
 #include "lvdrawbuf.h"
 #include "hist.h"
 #include "lvthread.h"
+#include "crconcurrent.h"
 #include "lvdocviewcmd.h"
 #include "lvdocviewprops.h"
 
@@ -75,98 +76,94 @@ public:
 typedef LVRef<LVDocImageHolder> LVDocImageRef;
 
 /// page image cache
+/// Holds up to maxPages rendered page images (and at most maxBytes of pixel data,
+/// if set), rendering them in background on a persistent worker pool.
+/// Pages are identified either by page number (page mode) or by document
+/// offset (scroll mode), like in LVDocView::Draw().
 class LVDocViewImageCache
 {
-    private:
-        LVMutex _mutex;
+    public:
         class Item {
             public:
                 LVRef<LVDrawBuf> _drawbuf;
-                LVRef<LVThread> _thread;
                 int _offset;
                 int _page;
-                bool _ready;
-                bool _valid;
+                int _size;
+                lUInt32 _lastAccess;
+                volatile bool _ready;
+                volatile bool _cancelled;
+                int _waiters;  // threads waiting for it to be ready, without the lock
+                bool _removed; // removed from cache while waited for: freed by last waiter
+                Item( int offset, int page, LVRef<LVDrawBuf> drawbuf );
+                /// returns page number in page mode, or offset in scroll mode
+                int getKey() const { return _page != -1 ? _page : _offset; }
+                bool matches( int offset, int page ) const {
+                    return (_offset == offset && offset!=-1) || (_page==page && page!=-1);
+                }
         };
-        Item _items[2];
-        int _last;
+    private:
+        LVMutex _mutex;
+        LVPtrVector<Item> _items;
+        CRThreadPool * _pool;
+        int _workerCount;
+        int _maxPages;
+        int _maxBytes;
+        int _totalBytes;
+        lUInt32 _accessCounter;
+        // navigation state used by eviction
+        int _posKey;
+        int _direction;
+        int _window;
+        // statistics
+        int _hits;
+        int _misses;
+        Item * find( int offset, int page );
+        int findVictim();
+        void removeItem( int index );
+        /// wait, without holding the lock, until page is rendered; returns false if not in cache
+        bool waitReady( int offset, int page, bool updateStats );
+        /// called with the lock held by a thread done waiting for item
+        void releaseWaiter( Item * item );
     public:
         /// return mutex
         LVMutex & getMutex() { return _mutex; }
-        /// set page to cache
-        void set( int offset, int page, LVRef<LVDrawBuf> drawbuf, LVRef<LVThread> thread )
-        {
-            LVLock lock( _mutex );
-            _last = (_last + 1) & 1;
-            _items[_last]._ready = false;
-            _items[_last]._thread = thread;
-            _items[_last]._drawbuf = drawbuf;
-            _items[_last]._offset = offset;
-            _items[_last]._page = page;
-            _items[_last]._valid = true;
-        }
-        /// return page image, wait until ready
-        LVRef<LVDrawBuf> getWithoutLock( int offset, int page )
-        {
-            for ( int i=0; i<2; i++ ) {
-                if ( _items[i]._valid &&
-                     ( (_items[i]._offset == offset && offset!=-1)
-                      || (_items[i]._page==page && page!=-1)) ) {
-                    if ( !_items[i]._ready ) {
-                        _items[i]._thread->join();
-                        _items[i]._thread = NULL;
-                        _items[i]._ready = true;
-                    }
-                    _last = i;
-                    return _items[i]._drawbuf;
-                }
-            }
-            return LVRef<LVDrawBuf>();
-        }
-        /// return page image, wait until ready
-        LVDocImageRef get( int offset, int page )
-        {
-            _mutex.lock();
-            LVRef<LVDrawBuf> buf = getWithoutLock( offset, page );
-            if ( !buf.isNull() )
-                return LVDocImageRef( new LVDocImageHolder(getWithoutLock( offset, page ), _mutex) );
-            return LVDocImageRef( NULL );
-        }
-        bool has( int offset, int page )
-        {
-            _mutex.lock();
-            for ( int i=0; i<2; i++ ) {
-                if ( _items[i]._valid && ( (_items[i]._offset == offset && offset!=-1)
-                      || (_items[i]._page==page && page!=-1)) ) {
-                    return true;
-                }
-            }
-            return false;
-        }
-        void clear()
-        {
-            LVLock lock( _mutex );
-            for ( int i=0; i<2; i++ ) {
-                if ( _items[i]._valid && !_items[i]._ready ) {
-                    _items[i]._thread->join();
-                }
-                _items[i]._thread.Clear();
-                _items[i]._valid = false;
-                _items[i]._drawbuf.Clear();
-                _items[i]._offset = -1;
-                _items[i]._page = -1;
-            }
-        }
-        LVDocViewImageCache()
-        : _last(0)
-        {
-            for ( int i=0; i<2; i++ )
-                _items[i]._valid = false;
-        }
-        ~LVDocViewImageCache()
-        {
-            clear();
-        }
+        /// returns worker pool used to render pages, creates it if necessary
+        CRThreadPool * getPool();
+        /// returns true if pages are rendered synchronously (no worker threads available)
+        bool isSynchronous() { return getPool()->isSynchronous(); }
+        /// set max number of cached pages and max total size of page buffers (0 for unlimited)
+        void setLimits( int maxPages, int maxBytes );
+        int getMaxPages() const { return _maxPages; }
+        int getMaxBytes() const { return _maxBytes; }
+        /// set number of worker threads (applied on next clear)
+        void setWorkerCount( int count );
+        /// set current position (page number or offset), navigation direction (-1, 0, 1),
+        /// and read-ahead window size in the same units: pages inside this window
+        /// ahead of current position are evicted last
+        void setPosition( int key, int direction, int window );
+        int getDirection() const { return _direction; }
+        /// add page to cache, returns created item which is not ready yet
+        Item * add( int offset, int page, LVRef<LVDrawBuf> drawbuf );
+        /// return page image if already rendered (to be called with getMutex() locked: never waits)
+        LVRef<LVDrawBuf> getWithoutLock( int offset, int page, bool updateStats=false );
+        /// return page image, wait until ready (the returned holder keeps the cache locked)
+        LVDocImageRef get( int offset, int page, bool updateStats=false );
+        /// returns true if page is in cache (ready or being rendered)
+        bool has( int offset, int page, bool updateStats=false );
+        /// returns true if page is in cache and already rendered
+        bool isReady( int offset, int page );
+        /// returns number of cache hits since last resetStats()
+        int getHits() const { return _hits; }
+        /// returns number of cache misses since last resetStats()
+        int getMisses() const { return _misses; }
+        /// returns number of cached pages
+        int getPageCount() const { return _items.length(); }
+        /// returns total size of cached page buffers
+        int getTotalBytes() const { return _totalBytes; }
+        void resetStats() { _hits = _misses = 0; }
+        void clear();
+        LVDocViewImageCache();
+        ~LVDocViewImageCache();
 };
 #endif
 
@@ -246,7 +243,7 @@ typedef LVArray<int> LVBookMarkPercentInfo;
 */
 class LVDocView : public CacheLoadingCallback
 {
-    friend class LVDrawThread;
+    friend class LVDrawTask;
 private:
     int m_bitsPerPixel;
     int m_dx;
@@ -310,6 +307,8 @@ protected:
 
     ldomMarkedRangeList m_markRanges;
     ldomMarkedRangeList m_bmkRanges;
+    /// window rectangles of text selections at last Draw(drawbuf), for redrawSelection()
+    LVArray<lvRect> m_drawnSelectionRects;
 
 private:
     lString32 m_filename;
@@ -343,6 +342,10 @@ private:
     LVMutex _mutex;
 #if CR_ENABLE_PAGE_IMAGE_CACHE==1
     LVDocViewImageCache m_imageCache;
+    /// number of pages to render ahead
+    int m_imageCachePrefetch;
+    /// last page (or offset) requested from image cache, to detect navigation direction
+    int m_imageCacheLastKey;
 #endif
 
 
@@ -415,6 +418,14 @@ public:
 
     /// draw current page to specified buffer
     void Draw( LVDrawBuf & drawbuf, bool autoResize = true);
+    /// redraw only page header(s) into buffer holding current page drawn by Draw(drawbuf), e.g. when isTimeChanged();
+    /// damaged gets the modified rectangles, returns false if nothing was redrawn
+    bool redrawPageHeader( LVDrawBuf & drawbuf, LVArray<lvRect> & damaged );
+    /// redraw only areas of previous and current text selections into buffer holding current page drawn by Draw(drawbuf);
+    /// damaged gets the modified rectangles, returns false if nothing was redrawn (or buffer has no accessible scan lines)
+    bool redrawSelection( LVDrawBuf & drawbuf, LVArray<lvRect> & damaged );
+    /// get window rectangles of text selections on current page(s)
+    void getSelectionWindowRects( LVArray<lvRect> & rects );
 
     /// close document
     void close();
@@ -439,6 +450,8 @@ public:
     ContinuousOperationResult updateCache(CRTimerUtil & maxTime);
     /// save unsaved data to cache file (if one is created), w/o timeout
     ContinuousOperationResult updateCache();
+    /// progressively rerender the DocFragments left behind by a delayed (partial) rerendering, nearest to current position first
+    ContinuousOperationResult renderPendingFragments(CRTimerUtil & maxTime);
 
     /// returns selected (marked) ranges
     ldomMarkedRangeList * getMarkedRanges() { return &m_markRanges; }
@@ -588,6 +601,22 @@ public:
     bool IsDrawed();
     /// cache page image (render in background if necessary) (0=current, -1=prev, 1=next)
     void cachePageImage( int delta );
+    /// cache page image by either Y pos or page number (unused param should be -1)
+    void cachePageImageAt( int offset, int page );
+    /// schedule background rendering of pages around current one, according to navigation direction
+    void prefetchPageImages();
+    /// set page image cache limits: max number of pages and max total buffer size in bytes (0=unlimited)
+    void setPageImageCacheLimits( int maxPages, int maxBytes );
+    /// set number of pages to render ahead in navigation direction (one page is always kept behind)
+    void setPageImageCachePrefetch( int pages );
+    /// set number of page rendering worker threads (needs concurrency provider)
+    void setPageImageCacheWorkers( int count );
+    /// returns number of page image cache hits
+    int getPageImageCacheHits() { return m_imageCache.getHits(); }
+    /// returns number of page image cache misses
+    int getPageImageCacheMisses() { return m_imageCache.getMisses(); }
+    /// reset page image cache hit/miss counters
+    void resetPageImageCacheStats() { m_imageCache.resetStats(); }
 #endif
     /// return view mutex
     LVMutex & getMutex() { return _mutex; }
@@ -704,6 +733,8 @@ public:
     void setInfoFont( font_ref_t font ) { m_infoFont = font; }
     /// draw page header to buffer
     virtual void drawPageHeader( LVDrawBuf * drawBuf, const lvRect & headerRc, int pageIndex, int headerInfoFlags, int pageCount );
+    /// decide whether and where header of specified page is drawn, and with which info (returns false if no header)
+    bool getPageHeaderLayout( LVRendPageInfo & page, lvRect & headerRc, int & headerInfoFlags );
     /// draw battery state to buffer
     virtual void drawBatteryState( LVDrawBuf * drawBuf, const lvRect & rc, bool isVertical );
 
@@ -840,6 +871,10 @@ public:
 
     /// draws page to image buffer
     void drawPageTo( LVDrawBuf * drawBuf, LVRendPageInfo & page, lvRect * pageRect, int pageCount, int basePage, bool hasTwoVisiblePages=false, bool isRightPage=false, bool isLastPage=false);
+    /// queues rasterizing the glyphs of pages (or of the scroll range) from page
+    /// (or position), see LVFontManager::PrerenderGlyphs(): does nothing without
+    /// glyph prerendering threads
+    void prerenderGlyphs( int position, int page, int pageCount, int height, bool wantHidden );
     /// draws coverpage to image buffer
     void drawCoverTo( LVDrawBuf * drawBuf, lvRect & rc );
     /// returns cover page image source, if any
@@ -7,6 +7,7 @@
 #define PROP_FONT_ANTIALIASING       "font.antialiasing.mode"
 #define PROP_FONT_HINTING            "font.hinting.mode"
 #define PROP_FONT_KERNING            "font.kerning.mode"
+#define PROP_FONT_SUBPIXEL_POSITIONING "font.subpixel.positioning" // 1, 2 or 4 glyph positions per pixel
 #define PROP_FONT_COLOR              "font.color.default"
 #define PROP_FONT_FACE               "font.face.default"
 #define PROP_FONT_BASE_WEIGHT        "font.face.base.weight"        // replaces PROP_FONT_WEIGHT_EMBOLDEN ("font.face.weight.embolden")
@@ -37,6 +37,10 @@ enum cr_rotate_angle_t {
 
 class LVFont;
 class GLDrawBuf; // workaround for no-rtti builds
+class LVBaseDrawBuf;
+
+/// max number of rectangles kept by LVBaseDrawBuf dirty region tracking
+#define DRAWBUF_MAX_DIRTY_RECTS 16
 
 /// Abstract drawing buffer
 class LVDrawBuf : public CacheableObject
@@ -77,6 +81,21 @@ public:
         rc.bottom = GetHeight();
     }
 
+    // dirty region support, for partial screen updates
+    /// starts or stops accumulating modified rectangles (forgetting previous ones)
+    virtual void setDirtyTracking( bool enable ) { CR_UNUSED(enable); }
+    /// returns true if modified rectangles are accumulated
+    virtual bool isDirtyTracking() const { return false; }
+    /// adds rectangle to modified region
+    virtual void markDirty( const lvRect & rc ) { CR_UNUSED(rc); }
+    /// returns rectangles modified since tracking started or last clearDirtyRects(), whole buffer when not tracking
+    virtual void getDirtyRects( LVArray<lvRect> & rects ) const {
+        rects.clear();
+        rects.add( lvRect(0, 0, GetWidth(), GetHeight()) );
+    }
+    /// forgets modified rectangles
+    virtual void clearDirtyRects() { }
+
     /// rotates buffer contents by specified angle
     virtual void Rotate( cr_rotate_angle_t angle ) = 0;
     /// returns white pixel value
@@ -227,6 +246,7 @@ public:
     /// virtual destructor
     virtual ~LVDrawBuf() { }
     virtual GLDrawBuf * asGLDrawBuf() { return NULL; }
+    virtual LVBaseDrawBuf * asBaseDrawBuf() { return NULL; }
 };
 
 /// LVDrawBufferBase
@@ -247,7 +267,37 @@ protected:
     bool _smoothImages;
     int _drawnImagesCount;
     int _drawnImagesSurface;
+    LVArray<lvRect> _dirtyRects;
+    bool _dirtyTracking;
+    /// adds rectangle, limited to clip rectangle, to modified region when tracking
+    inline void markDirtyClipped( int x0, int y0, int x1, int y1 ) {
+        if ( _dirtyTracking ) {
+            lvRect rc( x0, y0, x1, y1 );
+            if ( rc.intersect( _clip ) )
+                markDirty( rc );
+        }
+    }
+    /// adds whole buffer to modified region when tracking
+    inline void markDirtyAll() {
+        if ( _dirtyTracking ) {
+            _dirtyRects.clear();
+            _dirtyRects.add( lvRect(0, 0, _dx, _dy) );
+        }
+    }
 public:
+    /// starts or stops accumulating modified rectangles (forgetting previous ones)
+    virtual void setDirtyTracking( bool enable ) { _dirtyTracking = enable; _dirtyRects.clear(); }
+    /// returns true if modified rectangles are accumulated
+    virtual bool isDirtyTracking() const { return _dirtyTracking; }
+    /// adds rectangle to modified region: merged with rectangles it overlaps or touches,
+    /// and with the closest one when there are already DRAWBUF_MAX_DIRTY_RECTS
+    virtual void markDirty( const lvRect & rc );
+    /// returns rectangles modified since tracking started or last clearDirtyRects(), whole buffer when not tracking
+    virtual void getDirtyRects( LVArray<lvRect> & rects ) const;
+    /// forgets modified rectangles
+    virtual void clearDirtyRects() { _dirtyRects.clear(); }
+    /// returns bounding box of modified rectangles (empty if none)
+    lvRect getDirtyBounds() const;
     /// set to true for drawing in Paged mode, false for Scroll mode
     virtual void setHidePartialGlyphs( bool hide ) { _hidePartialGlyphs = hide; }
     /// set to true to invert images only (so they get inverted back to normal by nightmode)
@@ -257,6 +307,9 @@ public:
     virtual void setDitherImages( bool dither ) { _ditherImages = dither; }
     /// set to true to switch to a more costly smooth scaler instead of nearest neighbor
     virtual void setSmoothScalingImages( bool smooth ) { _smoothImages = smooth; }
+    bool getHidePartialGlyphs() const { return _hidePartialGlyphs; }
+    bool getDitherImages() const { return _ditherImages; }
+    bool getSmoothScalingImages() const { return _smoothImages; }
     /// returns current background color
     virtual lUInt32 GetBackgroundColor() const { return _backgroundColor; }
     /// sets current background color
@@ -298,10 +351,13 @@ public:
     int getDrawnImagesCount() const { return _drawnImagesCount; }
     /// Get surface of images drawn on buffer
     int getDrawnImagesSurface() const { return _drawnImagesSurface; }
+    /// Account for images drawn on buffer by other means (see LVRecordingDrawBuf)
+    void addDrawnImages( int count, int surface ) { _drawnImagesCount += count; _drawnImagesSurface += surface; }
+    virtual LVBaseDrawBuf * asBaseDrawBuf() { return this; }
 
     LVBaseDrawBuf() : _dx(0), _dy(0), _rowsize(0), _data(NULL), _drawExtraInfo(NULL), _hidePartialGlyphs(true),
                         _invertImages(false), _ditherImages(false), _smoothImages(false),
-                        _drawnImagesCount(0), _drawnImagesSurface(0) { }
+                        _drawnImagesCount(0), _drawnImagesSurface(0), _dirtyTracking(false) { }
     virtual ~LVBaseDrawBuf() { }
 };
 
@@ -354,6 +410,36 @@ enum DrawBufPixelFormat
     DRAW_BUF_32_BPP = 32  /// color 32bit RGB 888
 };
 
+/// dithering used by gray quantization to 1, 2 or 4 bpp
+enum DrawBufDitherMode
+{
+    DITHER_NONE = 0,        /// nearest level
+    DITHER_ORDERED,         /// 8x8 Bayer matrix, stable across partial updates
+    DITHER_FLOYD_STEINBERG, /// error diffusion
+    DITHER_ATKINSON         /// error diffusion of 3/4 of the error, less noisy on e-ink
+};
+
+/**
+ * Quantizes gray pixels to packed 1, 2 or 4 bpp gray, leftmost pixel in most significant bits,
+ * keeping source polarity (0 = darkest level unless the source is inverted).
+ * src: srcBpp = 2 (packed), 3, 4 or 8 (1 byte per pixel), or 32 (0xAARRGGBB) pixels, srcPitch bytes per row
+ * dst: dstPitch bytes per row; may be src for in place conversion, if dstPitch <= srcPitch and rect is NULL
+ * rect: when not NULL, only converts this rectangle (extended to whole destination bytes), leaving
+ *       other dst bytes unchanged; error diffusion then starts from the rectangle edges
+ * Returns false for unsupported formats.
+ */
+bool QuantizeToGray( const lUInt8 * src, int srcPitch, int srcBpp, int dx, int dy,
+                     lUInt8 * dst, int dstPitch, int dstBpp, DrawBufDitherMode mode, const lvRect * rect = NULL );
+
+/**
+ * Rotates dx*dy pixels clockwise by angle into another buffer (dy*dx pixels for 90 and 270 degrees).
+ * bpp: 1 or 2 (packed, leftmost pixel in most significant bits), 3, 4 or 8 (1 byte per pixel), 16 or 32
+ * Moves pixels by cache sized tiles, so it is also the fast way to rotate to a device framebuffer.
+ * Returns false for unsupported formats, or when dst is src.
+ */
+bool RotatePixels( const lUInt8 * src, int srcPitch, int dx, int dy, int bpp,
+                   lUInt8 * dst, int dstPitch, cr_rotate_angle_t angle );
+
 /**
  * 2-bit gray bitmap buffer, partial support for 1-bit buffer
  * Supported pixel formats for LVGrayDrawBuf :
@@ -414,6 +500,10 @@ public:
     virtual ~LVGrayDrawBuf();
     /// convert to 1-bit bitmap
     void ConvertToBitmap(bool flgDither);
+    /// rotates buffer contents into external buffer (e.g. framebuffer) with dstPitch bytes per row, leaving this buffer unchanged
+    bool RotateTo( cr_rotate_angle_t angle, lUInt8 * dst, int dstPitch ) const;
+    /// quantize to packed 1, 2 or 4 bpp gray into dst (see QuantizeToGray()), or in place to 1 or 2 bpp when dst is NULL
+    bool Quantize( int bpp, DrawBufDitherMode mode, lUInt8 * dst = NULL, int dstPitch = 0, const lvRect * rect = NULL );
     virtual void DrawLine(int x0, int y0, int x1, int y1, lUInt32 color0, int length1, int length2, int direction=0);
 };
 
@@ -547,6 +637,10 @@ public:
     virtual ~LVColorDrawBuf();
     /// convert to 1-bit bitmap
     void ConvertToBitmap(bool flgDither);
+    /// rotates buffer contents into external buffer (e.g. framebuffer) with dstPitch bytes per row, leaving this buffer unchanged
+    bool RotateTo( cr_rotate_angle_t angle, lUInt8 * dst, int dstPitch ) const;
+    /// quantize 32 bpp buffer to packed 1, 2 or 4 bpp gray into dst (see QuantizeToGray())
+    bool Quantize( int bpp, DrawBufDitherMode mode, lUInt8 * dst, int dstPitch, const lvRect * rect = NULL );
     /// draw line
     virtual void DrawLine(int x0, int y0, int x1, int y1, lUInt32 color0, int length1=1, int length2=0, int direction=0);
 #if !defined(__SYMBIAN32__) && defined(_WIN32) && !defined(QT_GL)
@@ -679,6 +773,110 @@ public:
     virtual lUInt8 * GetScanLine( int y ) const { return 0; }
 };
 
+class LVRecordedImage;
+
+/// Drawing calls recorder
+/// Stands for a target buffer (same size, depth and state) while drawing code runs, and
+/// records the drawing calls with their clip rectangle, to replay them later into
+/// horizontal bands of the target, possibly concurrently (see DrawDocumentInBands()).
+/// Glyph bitmaps are copied. Images are decoded (and smooth scaled) once, keeping the
+/// lines bands need: by the replaying threads (decodeImage()) when they can be decoded
+/// from a copy of their data, else while recording. Replaying draws exactly the same
+/// pixels as direct drawing. Calls that can't be replayed this way (Clear(), pixel reads,
+/// nine-patch images...) make the recording not replayable: draw directly instead.
+class LVRecordingDrawBuf : public LVBaseDrawBuf
+{
+private:
+    enum {
+        CMD_FILL_RECT,
+        CMD_FILL_RECT_PATTERN,
+        CMD_INVERT_RECT,
+        CMD_DRAW_LINE,
+        CMD_DRAW_BITMAP,
+        CMD_DRAW_IMAGE
+    };
+    struct Command {
+        int type;
+        lvRect clip;     // clip rectangle when recorded
+        lvRect rc;       // rectangle, line ends, or bitmap/image position and size (right, bottom)
+        lUInt32 color0;  // fill or line color, or glyph text color
+        lUInt32 color1;  // second pattern color, or glyph palette color
+        int param0;      // pattern bytes, line lengths, bitmap data offset, or image index
+        int param1;
+        int param2;      // line direction, or image/bitmap flags
+    };
+    LVArray<Command> _commands;
+    LVArray<lUInt8> _bitmaps;
+    LVPtrVector<LVRecordedImage> _images;
+    int _bpp;
+    lUInt32 _whiteColor;
+    lUInt32 _blackColor;
+    int _imageBytes;
+    int _imageBytesLimit;
+    mutable bool _replayable;
+    /// adds command unless its rectangle is out of clip
+    bool addCommand( int type, const lvRect & clip, int x0, int y0, int x1, int y1, lUInt32 color0 = 0, lUInt32 color1 = 0,
+                     int param0 = 0, int param1 = 0, int param2 = 0 );
+public:
+    /// false if some drawing call couldn't be recorded
+    bool isReplayable() const { return _replayable; }
+    /// number of recorded drawing calls
+    int getCommandCount() const { return _commands.length(); }
+    /// number of recorded images (one per image drawing call)
+    int getImageCount() const { return _images.length(); }
+    /// creates sources for the images drawn in band, for Replay(); to be called from recording thread,
+    /// as image source objects can't be shared by threads
+    void getBandImages( const lvRect & band, LVArray<LVImageSourceRef> & images ) const;
+    /// true if image index is left to replaying threads: decodeImage() is to decode it
+    bool isDeferredImage( int index ) const;
+    /// gets indexes of the images drawn in band that decodeImage() is to decode before Replay()
+    void getBandDeferredImages( const lvRect & band, LVArray<int> & indexes ) const;
+    /// decodes an image left to replaying threads, for all bands drawing it; to be called once,
+    /// from any thread, before replaying these bands
+    void decodeImage( int index ) const;
+    /// draws recorded calls into buf, a buffer of same size and depth as the target, limited to band
+    void Replay( LVBaseDrawBuf & buf, const lvRect & band, LVArray<LVImageSourceRef> & images ) const;
+
+    virtual int GetBitsPerPixel() const { return _bpp; }
+    virtual lUInt32 GetWhiteColor() const { return _whiteColor; }
+    virtual lUInt32 GetBlackColor() const { return _blackColor; }
+    virtual void FillRect( int x0, int y0, int x1, int y1, lUInt32 color );
+    virtual void FillRectPattern( int x0, int y0, int x1, int y1, lUInt32 color0, lUInt32 color1, const lUInt8 * __restrict pattern );
+    virtual void InvertRect( int x0, int y0, int x1, int y1 );
+    virtual void DrawLine( int x0, int y0, int x1, int y1, lUInt32 color0, int length1=1, int length2=0, int direction=0 );
+    virtual void Draw( int x, int y, const lUInt8 * bitmap, int width, int height, const lUInt32 * __restrict palette );
+    virtual void Draw( LVImageSourceRef img, int x, int y, int width, int height, bool dither );
+
+    // Calls that can't be replayed into bands
+    virtual void Clear( lUInt32 color ) { CR_UNUSED(color); _replayable = false; }
+    virtual void Invert() { _replayable = false; }
+    virtual void Rotate( cr_rotate_angle_t angle ) { CR_UNUSED(angle); _replayable = false; }
+    virtual void Resize( int dx, int dy ) { CR_UNUSED2(dx, dy); _replayable = false; }
+    virtual lUInt32 GetPixel( int x, int y ) const { CR_UNUSED2(x, y); _replayable = false; return 0; }
+    virtual lUInt32 GetAvgColor( lvRect & rc16 ) const { CR_UNUSED(rc16); _replayable = false; return 0; }
+    virtual lUInt32 GetInterpolatedColor( int x16, int y16 ) const { CR_UNUSED2(x16, y16); _replayable = false; return 0; }
+    virtual lUInt8 * GetScanLine( int y ) const { CR_UNUSED(y); _replayable = false; return NULL; }
+    virtual void DrawTo( LVDrawBuf * __restrict buf, int x, int y, int options, const lUInt32 * __restrict palette ) {
+        CR_UNUSED5(buf, x, y, options, palette);
+        _replayable = false;
+    }
+    virtual void DrawOnTop( LVDrawBuf * __restrict buf, int x, int y ) { CR_UNUSED3(buf, x, y); _replayable = false; }
+    virtual void DrawRescaled( const LVDrawBuf * __restrict src, int x, int y, int dx, int dy, int options ) {
+        CR_UNUSED6(src, x, y, dx, dy, options);
+        _replayable = false;
+    }
+#if !defined(__SYMBIAN32__) && defined(_WIN32) && !defined(QT_GL)
+    virtual void DrawTo( HDC dc, int x, int y, int options, const lUInt32 * __restrict palette ) {
+        CR_UNUSED5(dc, x, y, options, palette);
+        _replayable = false;
+    }
+#endif
+
+    /// creates recorder for drawing into target, taking its size, depth, clip, colors and drawing options
+    explicit LVRecordingDrawBuf( LVDrawBuf & target );
+    virtual ~LVRecordingDrawBuf();
+};
+
 // This is to be used as the buffer provided to font->DrawTextString(). We based it
 // on LVInkMeasurementDrawBuf just so that we don't have to redefine all the methods,
 // even if none of them will be used (FillRect might be called when drawing underlines,
@@ -34,12 +34,11 @@ extern "C" {
 }
 #endif
 
-#if USE_GLYPHCACHE_HASHTABLE==1
-#include "lvhashtable.h"
-#define GLYPHCACHE_TABLE_SZ         256
-#endif
+#include <atomic>
 
 struct LVFontGlyphCacheItem;
+struct LVFontGlyphCachePage;
+class LVFontLocalGlyphCache;
 
 union GlyphCacheItemData {
 	lChar32 ch;
@@ -48,43 +47,105 @@ union GlyphCacheItemData {
 #endif
 };
 
-#if USE_GLYPHCACHE_HASHTABLE == 1
-inline lUInt32 getHash(GlyphCacheItemData data)
-{
-    return getHash(*((lUInt32*)&data));
-}
-
-// Note: this may cause some issue when building on Win32 (or anywhere lChar32
-// is not 32bits), see https://github.com/buggins/coolreader/pull/117
-inline bool operator==(GlyphCacheItemData data1, GlyphCacheItemData data2)
-{
-    return (*((lUInt32*)&data1)) == (*((lUInt32*)&data2));
-}
-#endif
-
+/// Glyph bitmaps are packed into pages (slabs) owned by a local (per font
+/// instance) cache: glyphs are never freed one by one, only whole pages
+/// are, when the global cache needs room.
+/// The global cache budget is accounted in bytes of allocated pages, and
+/// the least recently used page is evicted first. Pages used since the
+/// last glyph allocation are never evicted, so glyphs just got from a
+/// font stay valid while another glyph is being made.
+/// Evicted pages and replaced glyph index tables are retired: their memory
+/// is only freed when no thread is inside a LVFontGlyphCacheReadSection,
+/// so glyphs got by other threads inside one stay valid.
 class LVFontGlobalGlyphCache
 {
 private:
-    LVFontGlyphCacheItem * head;
-    LVFontGlyphCacheItem * tail;
+    LVFontGlyphCachePage * head;
+    LVFontGlyphCachePage * tail;
     int size;
     int max_size;
-    void removeNoLock( LVFontGlyphCacheItem * item );
-    void putNoLock( LVFontGlyphCacheItem * item );
+    std::atomic<lUInt32> clock; // page use stamp, incremented on each glyph allocation
+    std::atomic<int> readers;   // threads inside a LVFontGlyphCacheReadSection
+    LVArray<void *> retired;    // malloc'ed blocks to free when there is no reader
+    void removeNoLock( LVFontGlyphCachePage * page );
+    void freeRetiredNoLock();
 public:
     LVFontGlobalGlyphCache( int maxSize )
-        : head(NULL), tail(NULL), size(0), max_size(maxSize )
+        : head(NULL), tail(NULL), size(0), max_size(maxSize ), clock(1), readers(0)
     {
     }
     ~LVFontGlobalGlyphCache()
     {
         clear();
+        freeRetiredNoLock();
     }
-    void put( LVFontGlyphCacheItem * item );
-    void remove( LVFontGlyphCacheItem * item );
-#if USE_GLYPHCACHE_HASHTABLE != 1
-    void refresh( LVFontGlyphCacheItem * item );
-#endif
+    void enterReader();
+    /// frees retired blocks when the last reader leaves
+    void leaveReader();
+    /// frees a malloc'ed block, now if there is no reader, or when the last one leaves
+    void retire( void * block );
+    /// returns the number of retired blocks not yet freed
+    int getRetiredCount() const { return retired.length(); }
+    /// current use stamp, to be set on pages when their glyphs are used
+    lUInt32 getClock() const { return clock.load(std::memory_order_relaxed); }
+    /// advance use stamp (after a glyph allocation)
+    void tick() { clock.fetch_add(1, std::memory_order_relaxed); }
+    /// evict least recently used pages to make room for a new page of pageSize bytes
+    void reserve( int pageSize );
+    void put( LVFontGlyphCachePage * page );
+    void remove( LVFontGlyphCachePage * page );
+    /// returns bytes allocated for pages
+    int getSize() const { return size; }
+    void clear();
+};
+
+struct LVFontGlyphCachePage
+{
+    LVFontGlyphCachePage * prev_global;
+    LVFontGlyphCachePage * next_global;
+    LVFontGlyphCachePage * next_local;
+    LVFontLocalGlyphCache * local_cache;
+    std::atomic<lUInt32> last_used; // global cache clock when last used
+    int size; // bytes allocated (header included)
+    int used; // bytes used in data
+    alignas(16) lUInt8 data[1];
+    //=======================================================================
+    int capacity() const { return size - (int)offsetof(LVFontGlyphCachePage, data); }
+    void touch( lUInt32 stamp ) {
+        // avoid writing to a shared cache line when already up to date
+        if ( last_used.load(std::memory_order_relaxed) != stamp )
+            last_used.store(stamp, std::memory_order_relaxed);
+    }
+};
+
+/// Open addressing glyph index of a local cache: readers don't take any
+/// lock (but must be inside a LVFontGlyphCacheReadSection), writers (put,
+/// page removal, clear) are serialized by the caller.
+/// Growing publishes a new table, the old one being retired to the global
+/// cache, as readers may still be walking it. When only removed item slots
+/// fill the table, it is rebuilt in place: readers may then miss a glyph,
+/// which will just be rendered again.
+class LVFontGlyphIndex
+{
+private:
+    struct Table {
+        lUInt32 mask;
+        std::atomic<LVFontGlyphCacheItem*> slots[1];
+    };
+    LVFontGlobalGlyphCache * global_cache;
+    std::atomic<Table*> table;
+    int count;   // items in current table
+    int deleted; // removed item slots in current table
+    static Table * newTable( lUInt32 size );
+    static inline lUInt32 slotOf( lUInt32 key, lUInt32 mask ) { return (key * 2654435761U) & mask; }
+    static void insert( Table * t, LVFontGlyphCacheItem * item );
+    void rebuild();
+public:
+    LVFontGlyphIndex( LVFontGlobalGlyphCache * globalCache ) : global_cache(globalCache), table(NULL), count(0), deleted(0) { }
+    ~LVFontGlyphIndex() { clear(); }
+    LVFontGlyphCacheItem * get( lUInt32 key ) const;
+    void put( lUInt32 key, LVFontGlyphCacheItem * item );
+    void removePage( LVFontGlyphCachePage * page );
     void clear();
 };
 
@@ -92,21 +153,12 @@ class LVFontLocalGlyphCache
 {
 private:
     LVFontGlobalGlyphCache *global_cache;
-#if USE_GLYPHCACHE_HASHTABLE == 1
-    LVHashTable<GlyphCacheItemData, struct LVFontGlyphCacheItem*> hashTable;
-#else
-    LVFontGlyphCacheItem * head;
-    LVFontGlyphCacheItem * tail;
-#endif
-    //int size;
+    LVFontGlyphIndex index;
+    LVFontGlyphCachePage * pages; // most recently allocated first
+    int next_page_size;
 public:
     LVFontLocalGlyphCache( LVFontGlobalGlyphCache * globalCache )
-    : global_cache(globalCache),
-#if USE_GLYPHCACHE_HASHTABLE == 1
-    hashTable(GLYPHCACHE_TABLE_SZ)
-#else
-    head(NULL), tail(NULL)
-#endif
+    : global_cache(globalCache), index(globalCache), pages(NULL), next_page_size(0)
     {}
     ~LVFontLocalGlyphCache()
     {
@@ -117,17 +169,28 @@ public:
     #if USE_HARFBUZZ==1
     LVFontGlyphCacheItem * getByIndex(lUInt32 index);
     #endif
+    /// allocate glyph item storage in current page, or in a new one
+    LVFontGlyphCacheItem * alloc( int itemSize );
     void put( LVFontGlyphCacheItem * item );
-    void remove( LVFontGlyphCacheItem * item );
+    /// forget all items of page and retire it (page must have been removed from global cache)
+    void removePage( LVFontGlyphCachePage * page );
+    LVFontGlobalGlyphCache * getGlobalCache() { return global_cache; }
+};
+
+/// Glyph items got from fonts (LVFont::getGlyph()) by the calling thread stay
+/// valid until it leaves this section, even if their pages are evicted by
+/// another thread meanwhile. Sections may be nested.
+class LVFontGlyphCacheReadSection
+{
+    LVFontGlobalGlyphCache * _cache;
+public:
+    LVFontGlyphCacheReadSection( LVFontGlobalGlyphCache * cache ) : _cache(cache) { _cache->enterReader(); }
+    ~LVFontGlyphCacheReadSection() { _cache->leaveReader(); }
 };
 
 struct LVFontGlyphCacheItem
 {
-    LVFontGlyphCacheItem * prev_global;
-    LVFontGlyphCacheItem * next_global;
-    LVFontGlyphCacheItem * prev_local;
-    LVFontGlyphCacheItem * next_local;
-    LVFontLocalGlyphCache * local_cache;
+    LVFontGlyphCachePage * page;
     GlyphCacheItemData data;
     lUInt16 bmp_width;
     lUInt16 bmp_height;
@@ -138,6 +201,7 @@ struct LVFontGlyphCacheItem
     //       This is usually 16 on 64-bit and 8 otherwise (c.f., https://www.gnu.org/software/libc/manual/html_node/Aligned-Memory-Blocks.html).
     //       It's also 16 on x86 on recent glibcs (c.f., https://sourceware.org/bugzilla/show_bug.cgi?id=21120).
     //       We just use 16 everywhere, as this turned out to be mildly helpful on armv7 (c.f., https://github.com/koreader/crengine/pull/441).
+    //       Items are allocated in pages at 16 bytes aligned offsets, so this holds there too.
     alignas(16) lUInt8 bmp[1];
     //=======================================================================
     int getSize() const
@@ -149,27 +213,22 @@ struct LVFontGlyphCacheItem
     }
     static LVFontGlyphCacheItem * newItem( LVFontLocalGlyphCache * local_cache, lChar32 ch, int w, int h )
     {
-        LVFontGlyphCacheItem * item = (LVFontGlyphCacheItem *)malloc( offsetof(LVFontGlyphCacheItem, bmp)
+        LVFontGlyphCacheItem * item = local_cache->alloc( offsetof(LVFontGlyphCacheItem, bmp)
                                                                         + ((w*h) * sizeof(*bmp)) );
-	if (item) {
-	    item->data.ch = ch;
-	    item->bmp_width = (lUInt16)w;
-	    item->bmp_height = (lUInt16)h;
-	    item->origin_x =   0;
-	    item->origin_y =   0;
-	    item->advance =    0;
-	    item->prev_global = NULL;
-	    item->next_global = NULL;
-	    item->prev_local = NULL;
-	    item->next_local = NULL;
-	    item->local_cache = local_cache;
+        if (item) {
+            item->data.ch = ch;
+            item->bmp_width = (lUInt16)w;
+            item->bmp_height = (lUInt16)h;
+            item->origin_x =   0;
+            item->origin_y =   0;
+            item->advance =    0;
         }
         return item;
     }
     #if USE_HARFBUZZ==1
     static LVFontGlyphCacheItem *newItem(LVFontLocalGlyphCache* local_cache, lUInt32 glyph_index, int w, int h)
     {
-        LVFontGlyphCacheItem * item = (LVFontGlyphCacheItem *)malloc( offsetof(LVFontGlyphCacheItem, bmp)
+        LVFontGlyphCacheItem * item = local_cache->alloc( offsetof(LVFontGlyphCacheItem, bmp)
                                                                         + ((w*h) * sizeof(*bmp)) );
         if (item) {
             item->data.gindex = glyph_index;
@@ -178,24 +237,26 @@ struct LVFontGlyphCacheItem
             item->origin_x = 0;
             item->origin_y = 0;
             item->advance = 0;
-            item->prev_global = NULL;
-            item->next_global = NULL;
-            item->prev_local = NULL;
-            item->next_local = NULL;
-            item->local_cache = local_cache;
         }
         return item;
     }
     #endif
-    static void freeItem( LVFontGlyphCacheItem * item )
-    {
-        if (item)
-            free( item );
-    }
 };
 
 #if USE_HARFBUZZ==1
 bool isHBScriptCursive( hb_script_t script );
+
+/// HarfBuzz shaping cache statistics, for all fonts
+typedef struct {
+    lUInt64 hits;
+    lUInt64 misses;
+    lUInt64 evictions;
+    lUInt64 shaping_ns; ///< time spent in hb_shape() on misses
+} LVShapingCacheStats;
+/// set max number of glyphs kept by each font HarfBuzz shaping cache (0 to disable)
+void setHarfBuzzShapingCacheSize( int glyphs );
+/// get HarfBuzz shaping cache statistics (time saved ~ hits * shaping_ns / misses)
+LVShapingCacheStats getHarfBuzzShapingCacheStats( bool reset=false );
 #endif
 
 enum hinting_mode_t {
@@ -376,6 +437,7 @@ enum glyph_extra_metric_t
 class LVDrawBuf;
 class SVGGlyphsCollector;
 class LVFont;
+class CRThreadPool;
 
 typedef LVProtectedFastRef<LVFont> LVFontRef;
 
@@ -405,6 +467,11 @@ public:
     /// hyphen width
     virtual int getHyphenWidth() { return getCharWidth( getHyphChar() ); }
 
+    /// returns true if this font has glyphs for all chars of text and its hyphen, so
+    /// measuring it won't involve another font (and can be done on a text measuring
+    /// thread, see FONT_MEASURE_GUARD)
+    virtual bool hasGlyphs( const lChar32 * text, int len ) { CR_UNUSED2(text, len); return false; }
+
     /**
      * Max width of -/./,/!/? to use for visial alignment by width
      */
@@ -462,9 +529,18 @@ public:
     /** \brief get glyph item
         \param code is unicode character
         \return glyph pointer if glyph was found, NULL otherwise
+        (when other threads may use fonts, only valid inside a LVFontGlyphCacheReadSection)
     */
     virtual LVFontGlyphCacheItem * getGlyph(lUInt32 ch, lChar32 def_char=0, bool is_fallback=false) = 0;
 
+    /// queue on pool (in at most maxTasks tasks) the rasterization of the glyphs of chars
+    /// not yet in glyph cache, without waiting for it (see LVFontManager::PrerenderGlyphs()):
+    /// the font keeps being usable, and waits for these tasks before changing how glyphs
+    /// are rendered or being destroyed
+    virtual void prerenderGlyphs( const lChar32 * chars, int count, CRThreadPool * pool, int maxTasks ) {
+        CR_UNUSED3(chars, count, pool); CR_UNUSED(maxTasks);
+    }
+
     /// returns font baseline offset
     virtual int getBaseline() = 0;
     /// returns font height including normal interline space
@@ -522,6 +598,11 @@ public:
     /// returns current hinting mode
     virtual hinting_mode_t  getHintingMode() const { return HINTING_MODE_AUTOHINT; }
 
+    /// sets number of subpixel glyph positions (1, 2 or 4), used with KERNING_MODE_HARFBUZZ
+    virtual void setSubpixelPositioning( int /*phases*/ ) { }
+    /// returns number of subpixel glyph positions (1: glyphs at whole pixels)
+    virtual int getSubpixelPositioning() const { return 1; }
+
     /// clear cache
     virtual void clearCache() { }
 
@@ -556,6 +637,29 @@ public:
     virtual LVFontRef getBulletListItemFont() { return LVFontRef(this); }
 };
 
+/// set of (font, char) pairs met in formatted text, to have their glyphs
+/// rasterized ahead of drawing with LVFontManager::PrerenderGlyphs()
+class LVFontGlyphSet
+{
+public:
+    class Entry {
+    public:
+        LVFontRef font;
+        LVArray<lChar32> chars; // may have duplicates
+        Entry( LVFont * f ) : font(f) { }
+    };
+private:
+    LVPtrVector<Entry> _entries;
+    Entry * _last;
+public:
+    LVFontGlyphSet() : _last(NULL) { }
+    /// add chars of text drawn with font (spaces and control chars are skipped)
+    void add( LVFont * font, const lChar32 * text, int len );
+    int length() const { return _entries.length(); }
+    Entry * get( int index ) { return _entries[index]; }
+    void clear() { _entries.clear(); _last = NULL; }
+};
+
 enum font_antialiasing_t
 {
     font_aa_none,
@@ -646,6 +750,18 @@ public:
     /// clear glyph cache
     virtual void clearGlyphCache() { }
 
+    /// set number of threads used to rasterize glyphs before drawing formatted text
+    /// (0 or 1: glyphs are rasterized one by one when drawn)
+    virtual void SetGlyphPrerenderThreads( int threads ) { CR_UNUSED(threads); }
+    /// get number of threads used to rasterize glyphs before drawing formatted text
+    virtual int GetGlyphPrerenderThreads() { return 0; }
+    /// queue the rasterization of the glyphs of this set not yet in glyph cache on worker
+    /// threads, and return without waiting for it: glyphs are put in the glyph cache as
+    /// they are ready, and the ones drawn before are rasterized by the drawing thread
+    virtual void PrerenderGlyphs( LVFontGlyphSet & glyphs ) { CR_UNUSED(glyphs); }
+    /// wait for the glyphs queued by PrerenderGlyphs() to be rasterized
+    virtual void WaitGlyphPrerendering() { }
+
     /// get antialiasing mode
     virtual int GetAntialiasMode() { return _antialiasMode; }
     /// set antialiasing mode
@@ -700,6 +816,12 @@ public:
     /// returns current hinting mode
     virtual hinting_mode_t  GetHintingMode() { return HINTING_MODE_AUTOHINT; }
 
+    /// sets number of horizontal subpixel positions glyphs are rendered at (1, 2 or 4), with
+    /// KERNING_MODE_HARFBUZZ: each position is a distinct glyph cache entry (1: whole pixels)
+    virtual void SetSubpixelPositioning( int /*phases*/ ) { }
+    /// returns number of horizontal subpixel positions glyphs are rendered at
+    virtual int GetSubpixelPositioning() { return 1; }
+
     virtual bool SetAlias(lString8 alias,lString8 facename,int id,bool bold,bool italic){ return false;}
 
     /// set as preferred font with the given bias to add in CalcMatch algorithm
@@ -61,6 +61,9 @@ public:
     virtual bool OnLineDecoded( LVImageSource * obj, int y, lUInt32 * __restrict data ) = 0;
     virtual void OnEndDecode( LVImageSource * obj, bool errors ) = 0;
     virtual bool GetTargetSize(int & width, int & height) const { return false; };
+    /// called before OnStartDecode() by decoders able to decode at a reduced size, not smaller
+    /// than GetTargetSize(): return true to get lines of this size instead of the image size
+    virtual bool OnReducedSize(int width, int height) { return false; }
 };
 
 struct CR9PatchInfo {
@@ -121,6 +124,9 @@ LVImageSourceRef LVCreateStreamImageSource( LVStreamRef stream, ldomDocument * d
 LVImageSourceRef LVCreateFileCopyImageSource( lString32 fname );
 /// creates image source as memory copy of stream contents
 LVImageSourceRef LVCreateStreamCopyImageSource( LVStreamRef stream );
+/// creates image source decoding a memory copy of the stream srcImage decodes from, so that it
+/// can be decoded by another thread (NULL if srcImage isn't decoded from a stream, or its copy fails)
+LVImageSourceRef LVCreateImageSourceCopy( LVImageSourceRef srcImage );
 /// creates decoded memory copy of image, if it's unpacked size is less than maxSize (8 bit gray or 32 bit color)
 LVImageSourceRef LVCreateUnpackedImageSource( LVImageSourceRef srcImage, int maxSize = 80*80*4, bool gray=false );
 /// creates decoded memory copy of image, if it's unpacked size is less than maxSize; bpp: 8,16,32 supported
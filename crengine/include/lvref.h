@@ -23,6 +23,9 @@
 #include "lvmemman.h"
 #include "crlocks.h"
 #include "lvautoptr.h"
+#if (USE_ATOMIC_REFCOUNT==1)
+#include <atomic>
+#endif
 
 /// Memory manager pool for ref counting
 /**
@@ -32,19 +35,55 @@
 extern ldomMemManStorage * pmsREF;
 #endif
 
+/// Reference counter value
+/**
+    Plain int by default. With USE_ATOMIC_REFCOUNT=1, an atomic int, so that
+    references to the same object can be taken and dropped from several threads.
+    Taking a reference needs no ordering (it is made from an existing one), dropping
+    one is acq_rel so that any use of the object through other references happens
+    before its deletion.
+    Copying (ie. when copying a whole css_style_rec_t) copies the value, as with an int.
+*/
+class ref_count_t {
+#if (USE_ATOMIC_REFCOUNT==1)
+    std::atomic<int> _value;
+public:
+    ref_count_t( int value ) : _value(value) { }
+    ref_count_t( const ref_count_t & v ) : _value(v.get()) { }
+    ref_count_t & operator = ( const ref_count_t & v ) { _value.store(v.get(), std::memory_order_relaxed); return *this; }
+    /// increments counter
+    void inc() { _value.fetch_add(1, std::memory_order_relaxed); }
+    /// decrements counter, returns new value
+    int dec() { return _value.fetch_sub(1, std::memory_order_acq_rel) - 1; }
+    /// returns current value
+    int get() const { return _value.load(std::memory_order_relaxed); }
+#else
+    int _value;
+public:
+    ref_count_t( int value ) : _value(value) { }
+    /// increments counter
+    void inc() { _value++; }
+    /// decrements counter, returns new value
+    int dec() { return --_value; }
+    /// returns current value
+    int get() const { return _value; }
+#endif
+};
+
 /// Reference counter structure
 /**
     For internal usage in LVRef<> class
 */
 class ref_count_rec_t {
 public:
-    int _refcount;
+    ref_count_t _refcount;
     void * _obj;
     static ref_count_rec_t null_ref;
     static ref_count_rec_t protected_null_ref;
 
     ref_count_rec_t( void * obj ) : _refcount(1), _obj(obj) { }
-#if (LDOM_USE_OWN_MEM_MAN==1)
+// (the memory manager pool is not thread safe: not used with atomic counters)
+#if (LDOM_USE_OWN_MEM_MAN==1) && (USE_ATOMIC_REFCOUNT!=1)
     void * operator new( size_t )
     {
         if (pmsREF == NULL)
@@ -63,12 +102,12 @@ public:
 /// sample ref counter implementation for LVFastRef
 class LVRefCounter
 {
-    int refCount;
+    ref_count_t refCount;
 public:
     LVRefCounter() : refCount(0) { }
-    void AddRef() { refCount++; }
-    int Release() { return --refCount; }
-    int getRefCount() { return refCount; }
+    void AddRef() { refCount.inc(); }
+    int Release() { return refCount.dec(); }
+    int getRefCount() { return refCount.get(); }
 };
 
 /// Fast smart pointer with reference counting
@@ -370,11 +409,11 @@ template <class T> class LVRef
 private:
     ref_count_rec_t * _ptr;
     //========================================
-    ref_count_rec_t * AddRef() const { ++_ptr->_refcount; return _ptr; } // NOLINT(clang-analyzer-cplusplus.NewDelete)
+    ref_count_rec_t * AddRef() const { _ptr->_refcount.inc(); return _ptr; } // NOLINT(clang-analyzer-cplusplus.NewDelete)
     //========================================
     void Release()
     { 
-        if (--_ptr->_refcount == 0) // NOLINT(clang-analyzer-cplusplus.NewDelete)
+        if (_ptr->_refcount.dec() == 0) // NOLINT(clang-analyzer-cplusplus.NewDelete)
         {
             if (_ptr != &ref_count_rec_t::null_ref)
             {
@@ -397,7 +436,7 @@ public:
 
     /// Default constructor.
     /** Initializes pointer to NULL */
-    LVRef() : _ptr(&ref_count_rec_t::null_ref) { ref_count_rec_t::null_ref._refcount++; }
+    LVRef() : _ptr(&ref_count_rec_t::null_ref) { ref_count_rec_t::null_ref._refcount.inc(); }
 
     /// Constructor by object pointer.
     /** Initializes pointer to given value 
@@ -410,7 +449,7 @@ public:
         }
         else
         {
-            ref_count_rec_t::null_ref._refcount++;
+            ref_count_rec_t::null_ref._refcount.inc();
             _ptr = &ref_count_rec_t::null_ref;
         }
     }
@@ -427,7 +466,7 @@ public:
 
     /// Clears pointer.
     /** Sets object pointer to NULL. */
-    void Clear() { Release(); _ptr = &ref_count_rec_t::null_ref; ++_ptr->_refcount; }
+    void Clear() { Release(); _ptr = &ref_count_rec_t::null_ref; _ptr->_refcount.inc(); }
 
     /// Copy operator.
     /** Duplicates a pointer from specified reference. 
@@ -487,7 +526,7 @@ public:
     /** It might be useful in some cases. 
         \return reference counter value.
     */
-    int getRefCount() const { return _ptr->_refcount; }
+    int getRefCount() const { return _ptr->_refcount.get(); }
 
     /// Returns stored pointer to object.
     /** Usual way to get pointer value. 
@@ -161,6 +161,13 @@ void copystyle( css_style_ref_t sourcestyle, css_style_ref_t deststyle );
 void DrawDocument( LVDrawBuf & drawbuf, ldomNode * node, int x0, int y0, int dx, int dy, int doc_x, int doc_y,
                    int page_height, ldomMarkedRangeList * marks, ldomMarkedRangeList * bookmarks = NULL,
                    bool draw_content=true, bool draw_background=true, bool skip_initial_borders=false );
+/// draws formatted document as DrawDocument(), sharing the pixel work between LVRendGetDrawThreads()
+/// threads, each drawing a horizontal band of the buffer (falls back to DrawDocument() when not possible)
+void DrawDocumentInBands( LVDrawBuf & drawbuf, ldomNode * node, int x0, int y0, int dx, int dy, int doc_x, int doc_y,
+                          int page_height, ldomMarkedRangeList * marks, ldomMarkedRangeList * bookmarks = NULL );
+/// adds to glyphs the text that DrawDocument() would draw from doc_y with height dy,
+/// for it to be prerendered (see LVFontManager::PrerenderGlyphs())
+void CollectDocumentGlyphs( ldomNode * node, int doc_y, int dy, LVFontGlyphSet & glyphs, bool want_hidden=false );
 
 // Estimate width of node when rendered:
 //   maxWidth: width if it would be rendered on an infinite width area
@@ -176,6 +183,10 @@ void getRenderedWidths(ldomNode * node, int &maxWidth, int &minWidth, int direct
 void LVRendSetBaseFontWeight(int weight);
 int LVRendGetBaseFontWeight();
 
+// Set/get number of threads drawing pages with DrawDocumentInBands() (0 or 1: no concurrency).
+void LVRendSetDrawThreads(int threads);
+int LVRendGetDrawThreads();
+
 int measureBorder(ldomNode *enode,int border);
 int lengthToPx( ldomNode *node, css_length_t val, int base_px, int base_em = -1, bool unspecified_as_em=false );
 int scaleForRenderDPI( int value );
@@ -232,6 +243,13 @@ extern int gRootFontSize;
 #define BLOCK_RENDERING_COMPLETE_INCOMPLETE_TABLES         0x02000000 // Add anonymous missing elements to a table without proper
                                                                       // children and table-cells without proper parents
 
+// Tables
+#define BLOCK_RENDERING_STREAM_LARGE_TABLES                0x80000000 // Lay out tables with many rows and no rowspan/colspan in
+                                                                      // batches of rows, with column widths computed from a sample
+                                                                      // of their rows (faster and bounded memory, but content in
+                                                                      // other rows may overflow its cell).
+                                                                      // Not included in FULL_FEATURED.
+
 // Enable everything
 #define BLOCK_RENDERING_FULL_FEATURED                      0x7FFFFFFF
 
@@ -75,6 +75,9 @@ enum lvopen_mode_t {
 
 #define LVOM_MASK 7
 #define LVOM_FLAG_SYNC 0x10
+/// for LVMapFileStream() in LVOM_READ mode: private copy-on-write mapping, whose
+/// buffers can be modified (see GetWriteBuffer()) without changing the file
+#define LVOM_FLAG_PRIVATE 0x20
 
 class LVContainer;
 class LVStream;
@@ -124,7 +124,7 @@ enum css_style_rec_important_bit {
 */
 typedef struct css_style_rec_tag css_style_rec_t;
 struct css_style_rec_tag {
-    int                  refCount; // for reference counting
+    ref_count_t          refCount; // for reference counting
     lUInt32              hash; // cache calculated hash value here
     lUInt32              important[NB_IMP_SLOTS];  // bitmap for !important (used only by LVCssDeclaration)
     lUInt32              importance[NB_IMP_SLOTS]; // bitmap for important bit's importance/origin
@@ -273,9 +273,9 @@ struct css_style_rec_tag {
         background_size[0] = css_length_t(css_val_unspecified, css_generic_auto);
         background_size[1] = css_length_t(css_val_unspecified, css_generic_auto);
     }
-    void AddRef() { refCount++; }
-    int Release() { return --refCount; }
-    int getRefCount() { return refCount; }
+    void AddRef() { refCount.inc(); }
+    int Release() { return refCount.dec(); }
+    int getRefCount() { return refCount.get(); }
     bool serialize( SerialBuf & buf );
     bool deserialize( SerialBuf & buf );
     //  important bitmap management
@@ -468,6 +468,31 @@ public:
                 _extra4!=v._extra4 || _extra5!=v._extra5
                 );
     }
+    /// hash of all fields but the position, which does not change how
+    /// the inner content of an erm_final block is formatted
+    lUInt32 getContentHash() const
+    {
+        lUInt32 h = (lUInt32)_height;
+        h = h * 31 + (lUInt32)(lUInt16)_width;
+        h = h * 31 + (lUInt32)(lUInt16)_inner_width;
+        h = h * 31 + (lUInt32)(lUInt16)_inner_x;
+        h = h * 31 + (lUInt32)(lUInt16)_inner_y;
+        h = h * 31 + (lUInt32)(lUInt16)_baseline;
+        h = h * 31 + (lUInt32)(lUInt16)_usable_left_overflow;
+        h = h * 31 + (lUInt32)(lUInt16)_usable_right_overflow;
+        h = h * 31 + (lUInt32)_top_overflow;
+        h = h * 31 + (lUInt32)_bottom_overflow;
+        h = h * 31 + (lUInt32)_lang_node_idx;
+        h = h * 31 + (lUInt32)_listprop_node_idx;
+        h = h * 31 + (lUInt32)_flags;
+        h = h * 31 + (lUInt32)_extra0;
+        h = h * 31 + (lUInt32)_extra1;
+        h = h * 31 + (lUInt32)_extra2;
+        h = h * 31 + (lUInt32)_extra3;
+        h = h * 31 + (lUInt32)_extra4;
+        h = h * 31 + (lUInt32)_extra5;
+        return h;
+    }
     // Get/Set
     int getX() const { return _x; }
     int getY() const { return _y; }
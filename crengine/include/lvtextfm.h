@@ -516,9 +516,28 @@ public:
 
     void Draw( LVDrawBuf * buf, int x, int y, ldomMarkedRangeList * marks = NULL,  ldomMarkedRangeList *bookmarks = NULL );
 
+    /// add to glyphs the chars of the text that Draw() would draw with a clip from
+    /// top to bottom (relative to the top of this text), for them to be prerendered
+    void collectGlyphs( LVFontGlyphSet & glyphs, int top, int bottom, bool want_hidden=false );
+
     bool isReusable() { return m_pbuffer->is_reusable; }
     void requestLightFormatting() { m_pbuffer->light_formatting = true; }
 
+    /// serialize formatted lines and words, to be restored instead of formatting again
+    /// (returns false when they can't be reused without formatting: floats, inline boxes)
+    bool serializeLines( SerialBuf & buf );
+    /// restore lines serialized from a formatting of the same source text, instead of
+    /// calling Format() with this width (returns false, with no line, if data is invalid)
+    bool deserializeLines( SerialBuf & buf, lUInt16 width, lUInt16 page_height );
+
+    /// returns true if Format() won't need to look at the source nodes (only text,
+    /// without nowrap or extra properties) nor at fallback fonts, so it can be run
+    /// on a text measuring thread (see FONT_MEASURE_GUARD)
+    bool canFormatWithoutNodes();
+    /// returns true if lines and words are the same as the ones of other (used to
+    /// check a formatting made on another thread against a serial one)
+    bool hasSameLines( LFormattedText * other );
+
     LFormattedText() { m_pbuffer = lvtextAllocFormatter( 0 ); }
 
     ~LFormattedText() { lvtextFreeFormatter( m_pbuffer ); }
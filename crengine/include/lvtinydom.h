@@ -376,6 +376,7 @@ class ldomTextStorageChunk
     lUInt16 _index;  /// ? index of chunk in storage
     char _type;       /// type, to show in log
     bool _saved;
+    bool _mapped;     /// _buf points into the cache file mapping (see CacheFile::map())
 
     void setunpacked( const lUInt8 * buf, int bufsize );
     /// pack data, and remove unpacked
@@ -594,6 +595,10 @@ public:
         return true;
     }
 
+    int getMaxAddedLetterSpacingPercent() {
+        return _maxAddedLetterSpacingPercent;
+    }
+
     bool setMaxAddedLetterSpacingPercent(int maxAddedLetterSpacingPercent) {
         if (maxAddedLetterSpacingPercent == _maxAddedLetterSpacingPercent)
             return false;
@@ -2524,6 +2529,173 @@ public:
     }
 };
 
+#if BUILD_LITE!=1
+/// Word break positions found by BreakSALine() for South East Asian text chunks.
+/// Breaks only depend on the chunk text, so they are keyed by a hash of it and
+/// can be reused across paragraphs, re-renderings and cache file reloads.
+class ldomSABreakCache {
+    LVHashTable<lUInt64, lUInt32> _index; // text hash -> offset in _data
+    LVArray<lInt32> _data; // for each entry: break count, then positions relative to chunk start
+    bool _modified;
+    static lUInt64 textHash( const lChar32 * text, int len );
+public:
+    ldomSABreakCache() : _index(256), _modified(false) {}
+    /// returns number of breaks found for this text (positions in breaks), or -1 if not cached
+    int find( const lChar32 * text, int len, const lInt32 * & breaks );
+    /// stores break positions (relative to text start) for this text
+    void add( const lChar32 * text, int len, const LVArray<lInt32> & breaks );
+    int length() { return _index.length(); }
+    void clear();
+    bool isModified() { return _modified; }
+    void setModified( bool modified ) { _modified = modified; }
+    bool serialize( SerialBuf & buf );
+    bool deserialize( SerialBuf & buf );
+};
+
+/// Min and max content widths measured by getRenderedWidths() for table cells,
+/// captions, floats and inline-blocks, so they are not measured again on each
+/// re-rendering or table layout pass. Entries are keyed by node and measuring
+/// parameters, and checked against the node style hash. They are all dropped when
+/// the document rendering hash (styles, fonts, global settings) changes.
+class ldomIntrinsicWidthCache {
+    struct Entry {
+        lUInt32 styleHash;
+        lUInt32 rendFlags;
+        lInt32 params; // direction and ignoreMargin
+        lInt32 maxWidth;
+        lInt32 minWidth;
+        Entry() : styleHash(0), rendFlags(0), params(0), maxWidth(0), minWidth(0) {}
+    };
+    LVHashTable<lUInt64, Entry> _map; // node data index and hash of parameters -> widths
+    lUInt32 _renderingHash;
+    bool _modified;
+    static lUInt64 makeKey( lUInt32 dataIndex, int params, lUInt32 rendFlags ) {
+        return ((lUInt64)dataIndex << 32) | (lUInt32)(rendFlags * 31 + params);
+    }
+    /// drops entries measured for another rendering hash
+    void checkRenderingHash( lUInt32 renderingHash );
+public:
+    ldomIntrinsicWidthCache() : _map(1024), _renderingHash(0), _modified(false) {}
+    /// returns true and widths if measured for these node style and parameters
+    bool find( lUInt32 renderingHash, lUInt32 dataIndex, lUInt32 styleHash, int direction, bool ignoreMargin,
+               int rendFlags, int & maxWidth, int & minWidth );
+    /// stores widths measured for node
+    void add( lUInt32 renderingHash, lUInt32 dataIndex, lUInt32 styleHash, int direction, bool ignoreMargin,
+              int rendFlags, int maxWidth, int minWidth );
+    int length() { return _map.length(); }
+    void clear();
+    bool isModified() { return _modified; }
+    void setModified( bool modified ) { _modified = modified; }
+    bool serialize( SerialBuf & buf );
+    bool deserialize( SerialBuf & buf );
+};
+
+/// Lines and words of final blocks formatted for drawing, saved to the cache file
+/// so that drawing pages after reopening a book needs no shaping nor line breaking.
+/// Entries are checked against the LFormattedText::Format() parameters, and a hash
+/// of the node format record and of the settings not in the document rendering
+/// hash, and dropped when this rendering hash changes. Only the most recently
+/// used ones are kept, up to FORMATTED_LINES_CACHE_MAX_SIZE bytes.
+class ldomFormattedLinesCache {
+public:
+    /// parameters lines were formatted with
+    struct Params {
+        lUInt32 hash;       // node format record and settings not in the rendering hash
+        lInt32 width;
+        lInt32 pageHeight;
+        lInt32 direction;
+        lInt32 usableLeftOverflow;
+        lInt32 usableRightOverflow;
+        Params() : hash(0), width(0), pageHeight(0), direction(0), usableLeftOverflow(0), usableRightOverflow(0) {}
+        bool operator == ( const Params & other ) const {
+            return hash == other.hash && width == other.width && pageHeight == other.pageHeight
+                && direction == other.direction && usableLeftOverflow == other.usableLeftOverflow
+                && usableRightOverflow == other.usableRightOverflow;
+        }
+    };
+private:
+    struct Entry {
+        Params params;
+        lUInt32 stamp;      // last use, to keep the most recently used entries
+        lInt32 height;      // height returned by LFormattedText::Format()
+        lUInt32 size;
+        lUInt8 * data;      // LFormattedText::serializeLines() output
+        Entry() : stamp(0), height(0), size(0), data(NULL) {}
+    };
+    LVHashTable<lUInt32, Entry> _map; // node data index -> lines
+    lUInt32 _renderingHash;
+    lUInt32 _stamp;
+    lUInt32 _totalSize;
+    bool _modified;
+    /// drops entries formatted for another rendering hash
+    void checkRenderingHash( lUInt32 renderingHash );
+    void remove( lUInt32 dataIndex );
+    /// drops least recently used entries until total size is below maxSize
+    void trim( lUInt32 maxSize );
+public:
+    ldomFormattedLinesCache() : _map(1024), _renderingHash(0), _stamp(0), _totalSize(0), _modified(false) {}
+    ~ldomFormattedLinesCache() { clear(); }
+    /// restores into txt (with its source text already added) lines formatted for
+    /// these parameters, returns false if none or invalid
+    bool restore( lUInt32 renderingHash, lUInt32 dataIndex, const Params & params,
+                  LFormattedText * txt, int & height );
+    /// stores lines of txt, just formatted with these parameters, if reusable
+    void add( lUInt32 renderingHash, lUInt32 dataIndex, const Params & params, LFormattedText * txt, int height );
+    int length() { return _map.length(); }
+    void clear();
+    bool isModified() { return _modified; }
+    void setModified( bool modified ) { _modified = modified; }
+    bool serialize( SerialBuf & buf );
+    bool deserialize( SerialBuf & buf );
+};
+
+class CRThreadPool;
+/// Final blocks following the one being formatted during a full rendering, formatted
+/// ahead on worker threads (see setFinalBlockFormattingThreads()). Their source text
+/// is added on the rendering thread, with the format record of the block they follow
+/// (same style and container): their lines are only used if they end up rendered with
+/// the same format record and parameters, and they are formatted again otherwise.
+class ldomFinalBlockFormatQueue {
+    struct Entry {
+        LFormattedTextRef txt;
+        // Format record the source text was added with
+        int fmtWidth;
+        lUInt32 fmtFlags;
+        int langNodeIndex;
+        int listPropNodeIndex;
+        // LFormattedText::Format() parameters
+        int width;
+        int usableLeftOverflow;
+        int usableRightOverflow;
+        bool noClearOwnFloats;
+        int height; // set by the worker
+        volatile bool ready;
+    };
+    LVHashTable<lUInt32, Entry *> _entries; // node data index -> entry
+    CRThreadPool * _pool; // created on first use
+    int _used;
+    int _discarded;
+    /// adds the source text of this final block and queues its formatting, returns false
+    /// if it needs the DOM to be formatted
+    bool add( ldomNode * node, RenderRectAccessor * fmt, int width, BlockFloatFootprint * float_footprint );
+public:
+    ldomFinalBlockFormatQueue() : _entries(64), _pool(NULL), _used(0), _discarded(0) {}
+    ~ldomFinalBlockFormatQueue();
+    /// returns true if final blocks should be formatted ahead
+    bool isEnabled();
+    /// returns true if blocks formatted ahead should be checked against a serial formatting
+    bool isChecking();
+    /// queues formatting of the next sibling final blocks of node having the same style
+    void addFollowing( ldomNode * node, RenderRectAccessor * fmt, int width, BlockFloatFootprint * float_footprint );
+    /// waits for the formatting of this node, if queued: returns false if none, or if
+    /// it was not made for this format record and parameters
+    bool take( ldomNode * node, RenderRectAccessor * fmt, int width, BlockFloatFootprint * float_footprint,
+               LFormattedTextRef & txt, int & height );
+    /// waits for queued formattings and drops them
+    void clear();
+};
+#endif
+
 class ldomDocument : public lxmlDocBase
 {
     friend class ldomDocumentWriter;
@@ -2571,6 +2743,13 @@ private:
 
     StyleSheetCache _styleSheetCache;
 
+#if BUILD_LITE!=1
+    ldomSABreakCache _saBreakCache;
+    ldomIntrinsicWidthCache _intrinsicWidthCache;
+    ldomFormattedLinesCache _formattedLinesCache;
+    ldomFinalBlockFormatQueue _finalBlockFormatQueue;
+#endif
+
 #if BUILD_LITE!=1
     /// load document cache file content
     bool loadCacheFileContent(CacheLoadingCallback * formatCallback, LVDocViewCallback * progressCallback=NULL);
@@ -2623,6 +2802,14 @@ public:
     void registerEmbeddedFonts();
     /// unregister embedded document fonts in font manager, if any exist in document
     void unregisterEmbeddedFonts();
+    /// return document's cache of South East Asian word break positions
+    ldomSABreakCache & getSABreakCache() { return _saBreakCache; }
+    /// return document's cache of min/max content widths
+    ldomIntrinsicWidthCache & getIntrinsicWidthCache() { return _intrinsicWidthCache; }
+    /// return document's cache of formatted lines of final blocks
+    ldomFormattedLinesCache & getFormattedLinesCache() { return _formattedLinesCache; }
+    /// return document's queue of final blocks formatted ahead during rendering
+    ldomFinalBlockFormatQueue & getFinalBlockFormatQueue() { return _finalBlockFormatQueue; }
 #endif
 
     /// returns pointer to TOC root node
@@ -2763,6 +2950,10 @@ public:
         return rerendering_delayed;
     }
     bool partialRender( ldomNode * node );
+    /// returns the number of DocFragments not yet rerendered for the current rendering settings
+    int getPendingPartialRerenderingsCount();
+    /// rerender pending DocFragments, the one containing 'around' first, then its neighbours; returns CR_TIMEOUT if some remain
+    ContinuousOperationResult partialRenderPending( CRTimerUtil & maxTime, ldomNode * around=NULL );
 #endif
     /// create xpointer from pointer string
     ldomXPointer createXPointer( const lString32 & xPointerStr );
@@ -3148,6 +3339,30 @@ void enableCacheFileContentsValidation(bool enable);
 /// pass false to not compress data in cache files
 void compressCachedData(bool enable);
 
+/// number of threads used to compress DOM storage chunks when saving the
+/// cache file (0 or 1: compress them on the calling thread)
+void setCacheFileCompressionThreads(int threads);
+
+/// number of threads used, during a full rendering, to format ahead the plain text final
+/// blocks following the one being rendered with the same style (0 or 1: format them one
+/// after the other); with check, they are also formatted serially, and mismatches logged
+void setFinalBlockFormattingThreads(int threads, bool check=false);
+/// get the number of final blocks formatted ahead and checked against their serial
+/// formatting, and of the ones with different lines, since setFinalBlockFormattingThreads()
+void getFinalBlockFormattingCheckCounts(int & checked, int & mismatches);
+
+/// pass true to store DOM storage chunks uncompressed and page aligned in cache files,
+/// and to use them in place from a memory mapping of the cache file when reopened
+void setCacheFileMappedMode(bool enable);
+
+/// compression level used for cache file blocks (0: zstd or zlib default)
+void setCacheFileCompressionLevel(int level);
+
+/// set zstd dictionary used to compress DOM storage chunks of this type
+/// ('t' text, 'e' elements, 'r' render rects, 's' styles), or remove it if data is NULL;
+/// to be called before opening documents, as it is needed to read back their cache files
+bool setCacheFileCompressionDictionary(char chunkType, const lUInt8 * data, int size);
+
 /// increase the 4 hardcoded TEXT_CACHE_UNPACKED_SPACE, ELEM_CACHE_UNPACKED_SPACE,
 // RECT_CACHE_UNPACKED_SPACE and STYLE_CACHE_UNPACKED_SPACE by this factor
 void setStorageMaxUncompressedSizeFactor(float factor);
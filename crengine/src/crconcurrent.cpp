@@ -9,6 +9,7 @@ CRMutex * _fontManMutex = NULL;
 CRMutex * _fontGlyphCacheMutex = NULL;
 CRMutex * _fontLocalGlyphCacheMutex = NULL;
 CRMutex * _crengineMutex = NULL;
+thread_local bool _fontMeasuringThread = false;
 
 void CRSetupEngineConcurrency() {
     if (!concurrencyProvider) {
@@ -90,3 +91,109 @@ void CRThreadExecutor::stop() {
     }
     _thread->join();
 }
+
+CRThreadPool::CRThreadPool(int threadCount) : _stopped(false), _activeCount(0) {
+    if (!concurrencyProvider || threadCount <= 0)
+        return;
+    _monitor = concurrencyProvider->createMonitor();
+    for (int i = 0; i < threadCount; i++) {
+        Worker * worker = new Worker(this);
+        _workers.add(worker);
+        _threads.add(concurrencyProvider->createThread(worker));
+    }
+    for (int i = 0; i < _threads.length(); i++)
+        _threads[i]->start();
+}
+
+CRThreadPool::~CRThreadPool() {
+    if (!_stopped)
+        stop();
+}
+
+void CRThreadPool::workerLoop() {
+    for (;;) {
+        CRRunnable * task = NULL;
+        {
+            CRGuard guard(_monitor);
+            CR_UNUSED(guard);
+            while (!_stopped && _queue.length() == 0)
+                _monitor->wait();
+            if (_stopped)
+                break;
+            task = _queue.popFront();
+            _activeCount++;
+        }
+        task->run();
+        delete task;
+        {
+            CRGuard guard(_monitor);
+            CR_UNUSED(guard);
+            _activeCount--;
+            _monitor->notifyAll();
+        }
+    }
+}
+
+void CRThreadPool::execute(CRRunnable * task) {
+    if (isSynchronous()) {
+        task->run();
+        delete task;
+        return;
+    }
+    CRGuard guard(_monitor);
+    CR_UNUSED(guard);
+    if (_stopped) {
+        CRLog::error("Ignoring new task since thread pool is stopped");
+        delete task;
+        return;
+    }
+    _queue.pushBack(task);
+    _monitor->notifyAll();
+}
+
+void CRThreadPool::waitAll() {
+    if (isSynchronous())
+        return;
+    CRGuard guard(_monitor);
+    CR_UNUSED(guard);
+    while (!_stopped && (_queue.length() > 0 || _activeCount > 0))
+        _monitor->wait();
+}
+
+void CRThreadPool::notifyDone(volatile bool & flag) {
+    if (isSynchronous()) {
+        flag = true;
+        return;
+    }
+    CRGuard guard(_monitor);
+    CR_UNUSED(guard);
+    flag = true;
+    _monitor->notifyAll();
+}
+
+void CRThreadPool::waitFor(volatile bool & flag) {
+    if (isSynchronous())
+        return;
+    CRGuard guard(_monitor);
+    CR_UNUSED(guard);
+    while (!flag && !_stopped)
+        _monitor->wait();
+}
+
+void CRThreadPool::stop() {
+    if (!isSynchronous()) {
+        {
+            CRGuard guard(_monitor);
+            CR_UNUSED(guard);
+            _stopped = true;
+            while (_queue.length() > 0) {
+                CRRunnable * p = _queue.popFront();
+                delete p;
+            }
+            _monitor->notifyAll();
+        }
+        for (int i = 0; i < _threads.length(); i++)
+            _threads[i]->join();
+    }
+    _stopped = true;
+}
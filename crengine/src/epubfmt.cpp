@@ -1,5 +1,13 @@
 #include "../include/epubfmt.h"
 #include "../include/fb2def.h"
+#include "../include/crconcurrent.h"
+
+// Number of threads used to inflate spine items ahead of the HTML parser
+// (0 to read them sequentially while parsing)
+static int _epubSpinePrefetchThreads = 0;
+void setEpubSpinePrefetchThreads(int threads) {
+    _epubSpinePrefetchThreads = threads > 0 ? threads : 0;
+}
 
 class EpubItem {
 public:
@@ -835,6 +843,11 @@ public:
         return _has_unsupported_encrypted_items;
     }
 
+    bool isEncryptedItem(lString32 name) {
+        encryption_method_t encryption_method;
+        return _encrypted_items.get(name, encryption_method);
+    }
+
     bool open() {
         LVStreamRef stream = _container->OpenStream(U"META-INF/encryption.xml", LVOM_READ);
         if (stream.isNull())
@@ -1203,6 +1216,136 @@ public:
     }
 };
 
+// Reads (inflates) spine items into memory streams on a worker pool, ahead of
+// the parser which still handles them one after another in spine order, so the
+// resulting DOM is the same as when reading them sequentially.
+// (The HTML tokenization itself can't be moved to workers: LVXMLParser asks the
+// writer for text flags, which depend on the styles of the current DOM node.)
+// Zip item streams share their archive's underlying file stream, so each worker
+// opens its own archive on the same file.
+class EpubSpinePrefetcher {
+    class Task : public CRRunnable {
+        EpubSpinePrefetcher * _prefetcher;
+        int _start;
+    public:
+        Task(EpubSpinePrefetcher * prefetcher, int start) : _prefetcher(prefetcher), _start(start) { }
+        virtual void run() { _prefetcher->fetchItems(_start); }
+    };
+    lString32 _path;
+    LVArray<lString32> _names; // empty if item doesn't need reading
+    LVStreamRef * _streams;
+    bool * _failed;
+    volatile bool * _ready;
+    volatile int _wanted;
+    volatile bool _cancelled;
+    int _window;
+    int _threadCount;
+    CRMonitorRef _monitor;
+    CRThreadPool _pool;
+
+    bool canFetch(int index) {
+        return _cancelled || index < _wanted + _window;
+    }
+    void setResult(int index, LVStreamRef & stream, bool failed) {
+        CRGuard guard(_monitor);
+        CR_UNUSED(guard);
+        _streams[index] = stream;
+        _failed[index] = failed;
+        _ready[index] = true;
+        // release our reference while guarded: the parser thread may grab it as soon as we unlock
+        stream.Clear();
+        _monitor->notifyAll();
+    }
+    void fetchItems(int start) {
+        LVContainerRef arc;
+        LVStreamRef file = LVOpenFileStream(_path.c_str(), LVOM_READ);
+        if ( !file.isNull() )
+            arc = LVOpenArchieve(file);
+        for ( int i=start; i<_names.length(); i+=_threadCount ) {
+            if ( _names[i].empty() )
+                continue;
+            {
+                CRGuard guard(_monitor);
+                CR_UNUSED(guard);
+                while ( !canFetch(i) )
+                    _monitor->wait();
+            }
+            LVStreamRef res;
+            bool failed = _cancelled || arc.isNull();
+            if ( !failed ) {
+                LVStreamRef stream = arc->OpenStream(_names[i].c_str(), LVOM_READ);
+                if ( !stream.isNull() ) {
+                    res = LVCreateMemoryStream();
+                    if ( LVPumpStream(res, stream) != stream->GetSize() ) {
+                        res.Clear();
+                        failed = true; // let the parser thread retry with its own archive
+                    }
+                    else
+                        res->SetPos(0);
+                }
+            }
+            setResult(i, res, failed);
+        }
+    }
+public:
+    EpubSpinePrefetcher(lString32 path, LVArray<lString32> & names, int threadCount)
+        : _path(path), _names(names), _wanted(0), _cancelled(false)
+        , _window(threadCount * 4), _threadCount(threadCount), _pool(threadCount)
+    {
+        int n = _names.length();
+        _streams = new LVStreamRef[n];
+        _failed = new bool[n];
+        _ready = new bool[n];
+        for ( int i=0; i<n; i++ ) {
+            _failed[i] = false;
+            _ready[i] = false;
+        }
+        _monitor = concurrencyProvider->createMonitor();
+        for ( int i=0; i<_threadCount; i++ )
+            _pool.execute(new Task(this, i));
+    }
+    ~EpubSpinePrefetcher() {
+        {
+            CRGuard guard(_monitor);
+            CR_UNUSED(guard);
+            _cancelled = true;
+            _monitor->notifyAll();
+        }
+        _pool.waitAll();
+        _pool.stop();
+        delete[] _streams;
+        delete[] _failed;
+        delete[] _ready;
+    }
+    /// returns prefetched stream for item (may be null if it doesn't exist);
+    /// returns false if item should be read by the caller itself
+    bool get(int index, LVStreamRef & stream) {
+        CRGuard guard(_monitor);
+        CR_UNUSED(guard);
+        _wanted = index;
+        _monitor->notifyAll();
+        while ( !_ready[index] )
+            _monitor->wait();
+        stream = _streams[index];
+        _streams[index].Clear();
+        return !_failed[index];
+    }
+    /// returns true if items can be read in parallel from the EPUB file
+    static bool canPrefetch(LVStreamRef stream, int threadCount) {
+#if (LDOM_USE_OWN_MEM_MAN==1)
+        // ref counters are allocated from a pool which is not thread safe
+        CR_UNUSED2(stream, threadCount);
+        return false;
+#else
+        if ( threadCount <= 0 || !concurrencyProvider || !stream->GetName() )
+            return false;
+        // we need to be able to reopen the same file
+        LVStreamRef file = LVOpenFileStream(stream->GetName(), LVOM_READ);
+        return !file.isNull() && file->GetSize() == stream->GetSize();
+#endif
+    }
+};
+
 bool ImportEpubDocument( LVStreamRef stream, ldomDocument * m_doc, LVDocViewCallback * progressCallback,
             CacheLoadingCallback * formatCallback, bool metadataOnly,
             const elem_def_t * node_scheme, const attr_def_t * attr_scheme, const ns_def_t * ns_scheme )
@@ -1797,6 +1940,20 @@ bool ImportEpubDocument( LVStreamRef stream, ldomDocument * m_doc, LVDocViewCall
             //CRLog::trace("subst: %s => %s", LCSTR(name), LCSTR(subst));
         }
     }
+    LVAutoPtr<EpubSpinePrefetcher> prefetcher;
+    if ( EpubSpinePrefetcher::canPrefetch(stream, _epubSpinePrefetchThreads) ) {
+        LVArray<lString32> names;
+        for ( size_t i=0; i<spineItemsNb; i++ ) {
+            lString32 name;
+            if (relaxed_spine || spineItems[i]->is_xhtml) {
+                name = LVCombinePaths(codeBase, spineItems[i]->href);
+                if ( decryptor->isEncryptedItem(name) )
+                    name.clear(); // needs our decrypting container
+            }
+            names.add(name);
+        }
+        prefetcher = new EpubSpinePrefetcher(lString32(stream->GetName()), names, _epubSpinePrefetchThreads);
+    }
     int lastProgressPercent = 5;
     for ( size_t i=0; i<spineItemsNb; i++ ) {
         if ( progressCallback ) {
@@ -1820,7 +1977,9 @@ bool ImportEpubDocument( LVStreamRef stream, ldomDocument * m_doc, LVDocViewCall
                 appender.setNonLinearFlag(spineItems[i]->nonlinear);
                 appender.setFragmentType(); // unset
                 CRLog::debug("Checking fragment: %s", LCSTR(name));
-                LVStreamRef stream = m_arc->OpenStream(name.c_str(), LVOM_READ);
+                LVStreamRef stream;
+                if ( prefetcher.isNull() || decryptor->isEncryptedItem(name) || !prefetcher->get(i, stream) )
+                    stream = m_arc->OpenStream(name.c_str(), LVOM_READ);
                 if ( !stream.isNull() ) {
                     lString32 base = name;
                     LVExtractLastPathElement(base);
@@ -1887,6 +2046,7 @@ bool ImportEpubDocument( LVStreamRef stream, ldomDocument * m_doc, LVDocViewCall
             }
         }
     }
+    prefetcher.clear(); // stop workers
 
     // Clear any toc items possibly added while parsing the HTML
     m_doc->getToc()->clear();
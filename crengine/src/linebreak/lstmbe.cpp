@@ -8,6 +8,23 @@
 #include <string.h>
 #include <math.h>
 
+// Vector kernels are selected at compile time from the target instruction set.
+// Define LSTM_DISABLE_SIMD to force the plain C++ loops.
+#if !defined(LSTM_DISABLE_SIMD)
+#   if defined(__AVX__)
+#       define LSTM_USE_AVX 1
+#       include <immintrin.h>
+#   endif
+#   if defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+#       define LSTM_USE_SSE 1
+#       include <xmmintrin.h>
+#   endif
+#   if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#       define LSTM_USE_NEON 1
+#       include <arm_neon.h>
+#   endif
+#endif
+
 // Uncomment the following #define to debug.
 // #define LSTM_DEBUG 1
 // #define LSTM_VECTORIZER_DEBUG 1
@@ -22,303 +39,66 @@
 #   define U_ASSERT(exp)
 #endif
 
-/**
- * Interface for reading 1D array.
- */
-class ReadArray1D {
-public:
-    virtual ~ReadArray1D();
-    virtual int32_t d1() const = 0;
-    virtual float get(int32_t i) const = 0;
-
-#ifdef LSTM_DEBUG
-    void print() const {
-        printf("\n[");
-        for (int32_t i = 0; i < d1(); i++) {
-           printf("%0.8e ", get(i));
-           if (i % 4 == 3) printf("\n");
-        }
-        printf("]\n");
-    }
-#endif
-};
-
-ReadArray1D::~ReadArray1D()
-{
-}
-
-/**
- * Interface for reading 2D array.
- */
-class ReadArray2D {
-public:
-    virtual ~ReadArray2D();
-    virtual int32_t d1() const = 0;
-    virtual int32_t d2() const = 0;
-    virtual float get(int32_t i, int32_t j) const = 0;
-};
-
-ReadArray2D::~ReadArray2D()
-{
-}
-
-/**
- * A class to index a float array as a 1D Array without owning the pointer or
- * copy the data.
- */
-class ConstArray1D : public ReadArray1D {
-public:
-    ConstArray1D() : data_(nullptr), d1_(0) {}
-
-    ConstArray1D(const float* data, int32_t d1) : data_(data), d1_(d1) {}
-
-    virtual ~ConstArray1D();
-
-    // Init the object, the object does not own the data nor copy.
-    // It is designed to directly use data from memory mapped resources.
-    void init(const float* data, int32_t d1) {
-        data_ = data;
-        d1_ = d1;
-    }
-
-    // ReadArray1D methods.
-    virtual int32_t d1() const override { return d1_; }
-    virtual float get(int32_t i) const override {
-        U_ASSERT(i < d1_);
-        return data_[i];
-    }
-
-private:
-    const float* data_;
-    int32_t d1_;
-};
-
-ConstArray1D::~ConstArray1D()
-{
-}
-
-/**
- * A class to index a float array as a 2D Array without owning the pointer or
- * copy the data.
- */
-class ConstArray2D : public ReadArray2D {
-public:
-    ConstArray2D() : data_(nullptr), d1_(0), d2_(0) {}
-
-    ConstArray2D(const float* data, int32_t d1, int32_t d2)
-        : data_(data), d1_(d1), d2_(d2) {}
-
-    virtual ~ConstArray2D();
-
-    // Init the object, the object does not own the data nor copy.
-    // It is designed to directly use data from memory mapped resources.
-    void init(const float* data, int32_t d1, int32_t d2) {
-        data_ = data;
-        d1_ = d1;
-        d2_ = d2;
-    }
-
-    // ReadArray2D methods.
-    inline int32_t d1() const override { return d1_; }
-    inline int32_t d2() const override { return d2_; }
-    float get(int32_t i, int32_t j) const override {
-        U_ASSERT(i < d1_);
-        U_ASSERT(j < d2_);
-        return data_[i * d2_ + j];
-    }
-
-    // Expose the ith row as a ConstArray1D
-    inline ConstArray1D row(int32_t i) const {
-        U_ASSERT(i < d1_);
-        return ConstArray1D(data_ + i * d2_, d2_);
-    }
-
-private:
-    const float* data_;
-    int32_t d1_;
-    int32_t d2_;
-};
-
-ConstArray2D::~ConstArray2D()
+// All matrices are stored row-major as contiguous float arrays, and vectors
+// are multiplied from the left (out = a * M), as in the ICU model data.
+
+// out[0..m) += a[0..n) * b[n x m]
+// The loops are ordered so that b is walked sequentially. Each output element
+// still accumulates its products in increasing j order, each product being
+// computed and added separately (no fused multiply-add), so the result is
+// bit-for-bit identical to the naive out[i] += a[j] * b[j][i] double loop,
+// whatever kernel is used (as long as the compiler is not allowed to contract
+// the scalar code into FMA instructions, see -ffp-contract=off).
+static inline void addDotProduct(float* out, const float* a, int32_t n, const float* b, int32_t m)
 {
-}
-
-/**
- * A class to allocate data as a writable 1D array.
- * This is the main class implement matrix operation.
- */
-class Array1D : public ReadArray1D {
-public:
-    Array1D() : memory_(nullptr), data_(nullptr), d1_(0) {}
-    Array1D(int32_t d1)
-        : memory_(calloc(d1, sizeof(float))),
-          data_((float*)memory_), d1_(d1) {
-    }
-
-    virtual ~Array1D();
-
-    // A special constructor which does not own the memory but writeable
-    // as a slice of an array.
-    Array1D(float* data, int32_t d1)
-        : memory_(nullptr), data_(data), d1_(d1) {}
-
-    // ReadArray1D methods.
-    virtual int32_t d1() const override { return d1_; }
-    virtual float get(int32_t i) const override {
-        U_ASSERT(i < d1_);
-        return data_[i];
-    }
-
-    // Return the index which point to the max data in the array.
-    inline int32_t maxIndex() const {
-        int32_t index = 0;
-        float max = data_[0];
-        for (int32_t i = 1; i < d1_; i++) {
-            if (data_[i] > max) {
-                max = data_[i];
-                index = i;
-            }
+    for (int32_t j = 0; j < n; j++) {
+        const float aj = a[j];
+        const float* row = b + j * m;
+        int32_t i = 0;
+#if LSTM_USE_AVX
+        const __m256 va8 = _mm256_set1_ps(aj);
+        for (; i + 8 <= m; i += 8) {
+            __m256 prod = _mm256_mul_ps(va8, _mm256_loadu_ps(row + i));
+            _mm256_storeu_ps(out + i, _mm256_add_ps(_mm256_loadu_ps(out + i), prod));
         }
-        return index;
-    }
-
-    // Slice part of the array to a new one.
-    inline Array1D slice(int32_t from, int32_t size) const {
-        U_ASSERT(from >= 0);
-        U_ASSERT(from < d1_);
-        U_ASSERT(from + size <= d1_);
-        return Array1D(data_ + from, size);
-    }
-
-    // Add dot product of a 1D array and a 2D array into this one.
-    inline Array1D& addDotProduct(const ReadArray1D& a, const ReadArray2D& b) {
-        U_ASSERT(a.d1() == b.d1());
-        U_ASSERT(b.d2() == d1());
-        for (int32_t i = 0; i < d1(); i++) {
-            for (int32_t j = 0; j < a.d1(); j++) {
-                data_[i] += a.get(j) * b.get(j, i);
-            }
-        }
-        return *this;
-    }
-
-    // Hadamard Product the values of another array of the same size into this one.
-    inline Array1D& hadamardProduct(const ReadArray1D& a) {
-        U_ASSERT(a.d1() == d1());
-        for (int32_t i = 0; i < d1(); i++) {
-            data_[i] *= a.get(i);
-        }
-        return *this;
-    }
-
-    // Add the Hadamard Product of two arrays of the same size into this one.
-    inline Array1D& addHadamardProduct(const ReadArray1D& a, const ReadArray1D& b) {
-        U_ASSERT(a.d1() == d1());
-        U_ASSERT(b.d1() == d1());
-        for (int32_t i = 0; i < d1(); i++) {
-            data_[i] += a.get(i) * b.get(i);
-        }
-        return *this;
-    }
-
-    // Add the values of another array of the same size into this one.
-    inline Array1D& add(const ReadArray1D& a) {
-        U_ASSERT(a.d1() == d1());
-        for (int32_t i = 0; i < d1(); i++) {
-            data_[i] += a.get(i);
-        }
-        return *this;
-    }
-
-    // Assign the values of another array of the same size into this one.
-    inline Array1D& assign(const ReadArray1D& a) {
-        U_ASSERT(a.d1() == d1());
-        for (int32_t i = 0; i < d1(); i++) {
-            data_[i] = a.get(i);
+#endif
+#if LSTM_USE_SSE
+        const __m128 va4 = _mm_set1_ps(aj);
+        for (; i + 4 <= m; i += 4) {
+            __m128 prod = _mm_mul_ps(va4, _mm_loadu_ps(row + i));
+            _mm_storeu_ps(out + i, _mm_add_ps(_mm_loadu_ps(out + i), prod));
         }
-        return *this;
-    }
-
-    // Apply tanh to all the elements in the array.
-    inline Array1D& tanh() {
-        return tanh(*this);
-    }
-
-    // Apply tanh of a and store into this array.
-    inline Array1D& tanh(const Array1D& a) {
-        U_ASSERT(a.d1() == d1());
-        for (int32_t i = 0; i < d1_; i++) {
-            data_[i] = std::tanh(a.get(i));
+#elif LSTM_USE_NEON
+        const float32x4_t va4 = vdupq_n_f32(aj);
+        for (; i + 4 <= m; i += 4) {
+            float32x4_t prod = vmulq_f32(va4, vld1q_f32(row + i));
+            vst1q_f32(out + i, vaddq_f32(vld1q_f32(out + i), prod));
         }
-        return *this;
-    }
-
-    // Apply sigmoid to all the elements in the array.
-    inline Array1D& sigmoid() {
-        for (int32_t i = 0; i < d1_; i++) {
-            data_[i] = 1.0f/(1.0f + expf(-data_[i]));
+#endif
+        for (; i < m; i++) {
+            float prod = aj * row[i];
+            out[i] += prod;
         }
-        return *this;
     }
+}
 
-    inline Array1D& clear() {
-        memset(data_, 0, d1_ * sizeof(float));
-        return *this;
-    }
-
-private:
-    void* memory_;
-    float* data_;
-    int32_t d1_;
-};
-
-Array1D::~Array1D()
+static inline float sigmoid(float x)
 {
-    if (memory_) {
-        free(memory_);
-    }
+    return 1.0f/(1.0f + expf(-x));
 }
 
-class Array2D : public ReadArray2D {
-public:
-    Array2D() : memory_(nullptr), data_(nullptr), d1_(0), d2_(0) {}
-    Array2D(int32_t d1, int32_t d2)
-        : memory_(calloc(d1 * d2, sizeof(float))),
-          data_((float*)memory_), d1_(d1), d2_(d2) {
-    }
-    virtual ~Array2D();
-
-    // ReadArray2D methods.
-    virtual int32_t d1() const override { return d1_; }
-    virtual int32_t d2() const override { return d2_; }
-    virtual float get(int32_t i, int32_t j) const override {
-        U_ASSERT(i < d1_);
-        U_ASSERT(j < d2_);
-        return data_[i * d2_ + j];
-    }
-
-    inline Array1D row(int32_t i) const {
-        U_ASSERT(i < d1_);
-        return Array1D(data_ + i * d2_, d2_);
-    }
-
-    inline Array2D& clear() {
-        memset(data_, 0, d1_ * d2_ * sizeof(float));
-        return *this;
-    }
-
-private:
-    void* memory_;
-    float* data_;
-    int32_t d1_;
-    int32_t d2_;
-};
-
-Array2D::~Array2D()
+// Return the index which point to the max data in the array.
+static inline int32_t maxIndex(const float* data, int32_t len)
 {
-    if (memory_) {
-        free(memory_);
+    int32_t index = 0;
+    float max = data[0];
+    for (int32_t i = 1; i < len; i++) {
+        if (data[i] > max) {
+            max = data[i];
+            index = i;
+        }
     }
+    return index;
 }
 
 typedef enum {
@@ -334,21 +114,42 @@ typedef enum {
     GRAPHEME_CLUSTER,
 } EmbeddingType;
 
+// One direction of the bidirectional LSTM
+struct LSTMLayer {
+    // x * W + b for each embedding row: as the input of a cell only depends on
+    // the character index, its contribution is computed once per model.
+    float* fInput;
+    const float* fU;
+    void init(const float* embedding, int32_t embeddingRows, int32_t embeddingSize,
+              const float* W, const float* U, const float* b, int32_t hunits);
+    ~LSTMLayer() { free(fInput); }
+};
+
+void LSTMLayer::init(const float* embedding, int32_t embeddingRows, int32_t embeddingSize,
+                     const float* W, const float* U, const float* b, int32_t hunits)
+{
+    int32_t width = 4 * hunits;
+    fInput = (float*)malloc(embeddingRows * width * sizeof(float));
+    for (int32_t k = 0; k < embeddingRows; k++) {
+        float* row = fInput + k * width;
+        memcpy(row, b, width * sizeof(float));
+        addDotProduct(row, embedding + k * embeddingSize, embeddingSize, W, width);
+    }
+    fU = U;
+}
+
 struct LSTMBreakEngine::LSTMData {
     LSTMData(const lstm_data& model);
     const lstm_data& model;
-    ConstArray2D fEmbedding;
-    ConstArray2D fForwardW;
-    ConstArray2D fForwardU;
-    ConstArray1D fForwardB;
-    ConstArray2D fBackwardW;
-    ConstArray2D fBackwardU;
-    ConstArray1D fBackwardB;
-    ConstArray2D fOutputW;
-    ConstArray1D fOutputB;
+    int32_t hunits;
+    LSTMLayer fForward;
+    LSTMLayer fBackward;
+    const float* fOutputW;
+    const float* fOutputB;
 };
 
 LSTMBreakEngine::LSTMData::LSTMData(const lstm_data& model): model(model) {
+    hunits = model.hunits;
     int32_t mat1_size = (model.num_index + 1) * model.embedding_size;
     int32_t mat2_size = model.embedding_size * 4 * model.hunits;
     int32_t mat3_size = model.hunits * 4 * model.hunits;
@@ -362,53 +163,57 @@ LSTMBreakEngine::LSTMData::LSTMData(const lstm_data& model): model(model) {
     U_ASSERT(data_len == mat1_size + mat2_size + mat3_size + mat4_size + mat5_size +
         mat6_size + mat7_size + mat8_size + mat9_size);
 #endif
-    float *matrices = model.matrices;
+    const float *matrices = model.matrices;
 
-    fEmbedding.init(matrices, (model.num_index + 1), model.embedding_size);
+    const float* embedding = matrices;
     matrices += mat1_size;
-    fForwardW.init(matrices, model.embedding_size, 4 * model.hunits);
+    const float* forwardW = matrices;
     matrices += mat2_size;
-    fForwardU.init(matrices, model.hunits, 4 * model.hunits);
+    const float* forwardU = matrices;
     matrices += mat3_size;
-    fForwardB.init(matrices, 4 * model.hunits);
+    const float* forwardB = matrices;
     matrices += mat4_size;
-    fBackwardW.init(matrices, model.embedding_size, 4 * model.hunits);
+    const float* backwardW = matrices;
     matrices += mat5_size;
-    fBackwardU.init(matrices, model.hunits, 4 * model.hunits);
+    const float* backwardU = matrices;
     matrices += mat6_size;
-    fBackwardB.init(matrices, 4 * model.hunits);
+    const float* backwardB = matrices;
     matrices += mat7_size;
-    fOutputW.init(matrices, 2 * model.hunits, 4);
+    fOutputW = matrices;
     matrices += mat8_size;
-    fOutputB.init(matrices, 4);
+    fOutputB = matrices;
+
+    fForward.init(embedding, model.num_index + 1, model.embedding_size,
+                  forwardW, forwardU, forwardB, hunits);
+    fBackward.init(embedding, model.num_index + 1, model.embedding_size,
+                   backwardW, backwardU, backwardB, hunits);
 }
 
 // Computing LSTM as stated in
 // https://en.wikipedia.org/wiki/Long_short-term_memory#LSTM_with_a_forget_gate
 // ifco is temp array allocate outside which does not need to be
 // input/output value but could avoid unnecessary memory alloc/free if passing
-// in.
+// in. h may be the same array as hPrev.
 static void compute(
-    int32_t hunits,
-    const ReadArray2D& W, const ReadArray2D& U, const ReadArray1D& b,
-    const ReadArray1D& x, Array1D& h, Array1D& c,
-    Array1D& ifco)
+    int32_t hunits, const LSTMLayer& layer, int32_t index,
+    const float* hPrev, float* h, float* c, float* ifco)
 {
-    // ifco = x * W + h * U + b
-    ifco.assign(b)
-        .addDotProduct(x, W)
-        .addDotProduct(h, U);
-
-    ifco.slice(0*hunits, hunits).sigmoid();  // i: sigmod
-    ifco.slice(1*hunits, hunits).sigmoid(); // f: sigmoid
-    ifco.slice(2*hunits, hunits).tanh(); // c_: tanh
-    ifco.slice(3*hunits, hunits).sigmoid(); // o: sigmod
-
-    c.hadamardProduct(ifco.slice(hunits, hunits))
-        .addHadamardProduct(ifco.slice(0, hunits), ifco.slice(2*hunits, hunits));
-
-    h.tanh(c)
-        .hadamardProduct(ifco.slice(3*hunits, hunits));
+    // ifco = x * W + b + hPrev * U
+    memcpy(ifco, layer.fInput + index * 4 * hunits, 4 * hunits * sizeof(float));
+    addDotProduct(ifco, hPrev, hunits, layer.fU, 4 * hunits);
+
+    // All gates of a unit in one pass
+    const float* ig = ifco;              // i: sigmoid
+    const float* fg = ifco + hunits;     // f: sigmoid
+    const float* cg = ifco + 2 * hunits; // c_: tanh
+    const float* og = ifco + 3 * hunits; // o: sigmoid
+    for (int32_t k = 0; k < hunits; k++) {
+        float ck = c[k] * sigmoid(fg[k]);
+        float icg = sigmoid(ig[k]) * std::tanh(cg[k]);
+        ck += icg;
+        c[k] = ck;
+        h[k] = std::tanh(ck) * sigmoid(og[k]);
+    }
 }
 
 // Minimum word size
@@ -428,87 +233,59 @@ LSTMBreakEngine::breakWord( const char32_t *text,
         // give up breaking this sentence rather than risk going out-of-memory
         return -1;
     }
+    if (input_seq_len <= 0)
+        return 0;
 
     int32_t* indices = (int32_t*) malloc(input_seq_len * sizeof(int32_t));
     for (int i = 0; i < input_seq_len; i++) {
         indices[i] = fData->model.mapping(text[startPos + i]);
+        // Characters not in the dictionary use the extra last embedding row
+        if (indices[i] < 0 || indices[i] > fData->model.num_index)
+            indices[i] = fData->model.num_index;
 #ifdef LSTM_VECTORIZER_DEBUG
         printf("[U+%04x ] map to %d\n", text[startPos + i], indices[i]);
 #endif
     }
 
-    int32_t hunits = fData->fForwardU.d1();
-
-    // ----- Begin of all the Array memory allocation needed for this function
-    // Allocate temp array used inside compute()
-    Array1D ifco(4 * hunits);
-
-    Array1D c(hunits);
-    Array1D logp(4);
+    int32_t hunits = fData->hunits;
 
+    // ----- Begin of all the memory allocation needed for this function,
+    // in a single block: ifco (4*hunits), c, forward h, backward h for each
+    // character, and logp (4)
+    float* memory = (float*) calloc((4 + 1 + 1 + input_seq_len) * hunits + 4, sizeof(float));
+    float* ifco = memory;
+    float* c = ifco + 4 * hunits;
+    float* hForward = c + hunits;
     // TODO: limit size of hBackward. If input_seq_len is too big, we could
     // run out of memory.
-    // Backward LSTM
-    Array2D hBackward(input_seq_len, hunits);
-
-    // Allocate fbRow and slice the internal array in two.
-    Array1D fbRow(2 * hunits);
+    float* hBackward = hForward + hunits;
+    float* logp = hBackward + input_seq_len * hunits;
 
     // To save the needed memory usage, the following is different from the
     // Python or ICU4X implementation. We first perform the Backward LSTM
     // and then merge the iteration of the forward LSTM and the output layer
     // together because we only neetdto remember the h[t-1] for Forward LSTM.
     for (int32_t i = input_seq_len - 1; i >= 0; i--) {
-        Array1D hRow = hBackward.row(i);
-        if (i != input_seq_len - 1) {
-            hRow.assign(hBackward.row(i+1));
-        }
-#ifdef LSTM_DEBUG
-        printf("hRow %d\n", i);
-        hRow.print();
-        printf("indicesBuf[%d] = %d\n", i, indices[i]);
-        printf("fData->fEmbedding.row(indicesBuf[%d]):\n", i);
-        fData->fEmbedding.row(indices[i]).print();
-#endif  // LSTM_DEBUG
-        compute(hunits,
-                fData->fBackwardW, fData->fBackwardU, fData->fBackwardB,
-                fData->fEmbedding.row(indices[i]),
-                hRow, c, ifco);
+        float* hRow = hBackward + i * hunits;
+        // hBackward rows after the last one are zero, as the initial state
+        const float* hPrev = (i != input_seq_len - 1) ? hRow + hunits : hRow;
+        compute(hunits, fData->fBackward, indices[i], hPrev, hRow, c, ifco);
     }
 
-
-    Array1D forwardRow = fbRow.slice(0, hunits);  // point to first half of data in fbRow.
-    Array1D backwardRow = fbRow.slice(hunits, hunits);  // point to second half of data n fbRow.
-
     // The following iteration merge the forward LSTM and the output layer
     // together.
-    c.clear();  // reuse c since it is the same size.
+    memset(c, 0, hunits * sizeof(float));  // reuse c since it is the same size.
     for (int32_t i = 0; i < input_seq_len; i++) {
-#ifdef LSTM_DEBUG
-        printf("forwardRow %d\n", i);
-        forwardRow.print();
-#endif  // LSTM_DEBUG
         // Forward LSTM
-        // Calculate the result into forwardRow, which point to the data in the first half
-        // of fbRow.
-        compute(hunits,
-                fData->fForwardW, fData->fForwardU, fData->fForwardB,
-                fData->fEmbedding.row(indices[i]),
-                forwardRow, c, ifco);
-
-        // assign the data from hBackward.row(i) to second half of fbRowa.
-        backwardRow.assign(hBackward.row(i));
-
-        logp.assign(fData->fOutputB).addDotProduct(fbRow, fData->fOutputW);
-#ifdef LSTM_DEBUG
-        printf("backwardRow %d\n", i);
-        backwardRow.print();
-        printf("logp %d\n", i);
-        logp.print();
-#endif  // LSTM_DEBUG
+        compute(hunits, fData->fForward, indices[i], hForward, hForward, c, ifco);
+
+        // logp = [hForward, hBackward[i]] * outputW + outputB
+        memcpy(logp, fData->fOutputB, 4 * sizeof(float));
+        addDotProduct(logp, hForward, hunits, fData->fOutputW, 4);
+        addDotProduct(logp, hBackward + i * hunits, hunits, fData->fOutputW + hunits * 4, 4);
 
         // current = argmax(logp)
-        LSTMClass current = (LSTMClass)logp.maxIndex();
+        LSTMClass current = (LSTMClass)maxIndex(logp, 4);
         // BIES logic.
         if (current == BEGIN || current == SINGLE) {
             if (i != 0) {
@@ -517,6 +294,7 @@ LSTMBreakEngine::breakWord( const char32_t *text,
         }
     }
 
+    free(memory);
     free(indices);
     return 0;
 }
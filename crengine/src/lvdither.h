@@ -0,0 +1,169 @@
+/*******************************************************
+
+   CoolReader Engine
+
+   lvdither.h:  gray quantization and dithering kernels
+
+   This source code is distributed under the terms of
+   GNU General Public License
+
+   See LICENSE file for details
+
+*******************************************************/
+
+#ifndef __LV_DITHER_H_INCLUDED__
+#define __LV_DITHER_H_INCLUDED__
+
+// Row kernels of QuantizeToGray() (lvdrawbuf.cpp): 8 bits gray rows are first
+// mapped to levels 0..maxLevel (one byte per pixel, maxLevel = 1, 3 or 15), by
+// ordered dithering or error diffusion, then packed to 1, 2 or 4 bpp bytes.
+// The ordered dithering kernel has vector versions selected at compile time
+// (see lvsimd.h), giving exactly the same levels as the plain loop.
+// Define DRAWBUF_DISABLE_SIMD to force the plain loops.
+
+#include <string.h>
+#include "../include/lvtypes.h"
+#include "lvsimd.h"
+
+// 32 bpp 0xAARRGGBB pixels to gray, as rgbToGray() in lvdrawbuf.cpp
+static inline void ditherGrayRow32( lUInt8 * __restrict gray, const lUInt32 * __restrict src, int count )
+{
+    for (int i = 0; i < count; i++) {
+        const lUInt32 cl = src[i];
+        gray[i] = (lUInt8)((((cl >> 16) & 0xFF) + ((cl >> 7) & 0x1FE) + (cl & 0xFF)) >> 2);
+    }
+}
+
+// 2 bpp packed pixels (starting at pixel x0 of the row) to gray
+static inline void ditherGrayRow2( lUInt8 * __restrict gray, const lUInt8 * __restrict src, int x0, int count )
+{
+    for (int i = 0; i < count; i++) {
+        const int x = x0 + i;
+        gray[i] = (lUInt8)(((src[x >> 2] >> (6 - ((x & 3) << 1))) & 3) * 85);
+    }
+}
+
+// Ordered dithering: level = ((v + (v>>7)) * maxLevel + t) >> 8, where t is the
+// threshold of pixel column (x0+i)&7 for this row, in 0..255 (128 = no dithering).
+// v + (v>>7) maps 0..255 to 0..256, so that 0 and 255 always give 0 and maxLevel.
+static inline void ditherOrderedRow( lUInt8 * __restrict levels, const lUInt8 * __restrict gray, int count,
+                                     int x0, const lUInt8 * thresholds, int maxLevel )
+{
+    int i = 0;
+#if DRAWBUF_USE_SSE2 || DRAWBUF_USE_NEON
+    lUInt8 t16[16];
+    for (int k = 0; k < 16; k++)
+        t16[k] = thresholds[(x0 + k) & 7];
+#endif
+#if DRAWBUF_USE_SSE2
+    {
+        const __m128i zero = _mm_setzero_si128();
+        const __m128i t = _mm_loadu_si128((const __m128i *)t16);
+        const __m128i t_lo = _mm_unpacklo_epi8(t, zero);
+        const __m128i t_hi = _mm_unpackhi_epi8(t, zero);
+        const __m128i m = _mm_set1_epi16((short)maxLevel);
+        for (; i + 16 <= count; i += 16) {
+            const __m128i v = _mm_loadu_si128((const __m128i *)(gray + i));
+            __m128i lo = _mm_unpacklo_epi8(v, zero);
+            __m128i hi = _mm_unpackhi_epi8(v, zero);
+            lo = _mm_add_epi16(lo, _mm_srli_epi16(lo, 7));
+            hi = _mm_add_epi16(hi, _mm_srli_epi16(hi, 7));
+            lo = _mm_srli_epi16(_mm_add_epi16(_mm_mullo_epi16(lo, m), t_lo), 8);
+            hi = _mm_srli_epi16(_mm_add_epi16(_mm_mullo_epi16(hi, m), t_hi), 8);
+            _mm_storeu_si128((__m128i *)(levels + i), _mm_packus_epi16(lo, hi));
+        }
+    }
+#elif DRAWBUF_USE_NEON
+    {
+        const uint8x16_t t = vld1q_u8(t16);
+        const uint16x8_t t_lo = vmovl_u8(vget_low_u8(t));
+        const uint16x8_t t_hi = vmovl_u8(vget_high_u8(t));
+        const uint16_t m = (uint16_t)maxLevel;
+        for (; i + 16 <= count; i += 16) {
+            const uint8x16_t v = vld1q_u8(gray + i);
+            uint16x8_t lo = vmovl_u8(vget_low_u8(v));
+            uint16x8_t hi = vmovl_u8(vget_high_u8(v));
+            lo = vsraq_n_u16(lo, lo, 7);
+            hi = vsraq_n_u16(hi, hi, 7);
+            lo = vmlaq_n_u16(t_lo, lo, m);
+            hi = vmlaq_n_u16(t_hi, hi, m);
+            vst1q_u8(levels + i, vcombine_u8(vshrn_n_u16(lo, 8), vshrn_n_u16(hi, 8)));
+        }
+    }
+#endif
+    for (; i < count; i++) {
+        const int v = gray[i];
+        levels[i] = (lUInt8)(((v + (v >> 7)) * maxLevel + thresholds[(x0 + i) & 7]) >> 8);
+    }
+}
+
+// Error diffusion, left to right, with errors in 1/16 units:
+// err0 holds errors diffused to the current row, err1 and err2 to the next two rows.
+// Each has count+4 items, pixel i being at index i+2.
+// Floyd-Steinberg diffuses 7/16 right, 3/16, 5/16 and 1/16 below;
+// Atkinson diffuses 1/8 to 6 neighbours (3/4 of the error: less noise in flat areas).
+static inline void ditherDiffuseRow( lUInt8 * __restrict levels, const lUInt8 * __restrict gray, int count,
+                                     int maxLevel, int * err0, int * err1, int * err2, bool atkinson )
+{
+    const int step = 255 / maxLevel;
+    // weights to the next two pixels, and below left, below and below right
+    const int r1 = atkinson ? 2 : 7, r2 = atkinson ? 2 : 0;
+    const int bl = atkinson ? 2 : 3, bc = atkinson ? 2 : 5, br = atkinson ? 2 : 1;
+    // errors to the next pixels, and to the two incomplete slots below, are kept in
+    // registers: an item of err1 is only written once all its neighbours are done
+    int right1 = 0, right2 = 0;
+    int below0 = 0, below1 = 0;
+    for (int i = 0; i < count; i++) {
+        int v = gray[i] + ((err0[i + 2] + right1 + 8) >> 4);
+        if (v < 0)
+            v = 0;
+        else if (v > 255)
+            v = 255;
+        const int q = (v * maxLevel + 127) / 255;
+        levels[i] = (lUInt8)q;
+        const int e = v - q * step;
+        right1 = right2 + e * r1;
+        right2 = e * r2;
+        err1[i + 1] += below0 + e * bl;
+        below0 = below1 + e * bc;
+        below1 = e * br;
+        if (atkinson)
+            err2[i + 2] += e * 2;
+    }
+    err1[count + 1] += below0;
+    err1[count + 2] += below1;
+}
+
+// Packs count levels to 1, 2 or 4 bpp bytes, leftmost pixel in most significant bits.
+// levels must be readable (and zero filled) up to the next multiple of 8 pixels.
+static inline void ditherPackRow( lUInt8 * __restrict dst, const lUInt8 * __restrict levels, int count, int bpp )
+{
+    switch (bpp) {
+    case 1:
+        for (int i = 0; i < count; i += 8) {
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+            // 8 levels 0/1 in a word: the multiply gathers bit 8*k to bit 63-k
+            lUInt64 w;
+            memcpy(&w, levels + i, 8);
+            *dst++ = (lUInt8)((w * 0x8040201008040201ULL) >> 56);
+#else
+            const lUInt8 * l = levels + i;
+            *dst++ = (lUInt8)((l[0] << 7) | (l[1] << 6) | (l[2] << 5) | (l[3] << 4)
+                            | (l[4] << 3) | (l[5] << 2) | (l[6] << 1) | l[7]);
+#endif
+        }
+        break;
+    case 2:
+        for (int i = 0; i < count; i += 4) {
+            const lUInt8 * l = levels + i;
+            *dst++ = (lUInt8)((l[0] << 6) | (l[1] << 4) | (l[2] << 2) | l[3]);
+        }
+        break;
+    case 4:
+        for (int i = 0; i < count; i += 2)
+            *dst++ = (lUInt8)((levels[i] << 4) | levels[i + 1]);
+        break;
+    }
+}
+
+#endif // __LV_DITHER_H_INCLUDED__
@@ -203,6 +203,10 @@ LVDocView::LVDocView(int bitsPerPixel, bool noDefaultDocument) :
 #endif
 #endif
 	m_statusColor = 0xFF000000;
+#if CR_ENABLE_PAGE_IMAGE_CACHE==1
+	m_imageCachePrefetch = 1;
+	m_imageCacheLastKey = -1;
+#endif
 	m_defaultFontFace = lString8(DEFAULT_FONT_NAME);
 	m_statusFontFace = lString8(DEFAULT_STATUS_FONT_NAME);
 	m_props = LVCreatePropsContainer();
@@ -626,6 +630,232 @@ void LVDocView::checkPos() {
 }
 
 #if CR_ENABLE_PAGE_IMAGE_CACHE==1
+LVDocViewImageCache::Item::Item( int offset, int page, LVRef<LVDrawBuf> drawbuf )
+: _drawbuf(drawbuf), _offset(offset), _page(page), _lastAccess(0), _ready(false), _cancelled(false)
+, _waiters(0), _removed(false)
+{
+    _size = drawbuf->GetRowSize() * drawbuf->GetHeight();
+}
+
+LVDocViewImageCache::LVDocViewImageCache()
+: _pool(NULL), _workerCount(1), _maxPages(2), _maxBytes(0), _totalBytes(0), _accessCounter(0)
+, _posKey(-1), _direction(0), _window(0), _hits(0), _misses(0)
+{
+}
+
+LVDocViewImageCache::~LVDocViewImageCache()
+{
+    clear();
+    if ( _pool ) {
+        _pool->stop();
+        delete _pool;
+    }
+}
+
+CRThreadPool * LVDocViewImageCache::getPool()
+{
+    if ( !_pool )
+        _pool = new CRThreadPool( _workerCount );
+    return _pool;
+}
+
+void LVDocViewImageCache::setWorkerCount( int count )
+{
+    _workerCount = count > 0 ? count : 0;
+}
+
+void LVDocViewImageCache::setLimits( int maxPages, int maxBytes )
+{
+    LVLock lock( _mutex );
+    _maxPages = maxPages > 1 ? maxPages : 1;
+    _maxBytes = maxBytes > 0 ? maxBytes : 0;
+}
+
+void LVDocViewImageCache::setPosition( int key, int direction, int window )
+{
+    LVLock lock( _mutex );
+    _posKey = key;
+    _direction = direction;
+    _window = window;
+}
+
+LVDocViewImageCache::Item * LVDocViewImageCache::find( int offset, int page )
+{
+    for ( int i=0; i<_items.length(); i++ ) {
+        if ( _items[i]->matches( offset, page ) )
+            return _items[i];
+    }
+    return NULL;
+}
+
+/// select item to evict: pages being rendered or waited for are never evicted, pages inside
+/// the read-ahead window are evicted only when nothing else is left; the least
+/// recently used page is preferred otherwise
+int LVDocViewImageCache::findVictim()
+{
+    int victim = -1;
+    bool victimProtected = true;
+    for ( int i=0; i<_items.length(); i++ ) {
+        Item * item = _items[i];
+        if ( !item->_ready || item->_waiters > 0 )
+            continue;
+        int dist = item->getKey() - _posKey;
+        if ( _direction < 0 )
+            dist = -dist;
+        bool isProtected = _posKey != -1 && dist >= 0 && dist <= _window;
+        if ( victim < 0 || (victimProtected && !isProtected)
+                || (victimProtected == isProtected && item->_lastAccess < _items[victim]->_lastAccess) ) {
+            victim = i;
+            victimProtected = isProtected;
+        }
+    }
+    return victim;
+}
+
+void LVDocViewImageCache::removeItem( int index )
+{
+    Item * item = _items.remove( index );
+    _totalBytes -= item->_size;
+    delete item;
+}
+
+LVDocViewImageCache::Item * LVDocViewImageCache::add( int offset, int page, LVRef<LVDrawBuf> drawbuf )
+{
+    LVLock lock( _mutex );
+    Item * item = new Item( offset, page, drawbuf );
+    while ( _items.length() > 0 && ( _items.length() >= _maxPages
+            || ( _maxBytes > 0 && _totalBytes + item->_size > _maxBytes ) ) ) {
+        int victim = findVictim();
+        if ( victim < 0 )
+            break; // everything is still being rendered: allow temporary overflow
+        removeItem( victim );
+    }
+    item->_lastAccess = ++_accessCounter;
+    _items.add( item );
+    _totalBytes += item->_size;
+    return item;
+}
+
+/// return page image if already rendered (to be called with the lock held: never waits)
+LVRef<LVDrawBuf> LVDocViewImageCache::getWithoutLock( int offset, int page, bool updateStats )
+{
+    Item * item = find( offset, page );
+    if ( updateStats ) {
+        if ( item )
+            _hits++;
+        else
+            _misses++;
+    }
+    if ( !item || !item->_ready )
+        return LVRef<LVDrawBuf>();
+    item->_lastAccess = ++_accessCounter;
+    return item->_drawbuf;
+}
+
+/// wait, without holding the lock, until page is rendered; returns false if not in cache
+bool LVDocViewImageCache::waitReady( int offset, int page, bool updateStats )
+{
+    Item * item;
+    {
+        LVLock lock( _mutex );
+        item = find( offset, page );
+        if ( updateStats ) {
+            if ( item )
+                _hits++;
+            else
+                _misses++;
+        }
+        if ( !item )
+            return false;
+        if ( item->_ready )
+            return true;
+        // item is not evicted nor freed while it has waiters
+        item->_waiters++;
+    }
+    // drawing tasks don't need the lock, but other threads using the cache do
+    getPool()->waitFor( item->_ready );
+    LVLock lock( _mutex );
+    releaseWaiter( item );
+    return true;
+}
+
+void LVDocViewImageCache::releaseWaiter( Item * item )
+{
+    if ( --item->_waiters == 0 && item->_removed )
+        delete item;
+}
+
+/// return page image, wait until ready
+LVDocImageRef LVDocViewImageCache::get( int offset, int page, bool updateStats )
+{
+    if ( !waitReady( offset, page, updateStats ) )
+        return LVDocImageRef( NULL );
+    _mutex.lock();
+    LVRef<LVDrawBuf> buf = getWithoutLock( offset, page );
+    if ( !buf.isNull() )
+        return LVDocImageRef( new LVDocImageHolder(buf, _mutex) );
+    // cleared meanwhile
+    _mutex.unlock();
+    return LVDocImageRef( NULL );
+}
+
+bool LVDocViewImageCache::has( int offset, int page, bool updateStats )
+{
+    LVLock lock( _mutex );
+    Item * item = find( offset, page );
+    if ( updateStats ) {
+        if ( item )
+            _hits++;
+        else
+            _misses++;
+    }
+    return item != NULL;
+}
+
+bool LVDocViewImageCache::isReady( int offset, int page )
+{
+    LVLock lock( _mutex );
+    Item * item = find( offset, page );
+    return item && item->_ready;
+}
+
+void LVDocViewImageCache::clear()
+{
+    // let pending tasks finish quickly, and take the items out of the cache
+    LVPtrVector<Item, false> items;
+    {
+        LVLock lock( _mutex );
+        while ( _items.length() > 0 ) {
+            Item * item = _items.remove( _items.length() - 1 );
+            item->_cancelled = true;
+            items.add( item );
+        }
+        _totalBytes = 0;
+    }
+    // wait for them without holding the lock, before freeing buffers
+    for ( int i=0; i<items.length(); i++ ) {
+        if ( !items[i]->_ready )
+            getPool()->waitFor( items[i]->_ready );
+    }
+    LVLock lock( _mutex );
+    bool waited = false;
+    for ( int i=0; i<items.length(); i++ ) {
+        if ( items[i]->_waiters > 0 ) {
+            items[i]->_removed = true; // freed by its last waiter
+            waited = true;
+        }
+        else {
+            delete items[i];
+        }
+    }
+    if ( _pool && _pool->getThreadCount() != _workerCount && !waited ) {
+        // apply new worker count (not while other threads may be in waitFor())
+        _pool->stop();
+        delete _pool;
+        _pool = NULL;
+    }
+}
+
 /// returns true if current page image is ready
 bool LVDocView::IsDrawed()
 {
@@ -637,25 +867,21 @@ bool LVDocView::isPageImageReady( int delta )
 {
 	if ( !m_is_rendered || !_posIsSet )
 	return false;
-	LVDocImageRef ref;
 	if ( isPageMode() ) {
 		int p = _page;
 		if ( delta<0 )
 		p--;
 		else if ( delta>0 )
 		p++;
-		//CRLog::trace("getPageImage: checking cache for page [%d] (delta=%d)", offset, delta);
-		ref = m_imageCache.get( -1, p );
+		return m_imageCache.isReady( -1, p );
 	} else {
 		int offset = _pos;
 		if ( delta<0 )
 		offset = getPrevPageOffset();
 		else if ( delta>0 )
 		offset = getNextPageOffset();
-		//CRLog::trace("getPageImage: checking cache for page [%d] (delta=%d)", offset, delta);
-		ref = m_imageCache.get( offset, -1 );
+		return m_imageCache.isReady( offset, -1 );
 	}
-	return ( !ref.isNull() );
 }
 
 /// get page image
@@ -674,49 +900,43 @@ LVDocImageRef LVDocView::getPageImage( int delta )
 		p++;
 		if ( p<0 || p>=m_pages.length() )
 		return ref;
-		ref = m_imageCache.get( -1, p );
-		if ( !ref.isNull() ) {
-			//CRLog::trace("getPageImage: + page [%d] found in cache", offset);
-			return ref;
-		}
 	} else {
 		offset = _pos;
 		if ( delta<0 )
 		offset = getPrevPageOffset();
 		else if ( delta>0 )
 		offset = getNextPageOffset();
-		//CRLog::trace("getPageImage: checking cache for page [%d] (delta=%d)", offset, delta);
-		ref = m_imageCache.get( offset, -1 );
-		if ( !ref.isNull() ) {
-			//CRLog::trace("getPageImage: + page [%d] found in cache", offset);
-			return ref;
-		}
 	}
-	while ( ref.isNull() ) {
+	// Queue rendering of this page and of the ones likely needed next before
+	// getting the image: the returned holder keeps the cache locked
+	if ( !m_imageCache.has( offset, p, true ) ) {
 		//CRLog::trace("getPageImage: - page [%d] not found, force rendering", offset);
 		cachePageImage( delta );
-		ref = m_imageCache.get( offset, p );
 	}
+	if ( delta == 0 && !m_imageCache.isSynchronous() ) {
+		// current page is shown: render pages which will likely be needed next
+		prefetchPageImages();
+	}
+	ref = m_imageCache.get( offset, p );
 	//CRLog::trace("getPageImage: page [%d] is ready", offset);
 	return ref;
 }
 
-class LVDrawThread : public LVThread {
+class LVDrawTask : public CRRunnable {
 	LVDocView * _view;
-	int _offset;
-	int _page;
-	LVRef<LVDrawBuf> _drawbuf;
+	CRThreadPool * _pool;
+	LVDocViewImageCache::Item * _item;
 public:
-	LVDrawThread( LVDocView * view, int offset, int page, LVRef<LVDrawBuf> drawbuf )
-	: _view(view), _offset(offset), _page(page), _drawbuf(drawbuf)
+	LVDrawTask( LVDocView * view, CRThreadPool * pool, LVDocViewImageCache::Item * item )
+	: _view(view), _pool(pool), _item(item)
 	{
-		start();
 	}
 	virtual void run()
 	{
-		//CRLog::trace("LVDrawThread::run() offset==%d", _offset);
-		_view->Draw( *_drawbuf, _offset, _page, true );
-		//_drawbuf->Rotate( _view->GetRotateAngle() );
+		//CRLog::trace("LVDrawTask::run() offset==%d", _item->_offset);
+		if ( !_item->_cancelled )
+			_view->Draw( *_item->_drawbuf, _item->_offset, _item->_page, true );
+		_pool->notifyDone( _item->_ready );
 	}
 };
 #endif
@@ -749,6 +969,133 @@ void LVDocView::Draw(LVDrawBuf & drawbuf, bool autoResize) {
 		Draw(drawbuf, _pos, -1, false, autoResize);
 			// this will find out the correct page from our page list
 	}
+	// remember where selections were drawn, for redrawSelection()
+	getSelectionWindowRects(m_drawnSelectionRects);
+}
+
+/// get window rectangles of text selections on current page(s)
+void LVDocView::getSelectionWindowRects(LVArray<lvRect> & rects) {
+	rects.clear();
+	if (!m_doc)
+		return;
+	ldomXRangeList & sel = m_doc->getSelections();
+	for (int i = 0; i < sel.length(); i++) {
+		LVArray<lvRect> segments;
+		sel[i]->getSegmentRects(segments);
+		for (int k = 0; k < segments.length(); k++) {
+			lvPoint topLeft = segments[k].topLeft();
+			lvPoint bottomRight = segments[k].bottomRight();
+			if (docToWindowPoint(topLeft) && docToWindowPoint(bottomRight, true)) {
+				lvRect rc(topLeft.x, topLeft.y, bottomRight.x, bottomRight.y);
+				if (rc.intersect(lvRect(0, 0, m_dx, m_dy)))
+					rects.add(rc);
+			}
+		}
+	}
+}
+
+/// copies rectangle between buffers of same size and format, widening it to whole bytes for packed pixels
+static bool copyDrawBufRect(LVDrawBuf & dst, LVDrawBuf & src, lvRect & rc) {
+	const int bpp = src.GetBitsPerPixel();
+	int x0, x1;
+	if (bpp <= 2) {
+		const int ppb = 8 / bpp;
+		rc.left -= rc.left % ppb;
+		rc.right = (rc.right + ppb - 1) / ppb * ppb;
+		if (rc.right > dst.GetWidth())
+			rc.right = dst.GetWidth();
+		x0 = rc.left / ppb;
+		x1 = (rc.right + ppb - 1) / ppb;
+	} else {
+		// 3 and 4 bpp gray buffers use a byte per pixel
+		const int bytesPerPixel = bpp <= 8 ? 1 : bpp / 8;
+		x0 = rc.left * bytesPerPixel;
+		x1 = rc.right * bytesPerPixel;
+	}
+	for (int y = rc.top; y < rc.bottom; y++) {
+		lUInt8 * d = dst.GetScanLine(y);
+		const lUInt8 * s = src.GetScanLine(y);
+		if (!d || !s)
+			return false;
+		memcpy(d + x0, s + x0, x1 - x0);
+	}
+	dst.markDirty(rc);
+	return true;
+}
+
+/// redraw only page header(s) into buffer holding current page drawn by Draw(drawbuf), e.g. on clock or battery change
+bool LVDocView::redrawPageHeader(LVDrawBuf & drawbuf, LVArray<lvRect> & damaged) {
+	LVLock lock(getMutex());
+	damaged.clear();
+	if (!m_is_rendered || !m_doc || m_font.isNull() || !isPageMode())
+		return false;
+	if (drawbuf.GetWidth() != m_dx || drawbuf.GetHeight() != m_dy)
+		return false;
+	checkPos();
+	lvRect oldClip;
+	drawbuf.GetClipRect(&oldClip);
+	drawbuf.SetBackgroundColor(m_backgroundColor);
+	drawbuf.SetTextColor(m_textColor);
+	int pc = getVisiblePageCount();
+	for (int i = 0; i < pc && _page + i >= 0 && _page + i < m_pages.length(); i++) {
+		LVRendPageInfo & page = *m_pages[_page + i];
+		lvRect headerRc;
+		int phi;
+		if (!getPageHeaderLayout(page, headerRc, phi))
+			continue;
+		// restore background under the header text, then draw it as drawPageTo() does
+		lvRect rc = headerRc;
+		if (!rc.intersect(lvRect(0, 0, m_dx, m_dy)))
+			continue;
+		drawbuf.SetClipRect(&rc);
+		if (m_backgroundImage.isNull())
+			drawbuf.FillRect(rc, m_backgroundColor);
+		else
+			drawPageBackground(drawbuf, 0, 0);
+		drawPageHeader(&drawbuf, headerRc, page.index, phi, m_pages.length());
+		// drawPageHeader() may draw 2 pixels below header rectangle
+		rc.bottom += 2;
+		rc.intersect(lvRect(0, 0, m_dx, m_dy));
+		damaged.add(rc);
+	}
+	drawbuf.SetClipRect(&oldClip);
+	return damaged.length() > 0;
+}
+
+/// redraw only areas of old and new text selections into buffer holding current page drawn by Draw(drawbuf)
+bool LVDocView::redrawSelection(LVDrawBuf & drawbuf, LVArray<lvRect> & damaged) {
+	LVLock lock(getMutex());
+	damaged.clear();
+	if (!m_is_rendered || !m_doc || m_font.isNull())
+		return false;
+	if (drawbuf.GetWidth() != m_dx || drawbuf.GetHeight() != m_dy)
+		return false;
+	int bpp = drawbuf.GetBitsPerPixel();
+	if (bpp != 1 && bpp != 2 && bpp != 3 && bpp != 4 && bpp != 8 && bpp != 16 && bpp != 32)
+		return false;
+	LVArray<lvRect> oldRects(m_drawnSelectionRects);
+	// the page is drawn off-screen: highlights are blended over text and images,
+	// so they can't be drawn again or erased without redrawing what is under them
+	LVDrawBuf * pageBuf = bpp <= 8 ? (LVDrawBuf *)new LVGrayDrawBuf(m_dx, m_dy, bpp)
+	                               : (LVDrawBuf *)new LVColorDrawBuf(m_dx, m_dy, bpp);
+	pageBuf->setInvertImages(drawbuf.getInvertImages());
+	Draw(*pageBuf, false);
+	// merge old and new rectangles, as draw buffers do for their dirty regions
+	pageBuf->setDirtyTracking(true);
+	for (int i = 0; i < oldRects.length(); i++)
+		pageBuf->markDirty(oldRects[i]);
+	for (int i = 0; i < m_drawnSelectionRects.length(); i++)
+		pageBuf->markDirty(m_drawnSelectionRects[i]);
+	LVArray<lvRect> rects;
+	pageBuf->getDirtyRects(rects);
+	bool res = true;
+	for (int i = 0; i < rects.length() && res; i++) {
+		res = copyDrawBufRect(drawbuf, *pageBuf, rects[i]);
+		if (res)
+			damaged.add(rects[i]);
+	}
+	delete pageBuf;
+	return res && damaged.length() > 0;
 }
 
 #if CR_ENABLE_PAGE_IMAGE_CACHE==1
@@ -763,8 +1110,6 @@ void LVDocView::cachePageImage( int delta )
 		p--;
 		else if ( delta>0 )
 		p++;
-		if ( p<0 || p>=m_pages.length() )
-		return;
 	} else {
 		offset = _pos;
 		if ( delta<0 )
@@ -772,6 +1117,14 @@ void LVDocView::cachePageImage( int delta )
 		else if ( delta>0 )
 		offset = getNextPageOffset();
 	}
+	cachePageImageAt( offset, p );
+}
+
+/// cache page image by either Y pos or page number (unused param should be -1)
+void LVDocView::cachePageImageAt( int offset, int p )
+{
+	if ( p!=-1 && (p<0 || p>=m_pages.length()) )
+		return;
 	//CRLog::trace("cachePageImage: request to cache page [%d] (delta=%d)", offset, delta);
 	if ( m_imageCache.has(offset, p) ) {
 		//CRLog::trace("cachePageImage: Page [%d] is found in cache", offset);
@@ -793,10 +1146,55 @@ void LVDocView::cachePageImage( int delta )
 		}
 	}
 	LVRef<LVDrawBuf> drawbuf( buf );
-	LVRef<LVThread> thread( new LVDrawThread( this, offset, p, drawbuf ) );
-	m_imageCache.set( offset, p, drawbuf, thread );
+	CRThreadPool * pool = m_imageCache.getPool();
+	LVDocViewImageCache::Item * item = m_imageCache.add( offset, p, drawbuf );
+	pool->execute( new LVDrawTask( this, pool, item ) );
 	//CRLog::trace("cachePageImage: caching page [%d] is finished", offset);
 }
+
+/// schedule background rendering of pages around current one, according to navigation direction
+void LVDocView::prefetchPageImages()
+{
+	int key = isPageMode() ? _page : _pos;
+	int direction = m_imageCache.getDirection();
+	if ( m_imageCacheLastKey != -1 && key != m_imageCacheLastKey )
+		direction = key > m_imageCacheLastKey ? 1 : -1;
+	m_imageCacheLastKey = key;
+	if ( direction == 0 )
+		direction = 1;
+	int ahead = m_imageCachePrefetch;
+	if ( ahead > m_imageCache.getMaxPages() - 2 )
+		ahead = m_imageCache.getMaxPages() - 2; // keep room for current and previous page
+	if ( ahead < 1 )
+		ahead = 1;
+	if ( isPageMode() ) {
+		m_imageCache.setPosition( key, direction, ahead );
+		for ( int i=1; i<=ahead; i++ )
+			cachePageImageAt( -1, key + direction * i );
+		if ( m_imageCache.getMaxPages() > 2 )
+			cachePageImageAt( -1, key - direction );
+	} else {
+		// offsets of pages further than next/previous are not known before they are drawn
+		m_imageCache.setPosition( key, direction, m_dy );
+		cachePageImage( direction );
+	}
+}
+
+void LVDocView::setPageImageCacheLimits( int maxPages, int maxBytes )
+{
+	m_imageCache.setLimits( maxPages, maxBytes );
+}
+
+void LVDocView::setPageImageCachePrefetch( int pages )
+{
+	m_imageCachePrefetch = pages > 0 ? pages : 1;
+}
+
+void LVDocView::setPageImageCacheWorkers( int count )
+{
+	m_imageCache.setWorkerCount( count );
+	clearImageCache();
+}
 #endif
 
 #if 0 // unused
@@ -1964,6 +2362,60 @@ void LVDocView::drawPageHeader(LVDrawBuf * drawbuf, const lvRect & headerRc,
 	drawbuf->SetTextColor(getTextColor());
 }
 
+/// decide whether and where header of specified page is drawn, and with which info
+bool LVDocView::getPageHeaderLayout(LVRendPageInfo & page, lvRect & headerRc, int & headerInfoFlags) {
+	if ( (m_pageHeaderInfo || !m_pageHeaderOverride.empty()) && getViewMode() == DVM_PAGES ) {
+		// Decide what to draw in header
+		// (In 2-pages mode, we are called for each of the 2 pages)
+		bool drawHeader = true;
+		bool hasTwoPages = getVisiblePageCount() == 2;
+		bool useTwoHeaders = hasTwoPages && !m_twoVisiblePagesAsOnePageNumber;
+		bool mergeTwoHeaders = hasTwoPages && !useTwoHeaders;
+		bool isRightPage = page.index & 1;
+		bool isCoverPage = !(page.flags & RN_PAGE_TYPE_NORMAL); // FB2 cover page
+		// Handle a few edge cases
+		if ( isCoverPage ) {
+			// Never draw header on a FB2 cover page
+			drawHeader = false;
+		}
+		else if ( mergeTwoHeaders ) {
+			if ( isRightPage ) {
+				if ( page.index == 1 && !(m_pages[0]->flags & RN_PAGE_TYPE_NORMAL) ) {
+					// 2nd page, but left page is a cover without header
+					// Draw it as if unmerged
+					useTwoHeaders = true;
+					mergeTwoHeaders = false;
+				}
+				else {
+					// Right page when merged: skip drawing as left pages
+					// has drawn it full width
+					drawHeader = false;
+				}
+			}
+		}
+		int phi = m_pageHeaderInfo;
+		if ( useTwoHeaders ) {
+			if ( isRightPage ) { // Right page shows everything but author
+				phi &= ~PGHDR_AUTHOR;
+			}
+			else { // Left page shows only author
+				phi &= ~PGHDR_TITLE;
+				phi &= ~PGHDR_PERCENT;
+				phi &= ~PGHDR_PAGE_NUMBER;
+				phi &= ~PGHDR_PAGE_COUNT;
+				phi &= ~PGHDR_BATTERY;
+				phi &= ~PGHDR_CLOCK;
+			}
+		}
+		if ( drawHeader ) {
+			getPageHeaderRectangle(page.index, headerRc, mergeTwoHeaders);
+			headerInfoFlags = phi;
+			return true;
+		}
+	}
+	return false;
+}
+
 void LVDocView::drawPageTo(LVDrawBuf * drawbuf, LVRendPageInfo & page,
 		lvRect * pageRect, int pageCount, int basePage, bool hasTwoVisiblePages, bool isRightPage, bool isLastPage) {
 	int start = page.start;
@@ -2051,56 +2503,10 @@ void LVDocView::drawPageTo(LVDrawBuf * drawbuf, LVRendPageInfo & page,
 
 	if (page.flags & RN_PAGE_TYPE_COVER)
 		clip.top = pageRect->top + m_pageMargins.top;
-	if ( (m_pageHeaderInfo || !m_pageHeaderOverride.empty()) && getViewMode() == DVM_PAGES ) {
-		// Decide what to draw in header
-		// (In 2-pages mode, we are called for each of the 2 pages)
-		bool drawHeader = true;
-		bool hasTwoPages = getVisiblePageCount() == 2;
-		bool useTwoHeaders = hasTwoPages && !m_twoVisiblePagesAsOnePageNumber;
-		bool mergeTwoHeaders = hasTwoPages && !useTwoHeaders;
-		bool isRightPage = page.index & 1;
-		bool isCoverPage = !(page.flags & RN_PAGE_TYPE_NORMAL); // FB2 cover page
-		// Handle a few edge cases
-		if ( isCoverPage ) {
-			// Never draw header on a FB2 cover page
-			drawHeader = false;
-		}
-		else if ( mergeTwoHeaders ) {
-			if ( isRightPage ) {
-				if ( page.index == 1 && !(m_pages[0]->flags & RN_PAGE_TYPE_NORMAL) ) {
-					// 2nd page, but left page is a cover without header
-					// Draw it as if unmerged
-					useTwoHeaders = true;
-					mergeTwoHeaders = false;
-				}
-				else {
-					// Right page when merged: skip drawing as left pages
-					// has drawn it full width
-					drawHeader = false;
-				}
-			}
-		}
-		int phi = m_pageHeaderInfo;
-		if ( useTwoHeaders ) {
-			if ( isRightPage ) { // Right page shows everything but author
-				phi &= ~PGHDR_AUTHOR;
-			}
-			else { // Left page shows only author
-				phi &= ~PGHDR_TITLE;
-				phi &= ~PGHDR_PERCENT;
-				phi &= ~PGHDR_PAGE_NUMBER;
-				phi &= ~PGHDR_PAGE_COUNT;
-				phi &= ~PGHDR_BATTERY;
-				phi &= ~PGHDR_CLOCK;
-			}
-		}
-		if ( drawHeader ) {
-			lvRect info;
-			getPageHeaderRectangle(page.index, info, mergeTwoHeaders);
-			drawPageHeader(drawbuf, info, page.index - 1 + basePage, phi, pageCount - 1 + basePage);
-			//clip.top = info.bottom;
-		}
-	}
+	lvRect headerRc;
+	int phi;
+	if ( getPageHeaderLayout(page, headerRc, phi) )
+		drawPageHeader(drawbuf, headerRc, page.index - 1 + basePage, phi, pageCount - 1 + basePage);
 	drawbuf->SetClipRect(&clip);
 	if (m_doc) {
 		if (page.flags & RN_PAGE_TYPE_COVER) {
@@ -2140,7 +2546,7 @@ void LVDocView::drawPageTo(LVDrawBuf * drawbuf, LVRendPageInfo & page,
 				CRLog::trace("Entering DrawDocument() : %d ranges", m_markRanges.length());
 			//CRLog::trace("Entering DrawDocument()");
 			if (page.height)
-				DrawDocument(*drawbuf, m_doc->getRootNode(),
+				DrawDocumentInBands(*drawbuf, m_doc->getRootNode(),
 						pageRect->left + m_pageMargins.left, // x0
 						clip.top,                            // y0
 						pageRect->width() - m_pageMargins.left - m_pageMargins.right, // dx
@@ -2502,6 +2908,26 @@ void LVDocView::drawPageBackground( LVDrawBuf & drawbuf, int offsetX, int offset
     */
 }
 
+void LVDocView::prerenderGlyphs( int position, int page, int pageCount, int height, bool wantHidden ) {
+	if ( fontMan->GetGlyphPrerenderThreads() < 2 )
+		return;
+	LVFontGlyphSet glyphs;
+	ldomNode * root = m_doc->getRootNode();
+	if ( isScrollMode() ) {
+		CollectDocumentGlyphs(root, -position, height, glyphs, wantHidden);
+	} else {
+		for ( int i = page; i >= 0 && i < page + pageCount && i < m_pages.length(); i++ ) {
+			LVRendPageInfo * p = m_pages[i];
+			if ( p->height )
+				CollectDocumentGlyphs(root, -p->start, p->height, glyphs, wantHidden);
+			for ( int fn = 0; fn < p->footnotes.length(); fn++ )
+				CollectDocumentGlyphs(root, -p->footnotes[fn].start, p->footnotes[fn].height, glyphs, wantHidden);
+		}
+	}
+	// (returns without waiting for the glyphs to be rasterized)
+	fontMan->PrerenderGlyphs( glyphs );
+}
+
 /// draw to specified buffer
 void LVDocView::Draw(LVDrawBuf & drawbuf, int position, int page, bool rotate, bool autoresize) {
 	LVLock lock(getMutex());
@@ -2538,7 +2964,10 @@ void LVDocView::Draw(LVDrawBuf & drawbuf, int position, int page, bool rotate, b
 			rc.right -= m_pageMargins.right;
 			drawCoverTo(&drawbuf, rc);
 		}
-		DrawDocument(drawbuf, m_doc->getRootNode(),
+		// Have the glyphs to draw rasterized in parallel while we draw (drawing
+		// then finds them in the glyph cache, or rasterizes the ones not yet done)
+		prerenderGlyphs(position, 0, 0, drawbuf.GetHeight(), drawbuf.WantsHiddenContent());
+		DrawDocumentInBands(drawbuf, m_doc->getRootNode(),
 				m_pageMargins.left,  // x0
 				0,                   // y0
 				drawbuf.GetWidth() - m_pageMargins.left - m_pageMargins.right, // dx
@@ -2547,6 +2976,8 @@ void LVDocView::Draw(LVDrawBuf & drawbuf, int position, int page, bool rotate, b
 				-position,           // doc_y
 				drawbuf.GetHeight(), // page_height
 				&m_markRanges, &m_bmkRanges);
+		// and the next screen ones, while the user reads this one
+		prerenderGlyphs(position + drawbuf.GetHeight(), 0, 0, drawbuf.GetHeight(), drawbuf.WantsHiddenContent());
 	} else {
 		int pc = getVisiblePageCount();
 		//CRLog::trace("searching for page with offset=%d", position);
@@ -2557,12 +2988,18 @@ void LVDocView::Draw(LVDrawBuf & drawbuf, int position, int page, bool rotate, b
         //drawPageBackground(drawbuf, (page * 1356) & 0xFFF, 0x1000 - (page * 1356) & 0xFFF);
         drawPageBackground(drawbuf, 0, 0);
 
+        // Have the glyphs to draw rasterized in parallel while we draw (drawing
+        // then finds them in the glyph cache, or rasterizes the ones not yet done)
+        prerenderGlyphs(0, page, pc, 0, drawbuf.WantsHiddenContent());
         if (page >= 0 && page < m_pages.length())
 			drawPageTo(&drawbuf, *m_pages[page], &m_pageRects[0],
 					m_pages.length(), 1, pc==2, false, page==m_pages.length()-1);
 		if (pc == 2 && page >= 0 && page + 1 < m_pages.length())
 			drawPageTo(&drawbuf, *m_pages[page + 1], &m_pageRects[1],
 					m_pages.length(), 1, true, true, page+1==m_pages.length()-1);
+		// and the next page(s) ones, while the user reads these
+		if (page >= 0)
+			prerenderGlyphs(0, page + pc, pc, 0, drawbuf.WantsHiddenContent());
 	}
 #if CR_INTERNAL_PAGE_ORIENTATION==1
 	if ( rotate ) {
@@ -3093,6 +3530,19 @@ void LVDocView::Render(int dx, int dy, LVRendPageList * pages) {
 			m_section_bounds_valid = false;
 			fontMan->gc();
 		}
+		else if ( m_doc->isPartialRerenderingEnabled() && !_posBookmark.isNull() ) {
+			// Rerendering delayed: lay out now only the DocFragment we are positioned in,
+			// so the current page is right. The others will be when drawn, or progressively
+			// with renderPendingFragments().
+			ldomNode * fragments = m_doc->getRootNode()->getChildNode(0);
+			for ( ldomNode * n = _posBookmark.getNode(); n; n = n->getParentNode() ) {
+				if ( n->getParentNode() == fragments ) {
+					if ( n->getNodeId() == el_DocFragment )
+						m_doc->partialRender(n);
+					break;
+				}
+			}
+		}
 		m_is_rendered = true;
 		//CRLog::debug("Making TOC...");
 		//makeToc();
@@ -5241,6 +5691,29 @@ ContinuousOperationResult LVDocView::updateCache()
     return swapToCache(infinite);
 }
 
+/// progressively rerender the DocFragments left behind by a delayed (partial) rerendering, nearest to current position first
+ContinuousOperationResult LVDocView::renderPendingFragments(CRTimerUtil & maxTime)
+{
+    LVLock lock(getMutex());
+    if ( !m_doc || !m_is_rendered || !m_doc->isPartialRerenderingEnabled() )
+        return CR_DONE;
+    lUInt32 prev_partial_rerenderings_count = m_doc->getPartialRerenderingsCount();
+    ContinuousOperationResult res = m_doc->partialRenderPending( maxTime, _posBookmark.getNode() );
+    if ( m_doc->getPartialRerenderingsCount() != prev_partial_rerenderings_count ) {
+        // Fragments before the current position may have changed height: have the
+        // position set back from the bookmark on next access, and redraw
+        _posIsSet = false;
+        m_section_bounds_valid = false;
+        clearImageCache();
+        if ( res == CR_DONE ) {
+            // All DocFragments are now laid out for the current settings: pages won't move anymore
+            updatePageNumbers(m_doc->getToc());
+            updateBookMarksRanges();
+        }
+    }
+    return res;
+}
+
 /// save document to cache file, with timeout option
 ContinuousOperationResult LVDocView::swapToCache(CRTimerUtil & maxTime)
 {
@@ -6601,6 +7074,8 @@ void LVDocView::propsUpdateDefaults(CRPropRef props) {
 	props->limitValueList(PROP_FONT_HINTING, int_option_hinting, 3);
 	static int int_option_kerning[] = { 0, 1, 2, 3 };
 	props->limitValueList(PROP_FONT_KERNING, int_option_kerning, 4);
+	static int int_option_subpixel[] = { 1, 2, 4 };
+	props->limitValueList(PROP_FONT_SUBPIXEL_POSITIONING, int_option_subpixel, 3);
     static int int_options_1_2[] = { 2, 1 };
 	props->limitValueList(PROP_LANDSCAPE_PAGES, int_options_1_2, 2);
 	props->limitValueList(PROP_PAGES_TWO_VISIBLE_AS_ONE_PAGE_NUMBER, bool_options_def_false, 2);
@@ -6794,6 +7269,13 @@ CRPropRef LVDocView::propsApply(CRPropRef props) {
                     // requestRender() does m_doc->clearRendBlockCache(), which is needed
                     // on hinting mode change
             }
+        } else if (name == PROP_FONT_SUBPIXEL_POSITIONING) {
+            int phases = props->getIntDef(PROP_FONT_SUBPIXEL_POSITIONING, 1);
+            if (fontMan->GetSubpixelPositioning() != phases) {
+                fontMan->SetSubpixelPositioning(phases);
+                REQUEST_RENDER("propsApply - font subpixel positioning")
+                    // advances are no more rounded per glyph
+            }
         } else if (name == PROP_HIGHLIGHT_SELECTION_COLOR || name == PROP_HIGHLIGHT_BOOKMARK_COLOR_COMMENT || name == PROP_HIGHLIGHT_BOOKMARK_COLOR_COMMENT) {
             REQUEST_RENDER("propsApply - highlight")
         } else if (name == PROP_LANDSCAPE_PAGES) {
@@ -16,6 +16,9 @@
 #include <stdio.h>
 #include <string.h>
 #include "../include/lvdrawbuf.h"
+#include "lvglyphblend.h"
+#include "lvdither.h"
+#include "lvrotate.h"
 
 #define GUARD_BYTE 0xa5
 #define CHECK_GUARD_BYTE \
@@ -245,6 +248,73 @@ lUInt32 Dither1BitColor( lUInt32 color, lUInt32 x, lUInt32 y )
     return (cl >> 7) & 1;
 }
 
+bool QuantizeToGray( const lUInt8 * src, int srcPitch, int srcBpp, int dx, int dy,
+                     lUInt8 * dst, int dstPitch, int dstBpp, DrawBufDitherMode mode, const lvRect * rect )
+{
+    if ( !src || !dst || dx <= 0 || dy <= 0 )
+        return false;
+    if ( dstBpp != 1 && dstBpp != 2 && dstBpp != 4 )
+        return false;
+    if ( srcBpp != 2 && srcBpp != 3 && srcBpp != 4 && srcBpp != 8 && srcBpp != 32 )
+        return false;
+    if ( dst == src && (rect || dstPitch > srcPitch) )
+        return false;
+    const int pixelsPerByte = 8 / dstBpp;
+    int x0 = 0, y0 = 0, x1 = dx, y1 = dy;
+    if ( rect ) {
+        x0 = rect->left > 0 ? rect->left : 0;
+        y0 = rect->top > 0 ? rect->top : 0;
+        x1 = rect->right < dx ? rect->right : dx;
+        y1 = rect->bottom < dy ? rect->bottom : dy;
+        if ( x0 >= x1 || y0 >= y1 )
+            return true;
+        // whole destination bytes
+        x0 -= x0 % pixelsPerByte;
+        x1 += (pixelsPerByte - x1 % pixelsPerByte) % pixelsPerByte;
+        if ( x1 > dx )
+            x1 = dx;
+    }
+    const int count = x1 - x0;
+    const int padded = (count + 7) & ~7;
+    const int maxLevel = (1 << dstBpp) - 1;
+    const bool diffuse = mode == DITHER_FLOYD_STEINBERG || mode == DITHER_ATKINSON;
+    // levels are zero filled up to padded, as ditherPackRow() needs
+    lUInt8 * levels = (lUInt8 *) calloc(padded * 2, sizeof(lUInt8));
+    lUInt8 * gray = levels + padded;
+    int * err = diffuse ? (int *) calloc((count + 4) * 3, sizeof(int)) : NULL;
+    int * err0 = err;
+    int * err1 = diffuse ? err + (count + 4) : NULL;
+    int * err2 = diffuse ? err + (count + 4) * 2 : NULL;
+    for ( int y = y0; y < y1; y++ ) {
+        const lUInt8 * row = src + (size_t)srcPitch * y;
+        const lUInt8 * g = gray;
+        if ( srcBpp == 32 )
+            ditherGrayRow32( gray, (const lUInt32 *)row + x0, count );
+        else if ( srcBpp == 2 )
+            ditherGrayRow2( gray, row, x0, count );
+        else
+            g = row + x0;
+        if ( diffuse ) {
+            ditherDiffuseRow( levels, g, count, maxLevel, err0, err1, err2, mode == DITHER_ATKINSON );
+            int * t = err0;
+            err0 = err1;
+            err1 = err2;
+            err2 = t;
+            memset( err2, 0, (count + 4) * sizeof(int) );
+        } else {
+            // Bayer thresholds of this row, in 0..255, or middle threshold without dithering
+            lUInt8 thresholds[8];
+            for ( int i = 0; i < 8; i++ )
+                thresholds[i] = mode == DITHER_ORDERED ? (lUInt8)(dither_2bpp_8x8[((y & 7) << 3) | i] * 4 + 2) : 128;
+            ditherOrderedRow( levels, g, count, x0, thresholds, maxLevel );
+        }
+        ditherPackRow( dst + (size_t)dstPitch * y + x0 / pixelsPerByte, levels, count, dstBpp );
+    }
+    free( err );
+    free( levels );
+    return true;
+}
+
 static lUInt8 revByteBits1( lUInt8 b )
 {
     return ( (b&1)<<7 )
@@ -265,6 +335,49 @@ lUInt8 revByteBits2( lUInt8 b )
         |  ( (b&0xC0)>>6 );
 }
 
+bool RotatePixels( const lUInt8 * src, int srcPitch, int dx, int dy, int bpp,
+                   lUInt8 * dst, int dstPitch, cr_rotate_angle_t angle )
+{
+    if ( !src || !dst || src == dst || dx <= 0 || dy <= 0 )
+        return false;
+    if ( bpp != 1 && bpp != 2 && bpp != 3 && bpp != 4 && bpp != 8 && bpp != 16 && bpp != 32 )
+        return false;
+    const int pixelBytes = bpp <= 2 ? 0 : bpp <= 8 ? 1 : bpp / 8; // 0: packed
+    switch ( angle ) {
+    case CR_ROTATE_ANGLE_0:
+        {
+            const int rowBytes = pixelBytes ? dx * pixelBytes : (dx * bpp + 7) / 8;
+            for ( int y=0; y<dy; y++ )
+                memcpy( dst + (size_t)dstPitch * y, src + (size_t)srcPitch * y, rowBytes );
+        }
+        break;
+    case CR_ROTATE_ANGLE_180:
+        if ( pixelBytes == 0 )
+            rotate180Packed( src, srcPitch, dx, dy, bpp, dst, dstPitch );
+        else if ( pixelBytes == 1 )
+            rotate180<lUInt8>( src, srcPitch, dx, dy, dst, dstPitch );
+        else if ( pixelBytes == 2 )
+            rotate180<lUInt16>( src, srcPitch, dx, dy, dst, dstPitch );
+        else
+            rotate180<lUInt32>( src, srcPitch, dx, dy, dst, dstPitch );
+        break;
+    default:
+        {
+            const bool cw = angle==CR_ROTATE_ANGLE_90;
+            if ( pixelBytes == 0 )
+                rotatePacked( src, srcPitch, dx, dy, bpp, dst, dstPitch, cw );
+            else if ( pixelBytes == 1 )
+                rotateTiled<lUInt8>( src, srcPitch, dx, dy, dst, dstPitch, cw );
+            else if ( pixelBytes == 2 )
+                rotateTiled<lUInt16>( src, srcPitch, dx, dy, dst, dstPitch, cw );
+            else
+                rotateTiled<lUInt32>( src, srcPitch, dx, dy, dst, dstPitch, cw );
+        }
+        break;
+    }
+    return true;
+}
+
 /// rotates buffer contents by specified angle
 void LVGrayDrawBuf::Rotate( cr_rotate_angle_t angle )
 {
@@ -292,42 +405,29 @@ void LVGrayDrawBuf::Rotate( cr_rotate_angle_t angle )
                 buf[sz-i-1] = tmp;
             }
         }
+        markDirtyAll();
         return;
     }
     const int newrowsize = _bpp<=2 ? (_dy * _bpp + 7) / 8 : _dy;
     sz = (newrowsize * _dx);
-    lUInt8 * __restrict dst = (lUInt8 *)calloc(sz, sizeof(*dst));
-    for ( int y=0; y<_dy; y++ ) {
-        const lUInt8 * __restrict src = _data + _rowsize*y;
-        int dstx, dsty;
-        for ( int x=0; x<_dx; x++ ) {
-            if ( angle==CR_ROTATE_ANGLE_90 ) {
-                dstx = _dy-1-y;
-                dsty = x;
-            } else {
-                dstx = y;
-                dsty = _dx-1-x;
-            }
-            if ( _bpp==DRAW_BUF_1_BPP ) {
-                const lUInt8 px = (src[ x >> 3 ] << (x&7)) & 0x80;
-                lUInt8 * __restrict dstrow = dst + newrowsize * dsty;
-                dstrow[ dstx >> 3 ] |= (px >> (dstx&7));
-            } else if (_bpp==DRAW_BUF_2_BPP ) {
-                const lUInt8 px = (src[ x >> 2 ] << ((x&3)<<1)) & 0xC0;
-                lUInt8 * __restrict dstrow = dst + newrowsize * dsty;
-                dstrow[ dstx >> 2 ] |= (px >> ((dstx&3)<<1));
-            } else { // DRAW_BUF_3_BPP, DRAW_BUF_4_BPP, DRAW_BUF_8_BPP
-                lUInt8 * __restrict dstrow = dst + newrowsize * dsty;
-                dstrow[ dstx ] = src[ x ];
-            }
-        }
-    }
-    free( _data );
+    lUInt8 * dst = (lUInt8 *)calloc(sz + 1, sizeof(*dst));
+    RotatePixels( _data, _rowsize, _dx, _dy, _bpp, dst, newrowsize, angle );
+    dst[sz] = GUARD_BYTE;
+    if ( _ownData )
+        free( _data );
     _data = dst;
+    _ownData = true;
     int tmp = _dx;
     _dx = _dy;
     _dy = tmp;
     _rowsize = newrowsize;
+    markDirtyAll();
+}
+
+/// rotates buffer contents into external buffer, which gets rotated buffer size
+bool LVGrayDrawBuf::RotateTo( cr_rotate_angle_t angle, lUInt8 * dst, int dstPitch ) const
+{
+    return RotatePixels( _data, _rowsize, _dx, _dy, _bpp, dst, dstPitch, angle );
 }
 
 /// rotates buffer contents by specified angle
@@ -344,39 +444,19 @@ void LVColorDrawBuf::Rotate( cr_rotate_angle_t angle )
                 buf[i] = buf[sz-i-1];
                 buf[sz-i-1] = tmp;
             }
+            markDirtyAll();
             return;
         }
         const int newrowsize = _dy * 2;
         sz = (_dx * newrowsize);
-        lUInt16 * __restrict dst = (lUInt16*) malloc( sz );
-    #if !defined(__SYMBIAN32__) && defined(_WIN32) && !defined(QT_GL)
-        const bool cw = angle!=CR_ROTATE_ANGLE_90;
-    #else
-        const bool cw = angle==CR_ROTATE_ANGLE_90;
-    #endif
-        for ( int y=0; y<_dy; y++ ) {
-            const lUInt16 * __restrict src = (lUInt16*)_data + _dx*y;
-            int nx, ny;
-            if ( cw ) {
-                nx = _dy - 1 - y;
-            } else {
-                nx = y;
-            }
-            for ( int x=0; x<_dx; x++ ) {
-                if ( cw ) {
-                    ny = x;
-                } else {
-                    ny = _dx - 1 - x;
-                }
-                dst[ _dy*ny + nx ] = src[ x ];
-            }
-        }
+        lUInt8 * dst = (lUInt8 *) malloc( sz );
+        RotateTo( angle, dst, newrowsize );
     #if !defined(__SYMBIAN32__) && defined(_WIN32) && !defined(QT_GL)
         memcpy( _data, dst, sz );
         free( dst );
     #else
         free( _data );
-        _data = (lUInt8*)dst;
+        _data = dst;
     #endif
         const int tmp = _dx;
         _dx = _dy;
@@ -391,45 +471,39 @@ void LVColorDrawBuf::Rotate( cr_rotate_angle_t angle )
                 buf[i] = buf[sz-i-1];
                 buf[sz-i-1] = tmp;
             }
+            markDirtyAll();
             return;
         }
         const int newrowsize = _dy * 4;
         sz = (_dx * newrowsize);
-        lUInt32 * __restrict dst = (lUInt32*) malloc( sz );
-    #if !defined(__SYMBIAN32__) && defined(_WIN32) && !defined(QT_GL)
-        bool cw = angle!=CR_ROTATE_ANGLE_90;
-    #else
-        bool cw = angle==CR_ROTATE_ANGLE_90;
-    #endif
-        for ( int y=0; y<_dy; y++ ) {
-            const lUInt32 * __restrict src = (lUInt32*)_data + _dx*y;
-            int nx, ny;
-            if ( cw ) {
-                nx = _dy - 1 - y;
-            } else {
-                nx = y;
-            }
-            for ( int x=0; x<_dx; x++ ) {
-                if ( cw ) {
-                    ny = x;
-                } else {
-                    ny = _dx - 1 - x;
-                }
-                dst[ _dy*ny + nx ] = src[ x ];
-            }
-        }
+        lUInt8 * dst = (lUInt8 *) malloc( sz );
+        RotateTo( angle, dst, newrowsize );
     #if !defined(__SYMBIAN32__) && defined(_WIN32) && !defined(QT_GL)
         memcpy( _data, dst, sz );
         free( dst );
     #else
         free( _data );
-        _data = (lUInt8*)dst;
+        _data = dst;
     #endif
         const int tmp = _dx;
         _dx = _dy;
         _dy = tmp;
         _rowsize = newrowsize;
     }
+    markDirtyAll();
+}
+
+/// rotates buffer contents into external buffer, which gets rotated buffer size
+bool LVColorDrawBuf::RotateTo( cr_rotate_angle_t angle, lUInt8 * dst, int dstPitch ) const
+{
+#if !defined(__SYMBIAN32__) && defined(_WIN32) && !defined(QT_GL)
+    // bottom-up DIB rows: rotate the other way
+    if ( angle==CR_ROTATE_ANGLE_90 )
+        angle = CR_ROTATE_ANGLE_270;
+    else if ( angle==CR_ROTATE_ANGLE_270 )
+        angle = CR_ROTATE_ANGLE_90;
+#endif
+    return RotatePixels( _data, _rowsize, _dx, _dy, _bpp, dst, dstPitch, angle );
 }
 
 class LVImageScaledDrawCallback : public LVImageDecoderCallback
@@ -541,6 +615,36 @@ public:
         height = dst_dy;
         return true;
     }
+    virtual bool OnReducedSize( int width, int height )
+    {
+        // Nine-patch frame lines must be kept as is
+        if ( isNinePatch || width <= 0 || height <= 0 )
+            return false;
+        // Resample the reduced image instead (it is never smaller than the target)
+        src_dx = width;
+        src_dy = height;
+        if (xmap)
+            delete[] xmap;
+        if (ymap)
+            delete[] ymap;
+        xmap = NULL;
+        ymap = NULL;
+        if (smoothscale) {
+            delete[] decoded;
+            decoded = NULL;
+            if (src_dx == dst_dx && src_dy == dst_dy)
+                smoothscale = false;
+            else
+                decoded = new lUInt8[src_dy * (src_dx * 4)];
+        }
+        if ( !smoothscale ) {
+            if ( src_dx != dst_dx )
+                xmap = GenMap( src_dx, dst_dx );
+            if ( src_dy != dst_dy )
+                ymap = GenMap( src_dy, dst_dy );
+        }
+        return true;
+    }
     virtual ~LVImageScaledDrawCallback()
     {
         if (xmap)
@@ -891,6 +995,7 @@ int  LVGrayDrawBuf::GetBitsPerPixel() const
 
 void LVGrayDrawBuf::Draw( LVImageSourceRef img, int x, int y, int width, int height, bool dither )
 {
+    markDirtyClipped( x, y, x+width, y+height );
     //fprintf( stderr, "LVGrayDrawBuf::Draw( img(%d, %d), %d, %d, %d, %d\n", img->GetWidth(), img->GetHeight(), x, y, width, height );
     if ( width<=0 || height<=0 )
         return;
@@ -923,6 +1028,7 @@ lUInt32 LVGrayDrawBuf::GetPixel( int x, int y ) const
 
 void LVGrayDrawBuf::Clear( lUInt32 color )
 {
+    markDirtyAll();
     if (!_data)
         return;
     color = rgbToGrayMask( color, _bpp );
@@ -939,6 +1045,7 @@ void LVGrayDrawBuf::Clear( lUInt32 color )
 
 void LVGrayDrawBuf::FillRect( int x0, int y0, int x1, int y1, lUInt32 color32 )
 {
+    markDirtyClipped( x0, y0, x1, y1 );
     if (x0<_clip.left)
         x0 = _clip.left;
     if (y0<_clip.top)
@@ -990,6 +1097,7 @@ void LVGrayDrawBuf::FillRect( int x0, int y0, int x1, int y1, lUInt32 color32 )
 
 void LVGrayDrawBuf::FillRectPattern( int x0, int y0, int x1, int y1, lUInt32 color032, lUInt32 color132, const lUInt8 * __restrict pattern )
 {
+    markDirtyClipped( x0, y0, x1, y1 );
     if (x0<_clip.left)
         x0 = _clip.left;
     if (y0<_clip.top)
@@ -1066,6 +1174,7 @@ static const lUInt8 inverted_bytes[] = {
 #endif
 void LVGrayDrawBuf::InvertRect(int x0, int y0, int x1, int y1)
 {
+    markDirtyClipped( x0, y0, x1, y1 );
     if (x0<_clip.left)
         x0 = _clip.left;
     if (y0<_clip.top)
@@ -1150,6 +1259,7 @@ void LVGrayDrawBuf::Resize( int dx, int dy )
         Clear(0);
     }
     SetClipRect( NULL );
+    markDirtyAll();
 }
 
 /// returns white pixel value
@@ -1208,6 +1318,7 @@ LVGrayDrawBuf::~LVGrayDrawBuf()
 }
 void LVGrayDrawBuf::DrawLine(int x0, int y0, int x1, int y1, lUInt32 color0, int length1, int length2, int direction)
 {
+    markDirtyClipped( x0, y0, x1, y1 );
     if (x0<_clip.left)
         x0 = _clip.left;
     if (y0<_clip.top)
@@ -1229,19 +1340,18 @@ void LVGrayDrawBuf::DrawLine(int x0, int y0, int x1, int y1, lUInt32 color0, int
 
     for (int y=y0; y<y1; y++)
     {
-        if (_bpp==1) {
+        if (_bpp==1 || _bpp==2) {
+            // packed pixels: set the bits of pixel x only (writing whole bytes at
+            // index x would spill over the following rows)
+            lUInt8 * __restrict line = GetScanLine(y);
             for (int x=x0; x<x1; x++)
             {
-                lUInt8 * __restrict line = GetScanLine(y);
-                if (direction==0 &&x%(length1+length2)<length1)line[x] = color;
-                if (direction==1 &&y%(length1+length2)<length1)line[x] = color;
-            }
-        } else if (_bpp==2) {
-            for (int x=x0; x<x1; x++)
-            {
-                lUInt8 * __restrict line = GetScanLine(y);
-                if (direction==0 &&x%(length1+length2)<length1)line[x] = color;
-                if (direction==1 &&y%(length1+length2)<length1)line[x] = color;
+                if ( (direction==0 &&x%(length1+length2)<length1) ||
+                     (direction==1 &&y%(length1+length2)<length1) ) {
+                    const lUInt8 mask = _bpp==1 ? (0x80 >> (x & 7)) : (0xC0 >> ((x & 3) << 1));
+                    lUInt8 & b = line[_bpp==1 ? (x >> 3) : (x >> 2)];
+                    b = (lUInt8)((b & ~mask) | (color & mask));
+                }
             }
         } else { // 3, 4, 8
             for (int x=x0; x<x1; x++)
@@ -1260,6 +1370,7 @@ void LVGrayDrawBuf::DrawLine(int x0, int y0, int x1, int y1, lUInt32 color0, int
 }
 void LVGrayDrawBuf::Draw( int x, int y, const lUInt8 * bitmap, int width, int height, const lUInt32 * __restrict /*palette*/)
 {
+    markDirtyClipped( x, y, x+width, y+height );
     // NOTE: LVColorDrawBuf's variant does a _data NULL check?
     //int buf_width = _dx; /* 2bpp */
     const int initial_height = height;
@@ -1322,25 +1433,7 @@ void LVGrayDrawBuf::Draw( int x, int y, const lUInt8 * bitmap, int width, int he
             return;
         while (height--)
         {
-            const lUInt8 * __restrict src = bitmap;
-            lUInt8 * __restrict dst = dstline;
-            size_t px_count = width;
-            while (px_count--)
-            {
-                lUInt8 opacity = *(src++); // glyph opacity
-                if ( opacity == 0 ) {
-                    // Background pixel, NOP
-                }
-                else if (opacity == 0xFF && bopacity == 0xFF) { // fully opaque pixel and color
-                    *dst = color;
-                }
-                else {
-                    opacity = (opacity*bopacity)>>8;
-                    const lUInt8 alpha = opacity ^ 0xFF;
-                    ApplyAlphaGray8( *dst, color, alpha, opacity );
-                }
-                dst++;
-            }
+            glyphBlendRow8( dstline, bitmap, width, color, bopacity );
             /* next line, accounting for clipping in src and padding in dst */
             bitmap += bmp_width;
             dstline += _rowsize;
@@ -1465,6 +1558,72 @@ void LVBaseDrawBuf::SetClipRect( const lvRect * clipRect )
     }
 }
 
+// true if rectangles overlap or share an edge: their union is then not much more than both
+static inline bool dirtyRectsTouch( const lvRect & a, const lvRect & b )
+{
+    return !( a.right < b.left || b.right < a.left || a.bottom < b.top || b.bottom < a.top );
+}
+
+void LVBaseDrawBuf::markDirty( const lvRect & rect )
+{
+    if ( !_dirtyTracking )
+        return;
+    lvRect rc = rect;
+    if ( !rc.intersect( lvRect(0, 0, _dx, _dy) ) )
+        return;
+    for ( int i=0; i<_dirtyRects.length(); i++ ) {
+        if ( _dirtyRects[i].isRectInside( rc ) )
+            return;
+    }
+    // merge with touching rectangles; the merged one may touch others, so rescan
+    for ( int i=0; i<_dirtyRects.length(); ) {
+        if ( dirtyRectsTouch( _dirtyRects[i], rc ) ) {
+            rc.extend( _dirtyRects.remove( i ) );
+            i = 0;
+        } else {
+            i++;
+        }
+    }
+    if ( _dirtyRects.length() >= DRAWBUF_MAX_DIRTY_RECTS ) {
+        // too many rectangles: merge with the one giving the smallest union
+        int best = 0;
+        lInt64 bestGrowth = 0;
+        for ( int i=0; i<_dirtyRects.length(); i++ ) {
+            lvRect u = _dirtyRects[i];
+            u.extend( rc );
+            const lInt64 growth = (lInt64)u.width() * u.height()
+                    - (lInt64)_dirtyRects[i].width() * _dirtyRects[i].height();
+            if ( i==0 || growth < bestGrowth ) {
+                best = i;
+                bestGrowth = growth;
+            }
+        }
+        rc.extend( _dirtyRects.remove( best ) );
+        // the union may now touch or cover other rectangles
+        markDirty( rc );
+        return;
+    }
+    _dirtyRects.add( rc );
+}
+
+void LVBaseDrawBuf::getDirtyRects( LVArray<lvRect> & rects ) const
+{
+    if ( !_dirtyTracking ) {
+        rects.clear();
+        rects.add( lvRect(0, 0, _dx, _dy) );
+        return;
+    }
+    rects = _dirtyRects;
+}
+
+lvRect LVBaseDrawBuf::getDirtyBounds() const
+{
+    lvRect bounds;
+    for ( int i=0; i<_dirtyRects.length(); i++ )
+        bounds.extend( _dirtyRects[i] );
+    return bounds;
+}
+
 lUInt8 * LVGrayDrawBuf::GetScanLine( int y ) const
 {
     return _data + _rowsize*y;
@@ -1472,6 +1631,7 @@ lUInt8 * LVGrayDrawBuf::GetScanLine( int y ) const
 
 void LVGrayDrawBuf::Invert()
 {
+    markDirtyAll();
     unsigned char * __restrict p = _data;
     size_t px_count = _rowsize * _dy;
     while (px_count--) {
@@ -1483,47 +1643,28 @@ void LVGrayDrawBuf::ConvertToBitmap(bool flgDither)
 {
     if (_bpp==1)
         return;
-    // TODO: implement for byte per pixel mode
-    const size_t sz = GetRowSize();
-    lUInt8 * bitmap = (lUInt8*) calloc(sz, sizeof(*bitmap));
-    if (flgDither)
-    {
-        static const lUInt8 cmap[4][4] = {
-            { 0, 0, 0, 0},
-            { 0, 0, 1, 0},
-            { 0, 1, 0, 1},
-            { 1, 1, 1, 1},
-        };
-        for (int y=0; y<_dy; y++)
-        {
-            const lUInt8 * __restrict src = GetScanLine(y);
-            lUInt8 * __restrict dst = bitmap + ((_dx+7)/8)*y;
-            for (int x=0; x<_dx; x++) {
-                int cl = (src[x>>2] >> (6-((x&3)*2)))&3;
-                cl = cmap[cl][ (x&1) + ((y&1)<<1) ];
-                if (cmap[cl][ (x&1) + ((y&1)<<1) ])
-                    dst[x>>3] |= 0x80>>(x&7);
-            }
-        }
-    }
-    else
-    {
-        for (int y=0; y<_dy; y++)
-        {
-            const lUInt8 * __restrict src = GetScanLine(y);
-            lUInt8 * __restrict dst = bitmap + ((_dx+7)/8)*y;
-            for (int x=0; x<_dx; x++) {
-                const int cl = (src[x>>2] >> (7-((x&3)*2)))&1;
-                if (cl)
-                    dst[x>>3] |= 0x80>>(x&7);
-            }
-        }
-    }
-    free( _data );
-    _data = bitmap;
-    _bpp = 1;
-    _rowsize = (_dx+7)/8;
-	CHECK_GUARD_BYTE;
+    Quantize( 1, flgDither ? DITHER_ORDERED : DITHER_NONE );
+}
+
+bool LVGrayDrawBuf::Quantize( int bpp, DrawBufDitherMode mode, lUInt8 * dst, int dstPitch, const lvRect * rect )
+{
+    if ( dst )
+        return QuantizeToGray( _data, _rowsize, _bpp, _dx, _dy, dst, dstPitch, bpp, mode, rect );
+    // in place: only to the packed formats of this buffer, which never need more bytes per row
+    if ( bpp == _bpp )
+        return true;
+    if ( rect || (bpp != 1 && bpp != 2) || bpp > _bpp )
+        return false;
+    const int rowsize = (_dx * bpp + 7) / 8;
+    if ( !QuantizeToGray( _data, _rowsize, _bpp, _dx, _dy, _data, rowsize, bpp, mode ) )
+        return false;
+    _bpp = bpp;
+    _rowsize = rowsize;
+    if ( _ownData && _data )
+        _data[_rowsize * _dy] = GUARD_BYTE;
+    CHECK_GUARD_BYTE;
+    markDirtyAll();
+    return true;
 }
 
 //=======================================================
@@ -1543,6 +1684,7 @@ int  LVColorDrawBuf::GetBitsPerPixel() const
 
 void LVColorDrawBuf::Draw( LVImageSourceRef img, int x, int y, int width, int height, bool dither )
 {
+    markDirtyClipped( x, y, x+width, y+height );
     //fprintf( stderr, "LVColorDrawBuf::Draw( img(%d, %d), %d, %d, %d, %d\n", img->GetWidth(), img->GetHeight(), x, y, width, height );
     LVImageScaledDrawCallback drawcb( this, img, x, y, width, height, dither, _invertImages, _smoothImages );
     img->Decode( &drawcb );
@@ -1553,6 +1695,7 @@ void LVColorDrawBuf::Draw( LVImageSourceRef img, int x, int y, int width, int he
 /// fills buffer with specified color
 void LVColorDrawBuf::Clear( lUInt32 color )
 {
+    markDirtyAll();
     // NOTE: Guard against _dx <= 0?
     if ( _bpp==16 ) {
         const lUInt16 cl16 = rgb888to565(color);
@@ -1720,6 +1863,7 @@ lUInt32 LVBaseDrawBuf::GetAvgColor(lvRect & rc16) const
 /// fills rectangle with specified color
 void LVColorDrawBuf::FillRect( int x0, int y0, int x1, int y1, lUInt32 color )
 {
+    markDirtyClipped( x0, y0, x1, y1 );
     if (x0<_clip.left)
         x0 = _clip.left;
     if (y0<_clip.top)
@@ -1763,6 +1907,7 @@ void LVColorDrawBuf::FillRect( int x0, int y0, int x1, int y1, lUInt32 color )
 
 void LVColorDrawBuf::DrawLine(int x0, int y0, int x1, int y1, lUInt32 color0, int length1, int length2, int direction)
 {
+    markDirtyClipped( x0, y0, x1, y1 );
     if (x0<_clip.left)
         x0 = _clip.left;
     if (y0<_clip.top)
@@ -1813,6 +1958,7 @@ void LVColorDrawBuf::DrawLine(int x0, int y0, int x1, int y1, lUInt32 color0, in
 /// fills rectangle with specified color
 void LVColorDrawBuf::FillRectPattern( int x0, int y0, int x1, int y1, lUInt32 color0, lUInt32 color1, const lUInt8 * __restrict pattern )
 {
+    markDirtyClipped( x0, y0, x1, y1 );
     if (x0<_clip.left)
         x0 = _clip.left;
     if (y0<_clip.top)
@@ -1910,10 +2056,12 @@ void LVColorDrawBuf::Resize( int dx, int dy )
 #endif
     }
     SetClipRect( NULL );
+    markDirtyAll();
 }
 
 void LVColorDrawBuf::InvertRect(int x0, int y0, int x1, int y1)
 {
+    markDirtyClipped( x0, y0, x1, y1 );
     if (x0<_clip.left)
         x0 = _clip.left;
     if (y0<_clip.top)
@@ -1946,6 +2094,7 @@ void LVColorDrawBuf::InvertRect(int x0, int y0, int x1, int y1)
 /// draws bitmap (1 byte per pixel) using specified palette
 void LVColorDrawBuf::Draw( int x, int y, const lUInt8 * bitmap, int width, int height, const lUInt32 * __restrict palette )
 {
+    markDirtyClipped( x, y, x+width, y+height );
     if ( !_data )
         return;
     //int buf_width = _dx; /* 2bpp */
@@ -2002,31 +2151,8 @@ void LVColorDrawBuf::Draw( int x, int y, const lUInt8 * bitmap, int width, int h
 
         while (height--)
         {
-            const lUInt8 * __restrict src = bitmap;
             lUInt16 * __restrict dst = ((lUInt16*)GetScanLine(y++)) + x;
-
-            size_t px_count = width;
-            while (px_count--)
-            {
-                // Note: former code was considering pixel opacity >= 0xF0 as fully opaque (0xFF),
-                // not sure why (it would save on the blending computation by 5% to 15%).
-                lUInt8 opacity = *(src++); // glyph pixel opacity
-                if ( opacity == 0 ) {
-                    // Background pixel, NOP
-                }
-                else if (opacity == 0xFF && bopacity == 0xFF) { // fully opaque pixel and color
-                    *dst = bmpcl16;
-                }
-                else {
-                    opacity = (opacity*bopacity)>>8;
-                    const lUInt8 alpha = opacity ^ 0xFF;
-                    const lUInt32 r = ((((*dst) & 0xF800) * alpha + (bmpcl16 & 0xF800) * opacity) >> 8) & 0xF800;
-                    const lUInt32 g = ((((*dst) & 0x07E0) * alpha + (bmpcl16 & 0x07E0) * opacity) >> 8) & 0x07E0;
-                    const lUInt32 b = ((((*dst) & 0x001F) * alpha + (bmpcl16 & 0x001F) * opacity) >> 8) & 0x001F;
-                    *dst = (lUInt16)(r | g | b);
-                }
-                dst++;
-            }
+            glyphBlendRow16( dst, bitmap, width, bmpcl16, bopacity );
             /* new src line, to account for clipping */
             bitmap += bmp_width;
         }
@@ -2038,31 +2164,8 @@ void LVColorDrawBuf::Draw( int x, int y, const lUInt8 * bitmap, int width, int h
 
         while (height--)
         {
-            const lUInt8 * __restrict src = bitmap;
             lUInt32 * __restrict dst = ((lUInt32*)GetScanLine(y++)) + x;
-
-            size_t px_count = width;
-            while (px_count--)
-            {
-                // Note: former code was considering pixel opacity >= 0xF0 as fully opaque (0xFF),
-                // not sure why (it would save on the blending computation by 5% to 15%).
-                lUInt8 opacity = *(src++); // glyph pixel opacity
-                if ( opacity == 0 ) {
-                    // Background pixel, NOP
-                }
-                else if (opacity == 0xFF && bopacity == 0xFF) { // fully opaque pixel and color
-                    *dst = bmpcl32;
-                }
-                else {
-                    opacity = (opacity*bopacity)>>8;
-                    const lUInt8 alpha = opacity ^ 0xFF;
-                    const lUInt32 n1 = ((((*dst) & 0xFF00FF) * alpha + (bmpcl32 & 0xFF00FF) * opacity) >> 8) & 0xFF00FF;
-                    const lUInt32 n2 = ((((*dst) & 0x00FF00) * alpha + (bmpcl32 & 0x00FF00) * opacity) >> 8) & 0x00FF00;
-                    *dst = n1 | n2;
-                }
-
-                dst++;
-            }
+            glyphBlendRow32( dst, bitmap, width, bmpcl32, bopacity );
             bitmap += bmp_width;
         }
     }
@@ -2136,6 +2239,9 @@ void LVGrayDrawBuf::DrawTo( LVDrawBuf * __restrict buf, int x, int y, int option
     CR_UNUSED2(options, palette);
     lvRect clip;
     buf->GetClipRect(&clip);
+    lvRect dirty( x, y, x+_dx, y+_dy );
+    if ( clip.isEmpty() || dirty.intersect( clip ) )
+        buf->markDirty( dirty );
 
 	if ( !(!clip.isEmpty() || buf->GetBitsPerPixel()!=GetBitsPerPixel() || GetWidth()!=buf->GetWidth() || GetHeight()!=buf->GetHeight()) ) {
 		// simple copy
@@ -2365,6 +2471,9 @@ void LVGrayDrawBuf::DrawOnTop( LVDrawBuf * __restrict buf, int x, int y )
 {
     lvRect clip;
     buf->GetClipRect(&clip);
+    lvRect dirty( x, y, x+_dx, y+_dy );
+    if ( clip.isEmpty() || dirty.intersect( clip ) )
+        buf->markDirty( dirty );
 
     if ( !(!clip.isEmpty() || buf->GetBitsPerPixel()!=GetBitsPerPixel() || GetWidth()!=buf->GetWidth() || GetHeight()!=buf->GetHeight()) ) {
         // simple copy
@@ -2599,6 +2708,9 @@ void LVColorDrawBuf::DrawTo( LVDrawBuf * __restrict buf, int x, int y, int optio
         return;
     lvRect clip;
     buf->GetClipRect(&clip);
+    lvRect dirty( x, y, x+_dx, y+_dy );
+    if ( clip.isEmpty() || dirty.intersect( clip ) )
+        buf->markDirty( dirty );
     const int bpp = buf->GetBitsPerPixel();
     for (int yy=0; yy<_dy; yy++) {
         if (y+yy >= clip.top && y+yy < clip.bottom) {
@@ -2735,6 +2847,9 @@ void LVColorDrawBuf::DrawOnTop( LVDrawBuf * __restrict buf, int x, int y)
         return;
     lvRect clip;
     buf->GetClipRect(&clip);
+    lvRect dirty( x, y, x+_dx, y+_dy );
+    if ( clip.isEmpty() || dirty.intersect( clip ) )
+        buf->markDirty( dirty );
     const int bpp = buf->GetBitsPerPixel();
     for (int yy=0; yy<_dy; yy++) {
         if (y+yy >= clip.top && y+yy < clip.bottom) {
@@ -2875,6 +2990,7 @@ void LVColorDrawBuf::DrawOnTop( LVDrawBuf * __restrict buf, int x, int y)
 /// draws rescaled buffer content to another buffer doing color conversion if necessary
 void LVGrayDrawBuf::DrawRescaled(const LVDrawBuf * __restrict src, int x, int y, int dx, int dy, int options)
 {
+    markDirtyClipped( x, y, x+dx, y+dy );
     CR_UNUSED(options);
     if (dx < 1 || dy < 1)
         return;
@@ -3013,6 +3129,7 @@ void LVGrayDrawBuf::DrawRescaled(const LVDrawBuf * __restrict src, int x, int y,
 /// draws rescaled buffer content to another buffer doing color conversion if necessary
 void LVColorDrawBuf::DrawRescaled(const LVDrawBuf * __restrict src, int x, int y, int dx, int dy, int options)
 {
+    markDirtyClipped( x, y, x+dx, y+dy );
     CR_UNUSED(options);
     if (dx < 1 || dy < 1)
         return;
@@ -3141,3 +3258,495 @@ void LVColorDrawBuf::ConvertToBitmap(bool flgDither)
     CR_UNUSED(flgDither);
 }
 
+bool LVColorDrawBuf::Quantize( int bpp, DrawBufDitherMode mode, lUInt8 * dst, int dstPitch, const lvRect * rect )
+{
+    if ( _bpp != 32 )
+        return false;
+    return QuantizeToGray( _data, _rowsize, _bpp, _dx, _dy, dst, dstPitch, bpp, mode, rect );
+}
+
+
+// Rows of a src_dy rows image needed to draw rows [top, bottom) of the buffer, when drawn
+// at y with height dst_dy (nearest neighbour row mapping, as LVImageScaledDrawCallback::GenMap())
+static bool recordedImageRows( int y, int dst_dy, int src_dy, int top, int bottom, int & row0, int & row1 )
+{
+    int i0 = top - y;
+    int i1 = bottom - y;
+    if ( i0 < 0 )
+        i0 = 0;
+    if ( i1 > dst_dy )
+        i1 = dst_dy;
+    if ( i0 >= i1 )
+        return false;
+    row0 = i0 * src_dy / dst_dy;
+    row1 = (i1 - 1) * src_dy / dst_dy + 1;
+    return true;
+}
+
+/// Image drawn by a recorded call, and its decoded lines: rows [row0, row1) of the lines
+/// of a width x height image, as they would be fed to LVImageScaledDrawCallback
+class LVRecordedImage
+{
+public:
+    int src_dx;
+    int src_dy;
+    int dst_dx;
+    int dst_dy;
+    int dst_y;
+    int clip_top;
+    int clip_bottom;
+    bool smooth;
+    // copy of the image to be decoded by the replaying threads: once for
+    // all bands by decodeImage(), or by each band drawing it if perBand
+    LVImageSourceRef source;
+    bool perBand;
+    int width;
+    int height;
+    int row0;
+    int row1;
+    lUInt32 * pixels; // NULL if no line is visible
+    lUInt8 * decoded; // rows actually fed by decoder
+    LVRecordedImage( int sdx, int sdy, int ddx, int ddy, int y, int top, int bottom, bool smoothscale )
+    : src_dx(sdx), src_dy(sdy), dst_dx(ddx), dst_dy(ddy), dst_y(y), clip_top(top), clip_bottom(bottom)
+    , smooth(smoothscale), perBand(false), width(0), height(0), row0(0), row1(0), pixels(NULL), decoded(NULL)
+    {
+    }
+    void allocate( int dx, int dy, int r0, int r1 )
+    {
+        release();
+        width = dx;
+        height = dy;
+        row0 = r0;
+        row1 = r1;
+        pixels = new lUInt32[ (r1 - r0) * dx ];
+        decoded = new lUInt8[ r1 - r0 ];
+        memset( decoded, 0, r1 - r0 );
+    }
+    void release()
+    {
+        delete[] pixels;
+        delete[] decoded;
+        pixels = NULL;
+        decoded = NULL;
+        width = height = row0 = row1 = 0;
+    }
+    int getBytes() const { return (row1 - row0) * (width * 4 + 1); }
+    /// bytes the decoded lines will take (at most: decoders may provide a reduced size image)
+    int getDecodedBytes() const;
+    /// decodes img, keeping the lines needed for rows [clip_top, clip_bottom)
+    void decode( LVImageSource * img );
+    ~LVRecordedImage()
+    {
+        release();
+    }
+};
+
+/// Decoder callback storing the lines LVImageScaledDrawCallback would use to LVRecordedImage
+/// (smooth scaling them first when requested)
+class LVImageRecordingCallback : public LVImageDecoderCallback
+{
+private:
+    LVRecordedImage * rec;
+    int src_dx;
+    int src_dy;
+    lUInt8 * decoded;
+    void setSourceSize( int sdx, int sdy )
+    {
+        src_dx = sdx;
+        src_dy = sdy;
+        rec->release();
+        if ( decoded )
+            delete[] decoded;
+        decoded = NULL;
+        // as LVImageScaledDrawCallback: no smooth scaling if the image has the drawn size
+        const bool smooth = rec->smooth && (src_dx != rec->dst_dx || src_dy != rec->dst_dy);
+        const int dx = smooth ? rec->dst_dx : src_dx;
+        const int dy = smooth ? rec->dst_dy : src_dy;
+        int row0, row1;
+        if ( dx<=0 || dy<=0 || !recordedImageRows( rec->dst_y, rec->dst_dy, dy, rec->clip_top, rec->clip_bottom, row0, row1 ) )
+            return;
+        rec->allocate( dx, dy, row0, row1 );
+        if ( smooth ) {
+            decoded = new lUInt8[src_dy * (src_dx * 4)];
+            memset( decoded, 0, src_dy * (src_dx * 4) );
+        }
+    }
+    void storeLine( int y, const lUInt32 * data )
+    {
+        if ( !rec->pixels || y < rec->row0 || y >= rec->row1 )
+            return;
+        memcpy( rec->pixels + (y - rec->row0) * rec->width, data, rec->width * 4 );
+        rec->decoded[ y - rec->row0 ] = 1;
+    }
+public:
+    explicit LVImageRecordingCallback( LVRecordedImage * image )
+    : rec(image), decoded(NULL)
+    {
+        setSourceSize( rec->src_dx, rec->src_dy );
+    }
+    virtual ~LVImageRecordingCallback()
+    {
+        if ( decoded )
+            delete[] decoded;
+    }
+    virtual bool GetTargetSize( int & width, int & height ) const {
+        width = rec->dst_dx;
+        height = rec->dst_dy;
+        return true;
+    }
+    virtual bool OnReducedSize( int width, int height )
+    {
+        // accepted by LVImageScaledDrawCallback too (nine-patch images aren't recorded)
+        if ( width <= 0 || height <= 0 )
+            return false;
+        setSourceSize( width, height );
+        return true;
+    }
+    virtual void OnStartDecode( LVImageSource * ) { }
+    virtual bool OnLineDecoded( LVImageSource *, int y, lUInt32 * __restrict data )
+    {
+        if ( decoded ) {
+            if ( y >= 0 && y < src_dy )
+                memcpy( decoded + (y * (src_dx * 4)), data, (src_dx * 4) );
+            return true;
+        }
+        storeLine( y, data );
+        return true;
+    }
+    virtual void OnEndDecode( LVImageSource *, bool )
+    {
+        if ( !decoded || !rec->pixels )
+            return;
+        const int dst_dx = rec->dst_dx;
+        lUInt8 * sdata = CRe::qSmoothScaleImage(decoded, src_dx, src_dy, false, dst_dx, rec->dst_dy);
+        if ( !sdata )
+            return; // nothing drawn, as by LVImageScaledDrawCallback
+        for ( int y = rec->row0; y < rec->row1; y++ )
+            storeLine( y, (const lUInt32 *)(sdata + (y * (dst_dx * 4))) );
+        free( sdata );
+    }
+};
+
+int LVRecordedImage::getDecodedBytes() const
+{
+    const bool smoothed = smooth && (src_dx != dst_dx || src_dy != dst_dy);
+    const int dx = smoothed ? dst_dx : src_dx;
+    int r0, r1;
+    if ( !recordedImageRows( dst_y, dst_dy, smoothed ? dst_dy : src_dy, clip_top, clip_bottom, r0, r1 ) )
+        return 0;
+    return (r1 - r0) * (dx * 4 + 1);
+}
+
+void LVRecordedImage::decode( LVImageSource * img )
+{
+    LVImageRecordingCallback cb( this );
+    img->Decode( &cb );
+}
+
+/// Feeds recorded lines (those needed for rows [top, bottom) of the buffer) to decoder callbacks
+class LVRecordedImageSource : public LVImageSource
+{
+private:
+    // may be decoded after this source is created: sizes are read when drawing
+    const LVRecordedImage * rec;
+    int dst_y;
+    int dst_dy;
+    int top;
+    int bottom;
+public:
+    LVRecordedImageSource( const LVRecordedImage * image, int y, int dy, int clip_top, int clip_bottom )
+    : rec(image), dst_y(y), dst_dy(dy), top(clip_top), bottom(clip_bottom)
+    {
+    }
+    virtual ldomNode * GetSourceNode() { return NULL; }
+    virtual LVStream * GetSourceStream() { return NULL; }
+    virtual ldomDocument * GetSourceDocument() { return NULL; }
+    virtual void Compact() { }
+    virtual int GetWidth() const { return rec->width; }
+    virtual int GetHeight() const { return rec->height; }
+    virtual bool Decode( LVImageDecoderCallback * callback )
+    {
+        callback->OnStartDecode( this );
+        int row0, row1;
+        if ( rec->pixels && recordedImageRows( dst_y, dst_dy, rec->height, top, bottom, row0, row1 ) ) {
+            if ( row0 < rec->row0 )
+                row0 = rec->row0;
+            if ( row1 > rec->row1 )
+                row1 = rec->row1;
+            for ( int y = row0; y < row1; y++ ) {
+                if ( rec->decoded[ y - rec->row0 ] )
+                    callback->OnLineDecoded( this, y, rec->pixels + (y - rec->row0) * rec->width );
+            }
+        }
+        callback->OnEndDecode( this, false );
+        return true;
+    }
+    virtual ~LVRecordedImageSource() { }
+};
+
+LVRecordingDrawBuf::LVRecordingDrawBuf( LVDrawBuf & target )
+: _bpp( target.GetBitsPerPixel() )
+, _whiteColor( target.GetWhiteColor() )
+, _blackColor( target.GetBlackColor() )
+, _imageBytes( 0 )
+, _replayable( true )
+{
+    _dx = target.GetWidth();
+    _dy = target.GetHeight();
+    _rowsize = target.GetRowSize();
+    _textColor = target.GetTextColor();
+    _backgroundColor = target.GetBackgroundColor();
+    _drawExtraInfo = target.GetDrawExtraInfo();
+    target.GetClipRect( &_clip );
+    LVBaseDrawBuf * base = target.asBaseDrawBuf();
+    if ( base ) {
+        _hidePartialGlyphs = base->getHidePartialGlyphs();
+        _invertImages = base->getInvertImages();
+        _ditherImages = base->getDitherImages();
+        _smoothImages = base->getSmoothScalingImages();
+    }
+    // decoded images may take as much memory as 8 32 bpp buffers
+    _imageBytesLimit = _dx * _dy * 4 * 8;
+    // modified area (see getDirtyBounds()) tells which rows are worth replaying
+    _dirtyTracking = true;
+}
+
+LVRecordingDrawBuf::~LVRecordingDrawBuf()
+{
+}
+
+bool LVRecordingDrawBuf::addCommand( int type, const lvRect & clip, int x0, int y0, int x1, int y1,
+                                     lUInt32 color0, lUInt32 color1, int param0, int param1, int param2 )
+{
+    lvRect rc( x0, y0, x1, y1 );
+    if ( !rc.intersect( clip ) )
+        return false;
+    Command cmd;
+    cmd.type = type;
+    cmd.clip = clip;
+    cmd.rc = lvRect( x0, y0, x1, y1 );
+    cmd.color0 = color0;
+    cmd.color1 = color1;
+    cmd.param0 = param0;
+    cmd.param1 = param1;
+    cmd.param2 = param2;
+    _commands.add( cmd );
+    return true;
+}
+
+void LVRecordingDrawBuf::FillRect( int x0, int y0, int x1, int y1, lUInt32 color )
+{
+    if ( !_replayable )
+        return;
+    markDirtyClipped( x0, y0, x1, y1 );
+    addCommand( CMD_FILL_RECT, _clip, x0, y0, x1, y1, color );
+}
+
+void LVRecordingDrawBuf::FillRectPattern( int x0, int y0, int x1, int y1, lUInt32 color0, lUInt32 color1, const lUInt8 * __restrict pattern )
+{
+    if ( !_replayable )
+        return;
+    markDirtyClipped( x0, y0, x1, y1 );
+    // pattern rows are used as pattern[y & 3]
+    int bytes;
+    memcpy( &bytes, pattern, 4 );
+    addCommand( CMD_FILL_RECT_PATTERN, _clip, x0, y0, x1, y1, color0, color1, bytes );
+}
+
+void LVRecordingDrawBuf::InvertRect( int x0, int y0, int x1, int y1 )
+{
+    if ( !_replayable )
+        return;
+    markDirtyClipped( x0, y0, x1, y1 );
+    addCommand( CMD_INVERT_RECT, _clip, x0, y0, x1, y1 );
+}
+
+void LVRecordingDrawBuf::DrawLine( int x0, int y0, int x1, int y1, lUInt32 color0, int length1, int length2, int direction )
+{
+    if ( !_replayable )
+        return;
+    markDirtyClipped( x0, y0, x1, y1 );
+    addCommand( CMD_DRAW_LINE, _clip, x0, y0, x1, y1, color0, 0, length1, length2, direction );
+}
+
+void LVRecordingDrawBuf::Draw( int x, int y, const lUInt8 * bitmap, int width, int height, const lUInt32 * __restrict palette )
+{
+    if ( !_replayable )
+        return;
+    lvRect clip = _clip;
+    if ( _hidePartialGlyphs ) {
+        // Resolve hiding of partially visible glyphs now, with the same tests as
+        // LVGrayDrawBuf/LVColorDrawBuf::Draw(): bands are replayed without it.
+        int h = height;
+        if ( y < clip.top ) {
+            h += y - clip.top;
+            if ( h <= height/2 )
+                return;
+        }
+        if ( y + height > clip.bottom ) {
+            if ( h <= height/2 )
+                return;
+            clip.bottom = _dy;
+        }
+    }
+    lvRect rc( x, y, x+width, y+height );
+    if ( rc.intersect( clip ) )
+        markDirty( rc );
+    const int offset = _bitmaps.length();
+    if ( !addCommand( CMD_DRAW_BITMAP, clip, x, y, x+width, y+height, _textColor,
+                      palette ? palette[0] : 0, offset, palette ? 1 : 0 ) )
+        return;
+    // grow by half: append() would reserve the exact size
+    const int size = width * height;
+    if ( offset + size > _bitmaps.size() )
+        _bitmaps.reserve( offset + size + _bitmaps.size() / 2 + 4096 );
+    _bitmaps.append( bitmap, size );
+}
+
+void LVRecordingDrawBuf::Draw( LVImageSourceRef img, int x, int y, int width, int height, bool dither )
+{
+    if ( !_replayable )
+        return;
+    markDirtyClipped( x, y, x+width, y+height );
+    if ( width<=0 || height<=0 ) {
+        // LVColorDrawBuf counts such images, LVGrayDrawBuf doesn't
+        if ( _bpp >= 16 )
+            _drawnImagesCount++;
+        return;
+    }
+    _drawnImagesCount++;
+    _drawnImagesSurface += width*height;
+    if ( img->GetNinePatchInfo() ) {
+        // nine-patch lines map is not a plain scaling: can't be cropped to needed rows
+        _replayable = false;
+        return;
+    }
+    int src_dx = img->GetWidth();
+    int src_dy = img->GetHeight();
+    if ( img->IsScalable() ) {
+        // decoded at drawn size, see LVImageScaledDrawCallback
+        src_dx = width;
+        src_dy = height;
+    }
+    if ( src_dx<=0 || src_dy<=0 )
+        return;
+    if ( !addCommand( CMD_DRAW_IMAGE, _clip, x, y, x+width, y+height, 0, 0, _images.length(), dither ? 1 : 0 ) )
+        return;
+    LVRecordedImage * rec = new LVRecordedImage( src_dx, src_dy, width, height, y, _clip.top, _clip.bottom, _smoothImages );
+    _images.add( rec );
+    // Images that can be decoded from a copy of their data are left to the threads
+    // replaying bands: decoded once for all bands by decodeImage(), or by each band
+    // drawing it when its lines would take too much memory.
+    rec->source = LVCreateImageSourceCopy( img );
+    if ( !rec->source.isNull() ) {
+        const int bytes = rec->getDecodedBytes();
+        if ( _imageBytes + bytes > _imageBytesLimit )
+            rec->perBand = true;
+        else
+            _imageBytes += bytes;
+        return;
+    }
+    rec->decode( img.get() );
+    _imageBytes += rec->getBytes();
+    if ( _imageBytes > _imageBytesLimit )
+        _replayable = false;
+}
+
+void LVRecordingDrawBuf::getBandImages( const lvRect & band, LVArray<LVImageSourceRef> & images ) const
+{
+    images.clear();
+    images.reserve( _images.length() );
+    for ( int i = 0; i < _images.length(); i++ )
+        images.add( LVImageSourceRef() );
+    for ( int i = 0; i < _commands.length(); i++ ) {
+        const Command & cmd = _commands.ptr()[i];
+        lvRect clip = cmd.clip;
+        if ( cmd.type != CMD_DRAW_IMAGE || !clip.intersect( band ) )
+            continue;
+        const LVRecordedImage * rec = _images[cmd.param0];
+        if ( rec->perBand )
+            images[cmd.param0] = LVCreateImageSourceCopy( rec->source );
+        else
+            images[cmd.param0] = LVImageSourceRef( new LVRecordedImageSource( rec, cmd.rc.top, cmd.rc.height(),
+                                                                              clip.top, clip.bottom ) );
+    }
+}
+
+void LVRecordingDrawBuf::getBandDeferredImages( const lvRect & band, LVArray<int> & indexes ) const
+{
+    indexes.clear();
+    for ( int i = 0; i < _commands.length(); i++ ) {
+        const Command & cmd = _commands.ptr()[i];
+        lvRect clip = cmd.clip;
+        if ( cmd.type != CMD_DRAW_IMAGE || !clip.intersect( band ) )
+            continue;
+        if ( isDeferredImage( cmd.param0 ) )
+            indexes.add( cmd.param0 );
+    }
+}
+
+bool LVRecordingDrawBuf::isDeferredImage( int index ) const
+{
+    const LVRecordedImage * rec = _images[index];
+    return !rec->source.isNull() && !rec->perBand;
+}
+
+void LVRecordingDrawBuf::decodeImage( int index ) const
+{
+    // (the source is only used by this thread: references are left untouched)
+    LVRecordedImage * rec = _images[index];
+    rec->decode( rec->source.get() );
+}
+
+void LVRecordingDrawBuf::Replay( LVBaseDrawBuf & buf, const lvRect & band, LVArray<LVImageSourceRef> & images ) const
+{
+    buf.setHidePartialGlyphs( false ); // resolved while recording
+    buf.setInvertImages( _invertImages );
+    buf.setDitherImages( _ditherImages );
+    buf.setSmoothScalingImages( false ); // recorded images are already scaled
+    buf.SetDrawExtraInfo( _drawExtraInfo );
+    for ( int i = 0; i < _commands.length(); i++ ) {
+        const Command & cmd = _commands.ptr()[i];
+        lvRect clip = cmd.clip;
+        if ( !clip.intersect( band ) )
+            continue;
+        buf.SetClipRect( &clip );
+        const lvRect & rc = cmd.rc;
+        switch ( cmd.type ) {
+        case CMD_FILL_RECT:
+            buf.FillRect( rc.left, rc.top, rc.right, rc.bottom, cmd.color0 );
+            break;
+        case CMD_FILL_RECT_PATTERN:
+            {
+                lUInt8 pattern[4];
+                memcpy( pattern, &cmd.param0, 4 );
+                buf.FillRectPattern( rc.left, rc.top, rc.right, rc.bottom, cmd.color0, cmd.color1, pattern );
+            }
+            break;
+        case CMD_INVERT_RECT:
+            buf.InvertRect( rc.left, rc.top, rc.right, rc.bottom );
+            break;
+        case CMD_DRAW_LINE:
+            buf.DrawLine( rc.left, rc.top, rc.right, rc.bottom, cmd.color0, cmd.param0, cmd.param1, cmd.param2 );
+            break;
+        case CMD_DRAW_BITMAP:
+            buf.SetTextColor( cmd.color0 );
+            buf.Draw( rc.left, rc.top, _bitmaps.ptr() + cmd.param0, rc.width(), rc.height(),
+                      cmd.param1 ? &cmd.color1 : NULL );
+            break;
+        case CMD_DRAW_IMAGE:
+            {
+                const LVRecordedImage * rec = _images[cmd.param0];
+                if ( images[cmd.param0].isNull() || (!rec->perBand && !rec->pixels) )
+                    break;
+                // images decoded by each band are scaled by it
+                buf.setSmoothScalingImages( rec->perBand && rec->smooth );
+                buf.Draw( images[cmd.param0], rc.left, rc.top, rc.width(), rc.height(), cmd.param1 != 0 );
+                buf.setSmoothScalingImages( false );
+            }
+            break;
+        }
+    }
+    buf.SetTextColor( _textColor );
+    buf.SetClipRect( NULL );
+}
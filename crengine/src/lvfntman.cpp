@@ -14,6 +14,7 @@
 
 #include <stdlib.h>
 #include <stdio.h>
+#include <new>
 
 
 
@@ -23,6 +24,8 @@
 #include "../include/lvdrawbuf.h"
 #include "../include/lvstyles.h"
 #include "../include/lvthread.h"
+#include "../include/lvhashtable.h"
+#include "../include/crconcurrent.h"
 
 // Uncomment for debugging text measurement or drawing
 // #define DEBUG_MEASURE_TEXT
@@ -62,6 +65,7 @@
 #include <hb-ft.h>
 #include <hb-ot.h>
 #include "lvhashtable.h"
+#include <chrono>
 #endif
 
 #if (USE_FONTCONFIG==1)
@@ -274,6 +278,7 @@ void LVFontManager::SetGammaIndex( int index ) {
         index = GAMMA_LEVELS-1;
     if ( gammaIndex!=index ) {
         CRLog::trace("FontManager gamma index changed from %d to %d", gammaIndex, index);
+        WaitGlyphPrerendering(); // (prerendering tasks apply gamma)
         gammaIndex = index;
         gammaLevel = cr_gamma_levels[index];
         gc();
@@ -290,6 +295,7 @@ double LVFontManager::GetGamma() {
 void LVFontManager::SetGamma( double gamma ) {
     // gammaLevel = cr_ft_gamma_levels[GAMMA_LEVELS/2];
     // gammaIndex = GAMMA_LEVELS/2;
+    WaitGlyphPrerendering(); // (prerendering tasks apply gamma)
     int oldGammaIndex = gammaIndex;
     for ( int i=0; i<GAMMA_LEVELS; i++ ) {
         double diff1 = cr_gamma_levels[i] - gamma;
@@ -425,6 +431,29 @@ int LVFont::getVisualAligmentWidth() {
     return _visual_alignment_width;
 }
 
+void LVFontGlyphSet::add( LVFont * font, const lChar32 * text, int len ) {
+    if ( !font || len <= 0 )
+        return;
+    if ( !_last || _last->font.get() != font ) {
+        // consecutive words are mostly in the same font
+        _last = NULL;
+        for ( int i=0; i<_entries.length(); i++ ) {
+            if ( _entries[i]->font.get() == font ) {
+                _last = _entries[i];
+                break;
+            }
+        }
+        if ( !_last ) {
+            _last = new Entry(font);
+            _entries.add(_last);
+        }
+    }
+    for ( int i=0; i<len; i++ ) {
+        if ( text[i] > 0x20 )
+            _last->chars.add(text[i]);
+    }
+}
+
 static lChar32 getReplacementChar(lUInt32 code, bool * can_be_ignored = NULL) {
     switch (code) {
     case UNICODE_SOFT_HYPHEN_CODE:
@@ -564,6 +593,7 @@ bool isHBScriptCursive( hb_script_t script ) {
 */
 class LVFontDef
 {
+    friend struct LVFontCacheKey;
 private:
     int               _size;
     int               _weight;
@@ -693,6 +723,36 @@ public:
     }
 };
 
+/// font cache find() request, to memoize its result
+struct LVFontCacheKey
+{
+    lString8 typeface; // comma separated list, as requested
+    int size;
+    int weight;
+    int italic;
+    int features;
+    int family;
+    int documentId;
+    bool useBias;
+    LVFontCacheKey() : size(0), weight(0), italic(0), features(0), family(0), documentId(-1), useBias(false) { }
+    LVFontCacheKey( const LVFontDef & def, bool bias )
+        : typeface(def._typeface), size(def._size), weight(def._weight)
+        , italic(def._italic), features(def._features)
+        , family(def._family), documentId(def._documentId), useBias(bias)
+        { }
+    bool operator == ( const LVFontCacheKey & k ) const {
+        return size == k.size && weight == k.weight && italic == k.italic && features == k.features
+            && family == k.family && documentId == k.documentId && useBias == k.useBias
+            && typeface == k.typeface;
+    }
+};
+
+// face name, weight and italic are what mostly differ between requests
+inline lUInt32 getHash( const LVFontCacheKey & k )
+{
+    return ((k.typeface.getHash() * 31 + (lUInt32)k.weight) * 31 + (lUInt32)k.italic) * 31 + (lUInt32)k.size;
+}
+
 /// font cache item
 class LVFontCacheItem
 {
@@ -713,8 +773,14 @@ class LVFontCache
 {
     LVPtrVector< LVFontCacheItem > _registered_list;
     LVPtrVector< LVFontCacheItem > _instance_list;
+    // find() results: getFont() is called for each styled node, with only a few
+    // distinct requests, each needing to match all registered fonts and instances.
+    // Must be dropped on any change to the lists or to the fonts bias.
+    LVHashTable< LVFontCacheKey, LVFontCacheItem * > _find_memo;
+    LVFontCacheItem * _find( const LVFontDef * def, bool useBias );
 public:
     void clear() {
+        _find_memo.clear();
         // First: execute a garbage collection pass.
         gc();
         // Finally: clear remaining references.
@@ -867,6 +933,7 @@ public:
         // font to regular (400) and one to bold (700).
         // It should ensure we use real fonts (and not synthesized ones) for normal text
         // and bold text with the font_base_weight setting set to its default value of 400.
+        _find_memo.clear(); // registered weights may change
         class BestCandidates {
             public:
             LVFontCacheItem * regular;
@@ -958,7 +1025,7 @@ public:
 
     }
 
-    LVFontCache( )
+    LVFontCache( ) : _find_memo(64)
     { }
     virtual ~LVFontCache() { }
 };
@@ -1136,195 +1203,348 @@ static LVFontGlyphCacheItem * newItem(LVFontLocalGlyphCache *local_cache, lUInt3
 }
 #endif
 
-// Each LVFontGlyphCacheItem is put in 2 caches:
-// - the LVFontLocalGlyphCache LVFreeTypeFace->_glyph_cache of the
-//   font it comes from
-// - the LVFontGlobalGlyphCache LVFreeTypeFontManager->_globalCache of
-//   the global and unique FontManager.
-// The first one is used for quick iteration to find the glyph in a
-// known font/size instance.
-// The global one is used to limit the number of cached glyphs, globally
-// across all fonts.
-// When adding the glyph to the local cache, the local cache adds it
-// to the global cache. When that happens, the global cache checks
-// its max_size, and remove any LRU item, by deleting it from itself,
-// and asking the relevant local cache to remove it too.
+// Each LVFontGlyphCacheItem is allocated in a LVFontGlyphCachePage
+// of the LVFontLocalGlyphCache LVFreeTypeFace->_glyph_cache of the
+// font it comes from, and indexed there for quick lookup of the glyph
+// in a known font/size instance.
+// Each page is put in the LVFontGlobalGlyphCache
+// LVFreeTypeFontManager->_globalCache of the global and unique
+// FontManager, which is used to limit the memory used by cached glyphs,
+// globally across all fonts.
+// When a local cache needs a new page, the global cache checks its
+// max_size, and removes the LRU pages, by deleting them from itself,
+// and asking the relevant local cache to forget their items and free them.
+// Lookups (getByChar(), getByIndex()) don't take any lock: they only
+// stamp the page of the found item with the global cache clock.
+// As another thread may evict a page while glyphs from it are being
+// drawn, evicted pages (and glyph index tables replaced when growing)
+// are not freed right away but retired to the global cache, which frees
+// them once no thread is inside a LVFontGlyphCacheReadSection (drawing
+// text or prerendering glyphs).
+
+// Glyph pages are allocated with increasing sizes, so fonts used for
+// a few glyphs (titles, fallback fonts) don't waste much
+#define GLYPH_CACHE_PAGE_MIN_SIZE 0x1000
+#define GLYPH_CACHE_PAGE_MAX_SIZE 0x8000
+// (items start at 16 bytes aligned offsets, see LVFontGlyphCacheItem::bmp)
+#define GLYPH_CACHE_ITEM_ALIGN(sz) (((sz) + 15) & ~15)
+
+// With subpixel positioning, glyphs rendered at other phases than 0 are
+// cached by index, with the phase in the high bits (glyph indexes are 16 bits)
+#define GLYPH_INDEX_WITH_PHASE(index, phase) ((lUInt32)(index) | ((lUInt32)(phase) << 24))
+
+static lUInt8 _glyphIndexDeletedSentinel;
+#define GLYPH_INDEX_DELETED ((LVFontGlyphCacheItem *)&_glyphIndexDeletedSentinel)
+
+static inline lUInt32 glyphIndexKey( const GlyphCacheItemData & data )
+{
+    return *((lUInt32*)&data);
+}
 
-void LVFontLocalGlyphCache::clear()
+LVFontGlyphIndex::Table * LVFontGlyphIndex::newTable( lUInt32 size )
 {
-    FONT_LOCAL_GLYPH_CACHE_GUARD
-#if USE_GLYPHCACHE_HASHTABLE == 1
-    LVHashTable<GlyphCacheItemData, struct LVFontGlyphCacheItem*>::iterator it = hashTable.forwardIterator();
-    LVHashTable<GlyphCacheItemData, struct LVFontGlyphCacheItem*>::pair* pair;
-    while ((pair = it.next()))
-    {
-        global_cache->remove(pair->value);
-        LVFontGlyphCacheItem::freeItem(pair->value);
+    // single malloc'ed block, so it can be retired to the global cache
+    Table * t = (Table *)malloc( offsetof(Table, slots) + size * sizeof(t->slots[0]) );
+    t->mask = size - 1;
+    for ( lUInt32 i = 0; i < size; i++ )
+        new (&t->slots[i]) std::atomic<LVFontGlyphCacheItem*>(NULL);
+    return t;
+}
+
+void LVFontGlyphIndex::insert( Table * t, LVFontGlyphCacheItem * item )
+{
+    lUInt32 j = slotOf(glyphIndexKey(item->data), t->mask);
+    while ( t->slots[j].load(std::memory_order_relaxed) )
+        j = (j + 1) & t->mask;
+    t->slots[j].store(item, std::memory_order_release);
+}
+
+LVFontGlyphCacheItem * LVFontGlyphIndex::get( lUInt32 key ) const
+{
+    Table * t = table.load(std::memory_order_acquire);
+    if ( !t )
+        return NULL;
+    for ( lUInt32 i = slotOf(key, t->mask); ; i = (i + 1) & t->mask ) {
+        LVFontGlyphCacheItem * item = t->slots[i].load(std::memory_order_acquire);
+        if ( !item )
+            return NULL;
+        if ( item != GLYPH_INDEX_DELETED && glyphIndexKey(item->data) == key )
+            return item;
     }
-    hashTable.clear();
-#else
-    while ( head ) {
-        LVFontGlyphCacheItem * ptr = head;
-        remove( ptr );
-        global_cache->remove( ptr );
-        LVFontGlyphCacheItem::freeItem( ptr );
+}
+
+void LVFontGlyphIndex::rebuild()
+{
+    Table * old = table.load(std::memory_order_relaxed);
+    lUInt32 size = 64;
+    while ( size < (lUInt32)(count + 1) * 2 )
+        size <<= 1;
+    if ( old && size <= old->mask + 1 ) {
+        // Not more items than when the table was made, only removed item
+        // slots: rehash in place rather than retiring a table each time
+        // pages get evicted
+        LVArray<LVFontGlyphCacheItem*> items( count, NULL );
+        int n = 0;
+        for ( lUInt32 i = 0; i <= old->mask; i++ ) {
+            LVFontGlyphCacheItem * item = old->slots[i].load(std::memory_order_relaxed);
+            if ( item && item != GLYPH_INDEX_DELETED )
+                items[n++] = item;
+            old->slots[i].store(NULL, std::memory_order_release);
+        }
+        for ( int i = 0; i < n; i++ )
+            insert( old, items[i] );
+        deleted = 0;
+        return;
     }
-#endif
+    Table * t = newTable(size);
+    if ( old ) {
+        for ( lUInt32 i = 0; i <= old->mask; i++ ) {
+            LVFontGlyphCacheItem * item = old->slots[i].load(std::memory_order_relaxed);
+            if ( item && item != GLYPH_INDEX_DELETED )
+                insert( t, item );
+        }
+    }
+    deleted = 0;
+    table.store(t, std::memory_order_release);
+    if ( old ) // readers may still be walking the old table
+        global_cache->retire( old );
 }
 
-LVFontGlyphCacheItem * LVFontLocalGlyphCache::getByChar(lChar32 ch)
+void LVFontGlyphIndex::put( lUInt32 key, LVFontGlyphCacheItem * item )
+{
+    Table * t = table.load(std::memory_order_relaxed);
+    if ( !t || (lUInt32)(count + deleted + 1) * 4 > (t->mask + 1) * 3 ) {
+        rebuild();
+        t = table.load(std::memory_order_relaxed);
+    }
+    lUInt32 i = slotOf(key, t->mask);
+    for ( ;; i = (i + 1) & t->mask ) {
+        LVFontGlyphCacheItem * p = t->slots[i].load(std::memory_order_relaxed);
+        if ( !p )
+            break;
+        if ( p != GLYPH_INDEX_DELETED && glyphIndexKey(p->data) == key ) {
+            // replace (its page storage is left as is)
+            t->slots[i].store(item, std::memory_order_release);
+            return;
+        }
+    }
+    t->slots[i].store(item, std::memory_order_release);
+    count++;
+}
+
+void LVFontGlyphIndex::removePage( LVFontGlyphCachePage * page )
+{
+    Table * t = table.load(std::memory_order_relaxed);
+    if ( !t )
+        return;
+    for ( lUInt32 i = 0; i <= t->mask; i++ ) {
+        LVFontGlyphCacheItem * item = t->slots[i].load(std::memory_order_relaxed);
+        if ( item && item != GLYPH_INDEX_DELETED && item->page == page ) {
+            t->slots[i].store(GLYPH_INDEX_DELETED, std::memory_order_release);
+            count--;
+            deleted++;
+        }
+    }
+}
+
+void LVFontGlyphIndex::clear()
+{
+    Table * t = table.load(std::memory_order_relaxed);
+    table.store(NULL, std::memory_order_release);
+    if ( t )
+        global_cache->retire( t );
+    count = 0;
+    deleted = 0;
+}
+
+void LVFontLocalGlyphCache::clear()
 {
     FONT_LOCAL_GLYPH_CACHE_GUARD
-#if USE_GLYPHCACHE_HASHTABLE == 1
-    LVFontGlyphCacheItem *ptr = 0;
+    index.clear();
+    while ( pages ) {
+        LVFontGlyphCachePage * page = pages;
+        pages = page->next_local;
+        global_cache->remove( page );
+        global_cache->retire( page );
+    }
+    next_page_size = 0;
+}
+
+LVFontGlyphCacheItem * LVFontLocalGlyphCache::getByChar(lChar32 ch)
+{
     GlyphCacheItemData data;
     data.ch = ch;
-    if (hashTable.get(data, ptr))
-        return ptr;
-#else
-    LVFontGlyphCacheItem * ptr = head;
-    for ( ; ptr; ptr = ptr->next_local ) {
-        if ( ptr->data.ch == ch ) {
-            global_cache->refresh( ptr );
-            return ptr;
-        }
-    }
-#endif
-    return NULL;
+    LVFontGlyphCacheItem * ptr = index.get(glyphIndexKey(data));
+    if ( ptr )
+        ptr->page->touch( global_cache->getClock() );
+    return ptr;
 }
 
 #if USE_HARFBUZZ==1
 LVFontGlyphCacheItem * LVFontLocalGlyphCache::getByIndex(lUInt32 index)
 {
-    FONT_LOCAL_GLYPH_CACHE_GUARD
-#if USE_GLYPHCACHE_HASHTABLE == 1
-    LVFontGlyphCacheItem *ptr = 0;
     GlyphCacheItemData data;
     data.gindex = index;
-    if (hashTable.get(data, ptr))
-        return ptr;
-#else
-    LVFontGlyphCacheItem *ptr = head;
-    for (; ptr; ptr = ptr->next_local) {
-        if (ptr->data.gindex == index) {
-            global_cache->refresh( ptr );
-            return ptr;
-        }
-    }
-#endif
-    return NULL;
+    LVFontGlyphCacheItem * ptr = this->index.get(glyphIndexKey(data));
+    if ( ptr )
+        ptr->page->touch( global_cache->getClock() );
+    return ptr;
 }
 #endif
 
-void LVFontLocalGlyphCache::put( LVFontGlyphCacheItem * item )
+LVFontGlyphCacheItem * LVFontLocalGlyphCache::alloc( int itemSize )
 {
     FONT_LOCAL_GLYPH_CACHE_GUARD
-    global_cache->put( item );
-#if USE_GLYPHCACHE_HASHTABLE == 1
-    hashTable.set(item->data, item);
-#else
-    item->next_local = head;
-    if ( head )
-        head->prev_local = item;
-    if ( !tail )
-        tail = item;
-    head = item;
-#endif
+    itemSize = GLYPH_CACHE_ITEM_ALIGN(itemSize);
+    LVFontGlyphCachePage * page = pages;
+    if ( !page || page->used + itemSize > page->capacity() ) {
+        // New page, large enough for this item
+        int pageSize = next_page_size ? next_page_size : GLYPH_CACHE_PAGE_MIN_SIZE;
+        if ( next_page_size < GLYPH_CACHE_PAGE_MAX_SIZE )
+            next_page_size = pageSize * 2;
+        int minSize = (int)offsetof(LVFontGlyphCachePage, data) + itemSize;
+        if ( pageSize < minSize )
+            pageSize = minSize;
+        global_cache->reserve( pageSize );
+        page = (LVFontGlyphCachePage *)malloc( pageSize );
+        if ( !page )
+            return NULL;
+        page->prev_global = NULL;
+        page->next_global = NULL;
+        page->local_cache = this;
+        page->last_used.store( global_cache->getClock(), std::memory_order_relaxed );
+        page->size = pageSize;
+        page->used = 0;
+        page->next_local = pages;
+        pages = page;
+        global_cache->put( page );
+    }
+    LVFontGlyphCacheItem * item = (LVFontGlyphCacheItem *)(page->data + page->used);
+    page->used += itemSize;
+    page->touch( global_cache->getClock() );
+    item->page = page;
+    global_cache->tick();
+    return item;
 }
 
-/// remove from list, but don't delete
-void LVFontLocalGlyphCache::remove( LVFontGlyphCacheItem * item )
+void LVFontLocalGlyphCache::put( LVFontGlyphCacheItem * item )
 {
     FONT_LOCAL_GLYPH_CACHE_GUARD
-#if USE_GLYPHCACHE_HASHTABLE == 1
-    hashTable.remove(item->data);
-#else
-    if ( item==head )
-        head = item->next_local;
-    if ( item==tail )
-        tail = item->prev_local;
-    if ( !head || !tail )
-        return;
-    if ( item->prev_local )
-        item->prev_local->next_local = item->next_local;
-    if ( item->next_local )
-        item->next_local->prev_local = item->prev_local;
-    item->next_local = NULL;
-    item->prev_local = NULL;
-#endif
+    index.put( glyphIndexKey(item->data), item );
 }
 
-#if USE_GLYPHCACHE_HASHTABLE != 1
-void LVFontGlobalGlyphCache::refresh( LVFontGlyphCacheItem * item )
+void LVFontLocalGlyphCache::removePage( LVFontGlyphCachePage * page )
 {
-    FONT_GLYPH_CACHE_GUARD
-    if ( tail!=item ) {
-        //move to head
-        removeNoLock( item );
-        putNoLock( item );
-    }
+    FONT_LOCAL_GLYPH_CACHE_GUARD
+    index.removePage( page );
+    LVFontGlyphCachePage ** p = &pages;
+    while ( *p && *p != page )
+        p = &(*p)->next_local;
+    if ( *p )
+        *p = page->next_local;
+    global_cache->retire( page );
 }
-#endif
 
-void LVFontGlobalGlyphCache::put( LVFontGlyphCacheItem * item )
+void LVFontGlobalGlyphCache::reserve( int pageSize )
 {
     FONT_GLYPH_CACHE_GUARD
-    putNoLock(item);
+    // Pages used since the previous glyph allocation may have glyphs still
+    // in use by the caller (ie. LVFontBoldTransform::getGlyph()): keep them,
+    // even if that makes us go over max_size.
+    lUInt32 now = clock.load(std::memory_order_relaxed);
+    while ( size + pageSize > max_size ) {
+        LVFontGlyphCachePage * lru = NULL;
+        lUInt32 lru_age = 0;
+        for ( LVFontGlyphCachePage * page = head; page; page = page->next_global ) {
+            lUInt32 age = now - page->last_used.load(std::memory_order_relaxed);
+            if ( age > lru_age ) {
+                lru = page;
+                lru_age = age;
+            }
+        }
+        if ( !lru )
+            break;
+        removeNoLock( lru );
+        lru->local_cache->removePage( lru );
+    }
 }
 
-void LVFontGlobalGlyphCache::putNoLock( LVFontGlyphCacheItem * item )
+void LVFontGlobalGlyphCache::put( LVFontGlyphCachePage * page )
 {
-    int sz = item->getSize();
-    // remove extra items from tail
-    while ( sz + size > max_size ) {
-        LVFontGlyphCacheItem * removed_item = tail;
-        if ( !removed_item )
-            break;
-        removeNoLock( removed_item );
-        removed_item->local_cache->remove( removed_item );
-        LVFontGlyphCacheItem::freeItem( removed_item );
-    }
-    // add new item to head
-    item->next_global = head;
+    FONT_GLYPH_CACHE_GUARD
+    page->next_global = head;
     if ( head )
-        head->prev_global = item;
-    head = item;
+        head->prev_global = page;
+    head = page;
     if ( !tail )
-        tail = item;
-    size += sz;
+        tail = page;
+    size += page->size;
 }
 
-void LVFontGlobalGlyphCache::remove( LVFontGlyphCacheItem * item )
+void LVFontGlobalGlyphCache::remove( LVFontGlyphCachePage * page )
 {
     FONT_GLYPH_CACHE_GUARD
-    removeNoLock(item);
+    removeNoLock(page);
 }
 
-void LVFontGlobalGlyphCache::removeNoLock( LVFontGlyphCacheItem * item )
+void LVFontGlobalGlyphCache::removeNoLock( LVFontGlyphCachePage * page )
 {
-    size -= item->getSize();
-    if ( item==head )
-        head = item->next_global;
-    if ( item==tail )
-        tail = item->prev_global;
-    if ( !head || !tail )
+    size -= page->size;
+    if ( page->prev_global )
+        page->prev_global->next_global = page->next_global;
+    else
+        head = page->next_global;
+    if ( page->next_global )
+        page->next_global->prev_global = page->prev_global;
+    else
+        tail = page->prev_global;
+    page->next_global = NULL;
+    page->prev_global = NULL;
+}
+
+void LVFontGlobalGlyphCache::enterReader()
+{
+    readers.fetch_add(1, std::memory_order_relaxed);
+    // Pairs with the fence in retire(): either retire() sees us, or we
+    // see the index without what is being retired
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+}
+
+void LVFontGlobalGlyphCache::leaveReader()
+{
+    if ( readers.fetch_sub(1, std::memory_order_acq_rel) != 1 )
         return;
-    if ( item->prev_global )
-        item->prev_global->next_global = item->next_global;
-    if ( item->next_global )
-        item->next_global->prev_global = item->prev_global;
-    item->next_global = NULL;
-    item->prev_global = NULL;
+    FONT_GLYPH_CACHE_GUARD
+    // Nobody can reach retired blocks anymore: readers entering now will
+    // only walk the current index tables and pages
+    if ( readers.load(std::memory_order_relaxed) == 0 )
+        freeRetiredNoLock();
+}
+
+void LVFontGlobalGlyphCache::retire( void * block )
+{
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    FONT_GLYPH_CACHE_GUARD
+    if ( readers.load(std::memory_order_relaxed) == 0 )
+        free( block );
+    else
+        retired.add( block );
+}
+
+void LVFontGlobalGlyphCache::freeRetiredNoLock()
+{
+    for ( int i=0; i<retired.length(); i++ )
+        free( retired[i] );
+    retired.clear();
 }
 
 void LVFontGlobalGlyphCache::clear()
 {
     FONT_GLYPH_CACHE_GUARD
     while ( head ) {
-        LVFontGlyphCacheItem * ptr = head;
-        remove( ptr );
-        ptr->local_cache->remove( ptr );
-        LVFontGlyphCacheItem::freeItem( ptr );
+        LVFontGlyphCachePage * page = head;
+        removeNoLock( page );
+        page->local_cache->removePage( page );
     }
 }
 
@@ -1433,6 +1653,163 @@ struct LVCharPosInfo
     lInt16 width;
 };
 
+// For use with Harfbuzz full: hb_shape() input, as set in _hb_buffer.
+// OpenType features are not part of it: they are per font, and
+// the font shaping cache is cleared when they change.
+struct LVHBShapingKey
+{
+    lString32 text; // codepoints added to the buffer (after any filterChar())
+    hb_direction_t direction;
+    hb_script_t script;
+    hb_language_t language;
+    int flags; // hb_buffer_flags_t
+    bool operator == ( const LVHBShapingKey & other ) const {
+        return direction == other.direction && script == other.script && language == other.language
+            && flags == other.flags && text == other.text;
+    }
+};
+
+inline lUInt32 getHash( const LVHBShapingKey & key )
+{
+    return ((key.text.getHash() * 31 + (lUInt32)key.script) * 31 + (lUInt32)key.direction) * 31
+            + getHash((void*)key.language) + (lUInt32)key.flags;
+}
+
+// hb_shape() output, as found in _hb_buffer after shaping
+struct LVHBShapedRun
+{
+    LVHBShapingKey key;
+    unsigned int glyph_count;
+    hb_glyph_info_t * glyph_info;
+    hb_glyph_position_t * glyph_pos;
+    LVHBShapedRun * prev; // LRU list
+    LVHBShapedRun * next;
+    LVHBShapedRun( const LVHBShapingKey & k, hb_buffer_t * buffer ) : key(k), prev(NULL), next(NULL) {
+        glyph_count = hb_buffer_get_length(buffer);
+        glyph_info = (hb_glyph_info_t*)malloc(glyph_count * sizeof(hb_glyph_info_t));
+        glyph_pos = (hb_glyph_position_t*)malloc(glyph_count * sizeof(hb_glyph_position_t));
+        memcpy(glyph_info, hb_buffer_get_glyph_infos(buffer, 0), glyph_count * sizeof(hb_glyph_info_t));
+        memcpy(glyph_pos, hb_buffer_get_glyph_positions(buffer, 0), glyph_count * sizeof(hb_glyph_position_t));
+    }
+    ~LVHBShapedRun() {
+        free(glyph_info);
+        free(glyph_pos);
+    }
+};
+
+// Max number of glyphs kept by each font shaping cache
+static int _hbShapingCacheSize = 8192;
+// Counters of LVShapingCacheStats, atomic as fonts may shape on several threads
+// (final blocks formatted ahead on worker threads)
+static struct {
+    std::atomic<lUInt64> hits;
+    std::atomic<lUInt64> misses;
+    std::atomic<lUInt64> evictions;
+    std::atomic<lUInt64> shaping_ns;
+} _hbShapingCacheStats;
+
+static inline void addShapingCacheStat( std::atomic<lUInt64> & counter, lUInt64 value )
+{
+    counter.fetch_add( value, std::memory_order_relaxed );
+}
+
+void setHarfBuzzShapingCacheSize( int glyphs )
+{
+    _hbShapingCacheSize = glyphs > 0 ? glyphs : 0;
+}
+
+LVShapingCacheStats getHarfBuzzShapingCacheStats( bool reset )
+{
+    LVShapingCacheStats stats;
+    if ( reset ) {
+        stats.hits = _hbShapingCacheStats.hits.exchange( 0 );
+        stats.misses = _hbShapingCacheStats.misses.exchange( 0 );
+        stats.evictions = _hbShapingCacheStats.evictions.exchange( 0 );
+        stats.shaping_ns = _hbShapingCacheStats.shaping_ns.exchange( 0 );
+    }
+    else {
+        stats.hits = _hbShapingCacheStats.hits.load();
+        stats.misses = _hbShapingCacheStats.misses.load();
+        stats.evictions = _hbShapingCacheStats.evictions.load();
+        stats.shaping_ns = _hbShapingCacheStats.shaping_ns.load();
+    }
+    return stats;
+}
+
+// Per font LRU cache of shaped runs, used by both measureText() and DrawTextString():
+// the same runs get shaped again when rendering other pages, re-rendering, and when
+// drawing the words that were measured.
+class LVHBShapingCache
+{
+    LVHashTable<LVHBShapingKey, LVHBShapedRun*> _table;
+    LVHBShapedRun * _head; // most recently used
+    LVHBShapedRun * _tail;
+    int _glyphs;
+    void unlink( LVHBShapedRun * run ) {
+        if ( run->prev )
+            run->prev->next = run->next;
+        else
+            _head = run->next;
+        if ( run->next )
+            run->next->prev = run->prev;
+        else
+            _tail = run->prev;
+        run->prev = run->next = NULL;
+    }
+    void pushFront( LVHBShapedRun * run ) {
+        run->next = _head;
+        if ( _head )
+            _head->prev = run;
+        _head = run;
+        if ( !_tail )
+            _tail = run;
+    }
+public:
+    LVHBShapingCache() : _table(256), _head(NULL), _tail(NULL), _glyphs(0) { }
+    ~LVHBShapingCache() { clear(); }
+    LVHBShapedRun * get( const LVHBShapingKey & key ) {
+        LVHBShapedRun * run = NULL;
+        if ( !_table.get(key, run) ) {
+            addShapingCacheStat( _hbShapingCacheStats.misses, 1 );
+            return NULL;
+        }
+        addShapingCacheStat( _hbShapingCacheStats.hits, 1 );
+        if ( run != _head ) {
+            unlink(run);
+            pushFront(run);
+        }
+        return run;
+    }
+    // Store the run just shaped in buffer, if it is not too large
+    void add( const LVHBShapingKey & key, hb_buffer_t * buffer ) {
+        int glyph_count = (int)hb_buffer_get_length(buffer);
+        if ( glyph_count * 8 > _hbShapingCacheSize ) // (also when disabled)
+            return;
+        LVHBShapedRun * run = new LVHBShapedRun(key, buffer);
+        _table.set(key, run);
+        pushFront(run);
+        _glyphs += glyph_count;
+        while ( _glyphs > _hbShapingCacheSize && _tail ) {
+            LVHBShapedRun * old = _tail;
+            unlink(old);
+            _table.remove(old->key);
+            _glyphs -= old->glyph_count;
+            addShapingCacheStat( _hbShapingCacheStats.evictions, 1 );
+            delete old;
+        }
+    }
+    void clear() {
+        while ( _head ) {
+            LVHBShapedRun * run = _head;
+            _head = run->next;
+            delete run;
+        }
+        _tail = NULL;
+        _table.clear();
+        _glyphs = 0;
+    }
+};
+
 inline lUInt32 getHash( const struct LVCharTriplet& triplet )
 {
     // lUInt32 hash = (((
@@ -1447,11 +1824,22 @@ inline lUInt32 getHash( const struct LVCharTriplet& triplet )
 }
 #endif
 
+// Minimal number of glyphs for a prerendering task (see LVFreeTypeFace::prerenderGlyphs())
+#define GLYPH_PRERENDER_MIN_TASK_GLYPHS 8
+
+// use FONT_FACE_GUARD in LVFreeTypeFace to acquire font operations mutex (except on text
+// measuring threads, see FONT_MEASURE_GUARD), then this font's own mutex: measuring threads
+// can so measure concurrently with different fonts, but never need two fonts' mutexes
+#define FONT_FACE_GUARD FONT_MEASURE_GUARD CRGuard _faceGuard(_faceMutex); CR_UNUSED(_faceGuard);
+
 class LVFreeTypeFace : public LVFont
 {
 protected:
     LVMutex &     _mutex;
+    CRMutex *     _faceMutex; // guards _face, _hb_buffer and the caches
     lString8      _fileName;
+    LVByteArrayRef _fontBuf; // font data, when loaded from buffer
+    int           _faceIndex;
     lString8      _faceName;
     css_font_family_t _fontFamily;
     FT_Library    _library;
@@ -1474,6 +1862,7 @@ protected:
     LVFontLocalGlyphCache            _glyph_cache;
     bool           _drawMonochrome;
     hinting_mode_t _hintingMode;
+    int            _subpixelPhases; // glyph positions per pixel with KERNING_MODE_HARFBUZZ (1: whole pixels)
     kerning_mode_t _kerningMode;
     bool           _fallbackFontIsSet;
     LVFontRef      _fallbackFont;
@@ -1485,12 +1874,19 @@ protected:
     FT_Pos         _synth_weight_strength; // for emboldening with FT_Outline_Embolden()
     FT_Pos         _synth_weight_half_strength;
     int            _features; // requested OpenType features bitmap
+    LVArray<FT_Face> _worker_faces; // idle faces for glyph prerendering tasks
+    int            _worker_face_count; // idle and in use by tasks
+    std::atomic<int> _prerender_tasks; // queued and running prerendering tasks
+    CRThreadPool * _prerender_pool;    // pool they were queued on
 #if USE_HARFBUZZ==1
     hb_font_t* _hb_font;
     hb_buffer_t* _hb_buffer;
     LVArray<hb_feature_t> _hb_features;
     // For use with KERNING_MODE_HARFBUZZ:
     LVFontLocalGlyphCache _glyph_cache2;
+    LVHBShapingCache _shaping_cache;
+    LVArray<hb_glyph_info_t> _rtl_glyph_info; // measureText() RTL reordering
+    LVArray<hb_glyph_position_t> _rtl_glyph_pos;
     // For use with KERNING_MODE_HARFBUZZ_LIGHT:
     LVHashTable<struct LVCharTriplet, struct LVCharPosInfo> _width_cache2;
 #endif
@@ -1574,6 +1970,7 @@ public:
     }
 
     int getXHeight() {
+        FONT_FACE_GUARD
         int x_height = 0;
         int glyph_index = getCharIndex( 'x', 0 );
         if ( glyph_index ) {
@@ -1665,20 +2062,23 @@ public:
     FT_Library getLibrary() { return _library; }
 
     LVFreeTypeFace( LVMutex &mutex, FT_Library  library, LVFontGlobalGlyphCache * globalCache )
-        : _mutex(mutex), _fontFamily(css_ff_sans_serif), _library(library), _face(NULL), _face_size(0)
+        : _mutex(mutex), _faceMutex(concurrencyProvider ? concurrencyProvider->createMutex() : NULL)
+        , _faceIndex(0), _fontFamily(css_ff_sans_serif), _library(library), _face(NULL), _face_size(0)
         , _size(0), _hyphen_width(0), _baseline(0), _weight(400), _italic(0)
         , _underline_offset(0), _underline_thickness(0), _extra_metric(NULL)
         , _glyph_cache(globalCache), _drawMonochrome(false)
-        , _hintingMode(HINTING_MODE_AUTOHINT), _kerningMode(KERNING_MODE_DISABLED)
+        , _hintingMode(HINTING_MODE_AUTOHINT), _subpixelPhases(1), _kerningMode(KERNING_MODE_DISABLED)
         , _fallbackFontIsSet(false), _nextFallbackFontIsSet(false)
         , _synth_weight(0), _synth_weight_strength(0), _synth_weight_half_strength(0)
         , _features(0)
+        , _worker_face_count(0), _prerender_tasks(0), _prerender_pool(NULL)
         #if USE_HARFBUZZ==1
         , _glyph_cache2(globalCache)
         , _width_cache2(1024)
         #endif
     {
         _hintingMode = fontMan->GetHintingMode();
+        _subpixelPhases = fontMan->GetSubpixelPositioning();
 
         #if USE_HARFBUZZ==1
         _hb_font = 0;
@@ -1694,9 +2094,17 @@ public:
             hb_buffer_destroy(_hb_buffer);
         #endif
         Clear();
+        delete _faceMutex;
+    }
+
+    /// wait for the prerendering tasks of this font, before changing what they use
+    void waitPrerendering() {
+        if ( _prerender_tasks.load() > 0 )
+            _prerender_pool->waitAll();
     }
 
     void clearCache() {
+        waitPrerendering();
         _glyph_cache.clear();
         _wcache.clear();
         _lsbcache.clear();
@@ -1704,6 +2112,7 @@ public:
         #if USE_HARFBUZZ==1
         _glyph_cache2.clear();
         _width_cache2.clear();
+        _shaping_cache.clear();
         #endif
     }
 
@@ -1735,13 +2144,30 @@ public:
     }
 
     virtual int getHyphenWidth() {
-        FONT_GUARD
+        FONT_FACE_GUARD
         if ( !_hyphen_width ) {
             _hyphen_width = getCharWidth( getHyphChar() );
         }
         return _hyphen_width;
     }
 
+    virtual bool hasGlyphs( const lChar32 * text, int len ) {
+        FONT_FACE_GUARD
+        if ( !_faceMutex || !_face )
+            return false;
+        // Measuring gets the fallback fonts even when not using them: have them
+        // set now, so it does not look at other fonts
+        getFallbackFont();
+        getNextFallbackFont();
+        if ( !getCharIndex( getHyphChar(), 0 ) )
+            return false;
+        for ( int i=0; i<len; i++ ) {
+            if ( !getCharIndex( text[i], 0 ) )
+                return false;
+        }
+        return true;
+    }
+
     void updateUnderlineMetrics() {
         // Defaults if no valid metrics:
         _underline_thickness = _size > 30 ? 2 : 1;
@@ -1884,12 +2310,16 @@ public:
     virtual void setFeatures( int features ) {
         _features = features;
         _hash = 0; // Force lvstyles.cpp calcHash(font_ref_t) to recompute the hash
+        #if USE_HARFBUZZ==1
+        _shaping_cache.clear(); // (features will be updated by setKerningMode())
+        #endif
     }
     virtual int getFeatures() const {
         return _features;
     }
 
     virtual void setKerningMode( kerning_mode_t kerningMode ) {
+        waitPrerendering();
         _kerningMode = kerningMode;
         _DecimalListItemFont.Clear(); // depends on kerning mode
         _hash = 0; // Force lvstyles.cpp calcHash(font_ref_t) to recompute the hash
@@ -1906,6 +2336,7 @@ public:
     virtual void setHintingMode(hinting_mode_t mode) {
         if (_hintingMode == mode)
             return;
+        waitPrerendering();
         _hintingMode = mode;
         _hash = 0; // Force lvstyles.cpp calcHash(font_ref_t) to recompute the hash
         clearCache();
@@ -1917,29 +2348,62 @@ public:
             hb_font_destroy(_hb_font);
         _hb_font = hb_ft_font_create(_face, NULL);
         if (_hb_font) {
-            // Use the same load flags as we do when using FT directly, to avoid mismatching advances & raster
-            int flags = FT_LOAD_DEFAULT;
-            flags |= (!_drawMonochrome ? FT_LOAD_TARGET_LIGHT : FT_LOAD_TARGET_MONO);
-            if (_hintingMode == HINTING_MODE_BYTECODE_INTERPRETOR) {
-                flags |= FT_LOAD_NO_AUTOHINT;
-            }
-            else if (_hintingMode == HINTING_MODE_AUTOHINT) {
-                flags |= FT_LOAD_FORCE_AUTOHINT;
-            }
-            else if (_hintingMode == HINTING_MODE_DISABLED) {
-                flags |= FT_LOAD_NO_AUTOHINT | FT_LOAD_NO_HINTING;
-            }
-            hb_ft_font_set_load_flags(_hb_font, flags);
+            hb_ft_font_set_load_flags(_hb_font, getHBLoadFlags());
         }
         #endif
     }
     virtual hinting_mode_t  getHintingMode() const { return _hintingMode; }
 
+    #if USE_HARFBUZZ==1
+    // Use the same load flags as we do when using FT directly, to avoid mismatching advances & raster
+    int getHBLoadFlags() {
+        int flags = FT_LOAD_DEFAULT;
+        flags |= (!_drawMonochrome ? FT_LOAD_TARGET_LIGHT : FT_LOAD_TARGET_MONO);
+        if (_hintingMode == HINTING_MODE_BYTECODE_INTERPRETOR) {
+            flags |= FT_LOAD_NO_AUTOHINT;
+        }
+        else if (_hintingMode == HINTING_MODE_AUTOHINT) {
+            flags |= FT_LOAD_FORCE_AUTOHINT;
+        }
+        else if (_hintingMode == HINTING_MODE_DISABLED) {
+            flags |= FT_LOAD_NO_AUTOHINT | FT_LOAD_NO_HINTING;
+        }
+        if (_subpixelPhases > 1) {
+            // Hinted advances are rounded to whole pixels: we want the
+            // fractional ones to position glyphs (the glyphs themselves
+            // are still hinted, vertically only with the light target)
+            flags |= FT_LOAD_NO_HINTING;
+        }
+        return flags;
+    }
+    #endif
+
+    virtual void setSubpixelPositioning( int phases ) {
+        phases = phases >= 4 ? 4 : phases >= 2 ? 2 : 1;
+        if (_subpixelPhases == phases)
+            return;
+        waitPrerendering();
+        _subpixelPhases = phases;
+        _hash = 0; // Force lvstyles.cpp calcHash(font_ref_t) to recompute the hash
+        clearCache();
+        #if USE_HARFBUZZ==1
+        if (_hb_font) {
+            // (destroy/create needed to clear HB advances cache, see setHintingMode())
+            hb_font_destroy(_hb_font);
+            _hb_font = hb_ft_font_create(_face, NULL);
+            if (_hb_font)
+                hb_ft_font_set_load_flags(_hb_font, getHBLoadFlags());
+        }
+        #endif
+    }
+    virtual int getSubpixelPositioning() const { return _subpixelPhases; }
+
     /// get/set bitmap mode (true=bitmap, false=antialiased)
     virtual void setBitmapMode( bool drawBitmap )
     {
         if ( _drawMonochrome == drawBitmap )
             return;
+        waitPrerendering();
         _drawMonochrome = drawBitmap;
         clearCache();
     }
@@ -1947,6 +2411,7 @@ public:
 
     // Synthetic thin/bold on a font that does not come with a corresponding variant.
     void setSynthWeight(int synth_weight) {
+        waitPrerendering();
         if (_weight == synth_weight) {
             _synth_weight = 0;
             _synth_weight_half_strength = 0;
@@ -2009,7 +2474,7 @@ public:
     // Used when an embedded font (registered by RegisterDocumentFont()) is intantiated
     bool loadFromBuffer(LVByteArrayRef buf, int index, int size, css_font_family_t fontFamily,
                                             bool monochrome, bool italicize, int weight=-1, int face_size=-1 ) {
-        FONT_GUARD
+        FONT_FACE_GUARD
         _hintingMode = fontMan->GetHintingMode();
         _drawMonochrome = monochrome;
         _fontFamily = fontFamily;
@@ -2018,6 +2483,8 @@ public:
         int error = FT_New_Memory_Face( _library, buf->get(), buf->length(), index, &_face ); /* create face object */
         if (error)
             return false;
+        _fontBuf = buf;
+        _faceIndex = index;
         if ( _fileName.endsWith(".pfb") || _fileName.endsWith(".pfa") ) {
             lString8 kernFile = _fileName.substr(0, _fileName.length()-4);
             if ( LVFileExists(Utf8ToUnicode(kernFile) + ".afm" ) ) {
@@ -2055,19 +2522,7 @@ public:
                 error = FT_Err_Invalid_Argument;
             }
             else {
-                // Use the same load flags as we do when using FT directly, to avoid mismatching advances & raster
-                int flags = FT_LOAD_DEFAULT;
-                flags |= (!_drawMonochrome ? FT_LOAD_TARGET_LIGHT : FT_LOAD_TARGET_MONO);
-                if (_hintingMode == HINTING_MODE_BYTECODE_INTERPRETOR) {
-                    flags |= FT_LOAD_NO_AUTOHINT;
-                }
-                else if (_hintingMode == HINTING_MODE_AUTOHINT) {
-                    flags |= FT_LOAD_FORCE_AUTOHINT;
-                }
-                else if (_hintingMode == HINTING_MODE_DISABLED) {
-                    flags |= FT_LOAD_NO_AUTOHINT | FT_LOAD_NO_HINTING;
-                }
-                hb_ft_font_set_load_flags(_hb_font, flags);
+                hb_ft_font_set_load_flags(_hb_font, getHBLoadFlags());
             }
         }
         #endif
@@ -2123,7 +2578,7 @@ public:
     // Load font from file path
     bool loadFromFile( const char * fname, int index, int size, css_font_family_t fontFamily,
                                            bool monochrome, bool italicize, int weight=-1, int face_size=-1 ) {
-        FONT_GUARD
+        FONT_FACE_GUARD
         _hintingMode = fontMan->GetHintingMode();
         _drawMonochrome = monochrome;
         _fontFamily = fontFamily;
@@ -2136,6 +2591,8 @@ public:
         int error = FT_New_Face( _library, _fileName.c_str(), index, &_face ); /* create face object */
         if (error)
             return false;
+        _fontBuf.Clear();
+        _faceIndex = index;
         if ( _fileName.endsWith(".pfb") || _fileName.endsWith(".pfa") ) {
             lString8 kernFile = _fileName.substr(0, _fileName.length()-4);
             if ( LVFileExists(Utf8ToUnicode(kernFile) + ".afm") ) {
@@ -2173,19 +2630,7 @@ public:
                 error = FT_Err_Invalid_Argument;
             }
             else {
-                // Use the same load flags as we do when using FT directly, to avoid mismatching advances & raster
-                int flags = FT_LOAD_DEFAULT;
-                flags |= (!_drawMonochrome ? FT_LOAD_TARGET_LIGHT : FT_LOAD_TARGET_MONO);
-                if (_hintingMode == HINTING_MODE_BYTECODE_INTERPRETOR) {
-                    flags |= FT_LOAD_NO_AUTOHINT;
-                }
-                else if (_hintingMode == HINTING_MODE_AUTOHINT) {
-                    flags |= FT_LOAD_FORCE_AUTOHINT;
-                }
-                else if (_hintingMode == HINTING_MODE_DISABLED) {
-                    flags |= FT_LOAD_NO_AUTOHINT | FT_LOAD_NO_HINTING;
-                }
-                hb_ft_font_set_load_flags(_hb_font, flags);
+                hb_ft_font_set_load_flags(_hb_font, getHBLoadFlags());
             }
         }
         #endif
@@ -2379,7 +2824,7 @@ public:
         \return true if glyh was found
     */
     virtual bool getGlyphInfo( lUInt32 code, glyph_info_t * glyph, lChar32 def_char=0, bool code_is_glyph_index=false, bool is_fallback=false ) {
-        //FONT_GUARD
+        FONT_FACE_GUARD
         FT_UInt glyph_index;
         if ( code_is_glyph_index ) {
             // Accept 0 and give info about the notdef/tofu char
@@ -2784,6 +3229,130 @@ public:
         return false;
     }
 
+#if USE_HARFBUZZ==1
+    /// shape text with _hb_buffer, or get the glyphs of a previous identical shaping
+    /// (glyph_info and glyph_pos are valid until next shaping with this font)
+    void hbShape( const lChar32 * text, int len, lChar32 def_char, bool has_fallback_font,
+                  lUInt32 hints, TextLangCfg * lang_cfg, bool set_latin_if_invalid,
+                  unsigned int & glyph_count, hb_glyph_info_t * & glyph_info,
+                  hb_glyph_position_t * & glyph_pos, hb_direction_t & direction, hb_script_t & script )
+    {
+        LVHBShapingKey key;
+        hb_buffer_clear_contents(_hb_buffer);
+        if ( has_fallback_font ) { // It has a fallback font, add chars as-is
+            for (int i = 0; i < len; i++) {
+                hb_buffer_add(_hb_buffer, (hb_codepoint_t)(text[i]), i);
+            }
+            key.text.append(text, len);
+        }
+        else { // No fallback font, check codepoint presence or get replacement char
+            key.text.reserve(len);
+            for (int i = 0; i < len; i++) {
+                lChar32 ch = filterChar(text[i], def_char);
+                hb_buffer_add(_hb_buffer, (hb_codepoint_t)ch, i);
+                key.text.append(1, ch);
+            }
+        }
+        // Note: hb_buffer_add_codepoints(_hb_buffer, (hb_codepoint_t*)text, len, 0, len)
+        // would do the same kind of loop we did above, so no speedup gain using it; and we
+        // get to be sure of the cluster initial value we set to each of our added chars.
+        hb_buffer_set_content_type(_hb_buffer, HB_BUFFER_CONTENT_TYPE_UNICODE);
+
+        // If we are provided with direction and hints, let harfbuzz know
+        if ( hints ) {
+            if ( hints & LFNT_HINT_DIRECTION_KNOWN ) {
+                if ( hints & LFNT_HINT_DIRECTION_IS_RTL )
+                    hb_buffer_set_direction(_hb_buffer, HB_DIRECTION_RTL);
+                else
+                    hb_buffer_set_direction(_hb_buffer, HB_DIRECTION_LTR);
+            }
+            int hb_flags = HB_BUFFER_FLAG_DEFAULT; // (hb_buffer_flags_t won't let us do |= )
+            if ( hints & LFNT_HINT_BEGINS_PARAGRAPH )
+                hb_flags |= HB_BUFFER_FLAG_BOT;
+            if ( hints & LFNT_HINT_ENDS_PARAGRAPH )
+                hb_flags |= HB_BUFFER_FLAG_EOT;
+            hb_buffer_set_flags(_hb_buffer, (hb_buffer_flags_t)hb_flags);
+        }
+        if ( lang_cfg ) {
+            hb_buffer_set_language(_hb_buffer, lang_cfg->getHBLanguage());
+        }
+        // Let HB guess what's not been set (script, direction, language)
+        hb_buffer_guess_segment_properties(_hb_buffer);
+        if ( set_latin_if_invalid && hb_buffer_get_script(_hb_buffer) == HB_SCRIPT_INVALID ) {
+            // Provide "latn", which has the best chance to be known by the font and have
+            // its OpenType features working.
+            hb_buffer_set_script(_hb_buffer, HB_SCRIPT_LATIN);
+        }
+        direction = hb_buffer_get_direction(_hb_buffer);
+        script = hb_buffer_get_script(_hb_buffer);
+        key.direction = direction;
+        key.script = script;
+        key.language = hb_buffer_get_language(_hb_buffer);
+        key.flags = (int)hb_buffer_get_flags(_hb_buffer);
+
+        LVHBShapedRun * run = _shaping_cache.get(key);
+        if ( run ) {
+            glyph_count = run->glyph_count;
+            glyph_info = run->glyph_info;
+            glyph_pos = run->glyph_pos;
+            return;
+        }
+        // Shape
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        hb_shape(_hb_font, _hb_buffer, _hb_features.ptr(), (unsigned int)_hb_features.length());
+        addShapingCacheStat( _hbShapingCacheStats.shaping_ns, std::chrono::duration_cast<std::chrono::nanoseconds>(
+                                 std::chrono::steady_clock::now() - start).count() );
+        _shaping_cache.add(key, _hb_buffer);
+        glyph_count = hb_buffer_get_length(_hb_buffer);
+        glyph_info = hb_buffer_get_glyph_infos(_hb_buffer, 0);
+        glyph_pos = hb_buffer_get_glyph_positions(_hb_buffer, 0);
+    }
+
+    /// same as hb_buffer_reverse_clusters(), on a copy of shaped glyphs
+    void hbReverseClusters( unsigned int glyph_count, hb_glyph_info_t * & glyph_info, hb_glyph_position_t * & glyph_pos )
+    {
+        _rtl_glyph_info.clear();
+        _rtl_glyph_pos.clear();
+        if ( glyph_count == 0 )
+            return;
+        // Reverse the whole run, then each cluster back
+        for ( int i = (int)glyph_count - 1; i >= 0; i-- ) {
+            _rtl_glyph_info.add(glyph_info[i]);
+            _rtl_glyph_pos.add(glyph_pos[i]);
+        }
+        glyph_info = _rtl_glyph_info.get();
+        glyph_pos = _rtl_glyph_pos.get();
+        unsigned int start = 0;
+        for ( unsigned int i = 1; i <= glyph_count; i++ ) {
+            if ( i == glyph_count || glyph_info[i].cluster != glyph_info[start].cluster ) {
+                for ( unsigned int a = start, b = i - 1; a < b; a++, b-- ) {
+                    hb_glyph_info_t ti = glyph_info[a];
+                    glyph_info[a] = glyph_info[b];
+                    glyph_info[b] = ti;
+                    hb_glyph_position_t tp = glyph_pos[a];
+                    glyph_pos[a] = glyph_pos[b];
+                    glyph_pos[b] = tp;
+                }
+                start = i;
+            }
+        }
+    }
+
+    /// advance in pixels of a shaped glyph: with subpixel positioning, advances
+    /// are summed in 26.6 in pen, and the sum is rounded instead of each advance,
+    /// so measureText() and DrawTextString() agree on glyph positions
+    int hbGlyphAdvance( hb_position_t x_advance, int * pen ) {
+        if ( !x_advance )
+            return 0;
+        x_advance += _synth_weight_strength;
+        if ( !pen )
+            return FONT_METRIC_TO_PX(x_advance);
+        int w = FONT_METRIC_TO_PX(*pen + x_advance) - FONT_METRIC_TO_PX(*pen);
+        *pen += x_advance;
+        return w;
+    }
+#endif
+
     /** \brief measure text
         \param text is text string pointer
         \param len is number of characters to measure
@@ -2807,7 +3376,7 @@ public:
                         lUInt32 hints=0
                      )
     {
-        FONT_GUARD
+        FONT_FACE_GUARD
         if ( len <= 0 || _face==NULL )
             return 0;
         if ( letter_spacing < 0 ) {
@@ -2847,7 +3416,8 @@ public:
             unsigned int glyph_count;
             hb_glyph_info_t* glyph_info = 0;
             hb_glyph_position_t* glyph_pos = 0;
-            hb_buffer_clear_contents(_hb_buffer);
+            hb_direction_t direction;
+            hb_script_t script;
 
             // hb_buffer_set_replacement_codepoint(_hb_buffer, def_char);
             // /\ This would just set the codepoint to use when parsing
@@ -2876,47 +3446,14 @@ public:
             bool is_fallback_font = hints & LFNT_HINT_IS_FALLBACK_FONT;
             LVFontRef fallback = is_fallback_font ? getNextFallbackFont() : getFallbackFont();
             bool has_fallback_font = !fallback.isNull();
-            if ( has_fallback_font ) { // It has a fallback font, add chars as-is
-                for (i = 0; i < len; i++) {
-                    hb_buffer_add(_hb_buffer, (hb_codepoint_t)(text[i]), i);
-                }
-            }
-            else { // No fallback font, check codepoint presence or get replacement char
-                for (i = 0; i < len; i++) {
-                    hb_buffer_add(_hb_buffer, (hb_codepoint_t)filterChar(text[i], def_char), i);
-                }
-            }
-            // Note: hb_buffer_add_codepoints(_hb_buffer, (hb_codepoint_t*)text, len, 0, len)
-            // would do the same kind of loop we did above, so no speedup gain using it; and we
-            // get to be sure of the cluster initial value we set to each of our added chars.
-            hb_buffer_set_content_type(_hb_buffer, HB_BUFFER_CONTENT_TYPE_UNICODE);
-
-            // If we are provided with direction and hints, let harfbuzz know
-            if ( hints ) {
-                if ( hints & LFNT_HINT_DIRECTION_KNOWN ) {
-                    if ( hints & LFNT_HINT_DIRECTION_IS_RTL )
-                        hb_buffer_set_direction(_hb_buffer, HB_DIRECTION_RTL);
-                    else
-                        hb_buffer_set_direction(_hb_buffer, HB_DIRECTION_LTR);
-                }
-                int hb_flags = HB_BUFFER_FLAG_DEFAULT; // (hb_buffer_flags_t won't let us do |= )
-                if ( hints & LFNT_HINT_BEGINS_PARAGRAPH )
-                    hb_flags |= HB_BUFFER_FLAG_BOT;
-                if ( hints & LFNT_HINT_ENDS_PARAGRAPH )
-                    hb_flags |= HB_BUFFER_FLAG_EOT;
-                hb_buffer_set_flags(_hb_buffer, (hb_buffer_flags_t)hb_flags);
-            }
-            if ( lang_cfg ) {
-                hb_buffer_set_language(_hb_buffer, lang_cfg->getHBLanguage());
-            }
-            // Let HB guess what's not been set (script, direction, language)
-            hb_buffer_guess_segment_properties(_hb_buffer);
+            // Shape (or get the glyphs from a previous identical shaping)
+            hbShape( text, len, def_char, has_fallback_font, hints, lang_cfg, false,
+                     glyph_count, glyph_info, glyph_pos, direction, script );
 
             // Some additional care might need to be taken, see:
             //   https://www.w3.org/TR/css-text-3/#letter-spacing-property
             if ( letter_spacing > 0 ) {
                 // Don't apply letter-spacing if the script is cursive
-                hb_script_t script = hb_buffer_get_script(_hb_buffer);
                 if ( isHBScriptCursive(script) )
                     letter_spacing = 0;
             }
@@ -2925,14 +3462,11 @@ public:
             // todo: it should be applied half-before/half-after each grapheme
             // cf in *some* minikin repositories: libs/minikin/Layout.cpp
 
-            // Shape
-            hb_shape(_hb_font, _hb_buffer, _hb_features.ptr(), (unsigned int)_hb_features.length());
-
             // Harfbuzz has guessed and set a direction even if we did not provide one.
             #ifdef DEBUG_MEASURE_TEXT
             bool is_rtl = false;
             #endif
-            if ( hb_buffer_get_direction(_hb_buffer) == HB_DIRECTION_RTL ) {
+            if ( direction == HB_DIRECTION_RTL ) {
                 #ifdef DEBUG_MEASURE_TEXT
                 is_rtl = true;
                 #endif
@@ -2947,13 +3481,11 @@ public:
                 // looks more natural (like it happens when LTR).
                 // But hb_buffer_reverse_clusters() is required to have the clusters
                 // ordered as our text indices, so we can map them back to our text.
-                hb_buffer_reverse_clusters(_hb_buffer);
+                // The glyphs may come from the shaping cache, and DrawTextString()
+                // wants them unreversed: do the same as it on a copy.
+                hbReverseClusters( glyph_count, glyph_info, glyph_pos );
             }
 
-            glyph_count = hb_buffer_get_length(_hb_buffer);
-            glyph_info = hb_buffer_get_glyph_infos(_hb_buffer, 0);
-            glyph_pos = hb_buffer_get_glyph_positions(_hb_buffer, 0);
-
             #ifdef DEBUG_MEASURE_TEXT
                 printf("MTHB >>> measureText %x len %d is_rtl=%d [%s]\n", text, len, is_rtl, _faceName.c_str());
                 for (i = 0; i < (int)glyph_count; i++) {
@@ -3002,6 +3534,8 @@ public:
             int hcl = 0; // cluster glyph at hg
             int t_notdef_start = -1;
             int t_notdef_end = -1;
+            int subpixel_pen = 0; // see hbGlyphAdvance()
+            int * pen = _subpixelPhases > 1 ? &subpixel_pen : NULL;
             for (int t = 0; t < len; t++) {
                 #ifdef DEBUG_MEASURE_TEXT
                     printf("MTHB t%d (=%x) ", t, text[t]);
@@ -3069,16 +3603,15 @@ public:
                                 // And go on with the found glyph now that we fixed what was before
                             }
                             // Glyph found in this font
-                            if ( glyph_pos[hg].x_advance )
-                                advance = FONT_METRIC_TO_PX(glyph_pos[hg].x_advance + _synth_weight_strength);
+                            advance = hbGlyphAdvance( glyph_pos[hg].x_advance, pen );
                         }
                         else {
                             #ifdef DEBUG_MEASURE_TEXT
                                 printf("(glyph not found) ");
                             #endif
                             // Keep the advance of .notdef/tofu in case there is no fallback font to correct them
-                            if ( glyph_pos[hg].x_advance )
-                                advance = FONT_METRIC_TO_PX(glyph_pos[hg].x_advance + _synth_weight_strength);
+                            // (DrawTextString() draws it with this font only then)
+                            advance = hbGlyphAdvance( glyph_pos[hg].x_advance, has_fallback_font ? NULL : pen );
                             if ( t_notdef_start < 0 ) {
                                 t_notdef_start = t;
                             }
@@ -3384,6 +3917,218 @@ public:
         // }
     }
 
+    /// load and render glyph into face slot (face is _face, or a prerendering worker face)
+    /// by_index: glyph for KERNING_MODE_HARFBUZZ, which gets advances from HarfBuzz
+    /// x_shift: horizontal shift of the outline, in 26.6 (subpixel positioning)
+    FT_GlyphSlot renderGlyphSlot( FT_Face face, FT_UInt glyph_index, bool by_index, int x_shift=0 ) {
+        FT_GlyphSlot slot = face->glyph;
+        int rend_flags = FT_LOAD_RENDER | ( !_drawMonochrome ? FT_LOAD_TARGET_LIGHT : FT_LOAD_TARGET_MONO );
+                                                //|FT_LOAD_MONOCHROME|FT_LOAD_FORCE_AUTOHINT
+        if (_hintingMode == HINTING_MODE_BYTECODE_INTERPRETOR) {
+            rend_flags |= FT_LOAD_NO_AUTOHINT;
+        }
+        else if (_hintingMode == HINTING_MODE_AUTOHINT) {
+            rend_flags |= FT_LOAD_FORCE_AUTOHINT;
+        }
+        else if (_hintingMode == HINTING_MODE_DISABLED) {
+            rend_flags |= FT_LOAD_NO_AUTOHINT | FT_LOAD_NO_HINTING;
+        }
+        bool transform = _synth_weight > 0 || _italic == 2 || x_shift != 0;
+        if (transform) { // Don't render yet
+            rend_flags &= ~FT_LOAD_RENDER;
+            // Also disable any hinting, as it would be wrong after embolden.
+            // But it feels this is now fine after switching to FT_LOAD_TARGET_LIGHT.
+            // rend_flags |= FT_LOAD_NO_AUTOHINT | FT_LOAD_NO_HINTING;
+        }
+
+        int error = FT_Load_Glyph( face,    /* handle to face object */
+                glyph_index,                /* glyph index           */
+                rend_flags );               /* load flags, see below */
+        if ( error == FT_Err_Execution_Too_Long && _hintingMode == HINTING_MODE_BYTECODE_INTERPRETOR ) {
+            // Native hinting bytecode may fail with some bad fonts: try again with no hinting
+            rend_flags |= FT_LOAD_NO_HINTING;
+            error = FT_Load_Glyph( face, glyph_index, rend_flags );
+        }
+        if ( error ) {
+            return NULL;
+        }
+
+        bool is_embolden = false;
+        if (_synth_weight > 0) {
+            if ( slot->format == FT_GLYPH_FORMAT_OUTLINE ) {
+                // See setSynthWeight() for details
+                FT_Outline_Embolden(&slot->outline, _synth_weight_strength);
+                FT_Outline_Translate(&slot->outline, 0, -_synth_weight_half_strength);
+                is_embolden = true; // slot->format changes to BITMAP after render
+            }
+        }
+        if (_italic == 2) {
+            FT_GlyphSlot_Oblique(slot);
+        }
+        if (x_shift != 0 && slot->format == FT_GLYPH_FORMAT_OUTLINE) {
+            FT_Outline_Translate(&slot->outline, x_shift, 0);
+        }
+        if (transform) {
+            // Render now that transformations are applied
+            FT_Render_Glyph(slot, _drawMonochrome?FT_RENDER_MODE_MONO:FT_RENDER_MODE_LIGHT);
+        }
+
+        // (Glyphs by index, drawn with HarfBuzz advances, keep their rendered metrics,
+        // as getGlyphByIndex() always did)
+        if (_synth_weight > 0 && is_embolden && (!by_index || slot->format == FT_GLYPH_FORMAT_OUTLINE)) {
+            // Tweak some metrics if synthesized weight
+            if ( slot->metrics.horiAdvance > 0 ) {
+                // slot->metrics.horiAdvance += _synth_weight_strength;
+                // As in getGlyphInfo(), we need to use slot->linearHoriAdvance to get
+                // the same advance/width whether hinting or not
+                slot->metrics.horiAdvance = (slot->linearHoriAdvance >> 10) + _synth_weight_strength;
+            }
+            else { // probable diacritic
+                // Compensate the width added to the previous advancing char
+                // by making the negative originX more negative
+                slot->metrics.horiBearingX -= _synth_weight_strength;
+            }
+        }
+        return slot;
+    }
+
+    /// new face for a prerendering worker, with the same file and size as _face
+    FT_Face newWorkerFace() {
+        FT_Face face = NULL;
+        int error;
+        if ( !_fontBuf.isNull() )
+            error = FT_New_Memory_Face( _library, _fontBuf->get(), _fontBuf->length(), _faceIndex, &face );
+        else
+            error = FT_New_Face( _library, _fileName.c_str(), _faceIndex, &face );
+        if ( error )
+            return NULL;
+        if ( FT_Set_Pixel_Sizes( face, 0, _face_size ) ) {
+            FT_Done_Face( face );
+            return NULL;
+        }
+        return face;
+    }
+
+    // Rasterizes a share of the glyphs of a prerenderGlyphs() call, with its own face
+    // (the font waits for these tasks before it is destroyed or changes its rendering
+    // settings, so they can use it without holding FONT_GUARD)
+    class PrerenderTask : public CRRunnable {
+        LVFreeTypeFace * _font;
+        FT_Face _face;
+        LVFontLocalGlyphCache * _cache;
+        bool _by_index;
+    public:
+        LVArray<lChar32> chars;
+        LVArray<FT_UInt> indexes;
+        PrerenderTask( LVFreeTypeFace * font, FT_Face face, LVFontLocalGlyphCache * cache, bool by_index )
+            : _font(font), _face(face), _cache(cache), _by_index(by_index) { }
+        virtual ~PrerenderTask() {
+            // Give the face back to the font (also when dropped without running)
+            {
+                FONT_LOCAL_GLYPH_CACHE_GUARD
+                _font->_worker_faces.add( _face );
+            }
+            _font->_prerender_tasks.fetch_sub( 1 );
+        }
+        virtual void run() {
+            for ( int i=0; i<indexes.length(); i++ ) {
+                FT_GlyphSlot slot = _font->renderGlyphSlot( _face, indexes[i], _by_index );
+                if ( !slot )
+                    continue;
+                // Keep the cache locked until the item is indexed: another worker
+                // allocating a page could otherwise evict the page it is in.
+                FONT_LOCAL_GLYPH_CACHE_GUARD
+                LVFontGlyphCacheItem * item;
+                #if USE_HARFBUZZ==1
+                if ( _by_index )
+                    item = newItem( _cache, (lUInt32)indexes[i], slot );
+                else
+                #endif
+                    item = newItem( _cache, chars[i], slot );
+                if ( item )
+                    _cache->put( item );
+            }
+        }
+    };
+
+    virtual void prerenderGlyphs( const lChar32 * chars, int count, CRThreadPool * pool, int maxTasks ) {
+        FONT_FACE_GUARD
+        if ( !_face || count <= 0 )
+            return;
+        LVFontGlyphCacheReadSection glyph_reader( _glyph_cache.getGlobalCache() );
+        bool by_index = false;
+        LVFontLocalGlyphCache * cache = &_glyph_cache;
+        #if USE_HARFBUZZ==1
+        if ( _kerningMode == KERNING_MODE_HARFBUZZ ) {
+            // Glyphs are drawn by glyph index: prerender the ones mapped by cmap
+            // (other glyphs from ligatures & al. will be rendered when drawn)
+            by_index = true;
+            cache = &_glyph_cache2;
+        }
+        #endif
+        // Glyphs not yet rendered, and found in this font (the glyphs of other
+        // chars will be got from the fallback font when drawn)
+        LVArray<lChar32> todo_chars;
+        LVArray<FT_UInt> todo_indexes;
+        LVHashTable<lUInt32, bool> seen(count < 64 ? 64 : count);
+        for ( int i=0; i<count; i++ ) {
+            lChar32 ch = chars[i];
+            FT_UInt index = getCharIndex( ch, 0 );
+            if ( index == 0 )
+                continue;
+            lUInt32 key = by_index ? (lUInt32)index : (lUInt32)ch;
+            bool dummy;
+            if ( seen.get(key, dummy) )
+                continue;
+            seen.set(key, true);
+            LVFontGlyphCacheItem * item;
+            #if USE_HARFBUZZ==1
+            if ( by_index )
+                item = cache->getByIndex( index );
+            else
+            #endif
+                item = cache->getByChar( ch );
+            if ( item )
+                continue;
+            todo_chars.add( ch );
+            todo_indexes.add( index );
+        }
+        // Not worth a task for a few glyphs
+        int tasks = todo_indexes.length() / GLYPH_PRERENDER_MIN_TASK_GLYPHS;
+        if ( tasks > maxTasks )
+            tasks = maxTasks;
+        if ( tasks < 1 )
+            return;
+        // Each task uses its own face, as a FT_Face can't be used by multiple threads.
+        // Faces are given back by tasks when done: take idle ones, and create up to
+        // maxTasks faces (when all are in use by tasks still running, glyphs will be
+        // rasterized when drawn).
+        LVArray<FT_Face> faces;
+        {
+            FONT_LOCAL_GLYPH_CACHE_GUARD
+            while ( faces.length() < tasks && _worker_faces.length() > 0 )
+                faces.add( _worker_faces.remove( _worker_faces.length() - 1 ) );
+        }
+        while ( faces.length() < tasks && _worker_face_count < maxTasks ) {
+            FT_Face face = newWorkerFace();
+            if ( !face )
+                break;
+            _worker_face_count++;
+            faces.add( face );
+        }
+        tasks = faces.length();
+        _prerender_pool = pool;
+        for ( int t=0; t<tasks; t++ ) {
+            PrerenderTask * task = new PrerenderTask( this, faces[t], cache, by_index );
+            for ( int i=t; i<todo_indexes.length(); i+=tasks ) {
+                task->chars.add( todo_chars[i] );
+                task->indexes.add( todo_indexes[i] );
+            }
+            _prerender_tasks.fetch_add( 1 );
+            pool->execute( task );
+        }
+    }
+
     /** \brief get glyph item
         \param code is unicode character
         \return glyph pointer if glyph was found, NULL otherwise
@@ -3409,71 +4154,13 @@ public:
         }
         LVFontGlyphCacheItem * item = _glyph_cache.getByChar( ch );
         if ( !item ) {
-            int rend_flags = FT_LOAD_RENDER | ( !_drawMonochrome ? FT_LOAD_TARGET_LIGHT : FT_LOAD_TARGET_MONO );
-                                                    //|FT_LOAD_MONOCHROME|FT_LOAD_FORCE_AUTOHINT
-            if (_hintingMode == HINTING_MODE_BYTECODE_INTERPRETOR) {
-                rend_flags |= FT_LOAD_NO_AUTOHINT;
-            }
-            else if (_hintingMode == HINTING_MODE_AUTOHINT) {
-                rend_flags |= FT_LOAD_FORCE_AUTOHINT;
-            }
-            else if (_hintingMode == HINTING_MODE_DISABLED) {
-                rend_flags |= FT_LOAD_NO_AUTOHINT | FT_LOAD_NO_HINTING;
-            }
-            if (_synth_weight > 0 || _italic == 2) { // Don't render yet
-                rend_flags &= ~FT_LOAD_RENDER;
-                // Also disable any hinting, as it would be wrong after embolden.
-                // But it feels this is now fine after switching to FT_LOAD_TARGET_LIGHT.
-                // rend_flags |= FT_LOAD_NO_AUTOHINT | FT_LOAD_NO_HINTING;
-            }
-
             /* load glyph image into the slot (erase previous one) */
             updateTransform(); // no-op
-            int error = FT_Load_Glyph( _face, /* handle to face object */
-                    ch_glyph_index,           /* glyph index           */
-                    rend_flags );             /* load flags, see below */
-            if ( error == FT_Err_Execution_Too_Long && _hintingMode == HINTING_MODE_BYTECODE_INTERPRETOR ) {
-                // Native hinting bytecode may fail with some bad fonts: try again with no hinting
-                rend_flags |= FT_LOAD_NO_HINTING;
-                error = FT_Load_Glyph( _face, ch_glyph_index, rend_flags );
-            }
-            if ( error ) {
+            FT_GlyphSlot slot = renderGlyphSlot( _face, ch_glyph_index, false );
+            if ( !slot ) {
                 return NULL;  /* ignore errors */
             }
-
-            bool is_embolden = false;
-            if (_synth_weight > 0) {
-                if ( _slot->format == FT_GLYPH_FORMAT_OUTLINE ) {
-                    // See setSynthWeight() for details
-                    FT_Outline_Embolden(&_slot->outline, _synth_weight_strength);
-                    FT_Outline_Translate(&_slot->outline, 0, -_synth_weight_half_strength);
-                    is_embolden = true; // _slot->format changes to BITMAP after render
-                }
-            }
-            if (_italic == 2) {
-                FT_GlyphSlot_Oblique(_slot);
-            }
-            if (_synth_weight > 0 || _italic == 2) {
-                // Render now that transformations are applied
-                FT_Render_Glyph(_slot, _drawMonochrome?FT_RENDER_MODE_MONO:FT_RENDER_MODE_LIGHT);
-            }
-
-            if (_synth_weight > 0 && is_embolden) {
-                // Tweak some metrics if synthesized weight
-                if ( _slot->metrics.horiAdvance > 0 ) {
-                    // _slot->metrics.horiAdvance += _synth_weight_strength;
-                    // As in getGlyphInfo(), we need to use _slot->linearHoriAdvance to get
-                    // the same advance/width whether hinting or not
-                    _slot->metrics.horiAdvance = (_slot->linearHoriAdvance >> 10) + _synth_weight_strength;
-                }
-                else { // probable diacritic
-                    // Compensate the width added to the previous advancing char
-                    // by making the negative originX more negative
-                    _slot->metrics.horiBearingX -= _synth_weight_strength;
-                }
-            }
-
-            item = newItem( &_glyph_cache, (lChar32)ch, _slot ); //, _drawMonochrome
+            item = newItem( &_glyph_cache, (lChar32)ch, slot ); //, _drawMonochrome
             if (item)
                 _glyph_cache.put( item );
         }
@@ -3481,79 +4168,21 @@ public:
     }
 
 #if USE_HARFBUZZ==1
-    LVFontGlyphCacheItem * getGlyphByIndex(lUInt32 index) {
+    /// get glyph item by glyph index, rendered shifted right by phase/_subpixelPhases pixel
+    LVFontGlyphCacheItem * getGlyphByIndex(lUInt32 index, int phase=0) {
         //FONT_GUARD
-        LVFontGlyphCacheItem *item = _glyph_cache2.getByIndex(index);
+        // Each phase is cached as a distinct glyph
+        lUInt32 key = GLYPH_INDEX_WITH_PHASE(index, phase);
+        LVFontGlyphCacheItem *item = _glyph_cache2.getByIndex(key);
         if (!item) {
             // glyph not found in cache, rendering...
-            int rend_flags = FT_LOAD_RENDER | ( !_drawMonochrome ? FT_LOAD_TARGET_LIGHT : FT_LOAD_TARGET_MONO );
-                                                    //|FT_LOAD_MONOCHROME|FT_LOAD_FORCE_AUTOHINT
-            if (_hintingMode == HINTING_MODE_BYTECODE_INTERPRETOR) {
-                rend_flags |= FT_LOAD_NO_AUTOHINT;
-            }
-            else if (_hintingMode == HINTING_MODE_AUTOHINT) {
-                rend_flags |= FT_LOAD_FORCE_AUTOHINT;
-            }
-            else if (_hintingMode == HINTING_MODE_DISABLED) {
-                rend_flags |= FT_LOAD_NO_AUTOHINT | FT_LOAD_NO_HINTING;
-            }
-
-            if (_synth_weight > 0 || _italic == 2) { // Don't render yet
-                rend_flags &= ~FT_LOAD_RENDER;
-                // Also disable any hinting, as it would be wrong after embolden.
-                // But it feels this is now fine after switching to FT_LOAD_TARGET_LIGHT.
-                // rend_flags |= FT_LOAD_NO_AUTOHINT | FT_LOAD_NO_HINTING;
-            }
-
             /* load glyph image into the slot (erase previous one) */
             updateTransform(); // no-op
-            int error = FT_Load_Glyph( _face, /* handle to face object */
-                    index,                    /* glyph index           */
-                    rend_flags );             /* load flags, see below */
-            if ( error == FT_Err_Execution_Too_Long && _hintingMode == HINTING_MODE_BYTECODE_INTERPRETOR ) {
-                // Native hinting bytecode may fail with some bad fonts: try again with no hinting
-                rend_flags |= FT_LOAD_NO_HINTING;
-                error = FT_Load_Glyph( _face, index, rend_flags );
-            }
-            if ( error ) {
+            FT_GlyphSlot slot = renderGlyphSlot( _face, index, true, phase * 64 / _subpixelPhases );
+            if ( !slot ) {
                 return NULL;  /* ignore errors */
             }
-
-            bool is_embolden = false;
-            if (_synth_weight > 0) {
-                if ( _slot->format == FT_GLYPH_FORMAT_OUTLINE ) {
-                    // See setSynthWeight() for details
-                    FT_Outline_Embolden(&_slot->outline, _synth_weight_strength);
-                    FT_Outline_Translate(&_slot->outline, 0, -_synth_weight_half_strength);
-                    is_embolden = true; // _slot->format changes to BITMAP after render
-                }
-            }
-            if (_italic==2) {
-                FT_GlyphSlot_Oblique(_slot);
-            }
-            if (_synth_weight > 0 || _italic == 2) {
-                // Render now that transformations are applied
-                FT_Render_Glyph(_slot, _drawMonochrome?FT_RENDER_MODE_MONO:FT_RENDER_MODE_LIGHT);
-            }
-            if (_synth_weight > 0 && is_embolden) {
-                if ( _slot->format == FT_GLYPH_FORMAT_OUTLINE ) {
-                    // Tweak some metrics if synthesized weight
-                    if ( _slot->metrics.horiAdvance > 0 ) {
-                        // _slot->metrics.horiAdvance += _synth_weight_strength;
-                        // As in getGlyphInfo(), we need to use _slot->linearHoriAdvance to get
-                        // the same advance/width whether hinting or not
-                        _slot->metrics.horiAdvance = (_slot->linearHoriAdvance >> 10) + _synth_weight_strength;
-                        // (this won't be used with Harfbuzz, but we'll tweak glyph_pos[hg].x_advance the same way)
-                    }
-                    else { // probable diacritic
-                        // Compensate the width added to the previous advancing char
-                        // by making the negative originX more negative
-                        _slot->metrics.horiBearingX -= _synth_weight_strength;
-                    }
-                }
-            }
-
-            item = newItem(&_glyph_cache2, index, _slot);
+            item = newItem(&_glyph_cache2, key, slot);
             if (item)
                 _glyph_cache2.put(item);
         }
@@ -3595,6 +4224,7 @@ public:
     /// returns char glyph advance width
     virtual int getCharWidth( lChar32 ch, lChar32 def_char='?' )
     {
+        FONT_FACE_GUARD
         int w = _wcache.get(ch);
         if ( w == CACHED_UNSIGNED_METRIC_NOT_SET ) {
             glyph_info_t glyph;
@@ -3614,6 +4244,7 @@ public:
     {
         if ( italic_only && !getItalic() )
             return 0;
+        FONT_FACE_GUARD
         int b = _lsbcache.get(ch);
         if ( b == CACHED_SIGNED_METRIC_NOT_SET ) {
             glyph_info_t glyph;
@@ -3635,6 +4266,7 @@ public:
     {
         if ( italic_only && !getItalic() )
             return 0;
+        FONT_FACE_GUARD
         int b = _rsbcache.get(ch);
         if ( b == CACHED_SIGNED_METRIC_NOT_SET ) {
             glyph_info_t glyph;
@@ -4058,9 +4690,11 @@ public:
                        int target_w=-1, int target_h=-1,
                        SVGGlyphsCollector * svg_collector=NULL)
     {
-        FONT_GUARD
+        FONT_FACE_GUARD
         if ( len <= 0 || _face==NULL )
             return 0;
+        // keep glyphs we get valid, even if evicted by another thread
+        LVFontGlyphCacheReadSection glyph_reader( _glyph_cache.getGlobalCache() );
         if ( letter_spacing < 0 ) {
             letter_spacing = 0;
         }
@@ -4090,76 +4724,35 @@ public:
             unsigned int glyph_count;
             hb_glyph_info_t *glyph_info = 0;
             hb_glyph_position_t *glyph_pos = 0;
-            hb_buffer_clear_contents(_hb_buffer);
-            // Fill HarfBuzz buffer
+            hb_direction_t direction;
+            hb_script_t script;
             bool is_fallback_font = flags & LFNT_HINT_IS_FALLBACK_FONT;
             LVFontRef fallback = is_fallback_font ? getNextFallbackFont() : getFallbackFont();
             bool has_fallback_font = !fallback.isNull();
-            if ( has_fallback_font ) { // It has a fallback font, add chars as-is
-                for (i = 0; i < len; i++) {
-                    hb_buffer_add(_hb_buffer, (hb_codepoint_t)(text[i]), i);
-                }
-            }
-            else { // No fallback font, check codepoint presence or get replacement char
-                for (i = 0; i < len; i++) {
-                    hb_buffer_add(_hb_buffer, (hb_codepoint_t)filterChar(text[i], def_char), i);
-                }
-            }
-            hb_buffer_set_content_type(_hb_buffer, HB_BUFFER_CONTENT_TYPE_UNICODE);
-
-            // If we are provided with direction and hints, let harfbuzz know
-            if ( flags ) {
-                if ( flags & LFNT_HINT_DIRECTION_KNOWN ) {
-                    // Trust direction decided by fribidi: if we made a word containing just '(',
-                    // harfbuzz wouldn't be able to determine its direction and would render
-                    // it LTR - while it could be in some RTL text and needs to be mirrored.
-                    if ( flags & LFNT_HINT_DIRECTION_IS_RTL )
-                        hb_buffer_set_direction(_hb_buffer, HB_DIRECTION_RTL);
-                    else
-                        hb_buffer_set_direction(_hb_buffer, HB_DIRECTION_LTR);
-                }
-                int hb_flags = HB_BUFFER_FLAG_DEFAULT; // (hb_buffer_flags_t won't let us do |= )
-                if ( flags & LFNT_HINT_BEGINS_PARAGRAPH )
-                    hb_flags |= HB_BUFFER_FLAG_BOT;
-                if ( flags & LFNT_HINT_ENDS_PARAGRAPH )
-                    hb_flags |= HB_BUFFER_FLAG_EOT;
-                hb_buffer_set_flags(_hb_buffer, (hb_buffer_flags_t)hb_flags);
-            }
-            if ( lang_cfg ) {
-                hb_buffer_set_language(_hb_buffer, lang_cfg->getHBLanguage());
-            }
-            // Let HB guess what's not been set (script, direction, language)
-            hb_buffer_guess_segment_properties(_hb_buffer);
-            // In case HB couldn't guess a script from the unicode chars we added to its buffer,
+            // Shape (or get the glyphs from a previous identical shaping, possibly
+            // done by measureText()).
+            // Unlike measureText(), we trust direction decided by fribidi: if we made a word
+            // containing just '(', harfbuzz wouldn't be able to determine its direction and
+            // would render it LTR - while it could be in some RTL text and needs to be mirrored.
+            // And in case HB couldn't guess a script from the unicode chars we added to its buffer,
             // (which can happen when we give it a single CJK punctuation which would be considered
             // as script COMMON, or a sequence of digits and punctuations), make sure we have HB aware
             // of some valid script, so that at least the 'locl' feature works and is able to provide
             // glyphs for the requested hb_language.
-            if ( hb_buffer_get_script(_hb_buffer) == HB_SCRIPT_INVALID ) {
-                // Provide "latn", which has the best chance to be known by the font and have
-                // its OpenType features working.
-                hb_buffer_set_script(_hb_buffer, HB_SCRIPT_LATIN);
-            }
+            hbShape( text, len, def_char, has_fallback_font, flags, lang_cfg, true,
+                     glyph_count, glyph_info, glyph_pos, direction, script );
 
             // See measureText() for details
             if ( letter_spacing > 0 ) {
                 // Don't apply letter-spacing if the script is cursive
-                hb_script_t script = hb_buffer_get_script(_hb_buffer);
                 if ( isHBScriptCursive(script) )
                     letter_spacing = 0;
             }
 
-            // Shape
-            hb_shape(_hb_font, _hb_buffer, _hb_features.ptr(), (unsigned int)_hb_features.length());
-
             // If direction is RTL, hb_shape() has reversed the order of the glyphs, so
             // they are in visual order and ready to be iterated and drawn. So,
             // we do not revert them, unlike in measureText().
-            bool is_rtl = hb_buffer_get_direction(_hb_buffer) == HB_DIRECTION_RTL;
-
-            glyph_count = hb_buffer_get_length(_hb_buffer);
-            glyph_info = hb_buffer_get_glyph_infos(_hb_buffer, 0);
-            glyph_pos = hb_buffer_get_glyph_positions(_hb_buffer, 0);
+            bool is_rtl = direction == HB_DIRECTION_RTL;
 
             #ifdef DEBUG_DRAW_TEXT
                 printf("DTHB >>> drawTextString %x len %d is_rtl=%d [%s]\n", text, len, is_rtl, _faceName.c_str());
@@ -4192,6 +4785,11 @@ public:
             int fb_t_start = 0;
             int fb_t_end = len;
             int hg = 0;  // index in glyph_info/glyph_pos
+            // With subpixel positioning, glyphs are drawn at the pen position (the
+            // sum of the 26.6 advances, see hbGlyphAdvance()), with the cached
+            // glyph variant rendered at the nearest fraction of pixel
+            int subpixel_pen = 0;
+            int * pen = _subpixelPhases > 1 && !transform_stretch ? &subpixel_pen : NULL;
             while (hg < glyph_count) { // hg is the start of a new cluster at this point
                 bool draw_with_fallback = false;
                 int hcl = glyph_info[hg].cluster;
@@ -4321,7 +4919,7 @@ public:
                     int prev_x = x;
                     for (i = hg; i < hg2; i++) {
                         if ( svg_collector ) {
-                            bool can_adjust_from_previous = (i == hg) && !isHBScriptCursive(hb_buffer_get_script(_hb_buffer));
+                            bool can_adjust_from_previous = (i == hg) && !isHBScriptCursive(script);
                             svg_collector->collectGlyph(this, glyph_info[i].codepoint, true, text[glyph_info[i].cluster],
                                                         glyph_pos[i].x_offset,  -glyph_pos[i].y_offset,
                                                         glyph_pos[i].x_advance, -glyph_pos[i].y_advance,
@@ -4329,7 +4927,24 @@ public:
                             svg_collector->addGlyph();
                             continue;
                         }
-                        LVFontGlyphCacheItem *item = getGlyphByIndex(glyph_info[i].codepoint);
+                        int dx = 0;
+                        int phase = 0;
+                        if ( pen ) {
+                            // Glyph origin relative to x (pixels the pen was rounded to)
+                            int origin = subpixel_pen - (FONT_METRIC_TO_PX(subpixel_pen) << 6) + glyph_pos[i].x_offset;
+                            dx = origin >> 6;
+                            phase = ((origin & 63) * _subpixelPhases + 32) >> 6;
+                            if ( phase == _subpixelPhases ) {
+                                phase = 0;
+                                dx++;
+                            }
+                        }
+                        else {
+                            dx = FONT_METRIC_TO_PX(glyph_pos[i].x_offset);
+                        }
+                        LVFontGlyphCacheItem *item = getGlyphByIndex(glyph_info[i].codepoint, phase);
+                        if ( !item && pen ) // keep pen in sync with measureText()
+                            hbGlyphAdvance( glyph_pos[i].x_advance, pen );
                         if (item) {
                             if ( transform_stretch ) {
                                 // Stretched drawing of glyph to the x/y/w/h provided (used with MathML)
@@ -4340,11 +4955,7 @@ public:
                             }
                             else {
                                 // Regular drawing of glyph at the baseline
-                                int w;
-                                if ( glyph_pos[i].x_advance )
-                                    w = FONT_METRIC_TO_PX(glyph_pos[i].x_advance + _synth_weight_strength);
-                                else
-                                    w = 0;
+                                int w = hbGlyphAdvance( glyph_pos[i].x_advance, pen );
                                 #ifdef DEBUG_DRAW_TEXT
                                     printf("%x(x=%d+%d,w=%d) ", glyph_info[i].codepoint, x,
                                             item->origin_x + FONT_METRIC_TO_PX(glyph_pos[i].x_offset), w);
@@ -4406,7 +5017,7 @@ public:
                                     // gives x=x0+width, which is necessary to correctly draw any underline
                                     w = x0 + width - x;
                                 }
-                                buf->Draw(x + item->origin_x + FONT_METRIC_TO_PX(glyph_pos[i].x_offset),
+                                buf->Draw(x + item->origin_x + dx,
                                           y + _baseline - item->origin_y - FONT_METRIC_TO_PX(glyph_pos[i].y_offset),
                                           item->bmp,
                                           item->bmp_width,
@@ -4885,13 +5496,17 @@ public:
     virtual void Clear()
     {
         LVLock lock(_mutex);
-        clearCache();
+        clearCache(); // (waits for prerendering tasks)
         #if USE_HARFBUZZ==1
         if (_hb_font) {
             hb_font_destroy(_hb_font);
             _hb_font = 0;
         }
         #endif
+        for ( int i=0; i<_worker_faces.length(); i++ )
+            FT_Done_Face(_worker_faces[i]);
+        _worker_faces.clear();
+        _worker_face_count = 0;
         if ( _face ) {
             FT_Done_Face(_face);
             _face = NULL;
@@ -4948,12 +5563,17 @@ public:
 
     /// hyphen width
     virtual int getHyphenWidth() {
-        FONT_GUARD
+        FONT_MEASURE_GUARD
         if ( _hyphWidth<0 )
             _hyphWidth = getCharWidth( getHyphChar() );
         return _hyphWidth;
     }
 
+    virtual bool hasGlyphs( const lChar32 * text, int len ) {
+        lChar32 hyph = getHyphChar();
+        return _baseFont->hasGlyphs( text, len ) && _baseFont->hasGlyphs( &hyph, 1 );
+    }
+
     /** \brief get glyph info
         \param glyph is pointer to glyph_info_t struct to place retrieved info
         \return true if glyh was found
@@ -5207,6 +5827,7 @@ public:
     {
         if ( len <= 0 )
             return 0;
+        LVFontGlyphCacheReadSection glyph_reader( _glyph_cache.getGlobalCache() );
         if ( letter_spacing < 0 ) {
             letter_spacing = 0;
         }
@@ -5296,11 +5917,22 @@ public:
         _baseFont->setBitmapMode( m );
     }
 
+    /// prerender base font glyphs (emboldened when drawn)
+    virtual void prerenderGlyphs( const lChar32 * chars, int count, CRThreadPool * pool, int maxTasks )
+    {
+        _baseFont->prerenderGlyphs( chars, count, pool, maxTasks );
+    }
+
     /// sets current hinting mode
     virtual void setHintingMode(hinting_mode_t mode) { _baseFont->setHintingMode(mode); }
     /// returns current hinting mode
     virtual hinting_mode_t  getHintingMode() const { return _baseFont->getHintingMode(); }
 
+    /// sets number of subpixel glyph positions
+    virtual void setSubpixelPositioning( int phases ) { _baseFont->setSubpixelPositioning(phases); }
+    /// returns number of subpixel glyph positions
+    virtual int getSubpixelPositioning() const { return _baseFont->getSubpixelPositioning(); }
+
     /// get kerning mode
     virtual kerning_mode_t getKerningMode() const { return _baseFont->getKerningMode(); }
 
@@ -5357,6 +5989,9 @@ private:
     FT_Library  _library;
     LVFontGlobalGlyphCache _globalCache;
     lString32 _requiredChars;
+    CRThreadPool * _prerenderPool;
+    int _prerenderThreads;
+    int _subpixelPhases;
     #if (DEBUG_FONT_MAN==1)
     FILE * _log;
     #endif
@@ -5531,6 +6166,25 @@ public:
         return _hintingMode;
     }
 
+    virtual void SetSubpixelPositioning( int phases ) {
+        phases = phases >= 4 ? 4 : phases >= 2 ? 2 : 1;
+        if (_subpixelPhases == phases)
+            return;
+        FONT_MAN_GUARD
+        CRLog::debug("Subpixel positioning is changed: %d", phases);
+        _subpixelPhases = phases;
+        gc();
+        clearGlyphCache();
+        LVPtrVector< LVFontCacheItem > * fonts = _cache.getInstances();
+        for ( int i=0; i<fonts->length(); i++ ) {
+            fonts->get(i)->getFont()->setSubpixelPositioning(phases);
+        }
+    }
+
+    virtual int GetSubpixelPositioning() {
+        return _subpixelPhases;
+    }
+
     /// set antialiasing mode
     virtual void SetKerningMode( kerning_mode_t mode )
     {
@@ -5585,6 +6239,48 @@ public:
         #endif
     }
 
+    virtual void SetGlyphPrerenderThreads( int threads )
+    {
+        FONT_GUARD
+        if ( threads == _prerenderThreads )
+            return;
+        // (fonts expect their queued tasks to be run)
+        WaitGlyphPrerendering();
+        delete _prerenderPool;
+        _prerenderPool = NULL;
+        _prerenderThreads = threads;
+    }
+
+    virtual int GetGlyphPrerenderThreads()
+    {
+        return _prerenderThreads;
+    }
+
+    virtual void PrerenderGlyphs( LVFontGlyphSet & glyphs )
+    {
+        FONT_GUARD
+        if ( _prerenderThreads < 2 || glyphs.length() == 0 )
+            return;
+        if ( !_prerenderPool )
+            _prerenderPool = new CRThreadPool( _prerenderThreads );
+        if ( _prerenderPool->isSynchronous() ) {
+            // No concurrency provider (yet): nothing to gain
+            delete _prerenderPool;
+            _prerenderPool = NULL;
+            return;
+        }
+        for ( int i=0; i<glyphs.length(); i++ ) {
+            LVFontGlyphSet::Entry * entry = glyphs.get(i);
+            entry->font->prerenderGlyphs( entry->chars.get(), entry->chars.length(), _prerenderPool, _prerenderThreads );
+        }
+    }
+
+    virtual void WaitGlyphPrerendering()
+    {
+        if ( _prerenderPool )
+            _prerenderPool->waitAll();
+    }
+
     virtual int GetFontCount()
     {
         return _cache.length();
@@ -5815,6 +6511,9 @@ public:
     virtual ~LVFreeTypeFontManager()
     {
         FONT_MAN_GUARD
+        WaitGlyphPrerendering();
+        delete _prerenderPool;
+        _prerenderPool = NULL;
         _globalCache.clear();
         _cache.clear();
         if ( _library )
@@ -5830,7 +6529,7 @@ public:
     }
 
     LVFreeTypeFontManager()
-    : _library(NULL), _globalCache(GLYPH_CACHE_SIZE)
+    : _library(NULL), _globalCache(GLYPH_CACHE_SIZE), _prerenderPool(NULL), _prerenderThreads(0), _subpixelPhases(1)
     {
         FONT_MAN_GUARD
         int error = FT_Init_FreeType( &_library );
@@ -7362,6 +8061,18 @@ LVFontCacheItem * LVFontCache::findFallback( lString8 face, int size )
 }
 
 LVFontCacheItem * LVFontCache::find( const LVFontDef * fntdef, bool useBias )
+{
+    LVFontCacheKey key( *fntdef, useBias );
+    LVFontCacheItem * item;
+    if ( _find_memo.get( key, item ) )
+        return item;
+    item = _find( fntdef, useBias );
+    if ( item ) // (not found if no font registered: don't keep that)
+        _find_memo.set( key, item );
+    return item;
+}
+
+LVFontCacheItem * LVFontCache::_find( const LVFontDef * fntdef, bool useBias )
 {
     int best_index = -1;
     int best_match = -1;
@@ -7407,6 +8118,7 @@ LVFontCacheItem * LVFontCache::find( const LVFontDef * fntdef, bool useBias )
 
 bool LVFontCache::setAsPreferredFontWithBias( lString8 face, int bias, bool clearOthersBias )
 {
+    _find_memo.clear();
     bool found = false;
     int i;
     for (i=0; i<_instance_list.length(); i++) {
@@ -7426,6 +8138,7 @@ void LVFontCache::addInstance( const LVFontDef * def, LVFontRef fnt )
     LVFontCacheItem * item = new LVFontCacheItem(*def);
     item->_fnt = fnt;
     _instance_list.add( item );
+    _find_memo.clear(); // may be a better match for some requests
 }
 
 void LVFontCache::update( const LVFontDef * def, LVFontRef fnt )
@@ -7458,6 +8171,7 @@ void LVFontCache::update( const LVFontDef * def, LVFontRef fnt )
         LVFontCacheItem * item;
         item = new LVFontCacheItem(*def);
         _registered_list.add( item );
+        _find_memo.clear();
     }
 }
 
@@ -7497,6 +8211,7 @@ void LVFontCache::removeDocumentFonts(int documentId)
 {
     if (-1 == documentId)
         return;
+    _find_memo.clear();
     _removeDocumentFonts(documentId, _registered_list);
     _removeDocumentFonts(documentId, _instance_list);
 }
@@ -7541,6 +8256,7 @@ void LVFontCache::gc()
                         _instance_list[i]->getDef()->getSize() );
             }
             _instance_list.erase(i, 1);
+            _find_memo.clear();
             droppedCount++;
         }
         else {
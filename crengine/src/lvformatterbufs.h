@@ -0,0 +1,124 @@
+/*******************************************************
+
+   CoolReader Engine
+
+   lvformatterbufs.h:  per thread buffers for LVFormatter
+
+   This source code is distributed under the terms of
+   GNU General Public License
+
+   See LICENSE file for details
+
+*******************************************************/
+
+#ifndef __LV_FORMATTER_BUFS_H_INCLUDED__
+#define __LV_FORMATTER_BUFS_H_INCLUDED__
+
+// LVFormatter (lvtextfm.cpp) needs, for each paragraph, a set of arrays with
+// one item per char (text, flags, widths, source, bidi types and levels...),
+// and a few more for reordering bidi lines.
+// Each thread has its own list of workspaces holding these arrays: as formatting
+// may nest (inline-blocks, floats and table cells formatted while formatting
+// their container), each nesting level uses the next workspace in the list.
+// The arrays of a set are carved from a single block, which grows geometrically
+// and is kept for the next paragraphs, so allocations only happen while the
+// longest paragraph met by a thread at that nesting level grows.
+
+#include <stdlib.h>
+#include "../include/lvtypes.h"
+
+#define LVFORMATTER_BUFS_MIN_ITEMS  1024
+#define LVFORMATTER_BUFS_MAX_ARRAYS 8
+
+class LVFormatterArena {
+    lUInt8 * _data;
+    size_t _capacity; // bytes allocated at _data
+    int _items; // items available in each array of the current set
+    int _arrayCount;
+    int _itemSizes[LVFORMATTER_BUFS_MAX_ARRAYS];
+    static size_t alignedSize( size_t size ) {
+        return (size + 15) & ~(size_t)15;
+    }
+    // Offset of array n in _data, arrays being 16 bytes aligned
+    size_t offsetOf( int n ) const {
+        size_t offset = 0;
+        for ( int i=0; i<n; i++ )
+            offset += alignedSize( (size_t)_itemSizes[i] * _items );
+        return offset;
+    }
+public:
+    int allocations; // number of allocations of _data, for statistics
+
+    /// Sets arrays[i] to an array of at least count items of itemSizes[i] bytes, for i < nb.
+    /// Content is not kept when arrays have to grow.
+    void reserve( int count, const int * itemSizes, int nb, void ** arrays ) {
+        bool same = nb == _arrayCount;
+        for ( int i=0; same && i<nb; i++ )
+            same = _itemSizes[i] == itemSizes[i];
+        if ( !same || count > _items ) {
+            _arrayCount = nb;
+            for ( int i=0; i<nb; i++ )
+                _itemSizes[i] = itemSizes[i];
+            if ( _items < LVFORMATTER_BUFS_MIN_ITEMS )
+                _items = LVFORMATTER_BUFS_MIN_ITEMS;
+            while ( _items < count )
+                _items *= 2;
+            size_t size = offsetOf( nb );
+            if ( size > _capacity ) {
+                free( _data );
+                _data = (lUInt8 *)malloc( size );
+                _capacity = size;
+                allocations++;
+            }
+        }
+        for ( int i=0; i<nb; i++ )
+            arrays[i] = _data + offsetOf( i );
+    }
+    int getItems() const { return _items; }
+    LVFormatterArena() : _data(NULL), _capacity(0), _items(0), _arrayCount(0), allocations(0) { }
+    ~LVFormatterArena() { free( _data ); }
+};
+
+class LVFormatterWorkspace {
+public:
+    LVFormatterArena paragraph; // per char arrays of the paragraph being formatted
+    LVFormatterArena line;      // per char arrays of a bidi line being reordered
+    LVFormatterWorkspace * next; // used by formatting nested in this one
+    bool inUse;
+    LVFormatterWorkspace() : next(NULL), inUse(false) { }
+    ~LVFormatterWorkspace() { delete next; }
+};
+
+class LVFormatterWorkspaces {
+    LVFormatterWorkspace * _first;
+public:
+    /// Returns the first workspace not in use, marked as in use
+    LVFormatterWorkspace * acquire() {
+        LVFormatterWorkspace ** ws = &_first;
+        while ( *ws && (*ws)->inUse )
+            ws = &(*ws)->next;
+        if ( !*ws )
+            *ws = new LVFormatterWorkspace();
+        (*ws)->inUse = true;
+        return *ws;
+    }
+    static void release( LVFormatterWorkspace * ws ) {
+        ws->inUse = false;
+    }
+    /// Total allocations made by this thread's workspaces, for statistics
+    int getAllocations() const {
+        int count = 0;
+        for ( LVFormatterWorkspace * ws = _first; ws; ws = ws->next )
+            count += ws->paragraph.allocations + ws->line.allocations;
+        return count;
+    }
+    /// Workspaces of the calling thread, freed when it ends
+    static LVFormatterWorkspaces & forCurrentThread() {
+        static thread_local LVFormatterWorkspaces workspaces;
+        return workspaces;
+    }
+    LVFormatterWorkspaces() : _first(NULL) { }
+    ~LVFormatterWorkspaces() { delete _first; }
+};
+
+#endif // __LV_FORMATTER_BUFS_H_INCLUDED__
@@ -0,0 +1,307 @@
+/*******************************************************
+
+   CoolReader Engine
+
+   lvglyphblend.h:  glyph coverage blending kernels
+
+   This source code is distributed under the terms of
+   GNU General Public License
+
+   See LICENSE file for details
+
+*******************************************************/
+
+#ifndef __LV_GLYPH_BLEND_H_INCLUDED__
+#define __LV_GLYPH_BLEND_H_INCLUDED__
+
+// Blend one row of an 8 bits glyph coverage bitmap, in a single color, into
+// a 32 bpp, 16 bpp (565) or 8 bpp gray draw buffer row (used by
+// LVColorDrawBuf::Draw() and LVGrayDrawBuf::Draw()).
+// Vector kernels are selected at compile time (see lvsimd.h).
+// They give exactly the same pixels as the plain loops, which still handle the
+// tail of each row. Define DRAWBUF_DISABLE_SIMD to force the plain loops.
+
+#include "../include/lvtypes.h"
+#include "lvsimd.h"
+
+// For all kernels, with o the glyph pixel coverage, and bopacity the color opacity:
+// - o == 0: dst is left as is
+// - o == 0xFF and bopacity == 0xFF: dst = color
+// - otherwise: opacity = (o*bopacity)>>8, and each channel gets
+//   (dst*(opacity^0xFF) + color*opacity) >> 8
+// (no channel sum can exceed 255*255, so 16 bits lanes are enough)
+
+// 32 bpp: color is 0x00RRGGBB, and blended pixels get a 0x00 alpha byte
+static inline void glyphBlendRow32( lUInt32 * __restrict dst, const lUInt8 * __restrict src, int count,
+                                    lUInt32 color, lUInt8 bopacity )
+{
+    int i = 0;
+#if DRAWBUF_USE_SSE2
+    {
+        const __m128i zero = _mm_setzero_si128();
+        const __m128i bop16 = _mm_set1_epi16(bopacity);
+        const __m128i ff16 = _mm_set1_epi16(0xFF);
+        const __m128i color32 = _mm_set1_epi32((int)color);
+        const __m128i color16 = _mm_unpacklo_epi8(color32, zero); // 2 pixels
+        const __m128i rgb_mask = _mm_set1_epi32(0x00FFFFFF);
+        const __m128i full_ok = bopacity == 0xFF ? _mm_set1_epi32(-1) : zero;
+        for (; i + 4 <= count; i += 4) {
+            lUInt32 s4 = (lUInt32)src[i] | ((lUInt32)src[i+1] << 8) | ((lUInt32)src[i+2] << 16) | ((lUInt32)src[i+3] << 24);
+            if ( s4 == 0 )
+                continue; // background pixels
+            const __m128i s16 = _mm_unpacklo_epi8(_mm_cvtsi32_si128((int)s4), zero);
+            const __m128i s32 = _mm_unpacklo_epi16(s16, zero);
+            const __m128i op = _mm_srli_epi16(_mm_mullo_epi16(s16, bop16), 8);
+            const __m128i al = _mm_xor_si128(op, ff16);
+            // spread each pixel opacity to its 4 channels
+            const __m128i op2 = _mm_unpacklo_epi16(op, op);
+            const __m128i al2 = _mm_unpacklo_epi16(al, al);
+            const __m128i op_lo = _mm_unpacklo_epi32(op2, op2);
+            const __m128i op_hi = _mm_unpackhi_epi32(op2, op2);
+            const __m128i al_lo = _mm_unpacklo_epi32(al2, al2);
+            const __m128i al_hi = _mm_unpackhi_epi32(al2, al2);
+            const __m128i d = _mm_loadu_si128((const __m128i *)(dst + i));
+            const __m128i d_lo = _mm_unpacklo_epi8(d, zero);
+            const __m128i d_hi = _mm_unpackhi_epi8(d, zero);
+            const __m128i r_lo = _mm_srli_epi16(_mm_add_epi16(_mm_mullo_epi16(d_lo, al_lo), _mm_mullo_epi16(color16, op_lo)), 8);
+            const __m128i r_hi = _mm_srli_epi16(_mm_add_epi16(_mm_mullo_epi16(d_hi, al_hi), _mm_mullo_epi16(color16, op_hi)), 8);
+            __m128i res = _mm_and_si128(_mm_packus_epi16(r_lo, r_hi), rgb_mask);
+            const __m128i is_full = _mm_and_si128(_mm_cmpeq_epi32(s32, _mm_set1_epi32(0xFF)), full_ok);
+            res = _mm_or_si128(_mm_and_si128(is_full, color32), _mm_andnot_si128(is_full, res));
+            const __m128i is_bg = _mm_cmpeq_epi32(s32, zero);
+            res = _mm_or_si128(_mm_and_si128(is_bg, d), _mm_andnot_si128(is_bg, res));
+            _mm_storeu_si128((__m128i *)(dst + i), res);
+        }
+    }
+#elif DRAWBUF_USE_NEON
+    {
+        const uint8x8_t bop8 = vdup_n_u8(bopacity);
+        const uint8x8_t ff8 = vdup_n_u8(0xFF);
+        const uint8x8_t cb = vdup_n_u8(color & 0xFF);
+        const uint8x8_t cg = vdup_n_u8((color >> 8) & 0xFF);
+        const uint8x8_t cr = vdup_n_u8((color >> 16) & 0xFF);
+        const uint8x8_t full_ok = vdup_n_u8(bopacity == 0xFF ? 0xFF : 0x00);
+        for (; i + 8 <= count; i += 8) {
+            const uint8x8_t s = vld1_u8(src + i);
+            if ( vget_lane_u64(vreinterpret_u64_u8(s), 0) == 0 )
+                continue; // background pixels
+            const uint8x8_t op = vshrn_n_u16(vmull_u8(s, bop8), 8);
+            const uint8x8_t al = veor_u8(op, ff8);
+            uint8x8x4_t d = vld4_u8((const uint8_t *)(dst + i)); // b, g, r, a planes
+            uint8x8x4_t r;
+            r.val[0] = vshrn_n_u16(vmlal_u8(vmull_u8(d.val[0], al), cb, op), 8);
+            r.val[1] = vshrn_n_u16(vmlal_u8(vmull_u8(d.val[1], al), cg, op), 8);
+            r.val[2] = vshrn_n_u16(vmlal_u8(vmull_u8(d.val[2], al), cr, op), 8);
+            r.val[3] = vdup_n_u8(0);
+            const uint8x8_t is_full = vand_u8(vceq_u8(s, ff8), full_ok);
+            r.val[0] = vbsl_u8(is_full, cb, r.val[0]);
+            r.val[1] = vbsl_u8(is_full, cg, r.val[1]);
+            r.val[2] = vbsl_u8(is_full, cr, r.val[2]);
+            const uint8x8_t is_bg = vceq_u8(s, vdup_n_u8(0));
+            for (int c = 0; c < 4; c++)
+                r.val[c] = vbsl_u8(is_bg, d.val[c], r.val[c]);
+            vst4_u8((uint8_t *)(dst + i), r);
+        }
+    }
+#endif
+    for (; i < count; i++) {
+        // Note: former code was considering pixel opacity >= 0xF0 as fully opaque (0xFF),
+        // not sure why (it would save on the blending computation by 5% to 15%).
+        lUInt8 opacity = src[i]; // glyph pixel opacity
+        if ( opacity == 0 ) {
+            // Background pixel, NOP
+        }
+        else if (opacity == 0xFF && bopacity == 0xFF) { // fully opaque pixel and color
+            dst[i] = color;
+        }
+        else {
+            opacity = (opacity*bopacity)>>8;
+            const lUInt8 alpha = opacity ^ 0xFF;
+            const lUInt32 n1 = (((dst[i] & 0xFF00FF) * alpha + (color & 0xFF00FF) * opacity) >> 8) & 0xFF00FF;
+            const lUInt32 n2 = (((dst[i] & 0x00FF00) * alpha + (color & 0x00FF00) * opacity) >> 8) & 0x00FF00;
+            dst[i] = n1 | n2;
+        }
+    }
+}
+
+// 16 bpp: color is RGB565
+// (per channel, ((dst&mask)*alpha + (color&mask)*opacity)>>8 & mask is computed
+// on the unshifted 5 or 6 bits values, which gives the same bits)
+static inline void glyphBlendRow16( lUInt16 * __restrict dst, const lUInt8 * __restrict src, int count,
+                                    lUInt16 color, lUInt8 bopacity )
+{
+    int i = 0;
+#if DRAWBUF_USE_SSE2
+    {
+        const __m128i zero = _mm_setzero_si128();
+        const __m128i bop16 = _mm_set1_epi16(bopacity);
+        const __m128i ff16 = _mm_set1_epi16(0xFF);
+        const __m128i color16 = _mm_set1_epi16((short)color);
+        const __m128i cr = _mm_set1_epi16(color >> 11);
+        const __m128i cg = _mm_set1_epi16((color >> 5) & 0x3F);
+        const __m128i cb = _mm_set1_epi16(color & 0x1F);
+        const __m128i mask6 = _mm_set1_epi16(0x3F);
+        const __m128i mask5 = _mm_set1_epi16(0x1F);
+        const __m128i full_ok = bopacity == 0xFF ? _mm_set1_epi16(-1) : zero;
+        for (; i + 8 <= count; i += 8) {
+            const __m128i s8 = _mm_loadl_epi64((const __m128i *)(src + i));
+            if ( _mm_movemask_epi8(_mm_cmpeq_epi8(s8, zero)) == 0xFFFF )
+                continue; // background pixels
+            const __m128i s16 = _mm_unpacklo_epi8(s8, zero);
+            const __m128i op = _mm_srli_epi16(_mm_mullo_epi16(s16, bop16), 8);
+            const __m128i al = _mm_xor_si128(op, ff16);
+            const __m128i d = _mm_loadu_si128((const __m128i *)(dst + i));
+            const __m128i dr = _mm_srli_epi16(d, 11);
+            const __m128i dg = _mm_and_si128(_mm_srli_epi16(d, 5), mask6);
+            const __m128i db = _mm_and_si128(d, mask5);
+            const __m128i r = _mm_srli_epi16(_mm_add_epi16(_mm_mullo_epi16(dr, al), _mm_mullo_epi16(cr, op)), 8);
+            const __m128i g = _mm_srli_epi16(_mm_add_epi16(_mm_mullo_epi16(dg, al), _mm_mullo_epi16(cg, op)), 8);
+            const __m128i b = _mm_srli_epi16(_mm_add_epi16(_mm_mullo_epi16(db, al), _mm_mullo_epi16(cb, op)), 8);
+            __m128i res = _mm_or_si128(_mm_or_si128(_mm_slli_epi16(r, 11), _mm_slli_epi16(g, 5)), b);
+            const __m128i is_full = _mm_and_si128(_mm_cmpeq_epi16(s16, ff16), full_ok);
+            res = _mm_or_si128(_mm_and_si128(is_full, color16), _mm_andnot_si128(is_full, res));
+            const __m128i is_bg = _mm_cmpeq_epi16(s16, zero);
+            res = _mm_or_si128(_mm_and_si128(is_bg, d), _mm_andnot_si128(is_bg, res));
+            _mm_storeu_si128((__m128i *)(dst + i), res);
+        }
+    }
+#elif DRAWBUF_USE_NEON
+    {
+        const uint8x8_t bop8 = vdup_n_u8(bopacity);
+        const uint16x8_t ff16 = vdupq_n_u16(0xFF);
+        const uint16x8_t color16 = vdupq_n_u16(color);
+        const uint16x8_t cr = vdupq_n_u16(color >> 11);
+        const uint16x8_t cg = vdupq_n_u16((color >> 5) & 0x3F);
+        const uint16x8_t cb = vdupq_n_u16(color & 0x1F);
+        const uint16x8_t full_ok = vdupq_n_u16(bopacity == 0xFF ? 0xFFFF : 0x0000);
+        for (; i + 8 <= count; i += 8) {
+            const uint8x8_t s8 = vld1_u8(src + i);
+            if ( vget_lane_u64(vreinterpret_u64_u8(s8), 0) == 0 )
+                continue; // background pixels
+            const uint16x8_t s16 = vmovl_u8(s8);
+            const uint16x8_t op = vshrq_n_u16(vmull_u8(s8, bop8), 8);
+            const uint16x8_t al = veorq_u16(op, ff16);
+            const uint16x8_t d = vld1q_u16(dst + i);
+            const uint16x8_t dr = vshrq_n_u16(d, 11);
+            const uint16x8_t dg = vandq_u16(vshrq_n_u16(d, 5), vdupq_n_u16(0x3F));
+            const uint16x8_t db = vandq_u16(d, vdupq_n_u16(0x1F));
+            const uint16x8_t r = vshrq_n_u16(vmlaq_u16(vmulq_u16(dr, al), cr, op), 8);
+            const uint16x8_t g = vshrq_n_u16(vmlaq_u16(vmulq_u16(dg, al), cg, op), 8);
+            const uint16x8_t b = vshrq_n_u16(vmlaq_u16(vmulq_u16(db, al), cb, op), 8);
+            uint16x8_t res = vorrq_u16(vorrq_u16(vshlq_n_u16(r, 11), vshlq_n_u16(g, 5)), b);
+            const uint16x8_t is_full = vandq_u16(vceqq_u16(s16, ff16), full_ok);
+            res = vbslq_u16(is_full, color16, res);
+            res = vbslq_u16(vceqq_u16(s16, vdupq_n_u16(0)), d, res);
+            vst1q_u16(dst + i, res);
+        }
+    }
+#endif
+    for (; i < count; i++) {
+        lUInt8 opacity = src[i]; // glyph pixel opacity
+        if ( opacity == 0 ) {
+            // Background pixel, NOP
+        }
+        else if (opacity == 0xFF && bopacity == 0xFF) { // fully opaque pixel and color
+            dst[i] = color;
+        }
+        else {
+            opacity = (opacity*bopacity)>>8;
+            const lUInt8 alpha = opacity ^ 0xFF;
+            const lUInt32 r = (((dst[i] & 0xF800) * alpha + (color & 0xF800) * opacity) >> 8) & 0xF800;
+            const lUInt32 g = (((dst[i] & 0x07E0) * alpha + (color & 0x07E0) * opacity) >> 8) & 0x07E0;
+            const lUInt32 b = (((dst[i] & 0x001F) * alpha + (color & 0x001F) * opacity) >> 8) & 0x001F;
+            dst[i] = (lUInt16)(r | g | b);
+        }
+    }
+}
+
+// 8 bpp gray
+// (unlike the color kernels, a pixel whose opacity becomes 0 once multiplied
+// by bopacity is left as is, as done by ApplyAlphaGray8())
+static inline void glyphBlendRow8( lUInt8 * __restrict dst, const lUInt8 * __restrict src, int count,
+                                   lUInt8 color, lUInt8 bopacity )
+{
+    int i = 0;
+#if DRAWBUF_USE_SSE2
+    {
+        const __m128i zero = _mm_setzero_si128();
+        const __m128i bop16 = _mm_set1_epi16(bopacity);
+        const __m128i ff16 = _mm_set1_epi16(0xFF);
+        const __m128i ff8 = _mm_set1_epi8((char)0xFF);
+        const __m128i color8 = _mm_set1_epi8((char)color);
+        const __m128i color16 = _mm_set1_epi16(color);
+        const __m128i full_ok = bopacity == 0xFF ? ff8 : zero;
+        for (; i + 16 <= count; i += 16) {
+            const __m128i s = _mm_loadu_si128((const __m128i *)(src + i));
+            if ( _mm_movemask_epi8(_mm_cmpeq_epi8(s, zero)) == 0xFFFF )
+                continue; // background pixels
+            const __m128i op_lo = _mm_srli_epi16(_mm_mullo_epi16(_mm_unpacklo_epi8(s, zero), bop16), 8);
+            const __m128i op_hi = _mm_srli_epi16(_mm_mullo_epi16(_mm_unpackhi_epi8(s, zero), bop16), 8);
+            const __m128i d = _mm_loadu_si128((const __m128i *)(dst + i));
+            const __m128i r_lo = _mm_srli_epi16(_mm_add_epi16(
+                        _mm_mullo_epi16(_mm_unpacklo_epi8(d, zero), _mm_xor_si128(op_lo, ff16)),
+                        _mm_mullo_epi16(color16, op_lo)), 8);
+            const __m128i r_hi = _mm_srli_epi16(_mm_add_epi16(
+                        _mm_mullo_epi16(_mm_unpackhi_epi8(d, zero), _mm_xor_si128(op_hi, ff16)),
+                        _mm_mullo_epi16(color16, op_hi)), 8);
+            __m128i res = _mm_packus_epi16(r_lo, r_hi);
+            const __m128i is_full = _mm_and_si128(_mm_cmpeq_epi8(s, ff8), full_ok);
+            res = _mm_or_si128(_mm_and_si128(is_full, color8), _mm_andnot_si128(is_full, res));
+            const __m128i is_bg = _mm_cmpeq_epi8(_mm_packus_epi16(op_lo, op_hi), zero);
+            res = _mm_or_si128(_mm_and_si128(is_bg, d), _mm_andnot_si128(is_bg, res));
+            _mm_storeu_si128((__m128i *)(dst + i), res);
+        }
+        if ( i + 8 <= count ) { // same on 8 pixels (glyph rows are often shorter than 16)
+            const __m128i s = _mm_loadl_epi64((const __m128i *)(src + i));
+            const __m128i op = _mm_srli_epi16(_mm_mullo_epi16(_mm_unpacklo_epi8(s, zero), bop16), 8);
+            const __m128i d = _mm_loadl_epi64((const __m128i *)(dst + i));
+            const __m128i r = _mm_srli_epi16(_mm_add_epi16(
+                        _mm_mullo_epi16(_mm_unpacklo_epi8(d, zero), _mm_xor_si128(op, ff16)),
+                        _mm_mullo_epi16(color16, op)), 8);
+            __m128i res = _mm_packus_epi16(r, r);
+            const __m128i is_full = _mm_and_si128(_mm_cmpeq_epi8(s, ff8), full_ok);
+            res = _mm_or_si128(_mm_and_si128(is_full, color8), _mm_andnot_si128(is_full, res));
+            const __m128i is_bg = _mm_cmpeq_epi8(_mm_packus_epi16(op, op), zero);
+            res = _mm_or_si128(_mm_and_si128(is_bg, d), _mm_andnot_si128(is_bg, res));
+            _mm_storel_epi64((__m128i *)(dst + i), res);
+            i += 8;
+        }
+    }
+#elif DRAWBUF_USE_NEON
+    {
+        const uint8x8_t bop8 = vdup_n_u8(bopacity);
+        const uint8x8_t ff8 = vdup_n_u8(0xFF);
+        const uint8x8_t color8 = vdup_n_u8(color);
+        const uint8x8_t full_ok = vdup_n_u8(bopacity == 0xFF ? 0xFF : 0x00);
+        for (; i + 8 <= count; i += 8) {
+            const uint8x8_t s = vld1_u8(src + i);
+            if ( vget_lane_u64(vreinterpret_u64_u8(s), 0) == 0 )
+                continue; // background pixels
+            const uint8x8_t op = vshrn_n_u16(vmull_u8(s, bop8), 8);
+            const uint8x8_t d = vld1_u8(dst + i);
+            uint8x8_t res = vshrn_n_u16(vmlal_u8(vmull_u8(d, veor_u8(op, ff8)), color8, op), 8);
+            res = vbsl_u8(vand_u8(vceq_u8(s, ff8), full_ok), color8, res);
+            res = vbsl_u8(vceq_u8(op, vdup_n_u8(0)), d, res);
+            vst1_u8(dst + i, res);
+        }
+    }
+#endif
+    for (; i < count; i++) {
+        lUInt8 opacity = src[i]; // glyph opacity
+        if ( opacity == 0 ) {
+            // Background pixel, NOP
+        }
+        else if (opacity == 0xFF && bopacity == 0xFF) { // fully opaque pixel and color
+            dst[i] = color;
+        }
+        else {
+            opacity = (opacity*bopacity)>>8;
+            if ( opacity ) { // (alpha = opacity ^ 0xFF < 0xFF)
+                const lUInt8 alpha = opacity ^ 0xFF;
+                dst[i] = (dst[i] * alpha + color * opacity) >> 8;
+            }
+        }
+    }
+}
+
+#endif // __LV_GLYPH_BLEND_H_INCLUDED__
@@ -792,15 +792,30 @@ public:
 
             if ( callback )
             {
-                callback->OnStartDecode(this);
                 /* Step 4: set parameters for decompression */
 
-                /* In this example, we don't need to change any of the defaults set by
-                 * jpeg_read_header(), so we do nothing here.
-                 */
                 // CRe expects BGRA (w/ inverted alpha, we'll handle that during the scanline copy).
                 cinfo.out_color_space = JCS_EXT_BGRX;
 
+                // When drawn smaller, let libjpeg scale the image down by 1/2, 1/4 or 1/8
+                // while decoding (cheap with its DCT scaling, and with much less lines to
+                // convert): the callback then only has to resample this reduced image.
+                int target_width, target_height;
+                if ( callback->GetTargetSize(target_width, target_height) && target_width > 0 && target_height > 0 ) {
+                    int denom = 8;
+                    while ( denom > 1 && ( (_width + denom - 1) / denom < target_width
+                                        || (_height + denom - 1) / denom < target_height ) )
+                        denom >>= 1;
+                    if ( denom > 1 ) {
+                        cinfo.scale_num = 1;
+                        cinfo.scale_denom = denom;
+                        jpeg_calc_output_dimensions(&cinfo);
+                        if ( !callback->OnReducedSize(cinfo.output_width, cinfo.output_height) )
+                            cinfo.scale_denom = 1;
+                    }
+                }
+                callback->OnStartDecode(this);
+
                 /* Step 5: Start decompressor */
 
                 (void) jpeg_start_decompress(&cinfo);
@@ -2400,6 +2415,26 @@ LVImageSourceRef LVCreateStreamCopyImageSource( LVStreamRef stream )
     return LVCreateStreamImageSource( LVCreateMemoryStream(stream) );
 }
 
+/// creates image source decoding a memory copy of the stream srcImage decodes from
+LVImageSourceRef LVCreateImageSourceCopy( LVImageSourceRef srcImage )
+{
+    LVStream * stream = srcImage.isNull() ? NULL : srcImage->GetSourceStream();
+    if ( !stream )
+        return LVImageSourceRef();
+    lvpos_t pos = stream->GetPos();
+    LVStreamRef copy = LVCreateMemoryStream();
+    lvsize_t size = LVPumpStream( copy.get(), stream );
+    stream->SetPos( pos );
+    if ( size == 0 || size != stream->GetSize() )
+        return LVImageSourceRef();
+    copy->SetPos( 0 );
+    LVImageSourceRef img = LVCreateStreamImageSource( copy );
+    // (unknown formats get a dummy source)
+    if ( img.isNull() || img->GetWidth() != srcImage->GetWidth() || img->GetHeight() != srcImage->GetHeight() )
+        return LVImageSourceRef();
+    return img;
+}
+
 class LVStretchImgSource : public LVImageSource, public LVImageDecoderCallback
 {
 protected:
@@ -2447,6 +2482,32 @@ public:
 	{
 		_line.clear();
         _callback->OnEndDecode(this, res);
+    }
+    /// the whole source is stretched to _dst_dx x _dst_dy, then possibly scaled again
+    /// by our callback: a source decoded larger than both would only be subsampled
+    virtual bool GetTargetSize( int & width, int & height ) const
+    {
+        // Split, tile and none transforms copy source pixels at their coordinates,
+        // and scalable images render themselves at the target size
+        if ( _hTransform != IMG_TRANSFORM_STRETCH || _vTransform != IMG_TRANSFORM_STRETCH || _src->IsScalable() )
+            return false;
+        int target_width, target_height;
+        if ( !_callback->GetTargetSize(target_width, target_height) || target_width <= 0 || target_height <= 0 ) {
+            target_width = _dst_dx;
+            target_height = _dst_dy;
+        }
+        width = target_width < _dst_dx ? target_width : _dst_dx;
+        height = target_height < _dst_dy ? target_height : _dst_dy;
+        return true;
+    }
+    virtual bool OnReducedSize( int width, int height )
+    {
+        if ( _hTransform != IMG_TRANSFORM_STRETCH || _vTransform != IMG_TRANSFORM_STRETCH || width <= 0 || height <= 0 )
+            return false;
+        // Stretch the reduced lines instead: our output size is unchanged
+        _src_dx = width;
+        _src_dy = height;
+        return true;
     }
 	virtual ldomDocument * GetSourceDocument() { return _src.isNull() ? NULL : _src->GetSourceDocument(); }
 	virtual ldomNode * GetSourceNode() { return _src.isNull() ? NULL : _src->GetSourceNode(); }
@@ -2457,6 +2518,9 @@ public:
     virtual bool   Decode( LVImageDecoderCallback * callback )
 	{
 		_callback = callback;
+		// (a previous decoding may have been at a reduced size)
+		_src_dx = _src->GetWidth();
+		_src_dy = _src->GetHeight();
 		return _src->Decode( this );
 	}
     virtual ~LVStretchImgSource()
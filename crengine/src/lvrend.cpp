@@ -17,6 +17,7 @@
 #include "../include/lvtinydom.h"
 #include "../include/fb2def.h"
 #include "../include/lvrend.h"
+#include "../include/crconcurrent.h"
 
 // Note about box model/sizing in crengine:
 // https://quirksmode.org/css/user-interface/boxsizing.html says:
@@ -130,6 +131,13 @@ int CssPageBreak2Flags( css_page_break_t prop );
 // Uncomment for debugging table rendering:
 // #define DEBUG_TABLE_RENDERING
 
+// With BLOCK_RENDERING_STREAM_LARGE_TABLES, tables with many rows and no
+// rowspan/colspan get their column widths from a sample of their rows, and
+// their rows are built, rendered and released in batches
+#define TABLE_STREAMING_MIN_ROWS    500
+#define TABLE_STREAMING_SAMPLE_ROWS 200
+#define TABLE_STREAMING_BATCH_ROWS  64
+
 class CCRTableCol;
 class CCRTableRow;
 
@@ -203,11 +211,13 @@ public:
     int kind; // erm_table_header_group, erm_table_row_group or erm_table_footer_group
     int height;
     int y;
+    int streamed_rows; // rows placed so far when streamed (rows is then not filled)
     ldomNode * elem;
     LVPtrVector<CCRTableRow, false> rows;
     CCRTableRowGroup() : index(0)
     , height(0)
     , y(0)
+    , streamed_rows(0)
     , elem(NULL)
     { }
 };
@@ -281,23 +291,28 @@ int StrToIntPercent( const lChar32 * s, int digitwidth )
 // the above url rules state: "If border styles differ only in color,
 // then a style set on a cell wins over one on a row, which wins over
 // a row group, column, column group and, lastly, table."
+void collapse_border(css_style_ref_t & target_style, int & current_target_size,
+    int border_id, const css_style_ref_t & neighbour_style, int neighbour_size,
+    bool use_neighbour_if_equal=false) {
+    if ( neighbour_size > current_target_size ||
+            (use_neighbour_if_equal && neighbour_size == current_target_size) ) {
+        switch (border_id) {
+            case 0: target_style->border_style_top = neighbour_style->border_style_top; break;
+            case 1: target_style->border_style_right = neighbour_style->border_style_right; break;
+            case 2: target_style->border_style_bottom = neighbour_style->border_style_bottom; break;
+            case 3: target_style->border_style_left = neighbour_style->border_style_left; break;
+        }
+        target_style->border_width[border_id] = neighbour_style->border_width[border_id];
+        target_style->border_color[border_id] = neighbour_style->border_color[border_id];
+        current_target_size = neighbour_size;
+    }
+}
+
 void collapse_border(css_style_ref_t & target_style, int & current_target_size,
     int border_id, ldomNode * neighbour_node, bool use_neighbour_if_equal=false) {
     if (neighbour_node) {
-        int neighbour_size = measureBorder(neighbour_node, border_id);
-        if ( neighbour_size > current_target_size ||
-                (use_neighbour_if_equal && neighbour_size == current_target_size) ) {
-            css_style_ref_t neighbour_style = neighbour_node->getStyle();
-            switch (border_id) {
-                case 0: target_style->border_style_top = neighbour_style->border_style_top; break;
-                case 1: target_style->border_style_right = neighbour_style->border_style_right; break;
-                case 2: target_style->border_style_bottom = neighbour_style->border_style_bottom; break;
-                case 3: target_style->border_style_left = neighbour_style->border_style_left; break;
-            }
-            target_style->border_width[border_id] = neighbour_style->border_width[border_id];
-            target_style->border_color[border_id] = neighbour_style->border_color[border_id];
-            current_target_size = neighbour_size;
-        }
+        collapse_border(target_style, current_target_size, border_id, neighbour_node->getStyle(),
+                            measureBorder(neighbour_node, border_id), use_neighbour_if_equal);
     }
 }
 
@@ -313,6 +328,10 @@ public:
     bool enhanced_rendering;
     bool is_ruby_table;
     bool rows_rendering_reordered;
+    bool streamed_rows; // rows laid out in batches (see TABLE_STREAMING_MIN_ROWS)
+    int streamed_rows_count; // number of rows when streamed_rows
+    int streamed_rows_looked_up; // rows met by LookupElem() when streamed_rows
+    int streamed_max_cells; // max number of cells in a row when streamed_rows
     ldomNode * elem;
     ldomNode * caption;
     int caption_h;
@@ -324,6 +343,25 @@ public:
     LVPtrVector<CCRTableRowGroup> rowgroups;
     // LVMatrix<CCRTableCell*> cells; // not used (it was filled, but never read)
     CCRTableRowGroup * currentRowGroup;
+    // When border_collapse, the table style and borders before they
+    // were reset, for the streamed rows' cells to collapse them
+    css_style_ref_t collapsed_table_style;
+    int collapsed_table_borders[4];
+    // When streamed_rows, where nextStreamedRow() is in the table
+    int stream_stage; // 0: first header group, 1: table children, 2: first footer group, 3: done
+    int stream_child; // next table child to look at (stage 1)
+    int stream_group_index; // next rowgroups item met among table children (stage 1)
+    CCRTableRowGroup * stream_header_group;
+    CCRTableRowGroup * stream_footer_group;
+    CCRTableRowGroup * stream_group; // group whose rows are being walked, or NULL
+    int stream_group_child;
+    int stream_group_direction;
+    // Next row to be added by loadRowsBatch(), and the group of the last one added
+    ldomNode * stream_next_row;
+    CCRTableRowGroup * stream_next_group;
+    int stream_next_direction;
+    CCRTableRowGroup * stream_prev_group;
+    int stream_row_index; // index in the table of the next row
 
     #if MATHML_SUPPORT==1
         // Additional property
@@ -342,6 +380,211 @@ public:
         }
     }
 
+    // Direction of a table element, from its dir= attribute and style
+    int itemDirection( ldomNode * item, int elem_direction ) {
+        css_style_ref_t style = item->getStyle();
+        int item_direction = elem_direction;
+        if ( item->hasAttribute( attr_dir ) ) {
+            lString32 dir = item->getAttributeValueLC( attr_dir );
+            if ( dir == U"rtl" ) {
+                item_direction = REND_DIRECTION_RTL;
+            }
+            else if ( dir == U"ltr" ) {
+                item_direction = REND_DIRECTION_LTR;
+            }
+            else if ( dir == U"auto" ) {
+                item_direction = REND_DIRECTION_UNSET;
+            }
+        }
+        if ( style->direction != css_dir_inherit ) {
+            if ( style->direction == css_dir_rtl )
+                item_direction = REND_DIRECTION_RTL;
+            else if ( style->direction == css_dir_ltr )
+                item_direction = REND_DIRECTION_LTR;
+            else if ( style->direction == css_dir_unset )
+                item_direction = REND_DIRECTION_UNSET;
+        }
+        return item_direction;
+    }
+
+    // Returns false if a table row contains anything else than plain cells
+    // (cells with rowspan/colspan, nested rows, captions, columns...)
+    bool isStreamableRow( ldomNode * row, int & nb_cells ) {
+        nb_cells = 0;
+        for (int i=0; i<row->getChildCount(); i++) {
+            ldomNode * item = row->getChildElementNode(i);
+            if ( !item )
+                continue;
+            switch ( item->getRendMethod() ) {
+            case erm_block:
+            case erm_final:
+                {
+                    if ( item->getStyle()->display == css_d_table_caption )
+                        return false;
+                    int cs = StrToIntPercent(item->getAttributeValue(attr_colspan).c_str());
+                    int rs = StrToIntPercent(item->getAttributeValue(attr_rowspan).c_str());
+                    if ( (cs > 1 && cs < 100) || (rs > 1 && rs < 100) )
+                        return false;
+                    nb_cells++;
+                }
+                break;
+            case erm_table_row:
+            case erm_table_column_group:
+            case erm_table_column:
+                return false;
+            default:
+                break;
+            }
+        }
+        return true;
+    }
+
+    // Returns false if a row group or column group contains anything
+    // that LookupElem() would not just take as its rows or columns
+    bool isStreamableGroup( ldomNode * group, bool column_group, int & nb_rows, int & max_cells ) {
+        nb_rows = 0;
+        for (int i=0; i<group->getChildCount(); i++) {
+            ldomNode * item = group->getChildElementNode(i);
+            if ( !item )
+                continue;
+            switch ( item->getRendMethod() ) {
+            case erm_table_row:
+                {
+                    int nb_cells;
+                    if ( column_group || !isStreamableRow( item, nb_cells ) )
+                        return false;
+                    if ( nb_cells > max_cells )
+                        max_cells = nb_cells;
+                    nb_rows++;
+                }
+                break;
+            case erm_table_row_group:
+            case erm_table_header_group:
+            case erm_table_footer_group:
+                // Ignored by LookupElem() inside a row group
+                if ( column_group )
+                    return false;
+                break;
+            case erm_block:
+            case erm_final:
+            case erm_table_column_group:
+                return false;
+            default:
+                break;
+            }
+        }
+        return true;
+    }
+
+    // With BLOCK_RENDERING_STREAM_LARGE_TABLES, large tables made only of
+    // rows of plain cells are laid out in batches of rows. This checks the
+    // table without building its rows, and returns its number of rows, or
+    // 0 if it won't be streamed. Sets rows_rendering_reordered as
+    // FixRowGroupsOrder() would have.
+    int countStreamedRows() {
+        if ( !BLOCK_RENDERING_N(elem, STREAM_LARGE_TABLES) || is_ruby_table )
+            return 0;
+        // (MathML tables tweaked by MathML_checkAndTweakTableElement() have
+        // their cells directly in the table, and are not streamed either.)
+        int nb_rows = 0;
+        int max_cells = 0;
+        bool header_met = false;
+        bool footer_met = false;
+        int header_rows = 0;
+        int footer_rows = 0;
+        bool groups_before_header = false;
+        bool rows_before_header = false;
+        bool groups_after_footer = false;
+        bool rows_after_footer = false;
+        for (int i=0; i<elem->getChildCount(); i++) {
+            ldomNode * item = elem->getChildElementNode(i);
+            if ( !item )
+                continue;
+            lvdom_element_render_method rendMethod = item->getRendMethod();
+            switch ( rendMethod ) {
+            case erm_table_row:
+                {
+                    int nb_cells;
+                    if ( !isStreamableRow( item, nb_cells ) )
+                        return 0;
+                    if ( nb_cells > max_cells )
+                        max_cells = nb_cells;
+                    nb_rows++;
+                    if ( !header_met )
+                        rows_before_header = true;
+                    if ( footer_met )
+                        rows_after_footer = true;
+                }
+                break;
+            case erm_table_row_group:
+            case erm_table_header_group:
+            case erm_table_footer_group:
+                {
+                    int group_rows;
+                    if ( !isStreamableGroup( item, false, group_rows, max_cells ) )
+                        return 0;
+                    nb_rows += group_rows;
+                    bool is_header = rendMethod == erm_table_header_group && !header_met;
+                    bool is_footer = rendMethod == erm_table_footer_group && !footer_met;
+                    if ( !header_met && !is_header )
+                        groups_before_header = true;
+                    if ( footer_met )
+                        groups_after_footer = true;
+                    if ( is_header ) {
+                        header_met = true;
+                        header_rows = group_rows;
+                    }
+                    if ( is_footer ) {
+                        footer_met = true;
+                        footer_rows = group_rows;
+                    }
+                }
+                break;
+            case erm_table_column_group:
+                {
+                    int group_rows;
+                    if ( !isStreamableGroup( item, true, group_rows, max_cells ) )
+                        return 0;
+                }
+                break;
+            case erm_block:
+            case erm_final:
+                // Cells out of rows
+                if ( item->getStyle()->display != css_d_table_caption )
+                    return 0;
+                break;
+            default:
+                break;
+            }
+        }
+        if ( nb_rows < TABLE_STREAMING_MIN_ROWS )
+            return 0;
+        if ( enhanced_rendering ) {
+            // FixRowGroupsOrder() moves the first header group and its rows
+            // before anything else, and the first footer group and its rows
+            // after anything else
+            if ( header_met && ( groups_before_header || (rows_before_header && header_rows > 0) ) )
+                rows_rendering_reordered = true;
+            if ( footer_met && ( groups_after_footer || (rows_after_footer && footer_rows > 0) ) )
+                rows_rendering_reordered = true;
+        }
+        streamed_max_cells = max_cells;
+        return nb_rows;
+    }
+
+    // When streamed_rows, only the first rows and rows evenly spread over
+    // the rest of the table are built by LookupElem(), for their cells
+    // content widths to give the column widths
+    bool isSampledRow( int i ) {
+        const int head = TABLE_STREAMING_SAMPLE_ROWS / 2;
+        if ( i < head )
+            return true;
+        int stride = (streamed_rows_count - head) / (TABLE_STREAMING_SAMPLE_ROWS - head);
+        if ( stride < 1 )
+            stride = 1;
+        return (i - head) % stride == 0;
+    }
+
     int LookupElem( ldomNode * el, int elem_direction, int state ) {
         if (!el->getChildCount())
             return 0;
@@ -351,28 +594,7 @@ public:
             if ( item ) {
                 // for each child element
                 css_style_ref_t style = item->getStyle();
-
-                int item_direction = elem_direction;
-                if ( item->hasAttribute( attr_dir ) ) {
-                    lString32 dir = item->getAttributeValueLC( attr_dir );
-                    if ( dir == U"rtl" ) {
-                        item_direction = REND_DIRECTION_RTL;
-                    }
-                    else if ( dir == U"ltr" ) {
-                        item_direction = REND_DIRECTION_LTR;
-                    }
-                    else if ( dir == U"auto" ) {
-                        item_direction = REND_DIRECTION_UNSET;
-                    }
-                }
-                if ( style->direction != css_dir_inherit ) {
-                    if ( style->direction == css_dir_rtl )
-                        item_direction = REND_DIRECTION_RTL;
-                    else if ( style->direction == css_dir_ltr )
-                        item_direction = REND_DIRECTION_LTR;
-                    else if ( style->direction == css_dir_unset )
-                        item_direction = REND_DIRECTION_UNSET;
-                }
+                int item_direction = itemDirection( item, elem_direction );
 
                 lvdom_element_render_method rendMethod = item->getRendMethod();
                 //CRLog::trace("LookupElem[%d] (%s, %d) %d", i, LCSTR(item->getNodeName()), state, (int)item->getRendMethod() );
@@ -415,6 +637,10 @@ public:
                     LookupElem( item, item_direction, 0 );
                     break;
                 case erm_table_row: // table row
+                    if ( streamed_rows && !isSampledRow( streamed_rows_looked_up++ ) ) {
+                        // Built by loadRowsBatch() when rendering
+                        break;
+                    }
                     {
                         // rows of table
                         CCRTableRow * row = new CCRTableRow;
@@ -639,6 +865,259 @@ public:
         }
     }
 
+    // When streamed_rows, walks the table rows in the order LookupElem() and
+    // FixRowGroupsOrder() would have put them: rows of the first header group,
+    // other rows in document order, rows of the first footer group.
+    // Returns NULL after the last one.
+    void enterStreamedGroup( CCRTableRowGroup * group ) {
+        stream_group = group;
+        stream_group_child = 0;
+        stream_group_direction = itemDirection( group->elem, direction );
+    }
+
+    ldomNode * nextStreamedRow( CCRTableRowGroup * & group, int & row_direction ) {
+        while ( true ) {
+            if ( stream_group ) {
+                ldomNode * group_elem = stream_group->elem;
+                while ( stream_group_child < group_elem->getChildCount() ) {
+                    ldomNode * item = group_elem->getChildElementNode( stream_group_child++ );
+                    if ( item && item->getRendMethod() == erm_table_row ) {
+                        group = stream_group;
+                        row_direction = itemDirection( item, stream_group_direction );
+                        return item;
+                    }
+                }
+                stream_group = NULL;
+            }
+            else if ( stream_stage == 0 ) {
+                stream_stage = 1;
+                if ( stream_header_group )
+                    enterStreamedGroup( stream_header_group );
+            }
+            else if ( stream_stage == 1 ) {
+                if ( stream_child >= elem->getChildCount() ) {
+                    stream_stage = 2;
+                    continue;
+                }
+                ldomNode * item = elem->getChildElementNode( stream_child++ );
+                if ( !item )
+                    continue;
+                switch ( item->getRendMethod() ) {
+                case erm_table_row:
+                    group = NULL;
+                    row_direction = itemDirection( item, direction );
+                    return item;
+                case erm_table_row_group:
+                case erm_table_header_group:
+                case erm_table_footer_group:
+                    {
+                        // LookupElem() made rowgroups in this same order
+                        CCRTableRowGroup * grp = rowgroups[stream_group_index++];
+                        if ( grp != stream_header_group && grp != stream_footer_group )
+                            enterStreamedGroup( grp );
+                    }
+                    break;
+                default:
+                    break;
+                }
+            }
+            else if ( stream_stage == 2 ) {
+                stream_stage = 3;
+                if ( stream_footer_group )
+                    enterStreamedGroup( stream_footer_group );
+            }
+            else {
+                return NULL;
+            }
+        }
+    }
+
+    void startStreamedRows() {
+        // Rows built by LookupElem() were only the sampled ones, needed to
+        // compute column widths: drop them
+        for ( int i=0; i<rowgroups.length(); i++ )
+            rowgroups[i]->rows.clear();
+        rows.clear();
+        stream_stage = 0;
+        stream_child = 0;
+        stream_group_index = 0;
+        stream_header_group = NULL;
+        stream_footer_group = NULL;
+        if ( enhanced_rendering ) { // otherwise, FixRowGroupsOrder() does nothing
+            for ( int i=0; i<rowgroups.length(); i++ ) {
+                if ( !stream_header_group && rowgroups[i]->kind == erm_table_header_group )
+                    stream_header_group = rowgroups[i];
+                else if ( !stream_footer_group && rowgroups[i]->kind == erm_table_footer_group )
+                    stream_footer_group = rowgroups[i];
+            }
+        }
+        stream_group = NULL;
+        stream_prev_group = NULL;
+        stream_row_index = 0;
+        stream_next_row = nextStreamedRow( stream_next_group, stream_next_direction );
+    }
+
+    // Replaces rows with the next TABLE_STREAMING_BATCH_ROWS rows of a streamed
+    // table, with their cells placed in the columns sized from the sampled rows.
+    // Returns false when all rows have been laid out.
+    bool loadRowsBatch() {
+        releaseRows();
+        int nbcols = cols.length();
+        while ( stream_next_row && rows.length() < TABLE_STREAMING_BATCH_ROWS ) {
+            CCRTableRow * row = new CCRTableRow;
+            row->elem = stream_next_row;
+            row->rowgroup = stream_next_group;
+            row->index = rows.length();
+            rows.add( row );
+            if (row->elem->hasAttribute(LXML_NS_ANY, attr_link)) {
+                lString32 lnk=row->elem->getAttributeValue(attr_link);
+                row->linkindex = lnk.atoi();
+            }
+            LookupElem( row->elem, stream_next_direction, 1 ); // lookup row cells
+            // Look ahead, to know if this row is the last of its group
+            stream_next_row = nextStreamedRow( stream_next_group, stream_next_direction );
+            bool is_group_first = row->rowgroup && row->rowgroup != stream_prev_group;
+            bool is_group_last = row->rowgroup && ( !stream_next_row || stream_next_group != row->rowgroup );
+            bool is_at_top = stream_row_index == 0;
+            bool is_at_bottom = stream_row_index == streamed_rows_count - 1;
+            stream_prev_group = row->rowgroup;
+            stream_row_index++;
+            // No colspan: cell j is in column j (or nbcols-1-j if RTL, as done
+            // by PlaceCells()), and countStreamedRows() made sure there are
+            // enough columns
+            for (int j=0; j<row->cells.length(); j++) {
+                CCRTableCell * cell = row->cells[j];
+                cell->col = cols[ is_rtl ? nbcols-1 - j : j ];
+                cell->width = cell->col->width;
+            }
+            if ( is_rtl )
+                row->cells.reverse();
+            if ( !collapsed_table_style.isNull() ) {
+                for (int j=0; j<row->cells.length(); j++) {
+                    collapseCellBorders( row->cells[j], row->elem, row->elem, row->rowgroup,
+                                         is_group_first, is_group_last, is_at_top, is_at_bottom );
+                }
+            }
+        }
+        return rows.length() > 0;
+    }
+
+    // Releases the rows laid out in the last batch (streamed_rows)
+    void releaseRows() {
+        for (int i=0; i<rows.length(); i++) {
+            if ( rows[i]->single_col_context ) {
+                delete rows[i]->single_col_context;
+                rows[i]->single_col_context = NULL;
+            }
+        }
+        rows.clear();
+    }
+
+    // When streamed_rows, row groups are placed as their rows are (rows
+    // are not added to rowgroups[]->rows), and rows Y made relative to them
+    void placeStreamedRowGroups() {
+        for (int i=0; i<rows.length(); i++) {
+            CCRTableRow * row = rows[i];
+            CCRTableRowGroup * grp = row->rowgroup;
+            if ( !grp )
+                continue;
+            if ( grp->streamed_rows == 0 )
+                grp->y = row->y;
+            grp->streamed_rows++;
+            grp->height = row->y + row->height - grp->y;
+            RenderRectAccessor rowfmt( row->elem );
+            rowfmt.setY( row->y - grp->y );
+        }
+    }
+
+    // With border-collapse, sets the cell style borders from its own and
+    // the ones of its first and last rows, row group and table.
+    void collapseCellBorders( CCRTableCell * cell, ldomNode * rtop, ldomNode * rbottom,
+                                CCRTableRowGroup * grp, bool is_group_first, bool is_group_last,
+                                bool is_at_top, bool is_at_bottom ) {
+        css_style_ref_t style = cell->elem->getStyle();
+        // (Note: we should not modify styles directly, as the change
+        // in style cache will affect other nodes with the same style,
+        // and corrupt style cache Hash, invalidating cache reuse.)
+        css_style_ref_t newstyle(new css_style_rec_t);
+        copystyle(style, newstyle);
+
+        // We don't do adjacent-cells "border size comparisons and
+        // take the larger one", as it's not obvious to get here
+        // this cell's adjactent ones (possibly multiple on a side
+        // when rowspan/colspan).
+        // But we should at least, for cells with no border, get the
+        // top and bottom, and the left and right for cells at
+        // table edges, from the TR, THEAD/TBODY or TABLE.
+        bool is_at_left = cell->col->index == 0;
+        bool is_at_right = (cell->col->index + cell->colspan) == cols.length();
+        // We'll avoid calling measureBorder() many times for this same cell,
+        // by passing these by reference to collapse_border():
+        int cell_border_top = measureBorder(cell->elem, 0);
+        int cell_border_right = measureBorder(cell->elem, 1);
+        int cell_border_bottom = measureBorder(cell->elem, 2);
+        int cell_border_left = measureBorder(cell->elem, 3);
+        //
+        // With border-collapse, a cell may get its top and bottom
+        // borders from its TR.
+        // (rtop and rbottom may be NULL, but collapse_border() checks for that)
+        collapse_border(newstyle, cell_border_top, 0, rtop);
+        collapse_border(newstyle, cell_border_bottom, 2, rbottom);
+        // We also get the left and right borders, for the first or
+        // the last cell in a row, from the row (top row if multi rows span)
+        if (is_at_left)
+            collapse_border(newstyle, cell_border_left, 3, rtop);
+        if (is_at_right)
+            collapse_border(newstyle, cell_border_right, 1, rtop);
+            // If a row is missing some cells, there is none that stick
+            // to the right of the table (is_at_right is false): the outer
+            // table border will have a hole for this row...
+        // We may also get them from the rowgroup this TR is part of, if any, for
+        // the cells in the first or the last row of this rowgroup
+        if (grp) {
+            if (is_group_first)
+                collapse_border(newstyle, cell_border_top, 0, grp->elem);
+            if (is_group_last)
+                collapse_border(newstyle, cell_border_bottom, 2, grp->elem);
+            if (is_at_left)
+                collapse_border(newstyle, cell_border_left, 3, grp->elem);
+            if (is_at_right)
+                collapse_border(newstyle, cell_border_right, 1, grp->elem);
+        }
+        // And we may finally get borders from the table itself (as they
+        // were before PlaceCells() reset them)
+        if (is_at_top)
+            collapse_border(newstyle, cell_border_top, 0, collapsed_table_style, collapsed_table_borders[0]);
+        if (is_at_bottom)
+            collapse_border(newstyle, cell_border_bottom, 2, collapsed_table_style, collapsed_table_borders[2]);
+        if (is_at_left)
+            collapse_border(newstyle, cell_border_left, 3, collapsed_table_style, collapsed_table_borders[3]);
+        if (is_at_right)
+            collapse_border(newstyle, cell_border_right, 1, collapsed_table_style, collapsed_table_borders[1]);
+
+        // Now, we should disable some borders for this cell,
+        // at inter-cell boundaries.
+        // We could either keep the right and bottom borders
+        // (which would be better to catch coordinates bugs).
+        // Or keep the top and left borders, which is better:
+        // if a cell carries its top border, when splitting
+        // rows to pages, a row at top of page will have its
+        // top border (unlike previous alternative), which is
+        // clearer for the reader.
+        // So, we disable the bottom and right borders, except
+        // for cells that are on the right or at the bottom of
+        // the table, as these will draw the outer table border
+        // on these sides.
+        if ( !is_at_right )
+            newstyle->border_style_right = css_border_none;
+        if ( !is_at_bottom )
+            newstyle->border_style_bottom = css_border_none;
+
+        cell->elem->setStyle(newstyle);
+        // (Note: we should no more modify a style after it has been
+        // applied to a node with setStyle().)
+    }
+
     // More or less complex algorithms to calculate column widths are described at:
     //   https://www.w3.org/TR/css-tables-3/#computing-cell-measures
     //   https://www.w3.org/TR/REC-html40/appendix/notes.html#h-B.5.2
@@ -781,6 +1260,11 @@ public:
                     cell->col_index = cell->col->index;
             }
         }
+        if ( streamed_rows && max_used_x < streamed_max_cells - 1 ) {
+            // Add and keep the columns needed by rows that were not sampled
+            ExtendCols( streamed_max_cells );
+            max_used_x = streamed_max_cells - 1;
+        }
         #ifdef DEBUG_TABLE_RENDERING
             printf("TABLE: grid %dx%d reduced to %dx%d\n",
                 cols.length(), rows.length(), max_used_x+1, max_used_y+1);
@@ -824,100 +1308,26 @@ public:
 
         if (border_collapse) {
             borderspacing_h = 0; // no border spacing when table collapse
+            collapsed_table_style = table_style;
+            for (i=0; i<4; i++)
+                collapsed_table_borders[i] = measureBorder(elem, i);
             // Each cell is responsible for drawing its borders.
-            for (i=0; i<rows.length(); i++) {
+            // (When streamed_rows, this is done on each batch by loadRowsBatch(),
+            // and the sampled rows' cells are measured with their own borders.)
+            for (i=0; i<rows.length() && !streamed_rows; i++) {
                 for (j=0; j<rows[i]->cells.length(); j++) {
                     CCRTableCell * cell = (rows[i]->cells[j]);
                     if ( !cell->elem ) // might be an empty cell added by MathML tweaks
                         continue;
-                    css_style_ref_t style = cell->elem->getStyle();
-                    // (Note: we should not modify styles directly, as the change
-                    // in style cache will affect other nodes with the same style,
-                    // and corrupt style cache Hash, invalidating cache reuse.)
-                    css_style_ref_t newstyle(new css_style_rec_t);
-                    copystyle(style, newstyle);
-
-                    // We don't do adjacent-cells "border size comparisons and
-                    // take the larger one", as it's not obvious to get here
-                    // this cell's adjactent ones (possibly multiple on a side
-                    // when rowspan/colspan).
-                    // But we should at least, for cells with no border, get the
-                    // top and bottom, and the left and right for cells at
-                    // table edges, from the TR, THEAD/TBODY or TABLE.
-                    bool is_at_top = cell->row->index == 0;
-                    bool is_at_bottom = (cell->row->index + cell->rowspan) == rows.length();
-                    bool is_at_left = cell->col->index == 0;
-                    bool is_at_right = (cell->col->index + cell->colspan) == cols.length();
-                    // We'll avoid calling measureBorder() many times for this same cell,
-                    // by passing these by reference to collapse_border():
-                    int cell_border_top = measureBorder(cell->elem, 0);
-                    int cell_border_right = measureBorder(cell->elem, 1);
-                    int cell_border_bottom = measureBorder(cell->elem, 2);
-                    int cell_border_left = measureBorder(cell->elem, 3);
-                    //
-                    // With border-collapse, a cell may get its top and bottom
-                    // borders from its TR.
-                    ldomNode * rtop = rows[cell->row->index]->elem;
-                        // (may be NULL, but collapse_border() checks for that)
+                    CCRTableRow * row = rows[cell->row->index];
                     // For a cell with rowspan>1, not sure if its bottom border should come
                     // from its own starting row, or the other row it happens to end on.
                     // Should look cleaner if we use the later.
-                    ldomNode * rbottom = rows[cell->row->index + cell->rowspan - 1]->elem;
-                    collapse_border(newstyle, cell_border_top, 0, rtop);
-                    collapse_border(newstyle, cell_border_bottom, 2, rbottom);
-                    // We also get the left and right borders, for the first or
-                    // the last cell in a row, from the row (top row if multi rows span)
-                    if (is_at_left)
-                        collapse_border(newstyle, cell_border_left, 3, rtop);
-                    if (is_at_right)
-                        collapse_border(newstyle, cell_border_right, 1, rtop);
-                        // If a row is missing some cells, there is none that stick
-                        // to the right of the table (is_at_right is false): the outer
-                        // table border will have a hole for this row...
-                    // We may also get them from the rowgroup this TR is part of, if any, for
-                    // the cells in the first or the last row of this rowgroup
-                    if (rows[cell->row->index]->rowgroup) {
-                        CCRTableRowGroup * grp = rows[cell->row->index]->rowgroup;
-                        if (rows[cell->row->index] == grp->rows.first())
-                            collapse_border(newstyle, cell_border_top, 0, grp->elem);
-                        if (rows[cell->row->index] == grp->rows.last())
-                            collapse_border(newstyle, cell_border_bottom, 2, grp->elem);
-                        if (is_at_left)
-                            collapse_border(newstyle, cell_border_left, 3, grp->elem);
-                        if (is_at_right)
-                            collapse_border(newstyle, cell_border_right, 1, grp->elem);
-                    }
-                    // And we may finally get borders from the table itself ("elem")
-                    if (is_at_top)
-                        collapse_border(newstyle, cell_border_top, 0, elem);
-                    if (is_at_bottom)
-                        collapse_border(newstyle, cell_border_bottom, 2, elem);
-                    if (is_at_left)
-                        collapse_border(newstyle, cell_border_left, 3, elem);
-                    if (is_at_right)
-                        collapse_border(newstyle, cell_border_right, 1, elem);
-
-                    // Now, we should disable some borders for this cell,
-                    // at inter-cell boundaries.
-                    // We could either keep the right and bottom borders
-                    // (which would be better to catch coordinates bugs).
-                    // Or keep the top and left borders, which is better:
-                    // if a cell carries its top border, when splitting
-                    // rows to pages, a row at top of page will have its
-                    // top border (unlike previous alternative), which is
-                    // clearer for the reader.
-                    // So, we disable the bottom and right borders, except
-                    // for cells that are on the right or at the bottom of
-                    // the table, as these will draw the outer table border
-                    // on these sides.
-                    if ( !is_at_right )
-                        newstyle->border_style_right = css_border_none;
-                    if ( !is_at_bottom )
-                        newstyle->border_style_bottom = css_border_none;
-
-                    cell->elem->setStyle(newstyle);
-                    // (Note: we should no more modify a style after it has been
-                    // applied to a node with setStyle().)
+                    CCRTableRow * lastrow = rows[cell->row->index + cell->rowspan - 1];
+                    CCRTableRowGroup * grp = row->rowgroup;
+                    collapseCellBorders( cell, row->elem, lastrow->elem, grp,
+                            grp && row == grp->rows.first(), grp && row == grp->rows.last(),
+                            cell->row->index == 0, (cell->row->index + cell->rowspan) == rows.length() );
                 }
                 // (Some optimisation could be made in these loops, as
                 // collapse_border() currently calls measureBorder() many
@@ -943,6 +1353,9 @@ public:
 
         // Compute for each cell the max (prefered if possible) and min (width of the
         // longest word, so no word is cut) rendered widths.
+        // When streamed_rows, rows are only the sampled ones: like browsers do with
+        // table-layout: fixed (which use only the first row), content in the other
+        // rows may overflow its cell.
         for (i=0; i<rows.length(); i++) {
             for (j=0; j<rows[i]->cells.length(); j++) {
                 // rows[i]->cells contains only real cells made from node elements
@@ -1436,6 +1849,71 @@ public:
         }
     }
 
+    // Update each cell height to be its row height, so it can draw its
+    // bottom border where it should be: as the row border.
+    // We also apply table cells' vertical-align property.
+    void alignCellsContent() {
+        for (int i=0; i<rows.length(); i++) {
+            for (int j=0; j<rows[i]->cells.length(); j++) {
+                CCRTableCell * cell = rows[i]->cells[j];
+                if ( !cell->elem ) // might be an empty cell added by MathML tweaks
+                    continue;
+                //int x = cell->col->index;
+                int y = cell->row->index;
+                if ( i==y ) {
+                    RenderRectAccessor fmt( cell->elem );
+                    CCRTableRow * lastrow = rows[ cell->row->index + cell->rowspan - 1 ];
+                    int row_h = lastrow->y + lastrow->height - cell->row->y;
+                    // Implement CSS property vertical-align for table cells
+                    // We have to format the cell with the row height for the borders
+                    // to be drawn at the correct positions: we can't just use
+                    // fmt.setY(fmt.getY() + pad) below to implement vertical-align.
+                    // We have to shift down the cell content itself
+                    int cell_h = fmt.getHeight(); // original height that fit cell content
+                    fmt.setHeight( row_h );
+                    if ( cell_h < row_h ) {
+                        int pad = 0; // default when cell->valign=1 / top
+                        if (cell->valign == 0) // baseline
+                            pad = cell->adjusted_baseline - cell->baseline; // shift-down to align cell and row baselines
+                        else if (cell->valign == 2) // center
+                            pad = (row_h - cell_h)/2;
+                        else if (cell->valign == 3) // bottom
+                            pad = (row_h - cell_h);
+                        if ( pad == 0 ) // No need to update this cell
+                            continue;
+                        if ( cell->elem->getRendMethod() == erm_final ) {
+                            if ( enhanced_rendering ) {
+                                // Just shift down the content box
+                                fmt.setInnerY( fmt.getInnerY() + pad );
+                            }
+                            else {
+                                // We need to update the cell element padding-top to include this pad
+                                css_style_ref_t style = cell->elem->getStyle();
+                                css_style_ref_t newstyle(new css_style_rec_t);
+                                copystyle(style, newstyle);
+                                // If padding-top is a percentage, it is relative to
+                                // the *width* of the containing block
+                                int orig_padding_top = lengthToPx( cell->elem, style->padding[2], cell->width );
+                                newstyle->padding[2].type = css_val_screen_px;
+                                newstyle->padding[2].value = orig_padding_top + pad;
+                                cell->elem->setStyle(newstyle);
+                            }
+                        } else if ( cell->elem->getRendMethod() != erm_invisible ) { // erm_block
+                            // We need to update each child fmt.y to include this pad
+                            for (int i=0; i<cell->elem->getChildCount(); i++) {
+                                ldomNode * item = cell->elem->getChildElementNode(i);
+                                if ( item ) {
+                                    RenderRectAccessor f( item );
+                                    f.setY( f.getY() + pad );
+                                }
+                            }
+                        }
+                    }
+                }
+            }
+        }
+    }
+
     int renderCells( LVRendPageContext & context )
     {
         int rend_flags = elem->getDocument()->getRenderBlockRenderingFlags();
@@ -1466,7 +1944,8 @@ public:
         int borderspacing_v_bottom = borderspacing_v - borderspacing_v_top;
         // (Both will be 0 if border_collapse)
 
-        int nb_rows = rows.length();
+        // Rows in the table (rows holds only the current batch when streamed_rows)
+        int nb_rows = streamed_rows ? streamed_rows_count : rows.length();
 
         // We will context.AddLine() for page splitting the elements
         // (caption, rows) as soon as we meet them and their y-positionings
@@ -1637,475 +2116,489 @@ public:
         }
 
         int i, j;
-        // Calc individual cells dimensions
-        for (i=0; i<rows.length(); i++) {
-            CCRTableRow * row = rows[i];
-            bool row_has_baseline_aligned_cells = false;
-            for (j=0; j<rows[i]->cells.length(); j++) {
-                CCRTableCell * cell = rows[i]->cells[j];
-                if ( !cell->elem ) // might be an empty cell added by MathML tweaks
-                    continue;
-                // int x = cell->col->index;
-                int y = cell->row->index;
-                // int n = rows[i]->cells.length();
-                if ( i==y ) { // upper left corner of cell
-                    // We need to render the cell to get its height
-                    if ( cell->elem->getRendMethod() == erm_final ) {
-                        LFormattedTextRef txform;
-                        css_style_ref_t elem_style = cell->elem->getStyle();
-                        int border_left = measureBorder(cell->elem,3);
-                        int border_right = measureBorder(cell->elem,1);
-                        int padding_left = lengthToPx( cell->elem, elem_style->padding[0], cell->width ) + border_left;
-                        int padding_right = lengthToPx( cell->elem, elem_style->padding[1], cell->width ) + border_right;
-                        int padding_top = lengthToPx( cell->elem, elem_style->padding[2], cell->width ) + measureBorder(cell->elem,0);
-                        int padding_bottom = lengthToPx( cell->elem, elem_style->padding[3], cell->width ) + measureBorder(cell->elem,2);
-                        // Deal with negative text-indent, as done in renderBlockElementEnhanced when erm_final
-                        if ( elem_style->text_indent.value < 0 ) {
-                            int indent = - lengthToPx(cell->elem, elem_style->text_indent, cell->width);
-                            if ( !is_rtl ) {
-                                padding_left -= indent;
-                                if ( padding_left < 0 && !BLOCK_RENDERING(rend_flags, ALLOW_HORIZONTAL_BLOCK_OVERFLOW) ) {
-                                    padding_left = 0; // be safe, drop excessive part of indent
+        // Rows are laid out in a single batch, or, when streamed_rows, in batches
+        // of rows built by loadRowsBatch() and released once added to the context
+        int row_offset = 0; // index in the table of rows[0]
+        if ( streamed_rows )
+            loadRowsBatch();
+        do {
+            // Calc individual cells dimensions
+            for (i=0; i<rows.length(); i++) {
+                CCRTableRow * row = rows[i];
+                bool row_has_baseline_aligned_cells = false;
+                for (j=0; j<rows[i]->cells.length(); j++) {
+                    CCRTableCell * cell = rows[i]->cells[j];
+                    if ( !cell->elem ) // might be an empty cell added by MathML tweaks
+                        continue;
+                    // int x = cell->col->index;
+                    int y = cell->row->index;
+                    // int n = rows[i]->cells.length();
+                    if ( i==y ) { // upper left corner of cell
+                        // We need to render the cell to get its height
+                        if ( cell->elem->getRendMethod() == erm_final ) {
+                            LFormattedTextRef txform;
+                            css_style_ref_t elem_style = cell->elem->getStyle();
+                            int border_left = measureBorder(cell->elem,3);
+                            int border_right = measureBorder(cell->elem,1);
+                            int padding_left = lengthToPx( cell->elem, elem_style->padding[0], cell->width ) + border_left;
+                            int padding_right = lengthToPx( cell->elem, elem_style->padding[1], cell->width ) + border_right;
+                            int padding_top = lengthToPx( cell->elem, elem_style->padding[2], cell->width ) + measureBorder(cell->elem,0);
+                            int padding_bottom = lengthToPx( cell->elem, elem_style->padding[3], cell->width ) + measureBorder(cell->elem,2);
+                            // Deal with negative text-indent, as done in renderBlockElementEnhanced when erm_final
+                            if ( elem_style->text_indent.value < 0 ) {
+                                int indent = - lengthToPx(cell->elem, elem_style->text_indent, cell->width);
+                                if ( !is_rtl ) {
+                                    padding_left -= indent;
+                                    if ( padding_left < 0 && !BLOCK_RENDERING(rend_flags, ALLOW_HORIZONTAL_BLOCK_OVERFLOW) ) {
+                                        padding_left = 0; // be safe, drop excessive part of indent
+                                    }
                                 }
-                            }
-                            else {
-                                padding_right -= indent;
-                                if ( padding_right < 0 && !BLOCK_RENDERING(rend_flags, ALLOW_HORIZONTAL_BLOCK_OVERFLOW) ) {
-                                    padding_right = 0;
+                                else {
+                                    padding_right -= indent;
+                                    if ( padding_right < 0 && !BLOCK_RENDERING(rend_flags, ALLOW_HORIZONTAL_BLOCK_OVERFLOW) ) {
+                                        padding_right = 0;
+                                    }
                                 }
                             }
-                        }
-                        RenderRectAccessor fmt( cell->elem );
-                        fmt.setWidth( cell->width ); // needed before calling elem->renderFinalBlock
-                        if ( is_ruby_table )
-                            RENDER_RECT_SET_FLAG(fmt, NO_INTERLINE_SCALE_UP);
-                        if ( enhanced_rendering ) {
-                            // As done in renderBlockElementEnhanced when erm_final
-                            fmt.setInnerX( padding_left );
-                            fmt.setInnerY( padding_top );
-                            fmt.setInnerWidth( cell->width - padding_left - padding_right );
-                            fmt.setUsableLeftOverflow( padding_left - border_left );
-                            fmt.setUsableRightOverflow( padding_right - border_right );
-                            RENDER_RECT_SET_FLAG(fmt, INNER_FIELDS_SET);
-                            RENDER_RECT_SET_DIRECTION(fmt, cell->direction);
-                            fmt.setLangNodeIndex( TextLangMan::getLangNodeIndex(cell->elem) );
-                        }
-                        fmt.push();
-                        int h = cell->elem->renderFinalBlock( txform, &fmt, cell->width - padding_left - padding_right);
-                        context.updateRenderProgress(1);
-                        cell->height = padding_top + h + padding_bottom;
-                        // A cell baseline is the baseline of its first line of text (or
-                        // the bottom of content edge of the cell if no line)
-                        if ( txform->GetLineCount() > 0 ) // we have a line
-                            cell->baseline = padding_top + txform->GetLineInfo(0)->baseline;
-                        else // no line, no image: bottom of content edge is at padding_top
-                            cell->baseline = padding_top;
-
-                        if ( cell->valign == 0 ) { // vertical-align: baseline
-                            // We'll use that baseline
-                            cell->adjusted_baseline = cell->baseline;
-                        }
-                        else { // all other vertical-align: values
-                            // "If a row has no cell box aligned to its baseline,
-                            // the baseline of that row is the bottom content edge
-                            // of the lowest cell in the row."
-                            // We'll position that bottom content edge
-                            cell->adjusted_baseline = padding_top + h;
-                        }
-
-                        // Gather footnotes links, as done in renderBlockElement() when erm_final/flgSplit
-                        // and cell lines when is_single_column:
-                        if ( elem->getDocument()->getDocFlag(DOC_FLAG_ENABLE_FOOTNOTES) || is_single_column ) {
-                            int orphans;
-                            int widows;
-                            if ( is_single_column ) {
-                                orphans = (int)(elem_style->orphans) - (int)(css_orphans_widows_1) + 1;
-                                widows = (int)(elem_style->widows) - (int)(css_orphans_widows_1) + 1;
-                                // We use a LVRendPageContext that gathers links by line,
-                                // so we can transfer them line by line to the upper/main context
-                                row->single_col_context = new LVRendPageContext(NULL, context.getPageHeight());
-                                row->single_col_context->AddLine(0, padding_top, RN_SPLIT_AFTER_AVOID);
+                            RenderRectAccessor fmt( cell->elem );
+                            fmt.setWidth( cell->width ); // needed before calling elem->renderFinalBlock
+                            if ( is_ruby_table )
+                                RENDER_RECT_SET_FLAG(fmt, NO_INTERLINE_SCALE_UP);
+                            if ( enhanced_rendering ) {
+                                // As done in renderBlockElementEnhanced when erm_final
+                                fmt.setInnerX( padding_left );
+                                fmt.setInnerY( padding_top );
+                                fmt.setInnerWidth( cell->width - padding_left - padding_right );
+                                fmt.setUsableLeftOverflow( padding_left - border_left );
+                                fmt.setUsableRightOverflow( padding_right - border_right );
+                                RENDER_RECT_SET_FLAG(fmt, INNER_FIELDS_SET);
+                                RENDER_RECT_SET_DIRECTION(fmt, cell->direction);
+                                fmt.setLangNodeIndex( TextLangMan::getLangNodeIndex(cell->elem) );
+                            }
+                            fmt.push();
+                            int h = cell->elem->renderFinalBlock( txform, &fmt, cell->width - padding_left - padding_right);
+                            context.updateRenderProgress(1);
+                            cell->height = padding_top + h + padding_bottom;
+                            // A cell baseline is the baseline of its first line of text (or
+                            // the bottom of content edge of the cell if no line)
+                            if ( txform->GetLineCount() > 0 ) // we have a line
+                                cell->baseline = padding_top + txform->GetLineInfo(0)->baseline;
+                            else // no line, no image: bottom of content edge is at padding_top
+                                cell->baseline = padding_top;
+
+                            if ( cell->valign == 0 ) { // vertical-align: baseline
+                                // We'll use that baseline
+                                cell->adjusted_baseline = cell->baseline;
                             }
-                            int count = txform->GetLineCount();
-                            for (int i=0; i<count; i++) {
-                                const formatted_line_t * line = txform->GetLineInfo(i);
-                                int link_insert_pos; // used if is_single_column
+                            else { // all other vertical-align: values
+                                // "If a row has no cell box aligned to its baseline,
+                                // the baseline of that row is the bottom content edge
+                                // of the lowest cell in the row."
+                                // We'll position that bottom content edge
+                                cell->adjusted_baseline = padding_top + h;
+                            }
+
+                            // Gather footnotes links, as done in renderBlockElement() when erm_final/flgSplit
+                            // and cell lines when is_single_column:
+                            if ( elem->getDocument()->getDocFlag(DOC_FLAG_ENABLE_FOOTNOTES) || is_single_column ) {
+                                int orphans;
+                                int widows;
                                 if ( is_single_column ) {
-                                    int line_flags = 0;
-                                    // Honor widows and orphans
-                                    if (orphans > 1 && i > 0 && i < orphans)
-                                        line_flags |= RN_SPLIT_BEFORE_AVOID;
-                                    if (widows > 1 && i < count-1 && count-1 - i < widows)
-                                        line_flags |= RN_SPLIT_AFTER_AVOID;
-                                    // Honor line's own flags
-                                    if (line->flags & LTEXT_LINE_SPLIT_AVOID_BEFORE)
-                                        line_flags |= RN_SPLIT_BEFORE_AVOID;
-                                    if (line->flags & LTEXT_LINE_SPLIT_AVOID_AFTER)
-                                        line_flags |= RN_SPLIT_AFTER_AVOID;
-                                    row->single_col_context->AddLine(padding_top + line->y,
-                                                        padding_top + line->y + line->height, line_flags);
-                                    if (i == count-1) // add bottom padding
-                                        row->single_col_context->AddLine(padding_top + line->y + line->height,
-                                            padding_top + line->y + line->height + padding_bottom, RN_SPLIT_BEFORE_AVOID);
-                                    if ( !elem->getDocument()->getDocFlag(DOC_FLAG_ENABLE_FOOTNOTES) )
-                                        continue;
-                                    if ( line->flags & LTEXT_LINE_PARA_IS_RTL )
-                                        link_insert_pos = row->single_col_context->getCurrentLinksCount();
-                                    else
-                                        link_insert_pos = -1; // append
+                                    orphans = (int)(elem_style->orphans) - (int)(css_orphans_widows_1) + 1;
+                                    widows = (int)(elem_style->widows) - (int)(css_orphans_widows_1) + 1;
+                                    // We use a LVRendPageContext that gathers links by line,
+                                    // so we can transfer them line by line to the upper/main context
+                                    row->single_col_context = new LVRendPageContext(NULL, context.getPageHeight());
+                                    row->single_col_context->AddLine(0, padding_top, RN_SPLIT_AFTER_AVOID);
                                 }
-                                for ( int w=0; w<line->word_count; w++ ) { // check link start flag for every word
-                                    if ( line->words[w].flags & LTEXT_WORD_IS_LINK_START ) {
-                                        const src_text_fragment_t * src = txform->GetSrcInfo( line->words[w].src_text_index );
-                                        if ( src && src->object ) {
-                                            ldomNode * node = (ldomNode*)src->object;
-                                            ldomNode * parent = node->getParentNode();
-                                            while (parent && parent->getNodeId() != el_a)
-                                                parent = parent->getParentNode();
-                                            if ( parent && parent->hasAttribute(LXML_NS_ANY, attr_href)
-                                                        && !STYLE_HAS_CR_HINT(parent->getStyle(), NOTEREF_IGNORE) ) {
-                                                lString32 href = parent->getAttributeValue(LXML_NS_ANY, attr_href);
-                                                if ( href.firstChar()=='#' ) {
-                                                    href.erase(0,1);
-                                                    if ( is_single_column )
-                                                        row->single_col_context->addLink( href, link_insert_pos );
-                                                    else
-                                                        row->links.add( href );
+                                int count = txform->GetLineCount();
+                                for (int i=0; i<count; i++) {
+                                    const formatted_line_t * line = txform->GetLineInfo(i);
+                                    int link_insert_pos; // used if is_single_column
+                                    if ( is_single_column ) {
+                                        int line_flags = 0;
+                                        // Honor widows and orphans
+                                        if (orphans > 1 && i > 0 && i < orphans)
+                                            line_flags |= RN_SPLIT_BEFORE_AVOID;
+                                        if (widows > 1 && i < count-1 && count-1 - i < widows)
+                                            line_flags |= RN_SPLIT_AFTER_AVOID;
+                                        // Honor line's own flags
+                                        if (line->flags & LTEXT_LINE_SPLIT_AVOID_BEFORE)
+                                            line_flags |= RN_SPLIT_BEFORE_AVOID;
+                                        if (line->flags & LTEXT_LINE_SPLIT_AVOID_AFTER)
+                                            line_flags |= RN_SPLIT_AFTER_AVOID;
+                                        row->single_col_context->AddLine(padding_top + line->y,
+                                                            padding_top + line->y + line->height, line_flags);
+                                        if (i == count-1) // add bottom padding
+                                            row->single_col_context->AddLine(padding_top + line->y + line->height,
+                                                padding_top + line->y + line->height + padding_bottom, RN_SPLIT_BEFORE_AVOID);
+                                        if ( !elem->getDocument()->getDocFlag(DOC_FLAG_ENABLE_FOOTNOTES) )
+                                            continue;
+                                        if ( line->flags & LTEXT_LINE_PARA_IS_RTL )
+                                            link_insert_pos = row->single_col_context->getCurrentLinksCount();
+                                        else
+                                            link_insert_pos = -1; // append
+                                    }
+                                    for ( int w=0; w<line->word_count; w++ ) { // check link start flag for every word
+                                        if ( line->words[w].flags & LTEXT_WORD_IS_LINK_START ) {
+                                            const src_text_fragment_t * src = txform->GetSrcInfo( line->words[w].src_text_index );
+                                            if ( src && src->object ) {
+                                                ldomNode * node = (ldomNode*)src->object;
+                                                ldomNode * parent = node->getParentNode();
+                                                while (parent && parent->getNodeId() != el_a)
+                                                    parent = parent->getParentNode();
+                                                if ( parent && parent->hasAttribute(LXML_NS_ANY, attr_href)
+                                                            && !STYLE_HAS_CR_HINT(parent->getStyle(), NOTEREF_IGNORE) ) {
+                                                    lString32 href = parent->getAttributeValue(LXML_NS_ANY, attr_href);
+                                                    if ( href.firstChar()=='#' ) {
+                                                        href.erase(0,1);
+                                                        if ( is_single_column )
+                                                            row->single_col_context->addLink( href, link_insert_pos );
+                                                        else
+                                                            row->links.add( href );
+                                                    }
                                                 }
                                             }
                                         }
                                     }
                                 }
                             }
-                        }
 
-                    }
-                    else if ( cell->elem->getRendMethod()!=erm_invisible ) {
-                        // We must use a different context (used by rendering
-                        // functions to record, with context.AddLine(), each
-                        // rendered block's height, to be used for splitting
-                        // blocks among pages, for page-mode display), so that
-                        // sub-renderings (of cells' content) do not add to our
-                        // main context. Their heights will already be accounted
-                        // in their row's height (added to main context below).
-                        // Except when table is a single column, and we can just
-                        // transfer lines to the upper context.
-                        LVRendPageContext * cell_context;
-                        int rendflags = rend_flags;
-                        if ( is_single_column ) {
-                            row->single_col_context = new LVRendPageContext(NULL, context.getPageHeight());
-                            cell_context = row->single_col_context;
-                            // We want to avoid negative margins (if allowed in global flags) and
-                            // going back the flow y, as the transfered lines would not reflect
-                            // that, and we could get some small mismatches and glitches.
-                            rendflags &= ~BLOCK_RENDERING_ALLOW_NEGATIVE_COLLAPSED_MARGINS;
-                        }
-                        else {
-                            cell_context = new LVRendPageContext( NULL, context.getPageHeight(), 0, false );
                         }
-                        // We request renderBlockElement() to give us back the baseline
-                        // of the block as expected for tables
-                        cell->baseline = REQ_BASELINE_FOR_TABLE;
-                        int h = renderBlockElement( *cell_context, cell->elem, 0, 0, cell->width,
-                                                    0, 0, // no usable left/right overflow outside cell
-                                                    cell->direction, &cell->baseline, rendflags);
-                        cell->height = h;
-                        // See above about what we store in cell->adjusted_baseline
-                        if ( cell->valign == 0 ) { // vertical-align: baseline
-                            // We'll use that baseline
-                            cell->adjusted_baseline = cell->baseline;
-                        }
-                        else {
-                            // We need the bottom content edge of what's been rendered.
-                            // We just need to remove this cell bottom padding (we should
-                            // not remove the inner content bottom margins or paddings).
-                            css_style_ref_t elem_style = cell->elem->getStyle();
-                            int padding_bottom = lengthToPx( cell->elem, elem_style->padding[3], cell->width ) + measureBorder(cell->elem,2);
-                            // We'll position that bottom content edge
-                            cell->adjusted_baseline = h - padding_bottom;
-                        }
-                        if ( !is_single_column ) {
-                            // Gather footnotes links accumulated by cell_context
-                            lString32Collection * link_ids = cell_context->getLinkIds();
-                            if (link_ids->length() > 0) {
-                                for ( int n=0; n<link_ids->length(); n++ ) {
-                                    row->links.add( link_ids->at(n) );
+                        else if ( cell->elem->getRendMethod()!=erm_invisible ) {
+                            // We must use a different context (used by rendering
+                            // functions to record, with context.AddLine(), each
+                            // rendered block's height, to be used for splitting
+                            // blocks among pages, for page-mode display), so that
+                            // sub-renderings (of cells' content) do not add to our
+                            // main context. Their heights will already be accounted
+                            // in their row's height (added to main context below).
+                            // Except when table is a single column, and we can just
+                            // transfer lines to the upper context.
+                            LVRendPageContext * cell_context;
+                            int rendflags = rend_flags;
+                            if ( is_single_column ) {
+                                row->single_col_context = new LVRendPageContext(NULL, context.getPageHeight());
+                                cell_context = row->single_col_context;
+                                // We want to avoid negative margins (if allowed in global flags) and
+                                // going back the flow y, as the transfered lines would not reflect
+                                // that, and we could get some small mismatches and glitches.
+                                rendflags &= ~BLOCK_RENDERING_ALLOW_NEGATIVE_COLLAPSED_MARGINS;
+                            }
+                            else {
+                                cell_context = new LVRendPageContext( NULL, context.getPageHeight(), 0, false );
+                            }
+                            // We request renderBlockElement() to give us back the baseline
+                            // of the block as expected for tables
+                            cell->baseline = REQ_BASELINE_FOR_TABLE;
+                            int h = renderBlockElement( *cell_context, cell->elem, 0, 0, cell->width,
+                                                        0, 0, // no usable left/right overflow outside cell
+                                                        cell->direction, &cell->baseline, rendflags);
+                            cell->height = h;
+                            // See above about what we store in cell->adjusted_baseline
+                            if ( cell->valign == 0 ) { // vertical-align: baseline
+                                // We'll use that baseline
+                                cell->adjusted_baseline = cell->baseline;
+                            }
+                            else {
+                                // We need the bottom content edge of what's been rendered.
+                                // We just need to remove this cell bottom padding (we should
+                                // not remove the inner content bottom margins or paddings).
+                                css_style_ref_t elem_style = cell->elem->getStyle();
+                                int padding_bottom = lengthToPx( cell->elem, elem_style->padding[3], cell->width ) + measureBorder(cell->elem,2);
+                                // We'll position that bottom content edge
+                                cell->adjusted_baseline = h - padding_bottom;
+                            }
+                            if ( !is_single_column ) {
+                                // Gather footnotes links accumulated by cell_context
+                                lString32Collection * link_ids = cell_context->getLinkIds();
+                                if (link_ids->length() > 0) {
+                                    for ( int n=0; n<link_ids->length(); n++ ) {
+                                        row->links.add( link_ids->at(n) );
+                                    }
                                 }
+                                delete cell_context;
                             }
-                            delete cell_context;
                         }
-                    }
-                    // RenderRectAccessor needs to be updated after the call
-                    // to renderBlockElement() which will have setX/setY to (0,0).
-                    // But we're updating them to be in the coordinates of the TR.
-                    RenderRectAccessor fmt( cell->elem );
-                    // TRs padding and border don't apply (see below), so they
-                    // don't add any x/y shift to the cells' positions in the TR
-                    fmt.setX(cell->col->x); // relative to its TR (border_spacing_h is
-                                            // already accounted in col->x)
-                    fmt.setY(0); // relative to its TR
-                    fmt.setWidth( cell->width );
-                    fmt.setHeight( cell->height );
-                    fmt.push();
-                    // Some fmt.set* may be updated below
-                    #ifdef DEBUG_TABLE_RENDERING
-                        printf("TABLE: renderCell[%d,%d] w/h: %d/%d\n", j, i, cell->width, cell->height);
-                    #endif
-                    if ( cell->rowspan == 1 ) {
-                        // Only set row height from this cell height if it is rowspan=1
-                        // We'll update rows height from cells with rowspan > 1 just below
-                        if ( row->height < cell->height )
-                            row->height = cell->height;
-                    }
-                    // Set the row baseline from baseline-aligned cells' baselines.
-                    // https://www.w3.org/TR/CSS22/tables.html#height-layout
-                    //   "First the cells that are aligned on their baseline are positioned.
-                    //   This will establish the baseline of the row"
-                    if ( cell->valign == 0 ) { // only cells with vertical-align: baseline
-                        row_has_baseline_aligned_cells = true;
-                        if ( row->baseline < cell->adjusted_baseline )
-                            row->baseline = cell->adjusted_baseline;
-                                // (cell->adjusted_baseline is cell->baseline)
+                        // RenderRectAccessor needs to be updated after the call
+                        // to renderBlockElement() which will have setX/setY to (0,0).
+                        // But we're updating them to be in the coordinates of the TR.
+                        RenderRectAccessor fmt( cell->elem );
+                        // TRs padding and border don't apply (see below), so they
+                        // don't add any x/y shift to the cells' positions in the TR
+                        fmt.setX(cell->col->x); // relative to its TR (border_spacing_h is
+                                                // already accounted in col->x)
+                        fmt.setY(0); // relative to its TR
+                        fmt.setWidth( cell->width );
+                        fmt.setHeight( cell->height );
+                        fmt.push();
+                        // Some fmt.set* may be updated below
+                        #ifdef DEBUG_TABLE_RENDERING
+                            printf("TABLE: renderCell[%d,%d] w/h: %d/%d\n", j, i, cell->width, cell->height);
+                        #endif
+                        if ( cell->rowspan == 1 ) {
+                            // Only set row height from this cell height if it is rowspan=1
+                            // We'll update rows height from cells with rowspan > 1 just below
+                            if ( row->height < cell->height )
+                                row->height = cell->height;
+                        }
+                        // Set the row baseline from baseline-aligned cells' baselines.
+                        // https://www.w3.org/TR/CSS22/tables.html#height-layout
+                        //   "First the cells that are aligned on their baseline are positioned.
+                        //   This will establish the baseline of the row"
+                        if ( cell->valign == 0 ) { // only cells with vertical-align: baseline
+                            row_has_baseline_aligned_cells = true;
+                            if ( row->baseline < cell->adjusted_baseline )
+                                row->baseline = cell->adjusted_baseline;
+                                    // (cell->adjusted_baseline is cell->baseline)
+                        }
                     }
                 }
-            }
-            // Fixup row height and baseline
-            for (j=0; j<rows[i]->cells.length(); j++) {
-                CCRTableCell * cell = rows[i]->cells[j];
-                int y = cell->row->index;
-                if ( i==y ) { // upper left corner of cell
-                    if ( !row_has_baseline_aligned_cells ) {
-                        // "If a row has no cell box aligned to its baseline,
-                        // the baseline of that row is the bottom content edge
-                        // of the lowest cell in the row."
-                        // We have stored in cell->adjusted_baseline the
-                        // cells bottom content edges.
-                        if ( row->baseline < cell->adjusted_baseline )
-                            row->baseline = cell->adjusted_baseline;
-                    }
-                    else if ( cell->valign == 0 ) {
-                        // Cells with vertical-align: baseline must align with
-                        // the row baseline: this can increase the height of
-                        // a cell, and so the height of the row.
-                        int shift_down = row->baseline - cell->adjusted_baseline;
-                        cell->adjusted_baseline = row->baseline;
-                        // And update row height from this cell height if it is rowspan=1
-                        if ( cell->rowspan == 1 && row->height < cell->height + shift_down )
-                            row->height = cell->height + shift_down;
+                // Fixup row height and baseline
+                for (j=0; j<rows[i]->cells.length(); j++) {
+                    CCRTableCell * cell = rows[i]->cells[j];
+                    int y = cell->row->index;
+                    if ( i==y ) { // upper left corner of cell
+                        if ( !row_has_baseline_aligned_cells ) {
+                            // "If a row has no cell box aligned to its baseline,
+                            // the baseline of that row is the bottom content edge
+                            // of the lowest cell in the row."
+                            // We have stored in cell->adjusted_baseline the
+                            // cells bottom content edges.
+                            if ( row->baseline < cell->adjusted_baseline )
+                                row->baseline = cell->adjusted_baseline;
+                        }
+                        else if ( cell->valign == 0 ) {
+                            // Cells with vertical-align: baseline must align with
+                            // the row baseline: this can increase the height of
+                            // a cell, and so the height of the row.
+                            int shift_down = row->baseline - cell->adjusted_baseline;
+                            cell->adjusted_baseline = row->baseline;
+                            // And update row height from this cell height if it is rowspan=1
+                            if ( cell->rowspan == 1 && row->height < cell->height + shift_down )
+                                row->height = cell->height + shift_down;
+                        }
+                        // else cell->adjusted_baseline won't be used
                     }
-                    // else cell->adjusted_baseline won't be used
                 }
             }
-        }
-
-        #if MATHML_SUPPORT==1
-            if ( mathml_tweaked_element_name_id ) {
-                MathML_fixupTableLayout();
-            }
-        #endif
 
-        // Update rows heights from multi-row (rowspan > 1) cells height
-        for (i=0; i<rows.length(); i++) {
-            //CCRTableRow * row = rows[i];
-            for (j=0; j<rows[i]->cells.length(); j++) {
-                CCRTableCell * cell = rows[i]->cells[j];
-                //int x = cell->col->index;
-                int y = cell->row->index;
-                if ( i==y && cell->rowspan>1 ) {
-                    int k;
-                    int total_h = 0;
-                    for ( k=i; k<=i+cell->rowspan-1; k++ ) {
-                        CCRTableRow * row2 = rows[k];
-                        total_h += row2->height;
-                    }
-                    int extra_h = cell->height - total_h;
-                    if ( extra_h>0 ) {
-                        int delta = extra_h / cell->rowspan;
-                        int delta_h = extra_h - delta * cell->rowspan;
-                        for ( k=i; k<=i+cell->rowspan-1; k++ ) {
-                            CCRTableRow * row2 = rows[k];
-                            row2->height += delta;
-                            if ( delta_h > 0 ) {
-                                row2->height++;
-                                delta_h--;
-                            }
-                        }
-                    }
+            #if MATHML_SUPPORT==1
+                if ( mathml_tweaked_element_name_id ) {
+                    MathML_fixupTableLayout();
                 }
-            }
-        }
-        if ( enhanced_rendering ) {
-            // Update rows' bottom overflow to include the height of
-            // the next rows spanned over by cells with rowspan>1.
-            // (This must be done in another loop from the one above)
+            #endif
+
+            // Update rows heights from multi-row (rowspan > 1) cells height
             for (i=0; i<rows.length(); i++) {
-                CCRTableRow * row = rows[i];
-                int max_h = 0;
+                //CCRTableRow * row = rows[i];
                 for (j=0; j<rows[i]->cells.length(); j++) {
                     CCRTableCell * cell = rows[i]->cells[j];
+                    //int x = cell->col->index;
                     int y = cell->row->index;
                     if ( i==y && cell->rowspan>1 ) {
+                        int k;
                         int total_h = 0;
-                        for ( int k=i; k<=i+cell->rowspan-1; k++ ) {
+                        for ( k=i; k<=i+cell->rowspan-1; k++ ) {
                             CCRTableRow * row2 = rows[k];
                             total_h += row2->height;
                         }
-                        if ( total_h > max_h ) {
-                            max_h = total_h;
+                        int extra_h = cell->height - total_h;
+                        if ( extra_h>0 ) {
+                            int delta = extra_h / cell->rowspan;
+                            int delta_h = extra_h - delta * cell->rowspan;
+                            for ( k=i; k<=i+cell->rowspan-1; k++ ) {
+                                CCRTableRow * row2 = rows[k];
+                                row2->height += delta;
+                                if ( delta_h > 0 ) {
+                                    row2->height++;
+                                    delta_h--;
+                                }
+                            }
                         }
                     }
                 }
-                if ( max_h > row->height ) {
-                    row->bottom_overflow = max_h - row->height;
-                }
             }
-        }
-
-        // update rows y and total height
-        //
-        // Notes:
-        // TR are not supposed to have margin or padding according
-        // to CSS 2.1 https://www.w3.org/TR/CSS21/box.html (they could
-        // in CSS 2, and may be in CSS 3, not clear), and Firefox ignores
-        // them too (no effet whatever value, with border-collapse or not).
-        // (If we have to support them, we could account for their top
-        // and bottom values here, but the left and right values would
-        // need to be accounted above while computing assignable_width for
-        // columns content. Given that each row can be styled differently
-        // with classNames, we may have different values for each row,
-        // which would make computing the assignable_width very tedious.)
-        //
-        // TR can have borders, but, tested on Firefox with various
-        // table styles:
-        //   - they are never displayed when NOT border-collapse
-        //   - with border-collapse, they are only displayed when
-        //     the border is greater than the TD ones, so when
-        //     collapsing is applied.
-        // So, we don't need to account for TR borders here either:
-        // we collapsed them to the cell if border-collapse,
-        // and we can just ignore them here, and not draw them in
-        // DrawDocument() (Former crengine code did draw the border,
-        // but it drew it OVER the cell content, for lack of accounting
-        // it in cells placement and content width.)
-        for (i=0; i<nb_rows; i++) {
-            table_h += borderspacing_v_top;
-            CCRTableRow * row = rows[i];
-            row->y = table_h;
-            // It can happen there is a row that does not map to
-            // a node (some are added at start of PlaceCells()),
-            // so check for row->elem to avoid a segfault
-            if ( row->elem ) {
-                RenderRectAccessor fmt( row->elem );
-                // TR position relative to the TABLE. If it is contained in a table group
-                // (thead, tbody...), these will be adjusted below to be relative to it.
-                // (Here were previously added row->elem borders)
-                fmt.setX(table_border_left + table_padding_left);
-                fmt.setY(row->y);
-                fmt.setWidth( table_width - table_border_left - table_padding_left - table_padding_right - table_border_right );
-                fmt.setHeight( row->height );
-                // This baseline will only be useful if we're part of
-                // some flow rendered with REQ_BASELINE_FOR_TABLE
-                fmt.setBaseline( row->baseline );
-                if ( enhanced_rendering ) {
-                    fmt.setBottomOverflow( row->bottom_overflow );
-                }
-            }
-            if ( context.wantsLines() && is_single_column ) {
-                // Transfer lines from each row->single_col_context to main context
-                // (This has to be done before we update table_h)
-                int cur_y = table_y0 + table_h;
-                int line_flags = 0;
-                if (avoid_pb_inside) {
-                    line_flags = RN_SPLIT_BEFORE_AVOID | RN_SPLIT_AFTER_AVOID;
-                }
-                if (is_rtl)
-                    line_flags |= RN_LINE_IS_RTL;
-                int content_line_flags = line_flags;
-                if ( row->height < min_row_height_for_split_by_line ) {
-                    // Too small row height: stick all line together to prevent split
-                    // inside this row
-                    content_line_flags = RN_SPLIT_BEFORE_AVOID | RN_SPLIT_AFTER_AVOID;
-                }
-                // Add border spacing top
-                int top_line_flags = line_flags | RN_SPLIT_AFTER_AVOID;
-                if (i == 0) // first row (or single row): stick to table top padding/border
-                    top_line_flags |= RN_SPLIT_BEFORE_AVOID;
-                context.AddLine(last_y, cur_y, top_line_flags);
-                // Add cell lines
-                if ( row->single_col_context && row->single_col_context->getLines() ) {
-                    // (It could happen no context was created or no line were added, if
-                    // cell was erm_invisible)
-                    LVPtrVector<LVRendLineInfo> * lines = row->single_col_context->getLines();
-                    for ( int i=0; i < lines->length(); i++ ) {
-                        LVRendLineInfo * line = lines->get(i);
-                        context.AddLine(cur_y, cur_y+line->getHeight(), line->getFlags()|content_line_flags);
-                        LVFootNoteList * links = line->getLinks();
-                        if ( links ) {
-                            for ( int j=0; j < links->length(); j++ ) {
-                                context.addLink( links->get(j)->getId() );
+            if ( enhanced_rendering ) {
+                // Update rows' bottom overflow to include the height of
+                // the next rows spanned over by cells with rowspan>1.
+                // (This must be done in another loop from the one above)
+                for (i=0; i<rows.length(); i++) {
+                    CCRTableRow * row = rows[i];
+                    int max_h = 0;
+                    for (j=0; j<rows[i]->cells.length(); j++) {
+                        CCRTableCell * cell = rows[i]->cells[j];
+                        int y = cell->row->index;
+                        if ( i==y && cell->rowspan>1 ) {
+                            int total_h = 0;
+                            for ( int k=i; k<=i+cell->rowspan-1; k++ ) {
+                                CCRTableRow * row2 = rows[k];
+                                total_h += row2->height;
+                            }
+                            if ( total_h > max_h ) {
+                                max_h = total_h;
                             }
                         }
-                        cur_y += line->getHeight();
                     }
-                }
-                // Add border spacing bottom
-                int bottom_line_flags = line_flags | RN_SPLIT_BEFORE_AVOID;
-                if (i == nb_rows-1) // last row (or single row): stick to table bottom padding/border
-                    bottom_line_flags |= RN_SPLIT_AFTER_AVOID;
-                context.AddLine(cur_y, cur_y+borderspacing_v_bottom, bottom_line_flags|RN_SPLIT_BEFORE_AVOID);
-                last_y = cur_y + borderspacing_v_bottom;
-                if (last_y != table_y0 + table_h + row->height + borderspacing_v_bottom) {
-                    printf("CRE WARNING: single column table row height error %d =! %d\n",
-                                last_y, table_y0 + table_h + row->height + borderspacing_v_bottom);
+                    if ( max_h > row->height ) {
+                        row->bottom_overflow = max_h - row->height;
+                    }
                 }
             }
-            table_h += row->height;
-            table_h += borderspacing_v_bottom;
-            if ( context.wantsLines() && !is_single_column ) {
-                // Includes the row and half of its border_spacing above and half below.
-                if (avoid_pb_inside) {
-                    // Avoid any split between rows
-                    line_flags = RN_SPLIT_BEFORE_AVOID | RN_SPLIT_AFTER_AVOID;
-                }
-                else if (i == 0) { // first row (or single row)
-                    // Avoid a split between table top border/padding/caption and first row.
-                    // Also, the first row could be column headers: avoid a split between it
-                    // and the 2nd row. (Any other reason to do that?)
-                    line_flags = RN_SPLIT_BEFORE_AVOID | RN_SPLIT_AFTER_AVOID;
-                    // Former code had:
-                    // line_flags |= CssPageBreak2Flags(getPageBreakBefore(elem))<<RN_SPLIT_BEFORE;
-                }
-                else if ( i==nb_rows-1 ) { // last row
-                    // Avoid a split between last row and previous to last (really?)
-                    // Avoid a split between last row and table bottom padding/border
-                    //   line_flags = RN_SPLIT_BEFORE_AVOID | RN_SPLIT_AFTER_AVOID;
-                    // Let's not avoid a split between last and previous last, as
-                    // the last row is most often not a bottom TH, and it would just
-                    // drag them onto next page, leaving a hole on previous page.
-                    line_flags = RN_SPLIT_BEFORE_AUTO | RN_SPLIT_AFTER_AVOID;
+
+            // update rows y and total height
+            //
+            // Notes:
+            // TR are not supposed to have margin or padding according
+            // to CSS 2.1 https://www.w3.org/TR/CSS21/box.html (they could
+            // in CSS 2, and may be in CSS 3, not clear), and Firefox ignores
+            // them too (no effet whatever value, with border-collapse or not).
+            // (If we have to support them, we could account for their top
+            // and bottom values here, but the left and right values would
+            // need to be accounted above while computing assignable_width for
+            // columns content. Given that each row can be styled differently
+            // with classNames, we may have different values for each row,
+            // which would make computing the assignable_width very tedious.)
+            //
+            // TR can have borders, but, tested on Firefox with various
+            // table styles:
+            //   - they are never displayed when NOT border-collapse
+            //   - with border-collapse, they are only displayed when
+            //     the border is greater than the TD ones, so when
+            //     collapsing is applied.
+            // So, we don't need to account for TR borders here either:
+            // we collapsed them to the cell if border-collapse,
+            // and we can just ignore them here, and not draw them in
+            // DrawDocument() (Former crengine code did draw the border,
+            // but it drew it OVER the cell content, for lack of accounting
+            // it in cells placement and content width.)
+            for (i=0; i<rows.length(); i++) {
+                table_h += borderspacing_v_top;
+                CCRTableRow * row = rows[i];
+                row->y = table_h;
+                // It can happen there is a row that does not map to
+                // a node (some are added at start of PlaceCells()),
+                // so check for row->elem to avoid a segfault
+                if ( row->elem ) {
+                    RenderRectAccessor fmt( row->elem );
+                    // TR position relative to the TABLE. If it is contained in a table group
+                    // (thead, tbody...), these will be adjusted below to be relative to it.
+                    // (Here were previously added row->elem borders)
+                    fmt.setX(table_border_left + table_padding_left);
+                    fmt.setY(row->y);
+                    fmt.setWidth( table_width - table_border_left - table_padding_left - table_padding_right - table_border_right );
+                    fmt.setHeight( row->height );
+                    // This baseline will only be useful if we're part of
+                    // some flow rendered with REQ_BASELINE_FOR_TABLE
+                    fmt.setBaseline( row->baseline );
+                    if ( enhanced_rendering ) {
+                        fmt.setBottomOverflow( row->bottom_overflow );
+                    }
                 }
-                else {
-                    // Otherwise, allow any split between rows, except if
-                    // the rows has some bottom overflow, which means it has
-                    // some cells with rowspan>1 that we'd rather not have cut.
-                    if ( row->bottom_overflow > 0 )
+                if ( context.wantsLines() && is_single_column ) {
+                    // Transfer lines from each row->single_col_context to main context
+                    // (This has to be done before we update table_h)
+                    int cur_y = table_y0 + table_h;
+                    int line_flags = 0;
+                    if (avoid_pb_inside) {
+                        line_flags = RN_SPLIT_BEFORE_AVOID | RN_SPLIT_AFTER_AVOID;
+                    }
+                    if (is_rtl)
+                        line_flags |= RN_LINE_IS_RTL;
+                    int content_line_flags = line_flags;
+                    if ( row->height < min_row_height_for_split_by_line ) {
+                        // Too small row height: stick all line together to prevent split
+                        // inside this row
+                        content_line_flags = RN_SPLIT_BEFORE_AVOID | RN_SPLIT_AFTER_AVOID;
+                    }
+                    // Add border spacing top
+                    int top_line_flags = line_flags | RN_SPLIT_AFTER_AVOID;
+                    if (row_offset + i == 0) // first row (or single row): stick to table top padding/border
+                        top_line_flags |= RN_SPLIT_BEFORE_AVOID;
+                    context.AddLine(last_y, cur_y, top_line_flags);
+                    // Add cell lines
+                    if ( row->single_col_context && row->single_col_context->getLines() ) {
+                        // (It could happen no context was created or no line were added, if
+                        // cell was erm_invisible)
+                        LVPtrVector<LVRendLineInfo> * lines = row->single_col_context->getLines();
+                        for ( int i=0; i < lines->length(); i++ ) {
+                            LVRendLineInfo * line = lines->get(i);
+                            context.AddLine(cur_y, cur_y+line->getHeight(), line->getFlags()|content_line_flags);
+                            LVFootNoteList * links = line->getLinks();
+                            if ( links ) {
+                                for ( int j=0; j < links->length(); j++ ) {
+                                    context.addLink( links->get(j)->getId() );
+                                }
+                            }
+                            cur_y += line->getHeight();
+                        }
+                    }
+                    // Add border spacing bottom
+                    int bottom_line_flags = line_flags | RN_SPLIT_BEFORE_AVOID;
+                    if (row_offset + i == nb_rows-1) // last row (or single row): stick to table bottom padding/border
+                        bottom_line_flags |= RN_SPLIT_AFTER_AVOID;
+                    context.AddLine(cur_y, cur_y+borderspacing_v_bottom, bottom_line_flags|RN_SPLIT_BEFORE_AVOID);
+                    last_y = cur_y + borderspacing_v_bottom;
+                    if (last_y != table_y0 + table_h + row->height + borderspacing_v_bottom) {
+                        printf("CRE WARNING: single column table row height error %d =! %d\n",
+                                    last_y, table_y0 + table_h + row->height + borderspacing_v_bottom);
+                    }
+                }
+                table_h += row->height;
+                table_h += borderspacing_v_bottom;
+                if ( context.wantsLines() && !is_single_column ) {
+                    // Includes the row and half of its border_spacing above and half below.
+                    if (avoid_pb_inside) {
+                        // Avoid any split between rows
+                        line_flags = RN_SPLIT_BEFORE_AVOID | RN_SPLIT_AFTER_AVOID;
+                    }
+                    else if (row_offset + i == 0) { // first row (or single row)
+                        // Avoid a split between table top border/padding/caption and first row.
+                        // Also, the first row could be column headers: avoid a split between it
+                        // and the 2nd row. (Any other reason to do that?)
+                        line_flags = RN_SPLIT_BEFORE_AVOID | RN_SPLIT_AFTER_AVOID;
+                        // Former code had:
+                        // line_flags |= CssPageBreak2Flags(getPageBreakBefore(elem))<<RN_SPLIT_BEFORE;
+                    }
+                    else if ( row_offset + i == nb_rows-1 ) { // last row
+                        // Avoid a split between last row and previous to last (really?)
+                        // Avoid a split between last row and table bottom padding/border
+                        //   line_flags = RN_SPLIT_BEFORE_AVOID | RN_SPLIT_AFTER_AVOID;
+                        // Let's not avoid a split between last and previous last, as
+                        // the last row is most often not a bottom TH, and it would just
+                        // drag them onto next page, leaving a hole on previous page.
                         line_flags = RN_SPLIT_BEFORE_AUTO | RN_SPLIT_AFTER_AVOID;
-                    else
-                        line_flags = RN_SPLIT_BEFORE_AUTO | RN_SPLIT_AFTER_AUTO;
+                    }
+                    else {
+                        // Otherwise, allow any split between rows, except if
+                        // the rows has some bottom overflow, which means it has
+                        // some cells with rowspan>1 that we'd rather not have cut.
+                        if ( row->bottom_overflow > 0 )
+                            line_flags = RN_SPLIT_BEFORE_AUTO | RN_SPLIT_AFTER_AVOID;
+                        else
+                            line_flags = RN_SPLIT_BEFORE_AUTO | RN_SPLIT_AFTER_AUTO;
+                    }
+                    if (is_rtl)
+                        line_flags |= RN_LINE_IS_RTL;
+                    context.AddLine(last_y, table_y0 + table_h, line_flags);
+                    last_y = table_y0 + table_h;
                 }
-                if (is_rtl)
-                    line_flags |= RN_LINE_IS_RTL;
-                context.AddLine(last_y, table_y0 + table_h, line_flags);
-                last_y = table_y0 + table_h;
-            }
-            // Add links gathered from this row's cells (even if ! context.wantsLines())
-            // in case of imbricated tables)
-            if (row->links.length() > 0) {
-                for ( int n=0; n<row->links.length(); n++ ) {
-                    context.addLink( row->links[n] );
+                // Add links gathered from this row's cells (even if ! context.wantsLines())
+                // in case of imbricated tables)
+                if (row->links.length() > 0) {
+                    for ( int n=0; n<row->links.length(); n++ ) {
+                        context.addLink( row->links[n] );
+                    }
                 }
             }
-        }
+
+            // Update each cell height to be its row height, and apply vertical-align
+            alignCellsContent();
+            if ( streamed_rows ) {
+                placeStreamedRowGroups();
+                row_offset += rows.length();
+            }
+        } while ( streamed_rows && loadRowsBatch() );
         if (nb_rows > 0) {
             // There must be the full borderspacing_v below last row.
             // Includes the last half of it here, as the other half was added
@@ -2143,69 +2636,6 @@ public:
             }
         }
 
-        // Update each cell height to be its row height, so it can draw its
-        // bottom border where it should be: as the row border.
-        // We also apply table cells' vertical-align property.
-        for (i=0; i<rows.length(); i++) {
-            for (j=0; j<rows[i]->cells.length(); j++) {
-                CCRTableCell * cell = rows[i]->cells[j];
-                if ( !cell->elem ) // might be an empty cell added by MathML tweaks
-                    continue;
-                //int x = cell->col->index;
-                int y = cell->row->index;
-                if ( i==y ) {
-                    RenderRectAccessor fmt( cell->elem );
-                    CCRTableRow * lastrow = rows[ cell->row->index + cell->rowspan - 1 ];
-                    int row_h = lastrow->y + lastrow->height - cell->row->y;
-                    // Implement CSS property vertical-align for table cells
-                    // We have to format the cell with the row height for the borders
-                    // to be drawn at the correct positions: we can't just use
-                    // fmt.setY(fmt.getY() + pad) below to implement vertical-align.
-                    // We have to shift down the cell content itself
-                    int cell_h = fmt.getHeight(); // original height that fit cell content
-                    fmt.setHeight( row_h );
-                    if ( cell_h < row_h ) {
-                        int pad = 0; // default when cell->valign=1 / top
-                        if (cell->valign == 0) // baseline
-                            pad = cell->adjusted_baseline - cell->baseline; // shift-down to align cell and row baselines
-                        else if (cell->valign == 2) // center
-                            pad = (row_h - cell_h)/2;
-                        else if (cell->valign == 3) // bottom
-                            pad = (row_h - cell_h);
-                        if ( pad == 0 ) // No need to update this cell
-                            continue;
-                        if ( cell->elem->getRendMethod() == erm_final ) {
-                            if ( enhanced_rendering ) {
-                                // Just shift down the content box
-                                fmt.setInnerY( fmt.getInnerY() + pad );
-                            }
-                            else {
-                                // We need to update the cell element padding-top to include this pad
-                                css_style_ref_t style = cell->elem->getStyle();
-                                css_style_ref_t newstyle(new css_style_rec_t);
-                                copystyle(style, newstyle);
-                                // If padding-top is a percentage, it is relative to
-                                // the *width* of the containing block
-                                int orig_padding_top = lengthToPx( cell->elem, style->padding[2], cell->width );
-                                newstyle->padding[2].type = css_val_screen_px;
-                                newstyle->padding[2].value = orig_padding_top + pad;
-                                cell->elem->setStyle(newstyle);
-                            }
-                        } else if ( cell->elem->getRendMethod() != erm_invisible ) { // erm_block
-                            // We need to update each child fmt.y to include this pad
-                            for (int i=0; i<cell->elem->getChildCount(); i++) {
-                                ldomNode * item = cell->elem->getChildElementNode(i);
-                                if ( item ) {
-                                    RenderRectAccessor f( item );
-                                    f.setY( f.getY() + pad );
-                                }
-                            }
-                        }
-                    }
-                }
-            }
-        }
-
         #if MATHML_SUPPORT==1
             if ( mathml_tweaked_element_name_id ) {
                 // Some cells may have been put in an added row that does not
@@ -2254,6 +2684,15 @@ public:
                     }
                 }
             }
+            else if ( grp->streamed_rows > 0 ) {
+                // Rows were made relative to it by placeStreamedRowGroups(),
+                // and have no bottom overflow (no rowspan)
+                RenderRectAccessor fmt( grp->elem );
+                fmt.setY( grp->y );
+                fmt.setHeight( grp->height );
+                fmt.setX( 0 );
+                fmt.setWidth( table_width );
+            }
         }
 
         if ( is_single_column ) {
@@ -2287,12 +2726,17 @@ public:
         enhanced_rendering = tbl_enhanced_rendering;
         is_ruby_table = tbl_is_ruby_table;
         rows_rendering_reordered = false;
+        streamed_max_cells = 0;
+        streamed_rows_looked_up = 0;
+        streamed_rows_count = countStreamedRows();
+        streamed_rows = streamed_rows_count > 0;
         #ifdef DEBUG_TABLE_RENDERING
             printf("TABLE: ============ parsing new table %s\n",
                 UnicodeToLocal(ldomXPointer(elem, 0).toString()).c_str());
         #endif
         LookupElem( tbl_elem, direction, 0 );
-        FixRowGroupsOrder();
+        if ( !streamed_rows ) // otherwise, rows are walked in that order by nextStreamedRow()
+            FixRowGroupsOrder();
         if (caption) {
             // Check if this caption will be rendered in logical order.
             // If not, set the flag to help text selection to not get confused
@@ -2320,6 +2764,8 @@ public:
             rows_rendering_reordered = true;
         }
         PlaceCells();
+        if ( streamed_rows )
+            startStreamedRows();
         if ( enhanced_rendering && rows_rendering_reordered ) {
             // printf("table rows re-ordered: %s\n", UnicodeToLocal(ldomXPointer(elem, 0).toString()).c_str());
             RenderRectAccessor fmt( elem );
@@ -10475,6 +10921,261 @@ void DrawDocument( LVDrawBuf & drawbuf, ldomNode * enode, int x0, int y0, int dx
     }
 }
 
+void CollectDocumentGlyphs( ldomNode * enode, int doc_y, int dy, LVFontGlyphSet & glyphs, bool want_hidden )
+{
+    // Walks the nodes as DrawDocument() does, collecting the text of
+    // the final blocks that it would draw instead of drawing it
+    if ( !enode->isElement() )
+        return;
+    RenderRectAccessor fmt( enode );
+    doc_y += fmt.getY();
+    if ( doc_y + fmt.getHeight() + fmt.getBottomOverflow() <= 0 || doc_y - fmt.getTopOverflow() >= dy ) {
+        // Out of range (TR with rowspan>1 cells are drawn even when out of
+        // range in legacy mode, but their cells are collected with the TR they
+        // are in range with)
+        return;
+    }
+    if ( enode->getNodeId()==el_DocFragment && enode->getDocument()->isPartialRerenderingEnabled() ) {
+        // Not rendered yet: DrawDocument() will render it first, we can't
+        // know its text positions before that
+        return;
+    }
+    int m = enode->getRendMethod();
+    if ( m == erm_inline && enode->isBoxingInlineBox() ) {
+        m = erm_block;
+    }
+    switch( m )
+    {
+    case erm_table:
+    case erm_table_row:
+    case erm_table_row_group:
+    case erm_table_header_group:
+    case erm_table_footer_group:
+    case erm_block:
+        {
+            int cnt = enode->getChildCount();
+            for (int i=0; i<cnt; i++) {
+                CollectDocumentGlyphs( enode->getChildNode( i ), doc_y, dy, glyphs, want_hidden );
+            }
+        }
+        break;
+    case erm_final:
+        {
+            int padding_top;
+            int inner_width;
+            if ( RENDER_RECT_HAS_FLAG(fmt, INNER_FIELDS_SET) ) {
+                padding_top = fmt.getInnerY();
+                inner_width = fmt.getInnerWidth();
+            }
+            else { // legacy rendering (as in DrawDocument())
+                css_style_ref_t style = enode->getStyle();
+                int width = fmt.getWidth();
+                int padding_left = lengthToPx( enode, style->padding[0], width ) + DEBUG_TREE_DRAW+measureBorder(enode,3);
+                int padding_right = lengthToPx( enode, style->padding[1], width ) + DEBUG_TREE_DRAW+measureBorder(enode,1);
+                padding_top = lengthToPx( enode, style->padding[2], width ) + DEBUG_TREE_DRAW+measureBorder(enode,0);
+                inner_width = width - padding_left - padding_right;
+            }
+            LFormattedTextRef txform;
+            enode->renderFinalBlock( txform, &fmt, inner_width );
+            int text_y = doc_y + padding_top;
+            txform->collectGlyphs( glyphs, -text_y, dy - text_y, want_hidden );
+        }
+        break;
+    default:
+        break;
+    }
+}
+
+static int rend_draw_threads = 0;
+static CRThreadPool * rend_draw_pool = NULL;
+
+void LVRendSetDrawThreads( int threads )
+{
+    CRENGINE_GUARD
+    if ( threads == rend_draw_threads )
+        return;
+    delete rend_draw_pool;
+    rend_draw_pool = NULL;
+    rend_draw_threads = threads;
+}
+
+int LVRendGetDrawThreads()
+{
+    return rend_draw_threads;
+}
+
+// Decodes an image left by the recording to drawing threads, for all bands drawing it
+class LVDecodeImageTask : public CRRunnable {
+    const LVRecordingDrawBuf * _recording;
+    int _index;
+    volatile bool * _done;
+public:
+    LVDecodeImageTask( const LVRecordingDrawBuf * recording, int index, volatile bool * done )
+        : _recording(recording), _index(index), _done(done) { }
+    virtual void run() {
+        _recording->decodeImage( _index );
+        rend_draw_pool->notifyDone( *_done );
+    }
+};
+
+// Replays a recording into a band of the drawing buffer, through a buffer sharing its pixels,
+// once the images it draws are decoded (by LVDecodeImageTask tasks, queued before bands)
+class LVDrawBandTask : public CRRunnable {
+    const LVRecordingDrawBuf * _recording;
+    lUInt8 * _data;
+    int _dx;
+    int _dy;
+    int _bpp;
+    lvRect _band;
+    // created and released by the calling thread: references counters are not thread safe
+    LVArray<LVImageSourceRef> * _images;
+    LVArray<int> * _awaitedImages;
+    volatile bool * _imagesDone;
+public:
+    LVDrawBandTask( const LVRecordingDrawBuf * recording, lUInt8 * data, int dx, int dy, int bpp,
+                    const lvRect & band, LVArray<LVImageSourceRef> * images,
+                    LVArray<int> * awaitedImages, volatile bool * imagesDone )
+        : _recording(recording), _data(data), _dx(dx), _dy(dy), _bpp(bpp), _band(band), _images(images)
+        , _awaitedImages(awaitedImages), _imagesDone(imagesDone) { }
+    virtual void run() {
+        for ( int i = 0; i < _awaitedImages->length(); i++ )
+            rend_draw_pool->waitFor( _imagesDone[_awaitedImages->get( i )] );
+        LVBaseDrawBuf * buf;
+        if ( _bpp >= 16 )
+            buf = new LVColorDrawBuf( _dx, _dy, _data, _bpp );
+        else
+            buf = new LVGrayDrawBuf( _dx, _dy, _bpp, _data );
+        _recording->Replay( *buf, _band, *_images );
+        delete buf;
+    }
+};
+
+// Tells if DrawDocument() may draw images or background images from doc_y with height
+// dy, walking the nodes as it does, but looking into whole final blocks (inline boxes,
+// floats). Misses only cost concurrency: the page is then drawn directly.
+static bool hasImagesToDraw( ldomNode * enode, int doc_y, int dy, bool whole=false )
+{
+    if ( !enode->isElement() )
+        return false;
+    if ( !whole ) {
+        RenderRectAccessor fmt( enode );
+        doc_y += fmt.getY();
+        if ( doc_y + fmt.getHeight() + fmt.getBottomOverflow() <= 0 || doc_y - fmt.getTopOverflow() >= dy )
+            return false;
+        if ( enode->getNodeId()==el_DocFragment && enode->getDocument()->isPartialRerenderingEnabled() )
+            return true; // not rendered yet
+        int m = enode->getRendMethod();
+        whole = !(m == erm_block || m == erm_table || m == erm_table_row || m == erm_table_row_group
+                  || m == erm_table_header_group || m == erm_table_footer_group)
+                || enode->isBoxingInlineBox();
+    }
+    if ( enode->isImage() || !enode->getStyle()->background_image.empty() )
+        return true;
+    int cnt = enode->getChildCount();
+    for ( int i=0; i<cnt; i++ ) {
+        if ( hasImagesToDraw( enode->getChildNode( i ), doc_y, dy, whole ) )
+            return true;
+    }
+    return false;
+}
+
+void DrawDocumentInBands( LVDrawBuf & drawbuf, ldomNode * node, int x0, int y0, int dx, int dy, int doc_x, int doc_y,
+                          int page_height, ldomMarkedRangeList * marks, ldomMarkedRangeList * bookmarks )
+{
+    CRENGINE_GUARD
+    LVBaseDrawBuf * base = drawbuf.asBaseDrawBuf();
+    const int width = drawbuf.GetWidth();
+    const int height = drawbuf.GetHeight();
+    const int bpp = drawbuf.GetBitsPerPixel();
+#if (USE_WIN32_FONTS==1)
+    // Text is drawn with GDI (DrawTo()), which can't be recorded
+    bool concurrent = false;
+#else
+    bool concurrent = rend_draw_threads >= 2 && base != NULL && height >= 2;
+#endif
+    lUInt8 * data = NULL;
+    if ( concurrent ) {
+        // Bands are drawn through LVColorDrawBuf/LVGrayDrawBuf objects set on the same
+        // pixels: rows must be contiguous, top-down, and laid out as these would do.
+        data = drawbuf.GetScanLine( 0 );
+        const int rowsize = bpp >= 16 ? width * (bpp >> 3) : (bpp <= 2 ? (width * bpp + 7) / 8 : width);
+        concurrent = data != NULL && (bpp==1 || bpp==2 || bpp==3 || bpp==4 || bpp==8 || bpp==16 || bpp==32)
+                     && drawbuf.GetRowSize() == rowsize && drawbuf.GetScanLine( 1 ) == data + rowsize;
+    }
+    if ( concurrent ) {
+        // Recording a text only page costs about as much as drawing it (glyphs are
+        // copied): bands only pay with images to decode and scale
+        concurrent = hasImagesToDraw( node, doc_y, dy );
+    }
+    if ( concurrent ) {
+        if ( !rend_draw_pool )
+            rend_draw_pool = new CRThreadPool( rend_draw_threads );
+        if ( rend_draw_pool->isSynchronous() ) {
+            // No concurrency provider (yet): nothing to gain
+            delete rend_draw_pool;
+            rend_draw_pool = NULL;
+            concurrent = false;
+        }
+    }
+    if ( !concurrent ) {
+        DrawDocument( drawbuf, node, x0, y0, dx, dy, doc_x, doc_y, page_height, marks, bookmarks );
+        return;
+    }
+    // Walking the document tree and shaping text use non thread safe objects (nodes,
+    // fonts): this is done once, here, recording the drawing calls. Images are copied
+    // to be decoded by the drawing threads, that share the pixel work.
+    LVRecordingDrawBuf recording( drawbuf );
+    DrawDocument( recording, node, x0, y0, dx, dy, doc_x, doc_y, page_height, marks, bookmarks );
+    if ( !recording.isReplayable() ) {
+        // (nine-patch images, or images that can't be copied and take too much memory)
+        DrawDocument( drawbuf, node, x0, y0, dx, dy, doc_x, doc_y, page_height, marks, bookmarks );
+        return;
+    }
+    const lvRect bounds = recording.getDirtyBounds();
+    if ( bounds.isEmpty() )
+        return;
+    // A few more bands than threads, so that threads drawing lighter ones can take more
+    int bands = rend_draw_threads * 2;
+    int bandHeight = (bounds.height() + bands - 1) / bands;
+    if ( bandHeight < 16 )
+        bandHeight = 16;
+    const int imageCount = recording.getImageCount();
+    volatile bool * imagesDone = new volatile bool[ imageCount > 0 ? imageCount : 1 ];
+    LVPtrVector< LVArray<LVImageSourceRef> > bandImages;
+    LVPtrVector< LVArray<int> > awaitedImages;
+    LVArray<lvRect> bandRects;
+    // All image sources are created before any task runs
+    for ( int y = bounds.top; y < bounds.bottom; y += bandHeight ) {
+        lvRect band( bounds.left, y, bounds.right, y + bandHeight < bounds.bottom ? y + bandHeight : bounds.bottom );
+        LVArray<LVImageSourceRef> * images = new LVArray<LVImageSourceRef>();
+        recording.getBandImages( band, *images );
+        LVArray<int> * awaited = new LVArray<int>();
+        recording.getBandDeferredImages( band, *awaited );
+        bandRects.add( band );
+        bandImages.add( images );
+        awaitedImages.add( awaited );
+    }
+    // Images are decoded concurrently, first: the pool runs tasks in order, so bands
+    // waiting for them can't keep them from running
+    for ( int i = 0; i < imageCount; i++ ) {
+        imagesDone[i] = false;
+        if ( recording.isDeferredImage( i ) )
+            rend_draw_pool->execute( new LVDecodeImageTask( &recording, i, imagesDone + i ) );
+    }
+    for ( int i = 0; i < bandRects.length(); i++ )
+        rend_draw_pool->execute( new LVDrawBandTask( &recording, data, width, height, bpp, bandRects[i],
+                                                     bandImages[i], awaitedImages[i], imagesDone ) );
+    rend_draw_pool->waitAll();
+    delete[] imagesDone;
+    if ( drawbuf.isDirtyTracking() ) {
+        LVArray<lvRect> rects;
+        recording.getDirtyRects( rects );
+        for ( int i = 0; i < rects.length(); i++ )
+            drawbuf.markDirty( rects[i] );
+    }
+    base->addDrawnImages( recording.getDrawnImagesCount(), recording.getDrawnImagesSurface() );
+}
+
 // See below in setNodeStyle() ("handle inheritance") for more comments
 inline bool inheritLength( css_length_t & val, css_length_t & parent_val, int parent_font_size, int percent_base_size=-1 )
 {
@@ -11443,6 +12144,15 @@ void setNodeStyle( ldomNode * enode, css_style_ref_t parent_style, LVFontRef par
 //   maxWidth: width if it would be rendered on an infinite width area
 //   minWidth: width with a wrap on all spaces (no hyphenation), so width taken by the longest word
 void getRenderedWidths(ldomNode * node, int &maxWidth, int &minWidth, int direction, bool ignoreMargin, int rendFlags) {
+    // Measuring walks the whole subtree and measures all its text: reuse widths
+    // measured for this node on previous renderings or table layout passes.
+    ldomDocument * doc = node->getDocument();
+    css_style_ref_t style = node->getStyle();
+    const lUInt32 styleHash = calcHash(style);
+    ldomIntrinsicWidthCache & cache = doc->getIntrinsicWidthCache();
+    if ( cache.find(doc->getDocumentRenderingHash(), node->getDataIndex(), styleHash,
+                    direction, ignoreMargin, rendFlags, maxWidth, minWidth) )
+        return;
     // Setup passed-by-reference parameters for recursive calls
     int curMaxWidth = 0;    // reset on <BR/> or on new block nodes
     int curWordWidth = 0;   // may not be reset to correctly estimate multi-nodes single-word ("I<sup>er</sup>")
@@ -11459,6 +12169,8 @@ void getRenderedWidths(ldomNode * node, int &maxWidth, int &minWidth, int direct
     // single words, than into maxWidth: so trust minWidth if larger than maxWidth.
     if ( maxWidth < minWidth)
         maxWidth = minWidth;
+    cache.add(doc->getDocumentRenderingHash(), node->getDataIndex(), styleHash,
+              direction, ignoreMargin, rendFlags, maxWidth, minWidth);
 }
 
 void getRenderedWidths(ldomNode * node, int &maxWidth, int &minWidth, int direction, bool ignoreMargin, int rendFlags,
@@ -0,0 +1,266 @@
+/*******************************************************
+
+   CoolReader Engine
+
+   lvrotate.h:  cache blocked pixel rotation kernels
+
+   This source code is distributed under the terms of
+   GNU General Public License
+
+   See LICENSE file for details
+
+*******************************************************/
+
+#ifndef __LV_ROTATE_H_INCLUDED__
+#define __LV_ROTATE_H_INCLUDED__
+
+// Kernels of RotatePixels() (lvdrawbuf.cpp). A w x h source gives a h x w
+// destination, with, clockwise:         dst(X, Y) = src(Y, h-1-X)
+//                   counterclockwise:   dst(X, Y) = src(w-1-Y, X)
+// Pixels are moved by square tiles, so that source and destination rows of a
+// tile stay in cache. Inside tiles, bytes are moved by 8x8 blocks, transposed
+// with vector instructions selected at compile time (see lvsimd.h). Packed 1
+// and 2 bpp tiles are unpacked to bytes, rotated, and packed again.
+// Define DRAWBUF_DISABLE_SIMD to force the plain loops.
+
+#include <stddef.h>
+#include <string.h>
+#include "../include/lvtypes.h"
+#include "lvsimd.h"
+
+#define ROTATE_TILE_SIZE 64
+
+// Transposes 8x8 bytes: row k of the source (at src + k*srcStep) becomes column k
+// of the destination (rows at dst + j*dstStep). Steps may be negative.
+static inline void rotateTranspose8x8( const lUInt8 * src, ptrdiff_t srcStep, lUInt8 * dst, ptrdiff_t dstStep )
+{
+#if DRAWBUF_USE_SSE2
+    const __m128i a0 = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *)src),
+                                         _mm_loadl_epi64((const __m128i *)(src + srcStep)));
+    const __m128i a1 = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *)(src + 2 * srcStep)),
+                                         _mm_loadl_epi64((const __m128i *)(src + 3 * srcStep)));
+    const __m128i a2 = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *)(src + 4 * srcStep)),
+                                         _mm_loadl_epi64((const __m128i *)(src + 5 * srcStep)));
+    const __m128i a3 = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *)(src + 6 * srcStep)),
+                                         _mm_loadl_epi64((const __m128i *)(src + 7 * srcStep)));
+    // columns 0..3 and 4..7 of rows 0..3, then of rows 4..7
+    const __m128i b0 = _mm_unpacklo_epi16(a0, a1);
+    const __m128i b1 = _mm_unpackhi_epi16(a0, a1);
+    const __m128i b2 = _mm_unpacklo_epi16(a2, a3);
+    const __m128i b3 = _mm_unpackhi_epi16(a2, a3);
+    // two complete columns in each
+    const __m128i c0 = _mm_unpacklo_epi32(b0, b2);
+    const __m128i c1 = _mm_unpackhi_epi32(b0, b2);
+    const __m128i c2 = _mm_unpacklo_epi32(b1, b3);
+    const __m128i c3 = _mm_unpackhi_epi32(b1, b3);
+    _mm_storel_epi64((__m128i *)dst, c0);
+    _mm_storel_epi64((__m128i *)(dst + dstStep), _mm_unpackhi_epi64(c0, c0));
+    _mm_storel_epi64((__m128i *)(dst + 2 * dstStep), c1);
+    _mm_storel_epi64((__m128i *)(dst + 3 * dstStep), _mm_unpackhi_epi64(c1, c1));
+    _mm_storel_epi64((__m128i *)(dst + 4 * dstStep), c2);
+    _mm_storel_epi64((__m128i *)(dst + 5 * dstStep), _mm_unpackhi_epi64(c2, c2));
+    _mm_storel_epi64((__m128i *)(dst + 6 * dstStep), c3);
+    _mm_storel_epi64((__m128i *)(dst + 7 * dstStep), _mm_unpackhi_epi64(c3, c3));
+#elif DRAWBUF_USE_NEON
+    const uint8x8x2_t t01 = vtrn_u8(vld1_u8(src), vld1_u8(src + srcStep));
+    const uint8x8x2_t t23 = vtrn_u8(vld1_u8(src + 2 * srcStep), vld1_u8(src + 3 * srcStep));
+    const uint8x8x2_t t45 = vtrn_u8(vld1_u8(src + 4 * srcStep), vld1_u8(src + 5 * srcStep));
+    const uint8x8x2_t t67 = vtrn_u8(vld1_u8(src + 6 * srcStep), vld1_u8(src + 7 * srcStep));
+    // columns 0 and 4, 2 and 6 (u02, u46), 1 and 5, 3 and 7 (u13, u57) of rows 0..3 and 4..7
+    const uint16x4x2_t u02 = vtrn_u16(vreinterpret_u16_u8(t01.val[0]), vreinterpret_u16_u8(t23.val[0]));
+    const uint16x4x2_t u13 = vtrn_u16(vreinterpret_u16_u8(t01.val[1]), vreinterpret_u16_u8(t23.val[1]));
+    const uint16x4x2_t u46 = vtrn_u16(vreinterpret_u16_u8(t45.val[0]), vreinterpret_u16_u8(t67.val[0]));
+    const uint16x4x2_t u57 = vtrn_u16(vreinterpret_u16_u8(t45.val[1]), vreinterpret_u16_u8(t67.val[1]));
+    const uint32x2x2_t v04 = vtrn_u32(vreinterpret_u32_u16(u02.val[0]), vreinterpret_u32_u16(u46.val[0]));
+    const uint32x2x2_t v15 = vtrn_u32(vreinterpret_u32_u16(u13.val[0]), vreinterpret_u32_u16(u57.val[0]));
+    const uint32x2x2_t v26 = vtrn_u32(vreinterpret_u32_u16(u02.val[1]), vreinterpret_u32_u16(u46.val[1]));
+    const uint32x2x2_t v37 = vtrn_u32(vreinterpret_u32_u16(u13.val[1]), vreinterpret_u32_u16(u57.val[1]));
+    vst1_u8(dst, vreinterpret_u8_u32(v04.val[0]));
+    vst1_u8(dst + dstStep, vreinterpret_u8_u32(v15.val[0]));
+    vst1_u8(dst + 2 * dstStep, vreinterpret_u8_u32(v26.val[0]));
+    vst1_u8(dst + 3 * dstStep, vreinterpret_u8_u32(v37.val[0]));
+    vst1_u8(dst + 4 * dstStep, vreinterpret_u8_u32(v04.val[1]));
+    vst1_u8(dst + 5 * dstStep, vreinterpret_u8_u32(v15.val[1]));
+    vst1_u8(dst + 6 * dstStep, vreinterpret_u8_u32(v26.val[1]));
+    vst1_u8(dst + 7 * dstStep, vreinterpret_u8_u32(v37.val[1]));
+#else
+    for (int j = 0; j < 8; j++) {
+        lUInt8 * d = dst + j * dstStep;
+        for (int k = 0; k < 8; k++)
+            d[k] = src[k * srcStep + j];
+    }
+#endif
+}
+
+// 90 degrees rotation of 1 byte, 2 bytes or 4 bytes pixels, by tiles
+template <typename T>
+static inline void rotateTiled( const lUInt8 * src, int srcPitch, int w, int h, lUInt8 * dst, int dstPitch, bool cw )
+{
+    const int tile = ROTATE_TILE_SIZE;
+    for (int ty = 0; ty < h; ty += tile) {
+        const int y1 = ty + tile < h ? ty + tile : h;
+        for (int tx = 0; tx < w; tx += tile) {
+            const int x1 = tx + tile < w ? tx + tile : w;
+            int y = ty;
+            if (sizeof(T) == 1) {
+                for (; y + 8 <= y1; y += 8) {
+                    int x = tx;
+                    for (; x + 8 <= x1; x += 8) {
+                        if (cw)
+                            rotateTranspose8x8(src + (ptrdiff_t)(y + 7) * srcPitch + x, -(ptrdiff_t)srcPitch,
+                                               dst + (ptrdiff_t)x * dstPitch + (h - 8 - y), dstPitch);
+                        else
+                            rotateTranspose8x8(src + (ptrdiff_t)y * srcPitch + x, srcPitch,
+                                               dst + (ptrdiff_t)(w - 1 - x) * dstPitch + y, -(ptrdiff_t)dstPitch);
+                    }
+                    // right edge of the tile
+                    for (int yy = y; yy < y + 8; yy++) {
+                        const T * s = (const T *)(src + (ptrdiff_t)yy * srcPitch);
+                        for (int xx = x; xx < x1; xx++) {
+                            if (cw)
+                                ((T *)(dst + (ptrdiff_t)xx * dstPitch))[h - 1 - yy] = s[xx];
+                            else
+                                ((T *)(dst + (ptrdiff_t)(w - 1 - xx) * dstPitch))[yy] = s[xx];
+                        }
+                    }
+                }
+            }
+            for (; y < y1; y++) {
+                const T * s = (const T *)(src + (ptrdiff_t)y * srcPitch);
+                if (cw) {
+                    for (int x = tx; x < x1; x++)
+                        ((T *)(dst + (ptrdiff_t)x * dstPitch))[h - 1 - y] = s[x];
+                } else {
+                    for (int x = tx; x < x1; x++)
+                        ((T *)(dst + (ptrdiff_t)(w - 1 - x) * dstPitch))[y] = s[x];
+                }
+            }
+        }
+    }
+}
+
+// Packed 1 or 2 bpp pixels x0..x0+count-1 of a row to one byte per pixel
+// (dst must have room for count rounded up to 8)
+static inline void rotateUnpackRow( lUInt8 * dst, const lUInt8 * src, int x0, int count, int bpp )
+{
+    if (count <= 0)
+        return;
+    // source bytes are read 8 bits at a time, from two bytes when x0 is not aligned
+    const int bitOffset = (x0 * bpp) & 7;
+    const int last = ((x0 + count) * bpp - 1) >> 3;
+    const lUInt8 * s = src + ((x0 * bpp) >> 3);
+    const lUInt8 * end = src + last;
+    for (int i = 0; i < count; i += 8 / bpp, s++) {
+        lUInt32 b = *s;
+        if (bitOffset)
+            b = ((b << 8) | (s < end ? s[1] : 0)) >> (8 - bitOffset);
+        b &= 0xFF;
+        if (bpp == 1) {
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+            // bit 7-k to byte k
+            const lUInt64 t = ((b * 0x0101010101010101ULL) & 0x0102040810204080ULL) + 0x7F7F7F7F7F7F7F7FULL;
+            const lUInt64 w = (t >> 7) & 0x0101010101010101ULL;
+            memcpy(dst + i, &w, 8);
+#else
+            for (int k = 0; k < 8; k++)
+                dst[i + k] = (b >> (7 - k)) & 1;
+#endif
+        } else {
+            dst[i] = (lUInt8)(b >> 6);
+            dst[i + 1] = (lUInt8)((b >> 4) & 3);
+            dst[i + 2] = (lUInt8)((b >> 2) & 3);
+            dst[i + 3] = (lUInt8)(b & 3);
+        }
+    }
+}
+
+// Packs count bytes to whole 1 or 2 bpp bytes starting at dst (trailing bits are 0)
+// (src must be readable up to count rounded up to 8)
+static inline void rotatePackRow( lUInt8 * dst, const lUInt8 * src, int count, int bpp )
+{
+    if (bpp == 1) {
+        for (int i = 0; i < count; i += 8) {
+            lUInt8 b;
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+            // byte k (0 or 1) to bit 7-k
+            lUInt64 w;
+            memcpy(&w, src + i, 8);
+            if (count - i < 8)
+                w &= (1ULL << ((count - i) * 8)) - 1; // bytes past count may be anything
+            b = (lUInt8)((w * 0x8040201008040201ULL) >> 56);
+#else
+            b = 0;
+            for (int k = 0; k < 8 && i + k < count; k++)
+                b |= src[i + k] << (7 - k);
+#endif
+            *dst++ = b;
+        }
+    } else {
+        for (int i = 0; i < count; i += 4) {
+            if (count - i >= 4) {
+                *dst++ = (lUInt8)((src[i] << 6) | (src[i + 1] << 4) | (src[i + 2] << 2) | src[i + 3]);
+            } else {
+                lUInt8 b = 0;
+                for (int k = 0; i + k < count; k++)
+                    b |= src[i + k] << (6 - 2 * k);
+                *dst++ = b;
+            }
+        }
+    }
+}
+
+// 90 degrees rotation of packed 1 or 2 bpp pixels. Destination tiles start at
+// whole bytes, so that they can be packed without touching their neighbours.
+static inline void rotatePacked( const lUInt8 * src, int srcPitch, int w, int h, int bpp, lUInt8 * dst, int dstPitch, bool cw )
+{
+    const int tile = ROTATE_TILE_SIZE;
+    lUInt8 block[tile * tile + 8];
+    lUInt8 rotated[tile * tile + 8];
+    // destination is h x w
+    for (int dy0 = 0; dy0 < w; dy0 += tile) {
+        const int th = dy0 + tile < w ? tile : w - dy0;
+        for (int dx0 = 0; dx0 < h; dx0 += tile) {
+            const int tw = dx0 + tile < h ? tile : h - dx0;
+            // source block: tw rows of th pixels
+            const int sy0 = cw ? h - dx0 - tw : dx0;
+            const int sx0 = cw ? dy0 : w - dy0 - th;
+            for (int i = 0; i < tw; i++)
+                rotateUnpackRow(block + i * tile, src + (ptrdiff_t)(sy0 + i) * srcPitch, sx0, th, bpp);
+            rotateTiled<lUInt8>(block, tile, th, tw, rotated, tile, cw);
+            for (int i = 0; i < th; i++)
+                rotatePackRow(dst + (ptrdiff_t)(dy0 + i) * dstPitch + dx0 * bpp / 8, rotated + i * tile, tw, bpp);
+        }
+    }
+}
+
+// 180 degrees rotation into another buffer
+template <typename T>
+static inline void rotate180( const lUInt8 * src, int srcPitch, int w, int h, lUInt8 * dst, int dstPitch )
+{
+    for (int y = 0; y < h; y++) {
+        const T * s = (const T *)(src + (ptrdiff_t)(h - 1 - y) * srcPitch);
+        T * d = (T *)(dst + (ptrdiff_t)y * dstPitch);
+        for (int x = 0; x < w; x++)
+            d[x] = s[w - 1 - x];
+    }
+}
+
+static inline void rotate180Packed( const lUInt8 * src, int srcPitch, int w, int h, int bpp, lUInt8 * dst, int dstPitch )
+{
+    const int chunk = ROTATE_TILE_SIZE;
+    lUInt8 pixels[chunk + 8];
+    lUInt8 reversed[chunk + 8];
+    for (int y = 0; y < h; y++) {
+        const lUInt8 * s = src + (ptrdiff_t)(h - 1 - y) * srcPitch;
+        lUInt8 * d = dst + (ptrdiff_t)y * dstPitch;
+        for (int x0 = 0; x0 < w; x0 += chunk) {
+            const int n = x0 + chunk < w ? chunk : w - x0;
+            rotateUnpackRow(pixels, s, w - x0 - n, n, bpp);
+            for (int i = 0; i < n; i++)
+                reversed[i] = pixels[n - 1 - i];
+            rotatePackRow(d + x0 * bpp / 8, reversed, n, bpp);
+        }
+    }
+}
+
+#endif // __LV_ROTATE_H_INCLUDED__
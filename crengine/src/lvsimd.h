@@ -0,0 +1,41 @@
+/*******************************************************
+
+   CoolReader Engine
+
+   lvsimd.h:  vector instruction set selection for drawing kernels
+
+   This source code is distributed under the terms of
+   GNU General Public License
+
+   See LICENSE file for details
+
+*******************************************************/
+
+#ifndef __LV_SIMD_H_INCLUDED__
+#define __LV_SIMD_H_INCLUDED__
+
+// Included by the vector kernel headers of lvdrawbuf.cpp (lvglyphblend.h...):
+// defines DRAWBUF_USE_SSE2 or DRAWBUF_USE_NEON from the target instruction
+// set, and includes its intrinsics. Kernels fall back to their plain loops
+// when neither is defined. Define DRAWBUF_DISABLE_SIMD to force the plain loops.
+
+#if !defined(DRAWBUF_DISABLE_SIMD)
+#   if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#       define DRAWBUF_USE_SSE2 1
+#       include <emmintrin.h>
+#   elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#       define DRAWBUF_USE_NEON 1
+#       include <arm_neon.h>
+#   endif
+#endif
+
+// Name of the selected kernels, for logs and benchmarks
+#if DRAWBUF_USE_SSE2
+#   define DRAWBUF_SIMD_NAME "sse2"
+#elif DRAWBUF_USE_NEON
+#   define DRAWBUF_SIMD_NAME "neon"
+#else
+#   define DRAWBUF_SIMD_NAME "scalar"
+#endif
+
+#endif // __LV_SIMD_H_INCLUDED__
@@ -345,6 +345,7 @@ private:
     lUInt8* m_map;
     lvsize_t m_size;
     lvpos_t m_pos;
+    bool m_private; // LVOM_FLAG_PRIVATE: copy-on-write mapping of read-only file
 
     /// Read or write buffer for stream region
     class LVBuffer : public LVStreamBuffer
@@ -403,7 +404,7 @@ public:
         LVStreamBufferRef res;
         if ( !m_map )
             return res;
-        if ( m_mode!=LVOM_APPEND || pos + size > m_size || size==0 )
+        if ( (m_mode!=LVOM_APPEND && !m_private) || pos + size > m_size || size==0 )
             return res;
         return LVStreamBufferRef ( new LVBuffer( LVStreamRef(this), m_map + pos, size, false ) );
     }
@@ -593,7 +594,7 @@ public:
 		m_hMap = CreateFileMapping(
 			m_hFile,
 			NULL,
-			(m_mode==LVOM_READ)?PAGE_READONLY:PAGE_READWRITE, //flProtect,
+			m_private ? PAGE_WRITECOPY : (m_mode==LVOM_READ)?PAGE_READONLY:PAGE_READWRITE, //flProtect,
 			0,
 			0,
 			NULL
@@ -605,7 +606,7 @@ public:
 		}
 		m_map = (lUInt8*) MapViewOfFile(
 			m_hMap,
-			m_mode==LVOM_READ ? FILE_MAP_READ : FILE_MAP_READ|FILE_MAP_WRITE,
+			m_private ? FILE_MAP_COPY : m_mode==LVOM_READ ? FILE_MAP_READ : FILE_MAP_READ|FILE_MAP_WRITE,
 			0,
 			0,
 			m_size
@@ -616,8 +617,8 @@ public:
 		}
 		return LVERR_OK;
 #else
-        int mapFlags = (m_mode==LVOM_READ) ? PROT_READ : PROT_READ | PROT_WRITE;
-        m_map = (lUInt8*)mmap( 0, m_size, mapFlags, MAP_SHARED, m_fd, 0 );
+        int mapFlags = (m_mode==LVOM_READ && !m_private) ? PROT_READ : PROT_READ | PROT_WRITE;
+        m_map = (lUInt8*)mmap( 0, m_size, mapFlags, m_private ? MAP_PRIVATE : MAP_SHARED, m_fd, 0 );
         if ( m_map == MAP_FAILED ) {
             CRLog::error( "LVFileMappedStream::Map() -- Cannot map file to memory" );
             return error();
@@ -712,9 +713,13 @@ public:
 
     lverror_t OpenFile( lString32 fname, lvopen_mode_t mode, lvsize_t minSize = (lvsize_t)-1 )
     {
+        m_private = (mode & LVOM_FLAG_PRIVATE) != 0;
+        mode = (lvopen_mode_t)(mode & LVOM_MASK);
         m_mode = mode;
         if ( mode!=LVOM_READ && mode!=LVOM_APPEND )
             return LVERR_FAIL; // not supported
+        if ( m_private && mode!=LVOM_READ )
+            return LVERR_FAIL; // not supported
         if ( minSize==(lvsize_t)-1 ) {
             if ( !LVFileExists(fname) )
                 return LVERR_FAIL;
@@ -840,8 +845,8 @@ public:
             }
         }
 
-        int mapFlags = (mode==LVOM_READ) ? PROT_READ : PROT_READ | PROT_WRITE;
-        m_map = (lUInt8*)mmap( 0, m_size, mapFlags, MAP_SHARED, m_fd, 0 );
+        int mapFlags = (mode==LVOM_READ && !m_private) ? PROT_READ : PROT_READ | PROT_WRITE;
+        m_map = (lUInt8*)mmap( 0, m_size, mapFlags, m_private ? MAP_PRIVATE : MAP_SHARED, m_fd, 0 );
         if ( m_map == MAP_FAILED ) {
             CRLog::error( "Cannot map file %s to memory", fn8.c_str() );
             return error();
@@ -855,7 +860,7 @@ public:
 #else
 		: m_fd(-1),
 #endif
-		m_map(NULL), m_size(0), m_pos(0)
+		m_map(NULL), m_size(0), m_pos(0), m_private(false)
     {
         m_mode=LVOM_ERROR;
     }
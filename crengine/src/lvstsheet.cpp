@@ -3323,7 +3323,8 @@ bool LVCssDeclaration::parse( const char * &decl, bool higher_importance, lxmlDo
                             match = BLOCK_RENDERING_D(doc, ALLOW_STYLE_W_H_ABSOLUTE_UNITS) != invert;
                         }
                         else if ( name == cr_only_if_full_featured ) {
-                            match = (doc->getRenderBlockRenderingFlags() == BLOCK_RENDERING_FULL_FEATURED) != invert;
+                            // (STREAM_LARGE_TABLES is not part of FULL_FEATURED)
+                            match = ((doc->getRenderBlockRenderingFlags() & BLOCK_RENDERING_FULL_FEATURED) == BLOCK_RENDERING_FULL_FEATURED) != invert;
                         }
                         else if ( name == cr_only_if_epub_document ) {
                             match = doc->getProps()->getIntDef(DOC_PROP_FILE_FORMAT_ID, doc_format_none) == doc_format_epub;
@@ -33,6 +33,8 @@ lUInt32 calcHash(font_ref_t & f)
     v = v * 31 + (lUInt32)f->getKerningMode();
     // No more needed since hinting mode does not change advances
     // v = v * 31 + (lUInt32)f->getHintingMode();
+    if ( f->getSubpixelPositioning() > 1 ) // (unhinted advances)
+        v = v * 31 + (lUInt32)f->getSubpixelPositioning();
     v = v * 31 + (lUInt32)f->getBitmapMode();
     v = v * 31 + (lUInt32)f->getTypeFace().getHash();
     v = v * 31 + (lUInt32)f->getBaseline();
@@ -25,6 +25,7 @@
 #include "../include/lvtinydom.h"
 #include "../include/lvrend.h"
 #include "../include/textlang.h"
+#include "lvformatterbufs.h"
 #endif
 
 #if USE_HARFBUZZ==1
@@ -392,12 +393,7 @@ public:
     //LVArray<lUInt8>   flags_buf;
     formatted_text_fragment_t * m_pbuffer;
     int       m_length;
-    int       m_size;
-    bool      m_staticBufs;
-    static bool      m_staticBufs_inUse;
-    #if (USE_LIBUNIBREAK==1)
-    static bool      m_libunibreak_init_done;
-    #endif
+    LVFormatterWorkspace * m_workspace; // this thread's buffers, while formatting
     lChar32 * m_text;
     lUInt16 * m_flags;
     src_text_fragment_t * * m_srcs;
@@ -438,6 +434,8 @@ public:
     #if (USE_BREAK_SA==1)
     int  m_sa_chunk_start; // -1 means no ongoing SA (South East Asian) chunk
     int  m_sa_chunk_end;
+    bool m_sa_collect_breaks; // store BreakSALine() results in m_sa_breaks
+    LVArray<lInt32> m_sa_breaks; // relative to m_sa_chunk_start, for the document SA break cache
     #endif
 
 // These are not unicode codepoints: these values are put where we
@@ -451,17 +449,14 @@ public:
 #define PAD_CHAR_INDEX        ((lUInt16)0xFFFC)
 
     LVFormatter(formatted_text_fragment_t * pbuffer)
-    : m_pbuffer(pbuffer), m_length(0), m_size(0), m_staticBufs(true), m_y(0)
+    : m_pbuffer(pbuffer), m_length(0), m_workspace(NULL), m_y(0)
     {
         #if (USE_LIBUNIBREAK==1)
-        if (!m_libunibreak_init_done) {
-            m_libunibreak_init_done = true;
-            // Have libunibreak build up a few lookup tables for quicker computation
-            init_linebreak();
-        }
+        // Have libunibreak build up a few lookup tables for quicker computation
+        // (once, whatever the thread we're called from)
+        static bool libunibreak_init_done = (init_linebreak(), true);
+        CR_UNUSED(libunibreak_init_done);
         #endif
-        if (m_staticBufs_inUse)
-            m_staticBufs = false;
         m_text = NULL;
         m_flags = NULL;
         m_srcs = NULL;
@@ -480,7 +475,10 @@ public:
         m_has_cjk = false;
         m_cjk_prev_line_added_space_div = 0;
         m_cjk_prev_line_added_space_mod = 0;
-        m_sa_chunk_start = -1;
+        #if (USE_BREAK_SA==1)
+            m_sa_chunk_start = -1;
+            m_sa_collect_breaks = false;
+        #endif
         m_specified_para_dir = REND_DIRECTION_UNSET;
         #if (USE_FRIBIDI==1)
             m_bidi_ctypes = NULL;
@@ -491,6 +489,7 @@ public:
 
     ~LVFormatter()
     {
+        dealloc();
     }
 
     // Embedded floats positioning helpers.
@@ -942,71 +941,43 @@ public:
         m_length = pos;
 
         TR("allocate(%d)", m_length);
-        // We start with static buffers, but when m_length reaches STATIC_BUFS_SIZE,
-        // we switch to dynamic buffers and we keep using them (realloc'ating when
-        // needed).
+        // Buffers come from this thread's formatter workspace (see lvformatterbufs.h),
+        // which keeps them from one paragraph and one formatter to the next, and grows
+        // them when needed. Formatting nested in ours (inline-blocks, floats...) gets
+        // its own workspace.
         // The code in this file will fill these buffers with m_length items, so
         // from index [0] to [m_length-1], and read them back.
         // Willingly or not (bug?), this code may also access the buffer one slot
         // further at [m_length], and we need to set this slot to zero to avoid
-        // a segfault. So, we need to reserve this additional slot when
-        // allocating dynamic buffers, or checking if the static buffers can be
-        // used.
+        // a segfault. So, we need to reserve this additional slot.
         // (memset()'ing all buffers on their full allocated size to 0 would work
         // too, but there's a small performance hit when doing so. Just setting
         // to zero the additional slot seems enough, as all previous slots seems
         // to be correctly filled.)
-
-#define STATIC_BUFS_SIZE 8192
-#define ITEMS_RESERVED 16
-
-        // "m_length+1" to keep room for the additional slot to be zero'ed
-        if ( !m_staticBufs || m_length+1 > STATIC_BUFS_SIZE ) {
-            // if (!m_staticBufs && m_text == NULL) printf("allocating dynamic buffers\n");
-            if ( m_length+1 > m_size ) {
-                // realloc
-                m_size = m_length+ITEMS_RESERVED;
-                m_text = cr_realloc(m_staticBufs ? NULL : m_text, m_size);
-                m_flags = cr_realloc(m_staticBufs ? NULL : m_flags, m_size);
-                m_charindex = cr_realloc(m_staticBufs ? NULL : m_charindex, m_size);
-                m_srcs = cr_realloc(m_staticBufs ? NULL : m_srcs, m_size);
-                m_widths = cr_realloc(m_staticBufs ? NULL : m_widths, m_size);
-                #if (USE_FRIBIDI==1)
-                    // Note: we could here check for RTL chars (and have a flag
-                    // to then not do it in copyText()) so we don't need to allocate
-                    // the following ones if we won't be using them.
-                    m_bidi_ctypes = cr_realloc(m_staticBufs ? NULL : m_bidi_ctypes, m_size);
-                    m_bidi_btypes = cr_realloc(m_staticBufs ? NULL : m_bidi_btypes, m_size);
-                    m_bidi_levels = cr_realloc(m_staticBufs ? NULL : m_bidi_levels, m_size);
-                #endif
-            }
-            m_staticBufs = false;
-        } else {
-            // static buffer space
-            static lChar32 m_static_text[STATIC_BUFS_SIZE];
-            static lUInt16 m_static_flags[STATIC_BUFS_SIZE];
-            static src_text_fragment_t * m_static_srcs[STATIC_BUFS_SIZE];
-            static lUInt16 m_static_charindex[STATIC_BUFS_SIZE];
-            static int m_static_widths[STATIC_BUFS_SIZE];
+        if ( !m_workspace )
+            m_workspace = LVFormatterWorkspaces::forCurrentThread().acquire();
+        static const int item_sizes[] = {
+            sizeof(*m_text), sizeof(*m_flags), sizeof(*m_charindex), sizeof(*m_srcs), sizeof(*m_widths),
             #if (USE_FRIBIDI==1)
-                static FriBidiCharType m_static_bidi_ctypes[STATIC_BUFS_SIZE];
-                static FriBidiBracketType m_static_bidi_btypes[STATIC_BUFS_SIZE];
-                static FriBidiLevel m_static_bidi_levels[STATIC_BUFS_SIZE];
+                // Note: we could here check for RTL chars (and have a flag
+                // to then not do it in copyText()) so we don't need to reserve
+                // the following ones if we won't be using them.
+                sizeof(*m_bidi_ctypes), sizeof(*m_bidi_btypes), sizeof(*m_bidi_levels),
             #endif
-            m_text = m_static_text;
-            m_flags = m_static_flags;
-            m_charindex = m_static_charindex;
-            m_srcs = m_static_srcs;
-            m_widths = m_static_widths;
-            m_staticBufs = true;
-            m_staticBufs_inUse = true;
-            // printf("using static buffers\n");
-            #if (USE_FRIBIDI==1)
-                m_bidi_ctypes = m_static_bidi_ctypes;
-                m_bidi_btypes = m_static_bidi_btypes;
-                m_bidi_levels = m_static_bidi_levels;
-            #endif
-        }
+        };
+        void * bufs[sizeof(item_sizes)/sizeof(item_sizes[0])];
+        // "m_length+1" to keep room for the additional slot to be zero'ed
+        m_workspace->paragraph.reserve( m_length+1, item_sizes, sizeof(item_sizes)/sizeof(item_sizes[0]), bufs );
+        m_text = (lChar32 *)bufs[0];
+        m_flags = (lUInt16 *)bufs[1];
+        m_charindex = (lUInt16 *)bufs[2];
+        m_srcs = (src_text_fragment_t **)bufs[3];
+        m_widths = (int *)bufs[4];
+        #if (USE_FRIBIDI==1)
+            m_bidi_ctypes = (FriBidiCharType *)bufs[5];
+            m_bidi_btypes = (FriBidiBracketType *)bufs[6];
+            m_bidi_levels = (FriBidiLevel *)bufs[7];
+        #endif
         memset( m_flags, 0, sizeof(lUInt16)*m_length ); // start with all flags set to zero
 
         // We set to zero the additional slot that the code may peek at (with
@@ -3261,34 +3232,30 @@ public:
             // - last parameter is a map of string indices which is reordered to
             //   reflect where each glyph ends up
             //
-            // For re-ordering, we need some temporary buffers.
-            // We use static buffers, and don't bother with dynamic buffers
-            // in case we would overflow the static buffers.
-            // (4096, if some glyphs spans 4 composing unicode codepoints, would
-            // make 1000 glyphs, which with a small font of width 4px, would
-            // allow them to be displayed on a 4000px screen.
-            // Increase that if not enough.)
-            #define MAX_LINE_SIZE 4096
-            if ( end-start > MAX_LINE_SIZE ) {
-                // Show a warning and truncate to avoid a segfault.
-                printf("CRE WARNING: bidi processing line overflow (%d > %d)\n", end-start, MAX_LINE_SIZE);
-                end = start + MAX_LINE_SIZE;
-            }
-            static lChar32 bidi_tmp_text[MAX_LINE_SIZE];
-            static lUInt16 bidi_tmp_flags[MAX_LINE_SIZE];
-            static src_text_fragment_t * bidi_tmp_srcs[MAX_LINE_SIZE];
-            static lUInt16 bidi_tmp_charindex[MAX_LINE_SIZE];
-            static int     bidi_tmp_widths[MAX_LINE_SIZE];
+            // For re-ordering, we need some temporary buffers, that we
+            // get from this thread's formatter workspace (they grow as
+            // needed, so there's no limit on the line size).
+            static const int tmp_item_sizes[] = {
+                sizeof(lChar32), sizeof(lUInt16), sizeof(src_text_fragment_t *),
+                sizeof(lUInt16), sizeof(int), sizeof(FriBidiStrIndex)
+            };
+            void * tmp_bufs[6];
+            m_workspace->line.reserve( end-start, tmp_item_sizes, 6, tmp_bufs );
+            lChar32 * bidi_tmp_text = (lChar32 *)tmp_bufs[0];
+            lUInt16 * bidi_tmp_flags = (lUInt16 *)tmp_bufs[1];
+            src_text_fragment_t * * bidi_tmp_srcs = (src_text_fragment_t * *)tmp_bufs[2];
+            lUInt16 * bidi_tmp_charindex = (lUInt16 *)tmp_bufs[3];
+            int *     bidi_tmp_widths = (int *)tmp_bufs[4];
             // Map of string indices which is reordered to reflect where each
             // glyph ends up. Note that fribidi will access it starting
             // from 0 (and not from 'start'): this would need us to allocate
-            // it the size of the full m_text (instead of MAX_LINE_SIZE)!
+            // it the size of the full m_text (instead of the line size)!
             // But we can trick that by providing a fake start address,
             // shifted by 'start' (which is ugly and could cause a segfault
             // if some other part than [start:end] would be accessed, but
             // we know fribid doesn't - by contract as it shouldn't reorder
             // any other part except between start:end).
-            static FriBidiStrIndex bidi_indices_map[MAX_LINE_SIZE];
+            FriBidiStrIndex * bidi_indices_map = (FriBidiStrIndex *)tmp_bufs[5];
             for (int i=start; i<end; i++) {
                 bidi_indices_map[i-start] = i;
             }
@@ -4440,7 +4407,7 @@ public:
                             word->width -= font->getHyphenWidth(); // TODO: strange fix - need some other solution
                         }
                         else if ( lastc=='.' || lastc==',' || lastc=='!' || lastc==':' || lastc==';' || lastc=='?') {
-                            FONT_GUARD
+                            FONT_MEASURE_GUARD
                             int w = font->getCharWidth(lastc);
                             TR("floating: %c w=%d", lastc, w);
                             if (frmline->width + w + wAlign + x >= maxWidth)
@@ -4451,7 +4418,7 @@ public:
                                   lastc==0x300d || lastc==0x300f ||   // 」 』 ideographic right bracket
                                   lastc==0xff01 || lastc==0xff0c ||   // ！ ， fullwidth ! and ,
                                   lastc==0xff1a || lastc==0xff1b ) {  // ： ； fullwidth : and ;
-                            FONT_GUARD
+                            FONT_MEASURE_GUARD
                             int w = font->getCharWidth(lastc);
                             if (frmline->width + w + wAlign + x >= maxWidth)
                                 word->width -= w;
@@ -4470,7 +4437,7 @@ public:
                             // (Chinese) add spaces between words in last line or single line
                             // (so they get visually aligned on a grid with the char on the
                             // previous justified lines)
-                            FONT_GUARD
+                            FONT_MEASURE_GUARD
                             int properwordcount = maxWidth/font->getSize() - 2;
                             int extraSpace = maxWidth - properwordcount*font->getSize() - wAlign;
                             int exccess = (frmline->width + x + word->width + extraSpace) - maxWidth;
@@ -4507,7 +4474,7 @@ public:
                         if ( first && font->getSize()!=0 && (maxWidth/font->getSize()-2)!=0 ) {
                             // proportionally enlarge text-indent when visualAlignment or
                             // floating punctuation is enabled
-                            FONT_GUARD
+                            FONT_MEASURE_GUARD
                             int cnt = ((x-wAlign/2)%font->getSize()==0) ? (x-wAlign/2)/font->getSize() : 0;
                                 // ugly way to caculate text-indent value, I can not get text-indent from here
                             int p = cnt*(cnt+1)/2;
@@ -4728,16 +4695,44 @@ public:
         } else {
             if (m_sa_chunk_start != -1) {
                 m_sa_chunk_end += 1;
-                // printf("BreakSALine from %d to %d\n", m_sa_chunk_start, m_sa_chunk_end);
-                BreakSALine(m_text, m_sa_chunk_start, m_sa_chunk_end, &foundSABreak, (void*)this);
+                breakSAChunk();
                 m_sa_chunk_start = -1;
             }
         }
     }
 
+    void breakSAChunk() {
+        // Breaks only depend on the chunk text: reuse the ones found
+        // for an identical chunk, by this or a previous rendering.
+        ldomSABreakCache * cache = NULL;
+        ldomNode * node = (ldomNode *)m_srcs[m_sa_chunk_start]->object;
+        if ( node && !(m_srcs[m_sa_chunk_start]->flags & LTEXT_SRC_IS_OBJECT) )
+            cache = &node->getDocument()->getSABreakCache();
+        const lChar32 * text = m_text + m_sa_chunk_start;
+        int len = m_sa_chunk_end - m_sa_chunk_start;
+        if ( cache ) {
+            const lInt32 * breaks;
+            int count = cache->find(text, len, breaks);
+            if ( count >= 0 ) {
+                for ( int i=0; i<count; i++ )
+                    foundSABreak((void*)this, m_sa_chunk_start + breaks[i]);
+                return;
+            }
+        }
+        // printf("BreakSALine from %d to %d\n", m_sa_chunk_start, m_sa_chunk_end);
+        m_sa_breaks.clear();
+        m_sa_collect_breaks = cache != NULL;
+        BreakSALine(m_text, m_sa_chunk_start, m_sa_chunk_end, &foundSABreak, (void*)this);
+        m_sa_collect_breaks = false;
+        if ( cache )
+            cache->add(text, len, m_sa_breaks);
+    }
+
     static void foundSABreak(void* _self, int32_t pos) {
         LVFormatter &self = *(LVFormatter*)_self;
         // printf("foundSABreak @%d\n", pos);
+        if (self.m_sa_collect_breaks)
+            self.m_sa_breaks.add(pos - self.m_sa_chunk_start);
         if (pos == self.m_sa_chunk_start || pos == self.m_sa_chunk_end)
             return;
         self.m_flags[pos-1] |= LCHAR_ALLOW_WRAP_AFTER;
@@ -5545,31 +5540,20 @@ public:
 
     void dealloc()
     {
-        if ( !m_staticBufs ) {
-            free( m_text );
-            free( m_flags );
-            free( m_srcs );
-            free( m_charindex );
-            free( m_widths );
+        if ( m_workspace ) {
+            // Give back the buffers to this thread's workspace
+            LVFormatterWorkspaces::release( m_workspace );
+            m_workspace = NULL;
             m_text = NULL;
             m_flags = NULL;
             m_srcs = NULL;
             m_charindex = NULL;
             m_widths = NULL;
             #if (USE_FRIBIDI==1)
-                free( m_bidi_ctypes );
-                free( m_bidi_btypes );
-                free( m_bidi_levels );
                 m_bidi_ctypes = NULL;
                 m_bidi_btypes = NULL;
                 m_bidi_levels = NULL;
             #endif
-            m_staticBufs = true;
-            // printf("freeing dynamic buffers\n");
-        }
-        else {
-            m_staticBufs_inUse = false;
-            // printf("releasing static buffers\n");
         }
     }
 
@@ -5585,10 +5569,6 @@ public:
     }
 };
 
-bool LVFormatter::m_staticBufs_inUse = false;
-#if (USE_LIBUNIBREAK==1)
-bool LVFormatter::m_libunibreak_init_done = false;
-#endif
 
 static void freeFrmLines( formatted_text_fragment_t * m_pbuffer )
 {
@@ -5721,6 +5701,136 @@ lString32Collection * LFormattedText::GetInlineBoxLinks( ldomNode * node ) {
     return NULL;
 }
 
+#define FORMATTED_LINES_MAGIC "FRMLINES"
+
+bool LFormattedText::serializeLines( SerialBuf & buf )
+{
+    // Only lines from a full formatting can be reused for drawing. Own floats and
+    // inline boxes are rendered and positioned while formatting: we can't skip that.
+    if ( !m_pbuffer->is_reusable || m_pbuffer->light_formatting || m_pbuffer->inlineboxes_links )
+        return false;
+    for ( int i=0; i<m_pbuffer->floatcount; i++ ) {
+        if ( m_pbuffer->floats[i]->srctext != NULL )
+            return false;
+    }
+    buf.putMagic(FORMATTED_LINES_MAGIC);
+    buf << (lUInt32)m_pbuffer->srctextlen << (lUInt32)m_pbuffer->height << (lUInt32)m_pbuffer->frmlinecount;
+    for ( int i=0; i<m_pbuffer->frmlinecount; i++ ) {
+        const formatted_line_t * line = m_pbuffer->frmlines[i];
+        buf << (lUInt32)line->word_count << line->y << line->x << line->width << line->height
+            << line->baseline << line->width_overflow << line->flags << line->align;
+        for ( int w=0; w<line->word_count; w++ ) {
+            const formatted_word_t * word = &line->words[w];
+            if ( word->flags & LTEXT_WORD_IS_INLINE_BOX )
+                return false;
+            buf << word->src_text_index << word->width << word->min_width << word->x << word->y
+                << word->flags << word->t.start << word->t.len // (or o.height and o.baseline)
+                << word->added_letter_spacing << word->distinct_glyphs;
+        }
+    }
+    return !buf.error();
+}
+
+bool LFormattedText::deserializeLines( SerialBuf & buf, lUInt16 width, lUInt16 page_height )
+{
+    freeFrmLines( m_pbuffer );
+    m_pbuffer->width = width;
+    m_pbuffer->height = 0;
+    m_pbuffer->page_height = page_height;
+    m_pbuffer->is_reusable = true;
+    lUInt32 srctextlen = 0;
+    lUInt32 height = 0;
+    lUInt32 linecount = 0;
+    if ( !buf.checkMagic(FORMATTED_LINES_MAGIC) )
+        return false;
+    buf >> srctextlen >> height >> linecount;
+    // Lines must have been made from the same source text
+    if ( buf.error() || srctextlen != (lUInt32)m_pbuffer->srctextlen )
+        return false;
+    for ( lUInt32 i=0; i<linecount && !buf.error(); i++ ) {
+        lUInt32 word_count = 0;
+        buf >> word_count;
+        // A word takes at least 20 bytes: don't trust a broken count
+        if ( buf.error() || word_count > (lUInt32)buf.space() / 20 ) {
+            buf.seterror();
+            break;
+        }
+        formatted_line_t * line = lvtextAddFormattedLine( m_pbuffer );
+        buf >> line->y >> line->x >> line->width >> line->height
+            >> line->baseline >> line->width_overflow >> line->flags >> line->align;
+        if ( word_count > 0 ) {
+            lUInt32 size = (word_count + FRM_ALLOC_SIZE-1) / FRM_ALLOC_SIZE * FRM_ALLOC_SIZE;
+            line->words = (formatted_word_t *)calloc( size, sizeof(formatted_word_t) );
+            line->word_count = word_count;
+        }
+        for ( lUInt32 w=0; w<word_count; w++ ) {
+            formatted_word_t * word = &line->words[w];
+            buf >> word->src_text_index >> word->width >> word->min_width >> word->x >> word->y
+                >> word->flags >> word->t.start >> word->t.len
+                >> word->added_letter_spacing >> word->distinct_glyphs;
+            if ( word->src_text_index >= srctextlen )
+                buf.seterror();
+        }
+    }
+    if ( buf.error() ) {
+        freeFrmLines( m_pbuffer );
+        return false;
+    }
+    m_pbuffer->height = height;
+    return true;
+}
+
+bool LFormattedText::canFormatWithoutNodes()
+{
+    for ( int i=0; i<m_pbuffer->srctextlen; i++ ) {
+        const src_text_fragment_t * src = &m_pbuffer->srctext[i];
+        // Objects (images, inline boxes, floats) are rendered and positioned
+        // via their nodes, and nowrap and extra properties are checked on
+        // the nodes' style
+        if ( src->flags & (LTEXT_SRC_IS_OBJECT | LTEXT_FLAG_NOWRAP | LTEXT_HAS_EXTRA) )
+            return false;
+        // Measured on a text measuring thread, with only the mutex of this font
+        if ( !((LVFont*)src->t.font)->hasGlyphs( src->t.text, src->t.len ) )
+            return false;
+        #if (USE_BREAK_SA==1)
+        // South East Asian text breaks are looked up in the document SA break cache
+        for ( int k=0; k<src->t.len; k++ ) {
+            lChar32 c = src->t.text[k];
+            if ( (c >= 0x0E00 && c <= 0x0EFF) || (c >= 0x1000 && c <= 0x109F) || (c >= 0x1780 && c <= 0x17FF)
+                    || (c >= 0x1950 && c <= 0x1AAF) || (c >= 0xA9E0 && c <= 0xAADF) || (c >= 0x11700 && c <= 0x1174F) )
+                return false;
+        }
+        #endif
+    }
+    return true;
+}
+
+bool LFormattedText::hasSameLines( LFormattedText * other )
+{
+    formatted_text_fragment_t * a = m_pbuffer;
+    formatted_text_fragment_t * b = other->m_pbuffer;
+    if ( a->height != b->height || a->frmlinecount != b->frmlinecount || a->floatcount != b->floatcount )
+        return false;
+    for ( int i=0; i<a->frmlinecount; i++ ) {
+        const formatted_line_t * la = a->frmlines[i];
+        const formatted_line_t * lb = b->frmlines[i];
+        if ( la->word_count != lb->word_count || la->y != lb->y || la->x != lb->x || la->width != lb->width
+                || la->height != lb->height || la->baseline != lb->baseline
+                || la->width_overflow != lb->width_overflow || la->flags != lb->flags || la->align != lb->align )
+            return false;
+        for ( int w=0; w<la->word_count; w++ ) {
+            const formatted_word_t * wa = &la->words[w];
+            const formatted_word_t * wb = &lb->words[w];
+            if ( wa->src_text_index != wb->src_text_index || wa->width != wb->width || wa->min_width != wb->min_width
+                    || wa->x != wb->x || wa->y != wb->y || wa->flags != wb->flags
+                    || wa->t.start != wb->t.start || wa->t.len != wb->t.len // (or o.height and o.baseline)
+                    || wa->added_letter_spacing != wb->added_letter_spacing || wa->distinct_glyphs != wb->distinct_glyphs )
+                return false;
+        }
+    }
+    return true;
+}
+
 void LFormattedText::setImageScalingOptions( img_scaling_options_t * options )
 {
     m_pbuffer->img_zoom_in_mode_block = options->zoom_in_block.mode;
@@ -5901,6 +6011,50 @@ static void drawBorder(LVDrawBuf * buf, int x0, int x1, int y, int h, ldomNode *
     }
 }
 
+void LFormattedText::collectGlyphs( LVFontGlyphSet & glyphs, int top, int bottom, bool want_hidden )
+{
+    // Same lines and words as drawn by Draw() with a clip from top to bottom
+    // (relative to our own top), inline boxes and floats included
+    bool ignore_clip = false;
+    if ( m_pbuffer->frmlinecount > 0 && m_pbuffer->frmlines[0]->word_count > 0 ) {
+        src_text_fragment_t * srcline = &m_pbuffer->srctext[m_pbuffer->frmlines[0]->words[0].src_text_index];
+        if ( srcline->flags & LTEXT_MATH_TRANSFORM )
+            ignore_clip = true;
+    }
+    int line_y = 0;
+    for ( int i=0; i<m_pbuffer->frmlinecount; i++ ) {
+        if ( line_y >= bottom && !ignore_clip )
+            break;
+        formatted_line_t * frmline = m_pbuffer->frmlines[i];
+        if ( line_y + frmline->height > top || ignore_clip ) {
+            for ( int j=0; j<frmline->word_count; j++ ) {
+                formatted_word_t * word = &frmline->words[j];
+                if ( word->flags & (LTEXT_WORD_IS_IMAGE|LTEXT_WORD_IS_PAD) )
+                    continue;
+                src_text_fragment_t * srcline = &m_pbuffer->srctext[word->src_text_index];
+                if ( word->flags & LTEXT_WORD_IS_INLINE_BOX ) {
+                    ldomNode * node = (ldomNode *) srcline->object;
+                    CollectDocumentGlyphs( node, -top, bottom - top, glyphs, want_hidden );
+                    continue;
+                }
+                if ( srcline->flags & LTEXT_SRC_IS_OBJECT )
+                    continue;
+                if ( (srcline->flags & LTEXT_HAS_EXTRA) && getLTextExtraProperty(srcline, LTEXT_EXTRA_CSS_HIDDEN) && !want_hidden )
+                    continue;
+                glyphs.add( (LVFont *) srcline->t.font, srcline->t.text + word->t.start, word->t.len );
+            }
+        }
+        line_y += frmline->height;
+    }
+    for ( int i=0; i<m_pbuffer->floatcount; i++ ) {
+        embedded_float_t * flt = m_pbuffer->floats[i];
+        if ( flt->srctext == NULL )
+            continue; // outer float, not drawn by us
+        ldomNode * node = (ldomNode *) flt->srctext->object;
+        CollectDocumentGlyphs( node, -top, bottom - top, glyphs, want_hidden );
+    }
+}
+
 void LFormattedText::Draw( LVDrawBuf * buf, int x, int y, ldomMarkedRangeList * marks, ldomMarkedRangeList *bookmarks )
 {
     int i, j;
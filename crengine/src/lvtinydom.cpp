@@ -149,6 +149,10 @@ extern const int gDOMVersionCurrent = DOM_VERSION_CURRENT;
 
 //#define CACHE_FILE_SECTOR_SIZE 4096
 #define CACHE_FILE_SECTOR_SIZE 1024
+// alignment of DOM storage chunks blocks in cache file mapped mode
+#define CACHE_FILE_PAGE_SIZE 4096
+// max number of (re)mappings of a growing cache file
+#define CACHE_FILE_MAX_MAPPINGS 8
 #define CACHE_FILE_WRITE_BLOCK_PADDING 1
 
 /// set t 1 to log storage reads/writes
@@ -213,7 +217,10 @@ enum CacheFileBlockType {
     CBT_STYLE_DATA,
     CBT_BLOB_INDEX, //16
     CBT_BLOB_DATA,
-    CBT_FONT_DATA  //18
+    CBT_FONT_DATA, //18
+    CBT_SA_BREAK_DATA,
+    CBT_INTRINSIC_WIDTH_DATA, //20
+    CBT_FORMATTED_LINES_DATA
 };
 
 
@@ -232,6 +239,7 @@ enum CacheFileBlockType {
 #include <math.h>
 #if (USE_ZSTD == 1)
 #include <zstd.h>
+#include <zdict.h>
 #else
 #include <zlib.h>
 
@@ -242,6 +250,7 @@ enum CacheFileBlockType {
 #include <xxhash.h>
 #include <lvtextfm.h>
 #include "../include/lvdocviewprops.h"
+#include "../include/crconcurrent.h"
 
 // define to store new text nodes as persistent text, instead of mutable
 #define USE_PERSISTENT_TEXT 1
@@ -258,6 +267,34 @@ void compressCachedData(bool enable) {
 	_compressCachedData = enable;
 }
 
+// default is to compress cache file blocks one by one on the calling thread
+static int _cacheFileCompressionThreads = 0;
+void setCacheFileCompressionThreads(int threads) {
+	_cacheFileCompressionThreads = threads > 0 ? threads : 0;
+}
+
+// default is to format final blocks one after the other on the rendering thread
+static int _finalBlockFormattingThreads = 0;
+static bool _finalBlockFormattingCheck = false;
+static int _finalBlockFormattingChecked = 0;
+static int _finalBlockFormattingMismatches = 0;
+void setFinalBlockFormattingThreads(int threads, bool check) {
+	_finalBlockFormattingThreads = threads > 0 ? threads : 0;
+	_finalBlockFormattingCheck = check;
+	_finalBlockFormattingChecked = 0;
+	_finalBlockFormattingMismatches = 0;
+}
+void getFinalBlockFormattingCheckCounts(int & checked, int & mismatches) {
+	checked = _finalBlockFormattingChecked;
+	mismatches = _finalBlockFormattingMismatches;
+}
+
+// default is to read DOM storage chunks from cache files into memory
+static bool _cacheFileMappedMode = false;
+void setCacheFileMappedMode(bool enable) {
+	_cacheFileMappedMode = enable;
+}
+
 // default is to use the TEXT_CACHE_UNPACKED_SPACE & co defined above as is
 static float _storageMaxUncompressedSizeFactor = 1;
 void setStorageMaxUncompressedSizeFactor(float factor) {
@@ -555,8 +592,136 @@ typedef struct {
     size_t buffOutSize;
     ZSTD_DCtx* dctx;
 } zstd_decomp_ress_t;
+
+static void ldomFreeCompRess(zstd_comp_ress_t * ress);
+#endif
+
+// compression level (0: library default)
+static int _cacheFileCompressionLevel = 0;
+void setCacheFileCompressionLevel(int level) {
+    _cacheFileCompressionLevel = level > 0 ? level : 0;
+}
+
+#if (USE_ZSTD == 1)
+// Optional zstd dictionaries for DOM storage chunks, one per chunk type
+// (CBT_TEXT_DATA .. CBT_ELEM_STYLE_DATA). Compressed frames record the ID
+// of the dictionary they were made with, so that cache files made with
+// another dictionary (or none) are still readable, and those made with
+// a dictionary no longer available fail to load (and get rebuilt).
+struct CacheFileDictionary {
+    lUInt8 * data;
+    int size;
+    unsigned id;
+    ZSTD_CDict * cdict;
+    int cdictLevel;
+    ZSTD_DDict * ddict;
+};
+#define CACHE_FILE_DICTIONARY_COUNT 4
+static CacheFileDictionary _cacheFileDictionaries[CACHE_FILE_DICTIONARY_COUNT] = {};
+
+static int getCacheFileCompressionLevel() {
+    return _cacheFileCompressionLevel > 0 ? _cacheFileCompressionLevel : ZSTD_CLEVEL_DEFAULT;
+}
+
+static CacheFileDictionary * getCacheFileDictionary( lUInt16 type ) {
+    int i = (int)type - CBT_TEXT_DATA;
+    if ( i < 0 || i >= CACHE_FILE_DICTIONARY_COUNT || !_cacheFileDictionaries[i].data )
+        return NULL;
+    return &_cacheFileDictionaries[i];
+}
+
+// returns compression dictionary for this block type, if any, built for
+// the current compression level (to be called from the thread owning the cache file)
+static const ZSTD_CDict * getCacheFileCDict( lUInt16 type ) {
+    CacheFileDictionary * dict = getCacheFileDictionary(type);
+    if ( !dict )
+        return NULL;
+    int level = getCacheFileCompressionLevel();
+    if ( dict->cdict && dict->cdictLevel != level ) {
+        ZSTD_freeCDict(dict->cdict);
+        dict->cdict = NULL;
+    }
+    if ( !dict->cdict ) {
+        dict->cdict = ZSTD_createCDict(dict->data, dict->size, level);
+        dict->cdictLevel = level;
+    }
+    return dict->cdict;
+}
+
+// returns decompression dictionary with this ID, NULL if not loaded
+static const ZSTD_DDict * getCacheFileDDict( unsigned id ) {
+    for ( int i=0; i<CACHE_FILE_DICTIONARY_COUNT; i++ ) {
+        CacheFileDictionary & dict = _cacheFileDictionaries[i];
+        if ( dict.data && dict.id == id ) {
+            if ( !dict.ddict )
+                dict.ddict = ZSTD_createDDict(dict.data, dict.size);
+            return dict.ddict;
+        }
+    }
+    return NULL;
+}
 #endif
 
+bool setCacheFileCompressionDictionary(char chunkType, const lUInt8 * data, int size) {
+#if (USE_ZSTD == 1)
+    int i;
+    switch ( chunkType ) {
+    case 't': i = 0; break;
+    case 'e': i = 1; break;
+    case 'r': i = 2; break;
+    case 's': i = 3; break;
+    default:
+        return false;
+    }
+    unsigned id = 0;
+    if ( data && size > 0 ) {
+        id = ZDICT_getDictID(data, size);
+        if ( id == 0 ) {
+            CRLog::error("setCacheFileCompressionDictionary: not a zstd dictionary");
+            return false;
+        }
+    }
+    CacheFileDictionary & dict = _cacheFileDictionaries[i];
+    if ( dict.cdict )
+        ZSTD_freeCDict(dict.cdict);
+    if ( dict.ddict )
+        ZSTD_freeDDict(dict.ddict);
+    if ( dict.data )
+        free(dict.data);
+    memset(&dict, 0, sizeof(dict));
+    if ( id ) {
+        dict.data = (lUInt8 *)malloc(size);
+        memcpy(dict.data, data, size);
+        dict.size = size;
+        dict.id = id;
+        CRLog::info("Cache file compression dictionary for '%c' chunks: id=%u, %d bytes", chunkType, id, size);
+    }
+    return true;
+#else
+    CR_UNUSED3(chunkType, data, size);
+    CRLog::error("setCacheFileCompressionDictionary: only supported with zstd");
+    return false;
+#endif
+}
+
+/// block data hashed and packed ahead of CacheFile::write(), see CacheFile::prepack()
+struct CacheFilePrepackedBlock {
+    lUInt16 type;
+    lUInt16 index;
+    const lUInt8 * buf;
+    int size;
+    bool sameSize;    // block already in file has the same size...
+    lUInt32 oldHash;  // ...and this hash: if equal, don't pack
+    lUInt32 hash;
+    lUInt8 * packed;  // NULL if not packed (unchanged, or packing failed)
+    lUInt32 packedSize;
+    lUInt32 packedHash;
+    CacheFilePrepackedBlock()
+        : type(0), index(0), buf(NULL), size(0), sameSize(false), oldHash(0), hash(0), packed(NULL), packedSize(0), packedHash(0) {}
+    CacheFilePrepackedBlock( lUInt16 blockType, lUInt16 blockIndex, const lUInt8 * data, int dataSize )
+        : type(blockType), index(blockIndex), buf(data), size(dataSize), sameSize(false), oldHash(0), hash(0), packed(NULL), packedSize(0), packedHash(0) {}
+};
+
 class CacheFile
 {
     int _sectorSize; // block position and size granularity
@@ -572,11 +737,18 @@ class CacheFile
 #if (USE_ZSTD == 1)
     zstd_comp_ress_t* _comp_ress;
     zstd_decomp_ress_t* _decomp_ress;
+    LVArray<zstd_comp_ress_t*> _prepack_ress; // one per prepack() batch slot
 #endif
+    LVArray<LVStreamBufferRef> _mappings; // all mappings of the file made by map(), latest last
+    int _mappedSize; // size of latest mapping
+    CRThreadPool * _prepackPool; // created on first prepack()
+    LVArray<CacheFilePrepackedBlock> _prepacked; // waiting for their write()
+    /// takes data prepared by prepack() for this block, if any
+    bool takePrepacked( lUInt16 type, lUInt16 index, const lUInt8 * buf, int size, CacheFilePrepackedBlock & block );
     // searches for existing block
     CacheFileItem * findBlock( lUInt16 type, lUInt16 index );
     // alocates block at index, reuses existing one, if possible
-    CacheFileItem * allocBlock( lUInt16 type, lUInt16 index, int size );
+    CacheFileItem * allocBlock( lUInt16 type, lUInt16 index, int size, int align = 0 );
     // mark block as free, for later reusing
     void freeBlock( CacheFileItem * block );
     // writes file header
@@ -590,6 +762,8 @@ class CacheFile
 public:
     // return current file size
     int getSize() { return _size; }
+    // returns true if block exists in file
+    bool hasBlock( lUInt16 type, lUInt16 index ) { return findBlock(type, index) != NULL; }
     // create uninitialized cache file, call open or create to initialize
     CacheFile(lUInt32 domVersion);
     // free resources
@@ -606,6 +780,9 @@ public:
     bool write( lUInt16 type, lUInt16 dataIndex, const lUInt8 * buf, int size, bool compress );
     /// reads and allocates block in memory
     bool read( lUInt16 type, lUInt16 dataIndex, lUInt8 * &buf, int &size );
+    /// in cache file mapped mode, returns uncompressed block data in place, from a private
+    /// copy-on-write mapping of the file, valid until this object is deleted (false: use read())
+    bool map( lUInt16 type, lUInt16 dataIndex, lUInt8 * &buf, int &size );
     /// reads and validates block
     bool validate( CacheFileItem * block );
     /// writes content of serial buffer
@@ -625,6 +802,14 @@ public:
     /// reads block as a stream
     LVStreamRef readStream(lUInt16 type, lUInt16 index);
 
+    /// number of blocks worth passing to prepack() at once (1 means it would not help)
+    int getPrepackBatchSize();
+    /// hashes and packs these blocks concurrently on the compression threads,
+    /// for the following write() calls with the same data
+    void prepack( LVArray<CacheFilePrepackedBlock> & blocks, bool compress );
+    /// releases prepacked data that was not written
+    void dropPrepacked();
+
 #if (USE_ZSTD == 1)
     bool allocCompRess(void);
     bool freeCompRess(void);
@@ -632,7 +817,7 @@ public:
     bool freeDecompRess(void);
 #endif
     /// pack data from buf to dstbuf
-    bool ldomPack( const lUInt8 * buf, size_t bufsize, lUInt8 * &dstbuf, lUInt32 & dstsize );
+    bool ldomPack( lUInt16 type, const lUInt8 * buf, size_t bufsize, lUInt8 * &dstbuf, lUInt32 & dstsize );
     /// unpack data from compbuf to dstbuf
     bool ldomUnpack( const lUInt8 * compbuf, size_t compsize, lUInt8 * &dstbuf, lUInt32 & dstsize );
 
@@ -664,6 +849,7 @@ CacheFile::CacheFile(lUInt32 domVersion)
 #if (USE_ZSTD == 1)
     , _comp_ress(nullptr), _decomp_ress(nullptr)
 #endif
+    , _mappedSize(0), _prepackPool(NULL)
 {
 }
 
@@ -675,7 +861,12 @@ CacheFile::~CacheFile()
         //CRTimerUtil infinite;
         //flush( true, infinite );
     }
+    if ( _prepackPool )
+        delete _prepackPool;
+    dropPrepacked();
 #if (USE_ZSTD == 1)
+    for ( int i=0; i<_prepack_ress.length(); i++ )
+        ldomFreeCompRess(_prepack_ress[i]);
     freeCompRess();
     freeDecompRess();
 #endif
@@ -918,12 +1109,12 @@ CacheFileItem * CacheFile::findBlock( lUInt16 type, lUInt16 index )
 }
 
 // allocates index record for block, sets its new size
-CacheFileItem * CacheFile::allocBlock( lUInt16 type, lUInt16 index, int size )
+CacheFileItem * CacheFile::allocBlock( lUInt16 type, lUInt16 index, int size, int align )
 {
     lUInt32 key = ((lUInt32)type)<<16 | index;
     CacheFileItem * existing = _map.get( key );
     if ( existing ) {
-        if ( existing->_blockSize >= size ) {
+        if ( existing->_blockSize >= size && (!align || existing->_blockFilePos % align == 0) ) {
             if ( existing->_dataSize != size ) {
                 existing->_dataSize = size;
                 _indexChanged = true;
@@ -938,7 +1129,8 @@ CacheFileItem * CacheFile::allocBlock( lUInt16 type, lUInt16 index, int size )
     int bestSize = -1;
     //int bestIndex = -1;
     for ( int i=0; i<_freeIndex.length(); i++ ) {
-        if ( _freeIndex[i] && (_freeIndex[i]->_blockSize>=size) && (bestSize==-1 || _freeIndex[i]->_blockSize<bestSize) ) {
+        if ( _freeIndex[i] && (_freeIndex[i]->_blockSize>=size) && (bestSize==-1 || _freeIndex[i]->_blockSize<bestSize)
+                && (!align || _freeIndex[i]->_blockFilePos % align == 0) ) {
             bestSize = _freeIndex[i]->_blockSize;
             //bestIndex = -1;
             existing = _freeIndex[i];
@@ -953,10 +1145,20 @@ CacheFileItem * CacheFile::allocBlock( lUInt16 type, lUInt16 index, int size )
         _indexChanged = true;
         return existing;
     }
+    if ( align && _size % align ) {
+        // keep the space up to the next aligned position as a free block
+        CacheFileItem * gap = new CacheFileItem( CBT_FREE, 0 );
+        gap->_blockSize = align - _size % align;
+        gap->_blockIndex = _index.length();
+        gap->_blockFilePos = _size;
+        _index.add(gap);
+        _freeIndex.add(gap);
+        _size += gap->_blockSize;
+    }
     // allocate new block
     CacheFileItem * block = new CacheFileItem( type, index );
     _map.set( key, block );
-    block->_blockSize = roundSector(size);
+    block->_blockSize = align ? (size + align - 1) / align * align : roundSector(size);
     block->_dataSize = size;
     block->_blockIndex = _index.length();
     _index.add(block);
@@ -967,6 +1169,42 @@ CacheFileItem * CacheFile::allocBlock( lUInt16 type, lUInt16 index, int size )
     return block;
 }
 
+/// in cache file mapped mode, returns uncompressed block data in place, from a private
+/// copy-on-write mapping of the file, valid until this object is deleted (false: use read())
+bool CacheFile::map( lUInt16 type, lUInt16 dataIndex, lUInt8 * &buf, int &size )
+{
+    if ( !_cacheFileMappedMode )
+        return false;
+    CacheFileItem * block = findBlock( type, dataIndex );
+    if ( !block || block->_uncompressedSize!=0 || block->_dataSize<=0 )
+        return false;
+    if ( block->_blockFilePos + block->_dataSize > _mappedSize ) {
+        // The file has grown since last mapped: map it again. Previous
+        // mappings are kept, as their data may still be in use.
+        if ( _mappings.length() >= CACHE_FILE_MAX_MAPPINGS || !_stream->GetName() )
+            return false;
+        LVStreamRef mapStream = LVMapFileStream( _stream->GetName(), (lvopen_mode_t)(LVOM_READ|LVOM_FLAG_PRIVATE), 0 );
+        if ( mapStream.isNull() )
+            return false;
+        int mapSize = (int)mapStream->GetSize();
+        if ( block->_blockFilePos + block->_dataSize > mapSize )
+            return false;
+        LVStreamBufferRef mapping = mapStream->GetWriteBuffer( 0, mapSize );
+        if ( mapping.isNull() || !mapping->getReadWrite() )
+            return false;
+        _mappings.add( mapping );
+        _mappedSize = mapSize;
+    }
+    lUInt8 * data = _mappings[_mappings.length()-1]->getReadWrite() + block->_blockFilePos;
+    if ( calcHash( data, block->_dataSize ) != block->_dataHash ) {
+        CRLog::error("CacheFile::map: CRC doesn't match for block %d:%d of size %d", type, dataIndex, block->_dataSize);
+        return false;
+    }
+    buf = data;
+    size = block->_dataSize;
+    return true;
+}
+
 /// reads and validates block
 bool CacheFile::validate( CacheFileItem * block )
 {
@@ -1073,13 +1311,19 @@ bool CacheFile::read( lUInt16 type, lUInt16 dataIndex, lUInt8 * &buf, int &size
 // writes block to file
 bool CacheFile::write( lUInt16 type, lUInt16 dataIndex, const lUInt8 * buf, int size, bool compress )
 {
+    // use hash and packed data computed by prepack(), if any
+    CacheFilePrepackedBlock prepacked;
+    bool isPrepacked = takePrepacked( type, dataIndex, buf, size, prepacked );
+
     // check whether data is changed
-    lUInt32 newhash = calcHash( buf, size );
+    lUInt32 newhash = isPrepacked ? prepacked.hash : calcHash( buf, size );
     CacheFileItem * existingblock = findBlock( type, dataIndex );
 
     if (existingblock) {
         bool sameSize = ((int)existingblock->_uncompressedSize==size) || (existingblock->_uncompressedSize==0 && (int)existingblock->_dataSize==size);
         if (sameSize && existingblock->_dataHash == newhash ) {
+            if ( prepacked.packed )
+                free( prepacked.packed );
             return true;
         }
     }
@@ -1095,10 +1339,23 @@ bool CacheFile::write( lUInt16 type, lUInt16 dataIndex, const lUInt8 * buf, int
     lUInt64 newpackedhash = newhash;
     if (!_compressCachedData)
         compress = false;
-    if ( compress ) {
+    if ( !compress && prepacked.packed ) {
+        free( prepacked.packed );
+        prepacked.packed = NULL;
+    }
+    if ( compress && isPrepacked ) {
+        if ( !prepacked.packed ) {
+            compress = false;
+        } else {
+            uncompressedSize = size;
+            size = prepacked.packedSize;
+            buf = prepacked.packed;
+            newpackedhash = prepacked.packedHash;
+        }
+    } else if ( compress ) {
         lUInt8 * dstbuf = NULL;
         lUInt32 dstsize = 0;
-        if ( !ldomPack( buf, size, dstbuf, dstsize ) ) {
+        if ( !ldomPack( type, buf, size, dstbuf, dstsize ) ) {
             compress = false;
         } else {
             uncompressedSize = size;
@@ -1111,15 +1368,19 @@ bool CacheFile::write( lUInt16 type, lUInt16 dataIndex, const lUInt8 * buf, int
         }
     }
 
+    // In mapped mode, DOM storage chunks are stored uncompressed and page aligned
+    int align = 0;
+    if ( _cacheFileMappedMode && !compress && type >= CBT_TEXT_DATA && type <= CBT_ELEM_STYLE_DATA && dataIndex != 0xFFFF )
+        align = CACHE_FILE_PAGE_SIZE;
     CacheFileItem * block = NULL;
-    if ( existingblock && existingblock->_dataSize>=size ) {
+    if ( existingblock && existingblock->_dataSize>=size && (!align || existingblock->_blockFilePos % align == 0) ) {
         // reuse existing block
         block = existingblock;
     } else {
         // allocate new block
         if ( existingblock )
             freeBlock( existingblock );
-        block = allocBlock( type, dataIndex, size );
+        block = allocBlock( type, dataIndex, size, align );
     }
     if ( !block )
     {
@@ -1277,46 +1538,60 @@ bool CacheFile::create( LVStreamRef stream )
 }
 
 #if (USE_ZSTD == 1)
-bool CacheFile::allocCompRess(void)
+static zstd_comp_ress_t * ldomCreateCompRess(void)
 {
-    // printf("CacheFile::allocCompRess\n");
-    _comp_ress = new zstd_comp_ress_t;
-    _comp_ress->buffOut = nullptr;
-    _comp_ress->cctx = nullptr;
+    zstd_comp_ress_t * ress = new zstd_comp_ress_t;
+    ress->buffOut = nullptr;
+    ress->cctx = nullptr;
 
-    _comp_ress->buffOutSize = ZSTD_CStreamOutSize();
-    _comp_ress->buffOut = malloc(_comp_ress->buffOutSize);
-    if (!_comp_ress->buffOut) {
-        return false;
+    ress->buffOutSize = ZSTD_CStreamOutSize();
+    ress->buffOut = malloc(ress->buffOutSize);
+    if (!ress->buffOut) {
+        delete ress;
+        return nullptr;
     }
-    _comp_ress->cctx = ZSTD_createCCtx();
-    if (_comp_ress->cctx == nullptr) {
-        return false;
+    ress->cctx = ZSTD_createCCtx();
+    if (ress->cctx == nullptr) {
+        free(ress->buffOut);
+        delete ress;
+        return nullptr;
     }
 
-    // Parameters are sticky
+    // Parameters are sticky (but compression level is set again by ldomPackBuffer(),
+    // as it may be changed by setCacheFileCompressionLevel())
     // NOTE: ZSTD_CLEVEL_DEFAULT is currently 3, sane range is 1-19
-    ZSTD_CCtx_setParameter(_comp_ress->cctx, ZSTD_c_compressionLevel, ZSTD_CLEVEL_DEFAULT);
+    ZSTD_CCtx_setParameter(ress->cctx, ZSTD_c_compressionLevel, getCacheFileCompressionLevel());
     // This would be redundant with CRe's own calcHash, AFAICT?
     //ZSTD_CCtx_setParameter(_comp_ress->cctx, ZSTD_c_checksumFlag, 1);
 
     // Threading? (Requires libzstd built w/ threading support)
     // NOTE: Since we always use ZSTD_e_end, which basically defers to ZSTD_compress2(), this will *not* make it async,
     //       it'll still block.
-    //ZSTD_CCtx_setParameter(_comp_ress->cctx, ZSTD_c_nbWorkers, 4);
+    //ZSTD_CCtx_setParameter(ress->cctx, ZSTD_c_nbWorkers, 4);
+    // (We rather compress several blocks at once, see CacheFile::prepack().)
 
-    return true;
+    return ress;
+}
+
+static void ldomFreeCompRess(zstd_comp_ress_t * ress)
+{
+    ZSTD_freeCCtx(ress->cctx);
+    free(ress->buffOut);
+    delete ress;
+}
+
+bool CacheFile::allocCompRess(void)
+{
+    // printf("CacheFile::allocCompRess\n");
+    _comp_ress = ldomCreateCompRess();
+    return _comp_ress != nullptr;
 }
 
 bool CacheFile::freeCompRess(void)
 {
     // printf("CacheFile::freeCompRess\n");
     if (_comp_ress) {
-        ZSTD_freeCCtx(_comp_ress->cctx);
-        _comp_ress->cctx = nullptr;
-        free(_comp_ress->buffOut);
-        _comp_ress->buffOut = nullptr;
-        delete _comp_ress;
+        ldomFreeCompRess(_comp_ress);
         _comp_ress = nullptr;
 
         return true;
@@ -1325,24 +1600,16 @@ bool CacheFile::freeCompRess(void)
     return false;
 }
 
-/// pack data from buf to dstbuf
-bool CacheFile::ldomPack( const lUInt8 * buf, size_t bufsize, lUInt8 * &dstbuf, lUInt32 & dstsize )
+/// pack data from buf to dstbuf, using these compression ressources and optional dictionary
+/// (can be called from any thread, as long as ress is not shared)
+static bool ldomPackBuffer( zstd_comp_ress_t * ress, const ZSTD_CDict * cdict, const lUInt8 * buf, size_t bufsize, lUInt8 * &dstbuf, lUInt32 & dstsize )
 {
     // printf("ldomPack() <- %p (%zu)\n", buf, bufsize);
 
-    // Lazy init our ressources, and keep 'em around
-    if (!_comp_ress) {
-        if(!allocCompRess()) {
-            CRLog::error("ldomPack() failed to allocate ressources");
-            return false;
-        }
-    }
-
     // c.f., ZSTD's examples/streaming_compression.c
-    // NOTE: We could probably gain much by training zstd and using a dictionary, here ;).
-    size_t const buffOutSize = _comp_ress->buffOutSize;
-    void*  const buffOut = _comp_ress->buffOut;
-    ZSTD_CCtx* const cctx = _comp_ress->cctx;
+    size_t const buffOutSize = ress->buffOutSize;
+    void*  const buffOut = ress->buffOut;
+    ZSTD_CCtx* const cctx = ress->cctx;
 
     // Reset the context
     size_t const err = ZSTD_CCtx_reset(cctx, ZSTD_reset_session_only);
@@ -1351,6 +1618,10 @@ bool CacheFile::ldomPack( const lUInt8 * buf, size_t bufsize, lUInt8 * &dstbuf,
         return false;
     }
 
+    // The dictionary (when set) takes precedence over the compression level
+    ZSTD_CCtx_setParameter(cctx, ZSTD_c_compressionLevel, getCacheFileCompressionLevel());
+    ZSTD_CCtx_refCDict(cctx, cdict);
+
     // Tell the compressor just how much data we need to compress
     ZSTD_CCtx_setPledgedSrcSize(cctx, bufsize);
 
@@ -1388,6 +1659,19 @@ bool CacheFile::ldomPack( const lUInt8 * buf, size_t bufsize, lUInt8 * &dstbuf,
     return true;
 }
 
+/// pack data from buf to dstbuf
+bool CacheFile::ldomPack( lUInt16 type, const lUInt8 * buf, size_t bufsize, lUInt8 * &dstbuf, lUInt32 & dstsize )
+{
+    // Lazy init our ressources, and keep 'em around
+    if (!_comp_ress) {
+        if(!allocCompRess()) {
+            CRLog::error("ldomPack() failed to allocate ressources");
+            return false;
+        }
+    }
+    return ldomPackBuffer(_comp_ress, getCacheFileCDict(type), buf, bufsize, dstbuf, dstsize);
+}
+
 bool CacheFile::allocDecompRess(void)
 {
     // printf("CacheFile::allocDecompRess\n");
@@ -1450,6 +1734,18 @@ bool CacheFile::ldomUnpack( const lUInt8 * compbuf, size_t compsize, lUInt8 * &d
         return false;
     }
 
+    // Use the dictionary this block was packed with, if any
+    const ZSTD_DDict * ddict = NULL;
+    unsigned const dictId = ZSTD_getDictID_fromFrame(compbuf, compsize);
+    if (dictId) {
+        ddict = getCacheFileDDict(dictId);
+        if (!ddict) {
+            CRLog::error("ldomUnpack(): compression dictionary %u is not available", dictId);
+            return false;
+        }
+    }
+    ZSTD_DCtx_refDDict(dctx, ddict);
+
     size_t uncompressed_size = 0;
     lUInt8 *uncompressed_buf = NULL;
 
@@ -1488,8 +1784,8 @@ bool CacheFile::ldomUnpack( const lUInt8 * compbuf, size_t compsize, lUInt8 * &d
     return true;
 }
 #else
-/// pack data from buf to dstbuf
-bool CacheFile::ldomPack( const lUInt8 * buf, size_t bufsize, lUInt8 * &dstbuf, lUInt32 & dstsize )
+/// pack data from buf to dstbuf (can be called from any thread)
+static bool ldomPackBuffer( const lUInt8 * buf, size_t bufsize, lUInt8 * &dstbuf, lUInt32 & dstsize )
 {
     lUInt8 tmp[PACK_BUF_SIZE]; // 64K buffer for compressed data
     int ret;
@@ -1497,7 +1793,8 @@ bool CacheFile::ldomPack( const lUInt8 * buf, size_t bufsize, lUInt8 * &dstbuf,
     z.zalloc = Z_NULL;
     z.zfree = Z_NULL;
     z.opaque = Z_NULL;
-    ret = deflateInit( &z, DOC_DATA_COMPRESSION_LEVEL );
+    int level = _cacheFileCompressionLevel > 0 ? _cacheFileCompressionLevel : DOC_DATA_COMPRESSION_LEVEL;
+    ret = deflateInit( &z, level < Z_BEST_COMPRESSION ? level : Z_BEST_COMPRESSION );
     if ( ret != Z_OK )
         return false;
     z.avail_in = bufsize;
@@ -1530,6 +1827,13 @@ bool CacheFile::ldomPack( const lUInt8 * buf, size_t bufsize, lUInt8 * &dstbuf,
     return true;
 }
 
+/// pack data from buf to dstbuf
+bool CacheFile::ldomPack( lUInt16 type, const lUInt8 * buf, size_t bufsize, lUInt8 * &dstbuf, lUInt32 & dstsize )
+{
+    CR_UNUSED(type);
+    return ldomPackBuffer(buf, bufsize, dstbuf, dstsize);
+}
+
 /// unpack data from compbuf to dstbuf
 bool CacheFile::ldomUnpack( const lUInt8 * compbuf, size_t compsize, lUInt8 * &dstbuf, lUInt32 & dstsize  )
 {
@@ -1574,6 +1878,129 @@ bool CacheFile::ldomUnpack( const lUInt8 * compbuf, size_t compsize, lUInt8 * &d
 }
 #endif
 
+/// hashes and packs one block, on a compression thread
+class CacheFilePrepackTask : public CRRunnable {
+    CacheFilePrepackedBlock * _block;
+    bool _compress;
+#if (USE_ZSTD == 1)
+    zstd_comp_ress_t * _ress;
+    const ZSTD_CDict * _cdict;
+public:
+    CacheFilePrepackTask( CacheFilePrepackedBlock * block, bool compress, zstd_comp_ress_t * ress, const ZSTD_CDict * cdict )
+        : _block(block), _compress(compress), _ress(ress), _cdict(cdict) {}
+#else
+public:
+    CacheFilePrepackTask( CacheFilePrepackedBlock * block, bool compress )
+        : _block(block), _compress(compress) {}
+#endif
+    virtual void run() {
+        _block->hash = calcHash( _block->buf, _block->size );
+        if ( !_compress || (_block->sameSize && _block->hash == _block->oldHash) )
+            return; // write() won't need packed data
+        lUInt8 * dstbuf = NULL;
+        lUInt32 dstsize = 0;
+#if (USE_ZSTD == 1)
+        if ( !ldomPackBuffer( _ress, _cdict, _block->buf, _block->size, dstbuf, dstsize ) )
+#else
+        if ( !ldomPackBuffer( _block->buf, _block->size, dstbuf, dstsize ) )
+#endif
+            return;
+        _block->packed = dstbuf;
+        _block->packedSize = dstsize;
+        _block->packedHash = calcHash( dstbuf, dstsize );
+    }
+};
+
+/// number of blocks worth passing to prepack() at once (1 means it would not help)
+int CacheFile::getPrepackBatchSize()
+{
+    if ( _cacheFileCompressionThreads < 2 || !concurrencyProvider )
+        return 1;
+    return _cacheFileCompressionThreads;
+}
+
+/// hashes and packs these blocks concurrently on the compression threads,
+/// for the following write() calls with the same data
+void CacheFile::prepack( LVArray<CacheFilePrepackedBlock> & blocks, bool compress )
+{
+    if ( !_compressCachedData )
+        compress = false;
+    int threads = getPrepackBatchSize();
+    if ( _prepackPool && _prepackPool->getThreadCount() != threads ) {
+        delete _prepackPool;
+        _prepackPool = NULL;
+    }
+    if ( !_prepackPool )
+        _prepackPool = new CRThreadPool( threads > 1 ? threads : 0 );
+    int slots = threads;
+#if (USE_ZSTD == 1)
+    // each task running concurrently needs its own compression context
+    while ( compress && _prepack_ress.length() < slots ) {
+        zstd_comp_ress_t * ress = ldomCreateCompRess();
+        if ( !ress )
+            break;
+        _prepack_ress.add( ress );
+    }
+    if ( compress ) {
+        if ( _prepack_ress.length() == 0 ) {
+            CRLog::error("CacheFile::prepack() failed to allocate ressources");
+            return; // blocks will be packed by write()
+        }
+        if ( slots > _prepack_ress.length() )
+            slots = _prepack_ress.length();
+    }
+#endif
+    for ( int start = 0; start < blocks.length(); start += slots ) {
+        for ( int i = start; i < blocks.length() && i < start + slots; i++ ) {
+            CacheFilePrepackedBlock & block = blocks[i];
+            CacheFileItem * existingblock = findBlock( block.type, block.index );
+            if ( existingblock ) {
+                block.sameSize = ((int)existingblock->_uncompressedSize==block.size) || (existingblock->_uncompressedSize==0 && (int)existingblock->_dataSize==block.size);
+                block.oldHash = existingblock->_dataHash;
+            }
+#if (USE_ZSTD == 1)
+            // (dictionaries are created here, tasks only use them)
+            _prepackPool->execute( new CacheFilePrepackTask( &block, compress, compress ? _prepack_ress[i - start] : NULL,
+                                                             compress ? getCacheFileCDict( block.type ) : NULL ) );
+#else
+            _prepackPool->execute( new CacheFilePrepackTask( &block, compress ) );
+#endif
+        }
+        _prepackPool->waitAll();
+    }
+    for ( int i = 0; i < blocks.length(); i++ )
+        _prepacked.add( blocks[i] );
+}
+
+/// takes data prepared by prepack() for this block, if any
+bool CacheFile::takePrepacked( lUInt16 type, lUInt16 index, const lUInt8 * buf, int size, CacheFilePrepackedBlock & block )
+{
+    for ( int i = 0; i < _prepacked.length(); i++ ) {
+        CacheFilePrepackedBlock & item = _prepacked[i];
+        if ( item.type != type || item.index != index )
+            continue;
+        block = _prepacked.remove( i );
+        if ( block.buf == buf && block.size == size )
+            return true;
+        // data has been modified since: not usable
+        if ( block.packed )
+            free( block.packed );
+        block = CacheFilePrepackedBlock();
+        return false;
+    }
+    return false;
+}
+
+/// releases prepacked data that was not written
+void CacheFile::dropPrepacked()
+{
+    for ( int i = 0; i < _prepacked.length(); i++ ) {
+        if ( _prepacked[i].packed )
+            free( _prepacked[i].packed );
+    }
+    _prepacked.clear();
+}
+
 // BLOB storage
 
 class ldomBlobItem {
@@ -1739,6 +2166,500 @@ LVStreamRef ldomBlobCache::getBlob( lString32 name )
     return LVStreamRef();
 }
 
+#if BUILD_LITE!=1
+#define SA_BREAK_CACHE_MAGIC "SABRKMAP"
+
+lUInt64 ldomSABreakCache::textHash( const lChar32 * text, int len )
+{
+    return XXH64(text, len * sizeof(lChar32), 0);
+}
+
+int ldomSABreakCache::find( const lChar32 * text, int len, const lInt32 * & breaks )
+{
+    lUInt32 offset;
+    if ( !_index.get(textHash(text, len), offset) )
+        return -1;
+    breaks = _data.get() + offset + 1;
+    return _data[offset];
+}
+
+void ldomSABreakCache::add( const lChar32 * text, int len, const LVArray<lInt32> & breaks )
+{
+    lUInt64 hash = textHash(text, len);
+    lUInt32 offset;
+    if ( _index.get(hash, offset) )
+        return;
+    offset = _data.length();
+    _data.add(breaks.length());
+    _data.add(breaks);
+    _index.set(hash, offset);
+    _modified = true;
+}
+
+void ldomSABreakCache::clear()
+{
+    _index.clear();
+    _data.clear();
+    _modified = false;
+}
+
+bool ldomSABreakCache::serialize( SerialBuf & buf )
+{
+    buf.putMagic(SA_BREAK_CACHE_MAGIC);
+    buf << (lUInt32)_index.length();
+    LVHashTable<lUInt64, lUInt32>::iterator it = _index.forwardIterator();
+    LVHashTable<lUInt64, lUInt32>::pair * p;
+    while ( (p = it.next()) != NULL ) {
+        buf << (lUInt32)(p->key >> 32) << (lUInt32)(p->key & 0xFFFFFFFF);
+        lUInt32 offset = p->value;
+        lInt32 count = _data[offset];
+        buf << count;
+        for ( int i = 1; i <= count; i++ )
+            buf << _data[offset + i];
+    }
+    return !buf.error();
+}
+
+bool ldomSABreakCache::deserialize( SerialBuf & buf )
+{
+    clear();
+    if ( !buf.checkMagic(SA_BREAK_CACHE_MAGIC) )
+        return false;
+    lUInt32 entries = 0;
+    buf >> entries;
+    for ( lUInt32 n = 0; n < entries && !buf.error(); n++ ) {
+        lUInt32 hi = 0, lo = 0;
+        lInt32 count = 0;
+        buf >> hi >> lo >> count;
+        if ( buf.error() || count < 0 )
+            break;
+        lUInt32 offset = _data.length();
+        _data.add(count);
+        for ( int i = 0; i < count; i++ ) {
+            lInt32 pos = 0;
+            buf >> pos;
+            _data.add(pos);
+        }
+        _index.set(((lUInt64)hi << 32) | lo, offset);
+    }
+    if ( buf.error() ) {
+        clear();
+        return false;
+    }
+    return true;
+}
+
+#define INTRINSIC_WIDTH_CACHE_MAGIC "INTRWDTH"
+
+void ldomIntrinsicWidthCache::checkRenderingHash( lUInt32 renderingHash )
+{
+    if ( renderingHash == _renderingHash )
+        return;
+    if ( _map.length() )
+        _modified = true;
+    _map.clear();
+    _renderingHash = renderingHash;
+}
+
+bool ldomIntrinsicWidthCache::find( lUInt32 renderingHash, lUInt32 dataIndex, lUInt32 styleHash, int direction,
+                                    bool ignoreMargin, int rendFlags, int & maxWidth, int & minWidth )
+{
+    checkRenderingHash( renderingHash );
+    const int params = direction * 2 + (ignoreMargin ? 1 : 0);
+    Entry e;
+    if ( !_map.get(makeKey(dataIndex, params, (lUInt32)rendFlags), e) )
+        return false;
+    if ( e.styleHash != styleHash || e.rendFlags != (lUInt32)rendFlags || e.params != params )
+        return false;
+    maxWidth = e.maxWidth;
+    minWidth = e.minWidth;
+    return true;
+}
+
+void ldomIntrinsicWidthCache::add( lUInt32 renderingHash, lUInt32 dataIndex, lUInt32 styleHash, int direction,
+                                   bool ignoreMargin, int rendFlags, int maxWidth, int minWidth )
+{
+    checkRenderingHash( renderingHash );
+    Entry e;
+    e.styleHash = styleHash;
+    e.rendFlags = (lUInt32)rendFlags;
+    e.params = direction * 2 + (ignoreMargin ? 1 : 0);
+    e.maxWidth = maxWidth;
+    e.minWidth = minWidth;
+    _map.set(makeKey(dataIndex, e.params, e.rendFlags), e);
+    _modified = true;
+}
+
+void ldomIntrinsicWidthCache::clear()
+{
+    _map.clear();
+    _renderingHash = 0;
+    _modified = false;
+}
+
+bool ldomIntrinsicWidthCache::serialize( SerialBuf & buf )
+{
+    buf.putMagic(INTRINSIC_WIDTH_CACHE_MAGIC);
+    buf << _renderingHash << (lUInt32)_map.length();
+    LVHashTable<lUInt64, Entry>::iterator it = _map.forwardIterator();
+    LVHashTable<lUInt64, Entry>::pair * p;
+    while ( (p = it.next()) != NULL ) {
+        const Entry & e = p->value;
+        buf << (lUInt32)(p->key >> 32) << (lUInt32)(p->key & 0xFFFFFFFF);
+        buf << e.styleHash << e.rendFlags << e.params << e.maxWidth << e.minWidth;
+    }
+    return !buf.error();
+}
+
+bool ldomIntrinsicWidthCache::deserialize( SerialBuf & buf )
+{
+    clear();
+    if ( !buf.checkMagic(INTRINSIC_WIDTH_CACHE_MAGIC) )
+        return false;
+    lUInt32 entries = 0;
+    buf >> _renderingHash >> entries;
+    for ( lUInt32 n = 0; n < entries && !buf.error(); n++ ) {
+        lUInt32 hi = 0, lo = 0;
+        Entry e;
+        buf >> hi >> lo;
+        buf >> e.styleHash >> e.rendFlags >> e.params >> e.maxWidth >> e.minWidth;
+        if ( buf.error() )
+            break;
+        _map.set(((lUInt64)hi << 32) | lo, e);
+    }
+    if ( buf.error() ) {
+        clear();
+        return false;
+    }
+    return true;
+}
+
+#define FORMATTED_LINES_CACHE_MAGIC "FRMLNCH2"
+// Enough for the lines of ~200 pages of text
+#define FORMATTED_LINES_CACHE_MAX_SIZE (2*1024*1024)
+
+void ldomFormattedLinesCache::checkRenderingHash( lUInt32 renderingHash )
+{
+    if ( renderingHash == _renderingHash )
+        return;
+    bool dropped = _map.length() > 0;
+    clear();
+    _renderingHash = renderingHash;
+    _modified = dropped;
+}
+
+void ldomFormattedLinesCache::remove( lUInt32 dataIndex )
+{
+    Entry e;
+    if ( _map.get(dataIndex, e) ) {
+        _totalSize -= e.size;
+        free( e.data );
+        _map.remove(dataIndex);
+    }
+}
+
+static int compareDescending( const void * a, const void * b )
+{
+    lUInt64 va = *(const lUInt64 *)a;
+    lUInt64 vb = *(const lUInt64 *)b;
+    return va < vb ? 1 : (va > vb ? -1 : 0);
+}
+
+void ldomFormattedLinesCache::trim( lUInt32 maxSize )
+{
+    if ( _totalSize <= maxSize )
+        return;
+    // Sort entries by stamp (unique), most recent first
+    LVArray<lUInt64> entries( _map.length(), 0 );
+    LVHashTable<lUInt32, Entry>::iterator it = _map.forwardIterator();
+    LVHashTable<lUInt32, Entry>::pair * p;
+    int n = 0;
+    while ( (p = it.next()) != NULL )
+        entries[n++] = ((lUInt64)p->value.stamp << 32) | p->value.size;
+    qsort( entries.get(), n, sizeof(lUInt64), compareDescending );
+    // Keep the most recent entries fitting in 3/4 of maxSize, so we
+    // don't have to trim again on next additions
+    lUInt32 minStamp = 0xFFFFFFFF;
+    lUInt32 kept = 0;
+    for ( int i=0; i<n; i++ ) {
+        lUInt32 size = (lUInt32)(entries[i] & 0xFFFFFFFF);
+        if ( kept + size > maxSize / 4 * 3 )
+            break;
+        kept += size;
+        minStamp = (lUInt32)(entries[i] >> 32);
+    }
+    LVArray<lUInt32> dropped;
+    LVHashTable<lUInt32, Entry>::iterator it2 = _map.forwardIterator();
+    while ( (p = it2.next()) != NULL ) {
+        if ( p->value.stamp < minStamp )
+            dropped.add( p->key );
+    }
+    for ( int i=0; i<dropped.length(); i++ )
+        remove( dropped[i] );
+}
+
+bool ldomFormattedLinesCache::restore( lUInt32 renderingHash, lUInt32 dataIndex, const Params & params,
+                                       LFormattedText * txt, int & height )
+{
+    checkRenderingHash( renderingHash );
+    Entry e;
+    if ( !_map.get(dataIndex, e) || !(e.params == params) )
+        return false;
+    SerialBuf buf( e.data, (int)e.size );
+    if ( !txt->deserializeLines( buf, (lUInt16)params.width, (lUInt16)params.pageHeight ) ) {
+        remove( dataIndex );
+        _modified = true;
+        return false;
+    }
+    e.stamp = ++_stamp;
+    _map.set( dataIndex, e );
+    height = e.height;
+    return true;
+}
+
+void ldomFormattedLinesCache::add( lUInt32 renderingHash, lUInt32 dataIndex, const Params & params,
+                                   LFormattedText * txt, int height )
+{
+    checkRenderingHash( renderingHash );
+    SerialBuf buf( 1024, true );
+    if ( !txt->serializeLines( buf ) )
+        return;
+    remove( dataIndex );
+    Entry e;
+    e.params = params;
+    e.stamp = ++_stamp;
+    e.height = height;
+    e.size = (lUInt32)buf.pos();
+    e.data = (lUInt8 *)malloc( e.size );
+    memcpy( e.data, buf.buf(), e.size );
+    _map.set( dataIndex, e );
+    _totalSize += e.size;
+    _modified = true;
+    trim( FORMATTED_LINES_CACHE_MAX_SIZE );
+}
+
+void ldomFormattedLinesCache::clear()
+{
+    LVHashTable<lUInt32, Entry>::iterator it = _map.forwardIterator();
+    LVHashTable<lUInt32, Entry>::pair * p;
+    while ( (p = it.next()) != NULL )
+        free( p->value.data );
+    _map.clear();
+    _renderingHash = 0;
+    _totalSize = 0;
+    _modified = false;
+}
+
+bool ldomFormattedLinesCache::serialize( SerialBuf & buf )
+{
+    buf.putMagic(FORMATTED_LINES_CACHE_MAGIC);
+    buf << _renderingHash << (lUInt32)_map.length();
+    LVHashTable<lUInt32, Entry>::iterator it = _map.forwardIterator();
+    LVHashTable<lUInt32, Entry>::pair * p;
+    while ( (p = it.next()) != NULL ) {
+        const Entry & e = p->value;
+        buf << p->key << e.params.hash << e.params.width << e.params.pageHeight << e.params.direction
+            << e.params.usableLeftOverflow << e.params.usableRightOverflow;
+        buf << e.stamp << e.height << e.size;
+        if ( !buf.check( (int)e.size ) ) {
+            memcpy( buf.buf() + buf.pos(), e.data, e.size );
+            buf.setPos( buf.pos() + (int)e.size );
+        }
+    }
+    return !buf.error();
+}
+
+bool ldomFormattedLinesCache::deserialize( SerialBuf & buf )
+{
+    clear();
+    if ( !buf.checkMagic(FORMATTED_LINES_CACHE_MAGIC) )
+        return false;
+    lUInt32 renderingHash = 0;
+    lUInt32 entries = 0;
+    buf >> renderingHash >> entries;
+    for ( lUInt32 n = 0; n < entries && !buf.error(); n++ ) {
+        lUInt32 dataIndex = 0;
+        Entry e;
+        buf >> dataIndex >> e.params.hash >> e.params.width >> e.params.pageHeight >> e.params.direction
+            >> e.params.usableLeftOverflow >> e.params.usableRightOverflow;
+        buf >> e.stamp >> e.height >> e.size;
+        if ( buf.error() || e.size > (lUInt32)buf.space() ) {
+            buf.seterror();
+            break;
+        }
+        e.data = (lUInt8 *)malloc( e.size );
+        memcpy( e.data, buf.buf() + buf.pos(), e.size );
+        buf.setPos( buf.pos() + (int)e.size );
+        _map.set( dataIndex, e );
+        _totalSize += e.size;
+        if ( e.stamp > _stamp )
+            _stamp = e.stamp;
+    }
+    if ( buf.error() ) {
+        clear();
+        return false;
+    }
+    _renderingHash = renderingHash;
+    return true;
+}
+
+/// formats one final block of a ldomFinalBlockFormatQueue, on a worker thread
+class FinalBlockFormatTask : public CRRunnable {
+    CRThreadPool * _pool;
+    LFormattedText * _txt;
+    int _width;
+    int _page_h;
+    int _direction;
+    int _usable_left_overflow;
+    int _usable_right_overflow;
+    bool _hanging_punctuation;
+    bool _no_clear_own_floats;
+    int & _height;
+    volatile bool & _ready;
+public:
+    FinalBlockFormatTask( CRThreadPool * pool, LFormattedText * txt, int width, int page_h, int direction,
+                          int usable_left_overflow, int usable_right_overflow, bool hanging_punctuation,
+                          bool no_clear_own_floats, int & height, volatile bool & ready )
+        : _pool(pool), _txt(txt), _width(width), _page_h(page_h), _direction(direction)
+        , _usable_left_overflow(usable_left_overflow), _usable_right_overflow(usable_right_overflow)
+        , _hanging_punctuation(hanging_punctuation), _no_clear_own_floats(no_clear_own_floats)
+        , _height(height), _ready(ready) {}
+    virtual void run() {
+        // Only queued without outer floats, and plain text has no float of its own
+        BlockFloatFootprint float_footprint( NULL, 0, 0, _no_clear_own_floats );
+        // Only queued with text having all its glyphs in its fonts (see
+        // LFormattedText::canFormatWithoutNodes()): measure without FONT_GUARD
+        _fontMeasuringThread = true;
+        _height = _txt->Format( (lUInt16)_width, (lUInt16)_page_h, _direction, _usable_left_overflow,
+                                _usable_right_overflow, _hanging_punctuation, &float_footprint );
+        _fontMeasuringThread = false;
+        _pool->notifyDone( _ready );
+    }
+};
+
+ldomFinalBlockFormatQueue::~ldomFinalBlockFormatQueue()
+{
+    clear();
+}
+
+bool ldomFinalBlockFormatQueue::isEnabled()
+{
+    return _finalBlockFormattingThreads >= 2 && concurrencyProvider;
+}
+
+bool ldomFinalBlockFormatQueue::isChecking()
+{
+    return _finalBlockFormattingCheck;
+}
+
+bool ldomFinalBlockFormatQueue::add( ldomNode * node, RenderRectAccessor * fmt, int width, BlockFloatFootprint * float_footprint )
+{
+    ldomDocument * doc = node->getDocument();
+    LFormattedTextRef txt( doc->createFormattedText() );
+    // As done by ldomNode::renderFinalBlock(), with the format record of the
+    // previous block instead of this node's one (not yet set)
+    int direction = RENDER_RECT_PTR_GET_DIRECTION(fmt);
+    lUInt32 flags = styleToTextFmtFlags( true, node->getStyle(), 0, direction );
+    int lang_node_idx = fmt->getLangNodeIndex();
+    TextLangCfg * lang_cfg = TextLangMan::getTextLangCfg(lang_node_idx>0 ? doc->getTinyNode(lang_node_idx) : NULL);
+    ::renderFinalBlock( node, txt.get(), fmt, flags, 0, -1, lang_cfg );
+    if ( !txt->canFormatWithoutNodes() )
+        return false;
+    txt->requestLightFormatting();
+    if ( !_pool )
+        _pool = new CRThreadPool( _finalBlockFormattingThreads );
+    Entry * e = new Entry();
+    e->txt = txt;
+    e->fmtWidth = fmt->getWidth();
+    e->fmtFlags = fmt->getFlags();
+    e->langNodeIndex = lang_node_idx;
+    e->listPropNodeIndex = fmt->getListPropNodeIndex();
+    e->width = width;
+    e->usableLeftOverflow = fmt->getUsableLeftOverflow();
+    e->usableRightOverflow = fmt->getUsableRightOverflow();
+    e->noClearOwnFloats = float_footprint->no_clear_own_floats;
+    e->height = 0;
+    e->ready = false;
+    _entries.set( node->getDataIndex(), e );
+    _pool->execute( new FinalBlockFormatTask( _pool, txt.get(), width, doc->getPageHeight(), direction,
+                        e->usableLeftOverflow, e->usableRightOverflow, doc->getHangingPunctiationEnabled(),
+                        e->noClearOwnFloats, e->height, e->ready ) );
+    return true;
+}
+
+void ldomFinalBlockFormatQueue::addFollowing( ldomNode * node, RenderRectAccessor * fmt, int width, BlockFloatFootprint * float_footprint )
+{
+    // Next blocks would not get the same outer floats or list item marker
+    if ( float_footprint->floats_cnt > 0 || fmt->getListPropNodeIndex() )
+        return;
+    ldomNode * parent = node->getParentNode();
+    if ( !parent )
+        return;
+    // Enough to keep all workers busy while the rendering thread collects text
+    int max_entries = _finalBlockFormattingThreads * 2;
+    css_style_rec_t * style = node->getStyle().get();
+    for ( int i = node->getNodeIndex() + 1; i < parent->getChildCount() && _entries.length() < max_entries; i++ ) {
+        ldomNode * sibling = parent->getChildNode( i );
+        if ( !sibling->isElement() || sibling->getRendMethod() != erm_final || sibling->getStyle().get() != style )
+            break;
+        // Would get another direction or language
+        if ( sibling->hasAttribute( attr_dir ) || sibling->hasAttribute( attr_lang ) )
+            break;
+        Entry * e;
+        if ( _entries.get( sibling->getDataIndex(), e ) )
+            continue; // already queued
+        if ( !add( sibling, fmt, width, float_footprint ) )
+            break;
+    }
+}
+
+bool ldomFinalBlockFormatQueue::take( ldomNode * node, RenderRectAccessor * fmt, int width, BlockFloatFootprint * float_footprint,
+                                      LFormattedTextRef & txt, int & height )
+{
+    Entry * e;
+    if ( !_entries.get( node->getDataIndex(), e ) )
+        return false;
+    _entries.remove( node->getDataIndex() );
+    _pool->waitFor( e->ready );
+    bool same = e->fmtWidth == fmt->getWidth() && e->fmtFlags == fmt->getFlags()
+             && e->langNodeIndex == fmt->getLangNodeIndex() && e->listPropNodeIndex == fmt->getListPropNodeIndex()
+             && e->width == width && e->usableLeftOverflow == fmt->getUsableLeftOverflow()
+             && e->usableRightOverflow == fmt->getUsableRightOverflow()
+             && float_footprint->floats_cnt == 0 && e->noClearOwnFloats == float_footprint->no_clear_own_floats;
+    if ( same ) {
+        txt = e->txt;
+        height = e->height;
+        _used++;
+    }
+    else {
+        _discarded++;
+    }
+    delete e;
+    return same;
+}
+
+void ldomFinalBlockFormatQueue::clear()
+{
+    if ( _pool ) {
+        _pool->waitAll();
+        LVHashTable<lUInt32, Entry *>::iterator it = _entries.forwardIterator();
+        LVHashTable<lUInt32, Entry *>::pair * p;
+        while ( (p = it.next()) != NULL ) {
+            delete p->value;
+            _discarded++;
+        }
+        _entries.clear();
+        // Workers are not kept between renderings
+        delete _pool;
+        _pool = NULL;
+    }
+    if ( _used || _discarded )
+        CRLog::info("Final blocks formatted ahead: %d used, %d discarded", _used, _discarded);
+    _used = 0;
+    _discarded = 0;
+}
+#endif
+
 #if BUILD_LITE!=1
 //#define DEBUG_RENDER_RECT_ACCESS
 #ifdef DEBUG_RENDER_RECT_ACCESS
@@ -3021,17 +3942,37 @@ bool ldomDataStorageManager::save( CRTimerUtil & maxTime )
 #if BUILD_LITE!=1
     if ( !_cache )
         return true;
+    // With compression threads, the next unsaved chunks are packed together
+    // ahead of their save(), which still writes them one by one, in order.
+    int batchSize = _cache->getPrepackBatchSize();
+    int prepackedUpTo = 0;
     for ( int i=0; i<_chunks.length(); i++ ) {
+        if ( batchSize > 1 && i >= prepackedUpTo ) {
+            LVArray<CacheFilePrepackedBlock> blocks;
+            blocks.reserve(batchSize);
+            int j = i;
+            for ( ; j<_chunks.length() && blocks.length()<batchSize; j++ ) {
+                ldomTextStorageChunk * chunk = _chunks[j];
+                if ( !chunk->_saved && chunk->_buf )
+                    blocks.add( CacheFilePrepackedBlock(cacheType(), chunk->_index, chunk->_buf, chunk->_bufpos) );
+            }
+            prepackedUpTo = j;
+            if ( blocks.length() > 1 )
+                _cache->prepack( blocks, COMPRESS_NODE_STORAGE_DATA && !_cacheFileMappedMode );
+        }
         if ( !_chunks[i]->save() ) {
             res = false;
             break;
         }
         //CRLog::trace("time elapsed: %d", (int)maxTime.elapsed());
-        if (maxTime.expired())
+        if (maxTime.expired()) {
+            _cache->dropPrepacked();
             return res;
+        }
 //        if ( (i&3)==3 &&  maxTime.expired() )
 //            return res;
     }
+    _cache->dropPrepacked();
     if (!maxTime.infinite())
         _cache->flush(false, maxTime); // intermediate flush
     if ( maxTime.expired() )
@@ -3357,6 +4298,7 @@ ldomTextStorageChunk::ldomTextStorageChunk(ldomDataStorageManager * manager, lUI
 	, _index(index)      /// ? index of chunk in storage
 	, _type( manager->_type )
 	, _saved(true)
+	, _mapped(false)
 {
     CR_UNUSED(compsize);
 }
@@ -3371,6 +4313,7 @@ ldomTextStorageChunk::ldomTextStorageChunk(lUInt32 preAllocSize, ldomDataStorage
 	, _index(index)      /// ? index of chunk in storage
 	, _type( manager->_type )
 	, _saved(false)
+	, _mapped(false)
 {
     _buf = (lUInt8*)calloc(preAllocSize, sizeof(*_buf));
     _manager->_uncompressedSize += _bufsize;
@@ -3386,6 +4329,7 @@ ldomTextStorageChunk::ldomTextStorageChunk(ldomDataStorageManager * manager, lUI
 	, _index(index)      /// ? index of chunk in storage
 	, _type( manager->_type )
 	, _saved(false)
+	, _mapped(false)
 {
 }
 
@@ -3416,7 +4360,7 @@ bool ldomTextStorageChunk::swapToCache( bool removeFromMemory )
 #if DEBUG_DOM_STORAGE==1
             CRLog::debug("Writing %d bytes of chunk %c%d to cache", _bufpos, _type, _index);
 #endif
-            if ( !_manager->_cache->write( _manager->cacheType(), _index, _buf, _bufpos, COMPRESS_NODE_STORAGE_DATA) ) {
+            if ( !_manager->_cache->write( _manager->cacheType(), _index, _buf, _bufpos, COMPRESS_NODE_STORAGE_DATA && !_cacheFileMappedMode) ) {
                 CRLog::error("Error while swapping of chunk %c%d to cache file", _type, _index);
                 crFatalError(-1, "Error while swapping of chunk to cache file");
                 return false;
@@ -3438,6 +4382,13 @@ bool ldomTextStorageChunk::restoreFromCache()
     if ( !_saved )
         return false;
     int size;
+    if ( _manager->_cache->map( _manager->cacheType(), _index, _buf, size ) ) {
+        // served from the file mapping: the kernel page cache takes care of
+        // it, so it does not count in our _maxUncompressedSize budget
+        _bufsize = size;
+        _mapped = true;
+        return true;
+    }
     if ( !_manager->_cache->read( _manager->cacheType(), _index, _buf, size ) )
         return false;
     _bufsize = size;
@@ -3583,6 +4534,15 @@ void ldomTextStorageChunk::modified()
     if ( !_buf ) {
         CRLog::error("Modified is called for node which is not in memory");
     }
+    else if ( _mapped ) {
+        // Changes went to copy-on-write pages of the mapping: move the data
+        // to our own buffer, as this chunk block in file may now be reused
+        lUInt8 * buf = (lUInt8 *)malloc( sizeof(lUInt8) * _bufsize );
+        memcpy( buf, _buf, _bufsize );
+        _buf = buf;
+        _mapped = false;
+        _manager->_uncompressedSize += _bufsize;
+    }
     _saved = false;
 }
 
@@ -3615,6 +4575,11 @@ lString8 ldomTextStorageChunk::getText( int offset )
 
 void ldomTextStorageChunk::setunpacked( const lUInt8 * buf, int bufsize )
 {
+    if ( _buf && _mapped ) {
+        _buf = NULL;
+        _bufsize = 0;
+        _mapped = false;
+    }
     if ( _buf ) {
         _manager->_uncompressedSize -= _bufsize;
         free(_buf);
@@ -5485,6 +6450,56 @@ bool ldomDocument::partialRender( ldomNode * node ) {
     // a cache save, and will soon reload the document from that new cache.
 }
 
+int ldomDocument::getPendingPartialRerenderingsCount() {
+    if ( !_partial_rerendering_enabled )
+        return 0;
+    int count = 0;
+    ldomNode * node = getRootNode()->getChildNode(0);
+    int nb_docfragments = node->getChildCount();
+    for (int idx = 0; idx < nb_docfragments; idx++) {
+        ldomNode * docfragment = node->getChildNode(idx);
+        if ( docfragment->getNodeId() == el_DocFragment && _rendered_fragments.get(docfragment->getDataIndex()) != _doc_rendering_hash )
+            count++;
+    }
+    return count;
+}
+
+ContinuousOperationResult ldomDocument::partialRenderPending( CRTimerUtil & maxTime, ldomNode * around ) {
+    // Drawing only rerenders the DocFragments met on the pages drawn: the others keep
+    // their old heights, so page numbers and the page count are off until they are
+    // rerendered too. This allows a frontend to get them all rerendered in small steps
+    // (ie. when idle), starting with the DocFragment containing 'around' (usually the
+    // current position) and moving away from it on both sides, so the pages nearest
+    // to what the user is reading are the first to get their final numbers.
+    if ( !_partial_rerendering_enabled )
+        return CR_DONE;
+    ldomNode * parent = getRootNode()->getChildNode(0);
+    int nb_docfragments = parent->getChildCount();
+    int start = 0;
+    for ( ldomNode * n = around; n; n = n->getParentNode() ) {
+        if ( n->getParentNode() == parent ) {
+            start = n->getNodeIndex();
+            break;
+        }
+    }
+    for ( int dist = 0; dist < nb_docfragments; dist++ ) {
+        for ( int dir = 1; dir >= -1; dir -= 2 ) {
+            if ( dist == 0 && dir < 0 )
+                continue; // start fragment already checked
+            int idx = start + dist * dir;
+            if ( idx < 0 || idx >= nb_docfragments )
+                continue;
+            ldomNode * docfragment = parent->getChildNode(idx);
+            if ( docfragment->getNodeId() != el_DocFragment )
+                continue;
+            if ( partialRender(docfragment) && maxTime.expired() ) {
+                return getPendingPartialRerenderingsCount() > 0 ? CR_TIMEOUT : CR_DONE;
+            }
+        }
+    }
+    return CR_DONE;
+}
+
 bool ldomDocument::render( LVRendPageList * pages, LVDocViewCallback * callback, int width, int dy,
                            bool showCover, int y0, font_ref_t def_font, int def_interline_space,
                            CRPropRef props, int usable_left_overflow, int usable_right_overflow )
@@ -5642,6 +6657,7 @@ bool ldomDocument::render( LVRendPageList * pages, LVDocViewCallback * callback,
         //updateStyles();
         CRLog::trace("rendering...");
         renderBlockElement( context, getRootNode(), 0, y0, width, usable_left_overflow, usable_right_overflow );
+        _finalBlockFormatQueue.clear();
         _rendered = true;
     #if 0 //def _DEBUG
         LVStreamRef ostream = LVOpenFileStream( "test_save_after_init_rend_method.xml", LVOM_WRITE );
@@ -16266,6 +17282,31 @@ bool ldomDocument::loadCacheFileContent(CacheLoadingCallback * formatCallback, L
             }
             registerEmbeddedFonts();
         }
+        // optional: cache files may have been saved by older versions
+        if ( _cacheFile->hasBlock(CBT_INTRINSIC_WIDTH_DATA, 0) ) {
+            SerialBuf buf(0, true);
+            if ( !_cacheFile->read(CBT_INTRINSIC_WIDTH_DATA, buf) || !_intrinsicWidthCache.deserialize(buf) ) {
+                CRLog::warn("Error while reading intrinsic widths data, ignoring it");
+                _intrinsicWidthCache.clear();
+            }
+        }
+        if ( _cacheFile->hasBlock(CBT_FORMATTED_LINES_DATA, 0) ) {
+            SerialBuf buf(0, true);
+            if ( !_cacheFile->read(CBT_FORMATTED_LINES_DATA, buf) || !_formattedLinesCache.deserialize(buf) ) {
+                CRLog::warn("Error while reading formatted lines data, ignoring it");
+                _formattedLinesCache.clear();
+            }
+        }
+#if (USE_BREAK_SA==1)
+        // optional: cache files may have been saved without any SA text
+        if ( _cacheFile->hasBlock(CBT_SA_BREAK_DATA, 0) ) {
+            SerialBuf buf(0, true);
+            if ( !_cacheFile->read(CBT_SA_BREAK_DATA, buf) || !_saBreakCache.deserialize(buf) ) {
+                CRLog::warn("Error while reading SA word break data, ignoring it");
+                _saBreakCache.clear();
+            }
+        }
+#endif
 
         if (progressCallback) progressCallback->OnLoadFileProgress(25);
         DocFileHeader h = {};
@@ -16590,6 +17631,35 @@ ContinuousOperationResult ldomDocument::saveChanges( CRTimerUtil & maxTime, LVDo
             }
             CHECK_EXPIRATION("saving embedded fonts")
         }
+        if ( _intrinsicWidthCache.isModified() ) {
+            CRLog::trace("ldomDocument::saveChanges() - intrinsic widths");
+            SerialBuf buf(4096);
+            if ( !_intrinsicWidthCache.serialize(buf) || !_cacheFile->write(CBT_INTRINSIC_WIDTH_DATA, buf, COMPRESS_MISC_DATA) ) {
+                CRLog::error("Error while saving intrinsic widths data");
+                return CR_ERROR;
+            }
+            _intrinsicWidthCache.setModified(false);
+        }
+        if ( _formattedLinesCache.isModified() ) {
+            CRLog::trace("ldomDocument::saveChanges() - formatted lines");
+            SerialBuf buf(4096);
+            if ( !_formattedLinesCache.serialize(buf) || !_cacheFile->write(CBT_FORMATTED_LINES_DATA, buf, COMPRESS_MISC_DATA) ) {
+                CRLog::error("Error while saving formatted lines data");
+                return CR_ERROR;
+            }
+            _formattedLinesCache.setModified(false);
+        }
+#if (USE_BREAK_SA==1)
+        if ( _saBreakCache.isModified() ) {
+            CRLog::trace("ldomDocument::saveChanges() - SA word breaks");
+            SerialBuf buf(4096);
+            if ( !_saBreakCache.serialize(buf) || !_cacheFile->write(CBT_SA_BREAK_DATA, buf, COMPRESS_MISC_DATA) ) {
+                CRLog::error("Error while saving SA word break data");
+                return CR_ERROR;
+            }
+            _saBreakCache.setModified(false);
+        }
+#endif
         if (progressCallback) progressCallback->OnSaveCacheFileProgress(95);
         // fall through
     case 12:
@@ -16799,6 +17869,7 @@ lUInt32 tinyNodeCollection::calcStyleHash(bool already_rendered, lUInt32 force_n
     // only on a laid out line, it does not need a re-rendering, but just
     // a _renderedBlockCache.clear() to reformat paragraphs and have the
     // word re-positioned (the paragraphs width & height do not change)
+    // (lines saved in the ldomFormattedLinesCache are checked against it)
 
     // Hanging punctuation does not need to trigger a re-render, as
     // it's now ensured by alignLine() and won't change paragraphs height.
@@ -20497,6 +21568,34 @@ int ldomNode::renderFinalBlock(  LFormattedTextRef & frmtext, RenderRectAccessor
 
     /// Render whole node content as single formatted object
 
+    // Note: final blocks are formatted one after the other, on the thread
+    // doing the rendering: formatting may look at the DOM (read through the
+    // document storage chunks, which are unpacked/packed and swapped to the
+    // cache file on access), and may render floats and inline-blocks and
+    // update their RenderRectAccessor.
+    // When enabled with setFinalBlockFormattingThreads(), during a full
+    // rendering, the next sibling blocks with the same style have their
+    // text added here too and, if it is plain text (no object, nowrap or
+    // extra property), are formatted ahead on worker threads (fonts
+    // measuring is guarded by FONT_GUARD). We use their lines only if they
+    // end up rendered with the same format record and parameters.
+#if BUILD_LITE!=1
+    ldomFinalBlockFormatQueue * format_queue = NULL;
+    LFormattedTextRef formatted_ahead;
+    int formatted_ahead_h = 0;
+    if ( float_footprint && !getDocument()->isRendered() && getDocument()->getFinalBlockFormatQueue().isEnabled() ) {
+        format_queue = &getDocument()->getFinalBlockFormatQueue();
+        if ( format_queue->take( this, fmt, width, float_footprint, formatted_ahead, formatted_ahead_h )
+                && !format_queue->isChecking() ) {
+            cache.set( this, formatted_ahead );
+            float_footprint->store( this );
+            format_queue->addFollowing( this, fmt, width, float_footprint );
+            frmtext = formatted_ahead;
+            return formatted_ahead_h;
+        }
+    }
+#endif
+
     // Get some properties cached in this node's RenderRectAccessor
     // and set the initial flags and lang_cfg (for/from the final node
     // itself) for renderFinalBlock(),
@@ -20511,6 +21610,11 @@ int ldomNode::renderFinalBlock(  LFormattedTextRef & frmtext, RenderRectAccessor
     // We need to store this LFormattedTextRef in the cache for it to
     // survive when leaving this function (some callers do use it).
     cache.set( this, f );
+#if BUILD_LITE!=1
+    // Have the next blocks formatted while we format this one
+    if ( format_queue )
+        format_queue->addFollowing( this, fmt, width, float_footprint );
+#endif
 
     // Gather some outer properties and context, so we can format (render)
     // the inner content in that context.
@@ -20521,6 +21625,10 @@ int ldomNode::renderFinalBlock(  LFormattedTextRef & frmtext, RenderRectAccessor
     // node, or search for text and links, we need to get it from
     // the cached RenderRectAccessor).
     BlockFloatFootprint restored_float_footprint; // (need to be available when we exit the else {})
+    // When drawing, or searching for text and links, after the document is
+    // rendered, lines formatted for the same parameters may be in the cache
+    // file: we can skip formatting them again.
+    bool use_lines_cache = !float_footprint && getDocument()->isRendered();
     if (float_footprint) { // Save it in this node's RenderRectAccessor
         float_footprint->store( this );
     }
@@ -20549,8 +21657,47 @@ int ldomNode::renderFinalBlock(  LFormattedTextRef & frmtext, RenderRectAccessor
     // Format/render inner content: this makes lines and words, which are
     // cached into the LFormattedText and ready to be used for drawing
     // and text selection.
-    int h = f->Format((lUInt16)width, (lUInt16)page_h, direction, usable_left_overflow, usable_right_overflow,
-                            getDocument()->getHangingPunctiationEnabled(), float_footprint);
+    bool hanging_punctuation = getDocument()->getHangingPunctiationEnabled();
+    int h;
+#if BUILD_LITE!=1
+    ldomFormattedLinesCache & lines_cache = getDocument()->getFormattedLinesCache();
+    lUInt32 rendering_hash = getDocument()->getDocumentRenderingHash();
+    ldomFormattedLinesCache::Params lines_params;
+    if ( use_lines_cache ) {
+        // (fmt holds the outer floats footprint, so it's part of its content hash)
+        lines_params.hash = fmt->getContentHash();
+        // Settings that only need the final blocks to be formatted again (not
+        // in the rendering hash), as they change word positions in lines
+        lines_params.hash = lines_params.hash * 31 + (hanging_punctuation ? 1 : 0);
+        lines_params.hash = lines_params.hash * 31 + (lUInt32)getDocument()->getMaxAddedLetterSpacingPercent();
+        lines_params.hash = lines_params.hash * 31 + (lUInt32)fontMan->GetHintingMode();
+        lines_params.hash = lines_params.hash * 31 + (lUInt32)fontMan->GetKerningMode();
+        lines_params.hash = lines_params.hash * 31 + (lUInt32)fontMan->GetSubpixelPositioning();
+        lines_params.width = width;
+        lines_params.pageHeight = page_h;
+        lines_params.direction = direction;
+        lines_params.usableLeftOverflow = usable_left_overflow;
+        lines_params.usableRightOverflow = usable_right_overflow;
+        if ( lines_cache.restore( rendering_hash, getDataIndex(), lines_params, f.get(), h ) ) {
+            frmtext = f;
+            return h;
+        }
+    }
+#endif
+    h = f->Format((lUInt16)width, (lUInt16)page_h, direction, usable_left_overflow, usable_right_overflow,
+                            hanging_punctuation, float_footprint);
+#if BUILD_LITE!=1
+    if ( !formatted_ahead.isNull() ) {
+        _finalBlockFormattingChecked++;
+        if ( formatted_ahead_h != h || !f->hasSameLines( formatted_ahead.get() ) ) {
+            _finalBlockFormattingMismatches++;
+            CRLog::error("renderFinalBlock: lines formatted ahead differ for %s",
+                         UnicodeToLocal(ldomXPointer(this, 0).toString()).c_str());
+        }
+    }
+    if ( use_lines_cache )
+        lines_cache.add( rendering_hash, getDataIndex(), lines_params, f.get(), h );
+#endif
     frmtext = f;
     //CRLog::trace("Created new formatted object for node #%08X", (lUInt32)this);
     return h;